@@ -0,0 +1,428 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-boot.c  initcall timings of the boot from the console
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * With initcall_debug the kernel prints
+ *
+ *   [    0.123456] calling  foo_init+0x0/0x24 @ 1
+ *   [    0.124000] initcall foo_init+0x0/0x24 returned 0 after 531 usecs
+ *
+ * for each initcall, built in or of a module.  The console lines are
+ * parsed as they come and each initcall takes one entry of the table,
+ * found by name; the table is not kept longer than one boot.  The boot
+ * ends at "Freeing init memory", where the table is written, printed
+ * and compared to the baseline.  The initcalls of modules loaded later
+ * rewrite the file as they finish.
+ */
+#define BOOT_MAX_CALLS	4096
+#define BOOT_NAME	64
+#define BOOT_HASH	8192
+#define BOOT_LINE	512
+#define BOOT_TOP	15
+
+/* flagged when slower by more than both */
+#define BOOT_REGRESS_US	1000
+#define BOOT_REGRESS_PCT	25
+
+struct boot_call {
+	char name[BOOT_NAME];
+	long long start;	/* usecs */
+	long long usecs;	/* -1 until it returns */
+	int ret;
+	int pid;
+};
+
+struct boot_table {
+	struct boot_call *calls;
+	int n, size;
+	short hash[BOOT_HASH];	/* index + 1 */
+	long long freed;	/* "Freeing init memory", -1 before */
+};
+
+char *boot_file;
+char *boot_baseline;
+
+static struct boot_table boot;
+static int boot_nr;
+static char boot_line[BOOT_LINE];
+static int boot_len;
+static long long boot_last;
+static struct timeval boot_host_start;
+
+static unsigned int boot_hash(const char *s)
+{
+	unsigned int h = 5381;
+
+	while (*s)
+		h = h * 33 + (unsigned char)*s++;
+	return h & (BOOT_HASH - 1);
+}
+
+static void boot_reset(struct boot_table *t)
+{
+	free(t->calls);
+	memset(t, 0, sizeof(*t));
+	t->freed = -1;
+}
+
+/* the entry of name, added if new, NULL when the table is full */
+static struct boot_call *boot_call(struct boot_table *t, const char *name)
+{
+	unsigned int h = boot_hash(name);
+	struct boot_call *c;
+
+	while (t->hash[h]) {
+		c = &t->calls[t->hash[h] - 1];
+		if (!strcmp(c->name, name))
+			return c;
+		h = (h + 1) & (BOOT_HASH - 1);
+	}
+	if (t->n == BOOT_MAX_CALLS)
+		return NULL;
+	if (t->n == t->size) {
+		t->size = t->size ? t->size * 2 : 256;
+		c = realloc(t->calls, t->size * sizeof(*c));
+		if (!c)
+			return NULL;
+		t->calls = c;
+	}
+	c = &t->calls[t->n];
+	memset(c, 0, sizeof(*c));
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->usecs = -1;
+	t->hash[h] = ++t->n;
+	return c;
+}
+
+static struct boot_call *boot_find(struct boot_table *t, const char *name)
+{
+	unsigned int h = boot_hash(name);
+
+	while (t->hash[h]) {
+		if (!strcmp(t->calls[t->hash[h] - 1].name, name))
+			return &t->calls[t->hash[h] - 1];
+		h = (h + 1) & (BOOT_HASH - 1);
+	}
+	return NULL;
+}
+
+/* "foo_init+0x0/0x24" to "foo_init", the module name is kept */
+static void boot_name(const char *s, char *name)
+{
+	int n = strcspn(s, "+ ");
+
+	if (n >= BOOT_NAME)
+		n = BOOT_NAME - 1;
+	memcpy(name, s, n);
+	name[n] = '\0';
+	s += strcspn(s, " ");
+	if (!strncmp(s, " [", 2) && strlen(name) + strcspn(s, "]") < BOOT_NAME)
+		strncat(name, s, strcspn(s, "]") + 1);
+}
+
+/*
+ * The printk time of a line in usecs, skipping it and the "<6>" level.
+ * Without CONFIG_PRINTK_TIME, the time since the first line came.
+ */
+static long long boot_time(const char **s)
+{
+	unsigned long sec, usec;
+	struct timeval now;
+	int n;
+
+	if ((*s)[0] == '<' && (*s)[1] && (*s)[2] == '>')
+		*s += 3;
+	if (sscanf(*s, "[%lu.%lu]%n", &sec, &usec, &n) == 2) {
+		*s += n + ((*s)[n] == ' ');
+		return sec * 1000000LL + usec;
+	}
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - boot_host_start.tv_sec) * 1000000LL +
+	    now.tv_usec - boot_host_start.tv_usec;
+}
+
+static int boot_write(const struct boot_table *t, const char *path)
+{
+	const struct boot_call *c;
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "ERROR: Could not create %s\n", path);
+		return -1;
+	}
+	/* chrome://tracing and Perfetto read it, one event per line */
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	for (i = 0; i < t->n; i++) {
+		c = &t->calls[i];
+		if (c->usecs < 0)
+			continue;
+		fprintf(fp, "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %lld, "
+			"\"dur\": %lld, \"pid\": 0, \"tid\": %d, "
+			"\"args\": {\"ret\": %d}},\n",
+			c->name, c->start, c->usecs, c->pid, c->ret);
+	}
+	if (t->freed >= 0)
+		fprintf(fp, "{\"name\": \"Freeing init memory\", \"ph\": \"i\", "
+			"\"ts\": %lld, \"pid\": 0, \"tid\": 1, \"s\": \"g\"},\n",
+			t->freed);
+	fprintf(fp, "{\"name\": \"end\", \"ph\": \"i\", \"ts\": %lld, "
+		"\"pid\": 0, \"tid\": 0, \"s\": \"g\"}\n]}\n", boot_last);
+	fclose(fp);
+	return 0;
+}
+
+/* read back a file of boot_write */
+static int boot_read(struct boot_table *t, const char *path)
+{
+	char line[BOOT_LINE], name[BOOT_LINE];
+	struct boot_call *c;
+	long long ts, dur;
+	int tid, ret;
+	FILE *fp;
+
+	boot_reset(t);
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "ERROR: Could not open %s\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "{\"name\": \"%[^\"]\", \"ph\": \"X\", "
+			   "\"ts\": %lld, \"dur\": %lld, \"pid\": 0, "
+			   "\"tid\": %d, \"args\": {\"ret\": %d",
+			   name, &ts, &dur, &tid, &ret) == 5) {
+			c = boot_call(t, name);
+			if (!c)
+				continue;
+			c->start = ts;
+			c->usecs = dur;
+			c->pid = tid;
+			c->ret = ret;
+		} else if (sscanf(line, "{\"name\": \"Freeing init memory\", "
+				  "\"ph\": \"i\", \"ts\": %lld", &ts) == 1) {
+			t->freed = ts;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+static const struct boot_table *boot_sort_table;
+
+static int boot_cmp(const void *a, const void *b)
+{
+	const struct boot_call *x = &boot_sort_table->calls[*(const int *)a];
+	const struct boot_call *y = &boot_sort_table->calls[*(const int *)b];
+
+	return x->usecs > y->usecs ? -1 : x->usecs < y->usecs;
+}
+
+static void boot_report(const struct boot_table *t, int nr)
+{
+	long long total = 0;
+	int *order, i, n = 0;
+
+	order = malloc((t->n + 1) * sizeof(*order));
+	if (!order)
+		return;
+	for (i = 0; i < t->n; i++) {
+		if (t->calls[i].usecs < 0)
+			continue;
+		total += t->calls[i].usecs;
+		order[n++] = i;
+	}
+	boot_sort_table = t;
+	qsort(order, n, sizeof(*order), boot_cmp);
+
+	printf("boot %d: %d initcalls, %lld.%03lld s in them", nr, n,
+	       total / 1000000, total / 1000 % 1000);
+	if (t->freed >= 0)
+		printf(", init memory freed at %lld.%03lld s",
+		       t->freed / 1000000, t->freed / 1000 % 1000);
+	printf("\n     usecs  initcall\n");
+	for (i = 0; i < n && i < BOOT_TOP; i++)
+		printf("%10lld  %s%s\n", t->calls[order[i]].usecs,
+		       t->calls[order[i]].name,
+		       t->calls[order[i]].ret ? "  (failed)" : "");
+	free(order);
+}
+
+/*
+ * The initcalls of t slower than in base, new and gone.  At the end of
+ * the boot those of modules are not there yet and are not called gone.
+ */
+static void boot_diff(const struct boot_table *t, struct boot_table *base,
+		      const char *name, int modules)
+{
+	const struct boot_call *c, *b;
+	long long d;
+	int i, flagged = 0;
+
+	printf("against %s (slower by %d us and %d%%):\n", name,
+	       BOOT_REGRESS_US, BOOT_REGRESS_PCT);
+	for (i = 0; i < t->n; i++) {
+		c = &t->calls[i];
+		if (c->usecs < 0)
+			continue;
+		b = boot_find(base, c->name);
+		if (!b || b->usecs < 0) {
+			printf("  new     %10lld us  %s\n", c->usecs, c->name);
+			flagged++;
+			continue;
+		}
+		d = c->usecs - b->usecs;
+		if (d > BOOT_REGRESS_US && d * 100 > b->usecs * BOOT_REGRESS_PCT) {
+			printf("  slower  %+10lld us  %s  %lld -> %lld\n", d,
+			       c->name, b->usecs, c->usecs);
+			flagged++;
+		}
+	}
+	for (i = 0; i < base->n; i++) {
+		b = &base->calls[i];
+		if (b->usecs < 0 || (!modules && strchr(b->name, '[')))
+			continue;
+		if (!boot_find((struct boot_table *)t, b->name)) {
+			printf("  gone    %10lld us  %s\n", b->usecs, b->name);
+			flagged++;
+		}
+	}
+	if (t->freed >= 0 && base->freed >= 0) {
+		d = t->freed - base->freed;
+		printf("  init memory freed at %lld.%03lld s, %+lld ms\n",
+		       t->freed / 1000000, t->freed / 1000 % 1000, d / 1000);
+	}
+	if (!flagged)
+		printf("  no regressions\n");
+}
+
+static void boot_done(void)
+{
+	struct boot_table base;
+
+	if (boot_file)
+		boot_write(&boot, boot_file);
+	boot_report(&boot, boot_nr);
+	if (boot_baseline) {
+		memset(&base, 0, sizeof(base));
+		if (!boot_read(&base, boot_baseline))
+			boot_diff(&boot, &base, boot_baseline, 0);
+		boot_reset(&base);
+	}
+	fflush(stdout);
+}
+
+static void boot_line_done(void)
+{
+	const char *s = boot_line;
+	char name[BOOT_NAME];
+	struct boot_call *c;
+	long long ts, usecs;
+	int ret;
+
+	ts = boot_time(&s);
+	/* the target booted again */
+	if ((boot.n || boot.freed >= 0) &&
+	    (!strncmp(s, "Linux version ", 14) || ts + 1000000 < boot_last)) {
+		if (boot.freed < 0)
+			boot_done();
+		boot_reset(&boot);
+		boot_nr++;
+	}
+	boot_last = ts;
+
+	if (!strncmp(s, "calling  ", 9)) {
+		boot_name(s + 9, name);
+		c = boot_call(&boot, name);
+		if (!c)
+			return;
+		c->start = ts;
+		c->usecs = -1;
+		s = strstr(s, " @ ");
+		c->pid = s ? atoi(s + 3) : 0;
+	} else if (!strncmp(s, "initcall ", 9)) {
+		boot_name(s + 9, name);
+		s = strstr(s, " returned ");
+		if (!s || sscanf(s, " returned %d after %lld usecs", &ret,
+				 &usecs) != 2)
+			return;
+		c = boot_find(&boot, name);
+		if (!c) {
+			/* its "calling" line came before the proxy */
+			c = boot_call(&boot, name);
+			if (!c)
+				return;
+			c->start = ts - usecs;
+		}
+		c->usecs = usecs;
+		c->ret = ret;
+		if (boot.freed >= 0 && boot_file)
+			boot_write(&boot, boot_file);
+	} else if (!strncmp(s, "Freeing init memory", 19) && boot.freed < 0) {
+		boot.freed = ts;
+		boot_done();
+	}
+}
+
+/* Feed the console text, as it comes */
+void boot_feed(const char *buf, int len)
+{
+	int i;
+
+	if (!boot_host_start.tv_sec) {
+		gettimeofday(&boot_host_start, NULL);
+		boot_reset(&boot);
+		boot_nr = 1;
+	}
+	for (i = 0; i < len; i++) {
+		if (buf[i] == '\n') {
+			boot_line[boot_len] = '\0';
+			boot_line_done();
+			boot_len = 0;
+		} else if (buf[i] != '\r' && buf[i] != '\0' &&
+			   boot_len < sizeof(boot_line) - 1) {
+			boot_line[boot_len++] = buf[i];
+		}
+	}
+}
+
+/* Compare two files written by boot_feed, without a target */
+int boot_compare(const char *path, const char *baseline)
+{
+	struct boot_table base;
+
+	memset(&base, 0, sizeof(base));
+	if (boot_read(&boot, path) || boot_read(&base, baseline))
+		return 1;
+	boot_report(&boot, 1);
+	boot_diff(&boot, &base, baseline, 1);
+	boot_reset(&base);
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-bt.c  backtraces of all the target's tasks, unwound on
+ *                   the target and symbolized here
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "android-agent-proxy.h"
+
+#define BT_CHUNK	0x10000		/* a multiple of the usb transfer size */
+#define BT_HEADER	24		/* pid, number of pcs and comm */
+
+static char reply[IO_BUFSIZE];
+
+static unsigned long bt_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static void bt_print(const unsigned char *rec, int nr)
+{
+	unsigned long pc, off;
+	const char *name, *file;
+	int i, line;
+
+	printf("%lu %.16s\n", bt_le32(rec), rec + 8);
+	for (i = 0; i < nr; i++) {
+		pc = bt_le32(rec + BT_HEADER + i * 4);
+		name = sym_lookup(pc, &off);
+		if (name)
+			printf("  #%-2d %08lx %s+0x%lx", i, pc, name, off);
+		else
+			printf("  #%-2d %08lx", i, pc);
+		file = sym_line(pc, &line);
+		if (file)
+			printf(" %s:%d", file, line);
+		printf("\n");
+	}
+}
+
+/*
+ * Print the backtrace of every task of a target stopped in kgdb, from
+ * the qkgdb.bt query.  vmlinux, if given, is used for the symbols.
+ */
+int bt_all(struct port_st *port, const char *vmlinux)
+{
+	struct timeval start, end;
+	unsigned char *buf;
+	unsigned long len, got, n;
+	unsigned long off, nr;
+	int tasks = 0;
+
+	if (vmlinux && sym_load(vmlinux))
+		return 1;
+	if (gdb_port_open(port))
+		return 1;
+
+	gettimeofday(&start, NULL);
+	if (gdb_command(port, "qkgdb.bt", reply, sizeof(reply)) <= 0 ||
+	    reply[0] != 'B') {
+		fprintf(stderr, "The target has no qkgdb.bt query, is it "
+			"built with CONFIG_KGDB_BACKTRACE?\n");
+		return 1;
+	}
+	len = strtoul(reply + 1, NULL, 16);
+
+	buf = malloc(len ? len : 1);
+	if (!buf)
+		return 1;
+	for (got = 0; got < len; got += n) {
+		n = len - got < BT_CHUNK ? len - got : BT_CHUNK;
+		if (gdb_read_raw(port, (char *)buf + got, n) != n) {
+			fprintf(stderr, "The backtraces stopped after %lu of "
+				"%lu bytes\n", got, len);
+			free(buf);
+			return 1;
+		}
+	}
+	gettimeofday(&end, NULL);
+
+	for (off = 0; off + BT_HEADER <= len; off += BT_HEADER + nr * 4) {
+		nr = bt_le32(buf + off + 4);
+		if (off + BT_HEADER + nr * 4 > len)
+			break;
+		bt_print(buf + off, nr);
+		tasks++;
+	}
+	free(buf);
+
+	fprintf(stderr, "%d tasks, %lu bytes in %.3fs\n", tasks, len,
+		(end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0);
+	return 0;
+}
@@ -0,0 +1,497 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-capture.c  binary capture of the proxied streams
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * Every read and write of the proxy, with its time, port, direction
+ * and payload, goes to a ring of 4 MB that a writer thread copies to
+ * the capture file.  The forwarding threads reserve a slot with a
+ * compare and swap of the head, fill it and commit it last by writing
+ * its length at its start; the writer takes the committed slots from
+ * the tail, zeroes them and gives them back by moving the tail.  A
+ * full ring drops the record and counts it, the proxy is never held
+ * up by the disk.
+ *
+ * The file is a header and then the records as they are in the ring,
+ * without the commit word, in the byte order of the host.
+ *
+ * ^C only sets a flag, the main thread stops the capture once its
+ * select() returns.  The signal can land on any thread not blocking
+ * it, so the handler passes it on to the main thread the first time
+ * to interrupt the select().
+ */
+#define CAPTURE_MAGIC	"AGCAPT01"
+#define CAPTURE_RING	(4 << 20)
+#define CAPTURE_MASK	(CAPTURE_RING - 1)
+#define CAPTURE_COMMIT	8	/* the length word ahead of a record */
+#define CAPTURE_SLOT(n)	\
+	((CAPTURE_COMMIT + sizeof(struct capture_rec) + (n) + 7) & ~7UL)
+#define CAPTURE_USB	0x80	/* in port: a usb target, a record a transfer */
+#define CAPTURE_LOST	2	/* dir of the count of the records dropped */
+#define CAPTURE_SHOW	160	/* characters of a packet printed */
+
+struct capture_head {
+	char magic[8];
+	uint64_t realtime;	/* ns of the start, CLOCK_REALTIME */
+	uint64_t monotonic;	/* and the same moment in CLOCK_MONOTONIC */
+};
+
+struct capture_rec {
+	uint32_t size;		/* bytes of payload after the record */
+	uint8_t port;		/* METRICS_GDB... | CAPTURE_USB */
+	uint8_t dir;		/* METRICS_RX, METRICS_TX or CAPTURE_LOST */
+	uint16_t sock;
+	uint64_t ns;		/* CLOCK_MONOTONIC */
+};
+
+char *capture_file;
+int capture_on;
+
+static char *capture_ring;
+static volatile unsigned long capture_head;
+static volatile unsigned long capture_tail;
+static unsigned long capture_lost;
+static volatile int capture_stopping;
+static volatile sig_atomic_t capture_sigint_pending;
+static pthread_t capture_main;
+static FILE *capture_fp;
+static pthread_t capture_thread;
+
+static const char *capture_roles[METRICS_ROLES] = {
+	"gdb", "console", "target"
+};
+
+static uint64_t capture_now(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Copy to and from the ring at pos, wrapping at its end */
+static void capture_put(unsigned long pos, const void *buf, int len)
+{
+	int off = pos & CAPTURE_MASK;
+	int first = len < CAPTURE_RING - off ? len : CAPTURE_RING - off;
+
+	memcpy(capture_ring + off, buf, first);
+	memcpy(capture_ring, (const char *)buf + first, len - first);
+}
+
+static void capture_get(unsigned long pos, void *buf, int len)
+{
+	int off = pos & CAPTURE_MASK;
+	int first = len < CAPTURE_RING - off ? len : CAPTURE_RING - off;
+
+	memcpy(buf, capture_ring + off, first);
+	memcpy((char *)buf + first, capture_ring, len - first);
+}
+
+/* Record n bytes of buf read from or written to port */
+void capture_io(int role, int dir, struct port_st *port, const char *buf,
+		int n)
+{
+	struct capture_rec rec;
+	unsigned long head, len = CAPTURE_SLOT(n);
+
+	rec.ns = capture_now(CLOCK_MONOTONIC);
+	do {
+		head = capture_head;
+		if (head + len - capture_tail > CAPTURE_RING) {
+			__sync_fetch_and_add(&capture_lost, 1);
+			return;
+		}
+	} while (!__sync_bool_compare_and_swap(&capture_head, head,
+					       head + len));
+
+	rec.size = n;
+	rec.port = role;
+	rec.sock = 0;
+	if (port && port->type == PORT_USB)
+		rec.port |= CAPTURE_USB;
+	else if (port)
+		rec.sock = port->sock;
+	rec.dir = dir;
+	capture_put(head + CAPTURE_COMMIT, &rec, sizeof(rec));
+	capture_put(head + CAPTURE_COMMIT + sizeof(rec), buf, n);
+	__sync_synchronize();
+	*(volatile uint32_t *)(capture_ring + (head & CAPTURE_MASK)) = len;
+}
+
+/* Write the committed records to the file, 0 when there were none */
+static int capture_drain(void)
+{
+	unsigned long tail = capture_tail;
+	volatile uint32_t *commit;
+	struct capture_rec rec;
+	unsigned long lost;
+	char buf[4096];
+	int len, off, n, count = 0;
+
+	for (;;) {
+		commit = (volatile uint32_t *)(capture_ring +
+					       (tail & CAPTURE_MASK));
+		len = *commit;
+		if (!len)
+			break;
+		__sync_synchronize();
+		capture_get(tail + CAPTURE_COMMIT, &rec, sizeof(rec));
+		fwrite(&rec, sizeof(rec), 1, capture_fp);
+		for (off = 0; off < (int)rec.size; off += n) {
+			n = rec.size - off;
+			if (n > (int)sizeof(buf))
+				n = sizeof(buf);
+			capture_get(tail + CAPTURE_COMMIT + sizeof(rec) + off,
+				    buf, n);
+			fwrite(buf, n, 1, capture_fp);
+		}
+
+		/* free slots read as zero, uncommitted */
+		off = tail & CAPTURE_MASK;
+		n = len < CAPTURE_RING - off ? len : CAPTURE_RING - off;
+		memset(capture_ring + off, 0, n);
+		memset(capture_ring, 0, len - n);
+		tail += len;
+		__sync_synchronize();
+		capture_tail = tail;
+		count++;
+	}
+
+	lost = __sync_fetch_and_and(&capture_lost, 0);
+	if (lost) {
+		uint32_t l = lost;
+
+		rec.size = sizeof(l);
+		rec.port = 0;
+		rec.dir = CAPTURE_LOST;
+		rec.sock = 0;
+		rec.ns = capture_now(CLOCK_MONOTONIC);
+		fwrite(&rec, sizeof(rec), 1, capture_fp);
+		fwrite(&l, sizeof(l), 1, capture_fp);
+		count++;
+	}
+
+	return count;
+}
+
+static void *capture_thread_main(void *arg)
+{
+	sigset_t set;
+
+	/* capture_stop() waits for this thread, it must not run it */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (!capture_stopping) {
+		if (!capture_drain()) {
+			fflush(capture_fp);
+			usleep(1000);
+		}
+	}
+	capture_drain();
+	fclose(capture_fp);
+
+	return NULL;
+}
+
+static void capture_stop(void)
+{
+	capture_on = 0;
+	capture_stopping = 1;
+	pthread_join(capture_thread, NULL);
+	printf("Capture written to %s\n", capture_file);
+}
+
+static void capture_sigint(int sig)
+{
+	if (capture_sigint_pending)
+		return;
+	capture_sigint_pending = 1;
+	pthread_kill(capture_main, sig);
+}
+
+/* Exit, which writes out the capture, if ^C came */
+void capture_poll(void)
+{
+	if (capture_sigint_pending)
+		exit(0);
+}
+
+/* Capture the proxied streams to capture_file until the proxy exits */
+int capture_start(void)
+{
+	struct capture_head h;
+
+	capture_ring = calloc(1, CAPTURE_RING);
+	capture_fp = fopen(capture_file, "wb");
+	if (!capture_ring || !capture_fp) {
+		printf("Error: could not open %s\n", capture_file);
+		free(capture_ring);
+		if (capture_fp)
+			fclose(capture_fp);
+		return 1;
+	}
+
+	memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+	h.realtime = capture_now(CLOCK_REALTIME);
+	h.monotonic = capture_now(CLOCK_MONOTONIC);
+	fwrite(&h, sizeof(h), 1, capture_fp);
+
+	if (pthread_create(&capture_thread, NULL, capture_thread_main, NULL)) {
+		fclose(capture_fp);
+		return 1;
+	}
+	atexit(capture_stop);
+	capture_main = pthread_self();
+	signal(SIGINT, capture_sigint);
+	signal(SIGTERM, capture_sigint);
+	capture_on = 1;
+	printf("Capturing the proxied streams to %s, ^C to stop\n",
+	       capture_file);
+
+	return 0;
+}
+
+/*
+ * The decoder.  The gdb and target streams are cut into packets, acks
+ * and ^C, with the packets that span records kept per stream until
+ * their checksum.  Whatever is between packets is console text, as on
+ * a serial target, and so are the $O packets of the usb console.
+ */
+struct capture_stream {
+	int state;		/* 0 out of a packet, 1 in, 2 and 3 checksum */
+	int len;
+	int size;
+	char *pkt;
+	unsigned char sum;
+};
+
+static void capture_show(const char *s, int len, int max)
+{
+	int i;
+
+	for (i = 0; i < len && i < max; i++) {
+		if (s[i] == '\\')
+			printf("\\\\");
+		else if (s[i] >= ' ' && s[i] < 0x7f)
+			putchar(s[i]);
+		else if (s[i] == '\t')
+			printf("\\t");
+		else if (s[i] == '\r')
+			printf("\\r");
+		else
+			printf("\\x%02x", (unsigned char)s[i]);
+	}
+	if (len > max)
+		printf("... (%d bytes)", len);
+}
+
+static void capture_text(const char *s, int len)
+{
+	const char *nl;
+	int n;
+
+	while (len > 0) {
+		nl = memchr(s, '\n', len);
+		n = nl ? nl - s : len;
+		printf("            | ");
+		capture_show(s, n, len);
+		printf("\n");
+		if (nl)
+			n++;
+		s += n;
+		len -= n;
+	}
+}
+
+static int capture_hex(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static void capture_packet(struct capture_stream *st)
+{
+	char *p = st->pkt;
+	int len = st->len;
+	int i, n;
+
+	printf("            ");
+	capture_show(p, len, CAPTURE_SHOW);
+	if (capture_hex(p[len - 2]) < 0 || capture_hex(p[len - 1]) < 0 ||
+	    (capture_hex(p[len - 2]) << 4 | capture_hex(p[len - 1])) !=
+	    st->sum)
+		printf("  bad checksum, %02x", st->sum);
+	printf("\n");
+
+	/* console output of the usb target, hex encoded */
+	if (len > 5 && p[0] == '$' && p[1] == 'O' && p[2] != 'K') {
+		for (i = 2, n = 0; i + 1 < len - 3; i += 2, n++)
+			p[n] = capture_hex(p[i]) << 4 | capture_hex(p[i + 1]);
+		capture_text(p, n);
+	}
+}
+
+static void capture_rsp(struct capture_stream *st, const char *buf, int len)
+{
+	int i, text = 0;
+
+	for (i = 0; i < len; i++) {
+		char c = buf[i];
+
+		if (!st->state) {
+			if (c != '$' && c != '%' && c != '+' && c != '-' &&
+			    c != 0x03)
+				continue;
+			if (i > text)
+				capture_text(buf + text, i - text);
+			text = i + 1;
+			if (c == '+' || c == '-')
+				printf("            %c\n", c);
+			else if (c == 0x03)
+				printf("            ^C\n");
+			else {
+				st->state = 1;
+				st->len = 0;
+				st->sum = 0;
+			}
+		} else if (st->state == 1 && c == '#') {
+			st->state = 2;
+		} else if (st->state == 1) {
+			st->sum += c;
+		} else {
+			st->state++;
+		}
+
+		if (st->state) {
+			if (st->len == st->size) {
+				st->size = st->size ? st->size * 2 : 1024;
+				st->pkt = realloc(st->pkt, st->size);
+			}
+			st->pkt[st->len++] = c;
+			if (st->state == 4) {
+				capture_packet(st);
+				st->state = 0;
+				text = i + 1;
+			}
+		}
+	}
+	if (!st->state && len > text)
+		capture_text(buf + text, len - text);
+	if (st->state)
+		printf("            (packet continues, %d bytes so far)\n",
+		       st->len);
+}
+
+/* Print the capture at path */
+int capture_decode(const char *path)
+{
+	struct capture_stream streams[METRICS_ROLES][2];
+	struct capture_head h;
+	struct capture_rec rec;
+	char *buf = NULL;
+	unsigned int size = 0;
+	unsigned long records = 0;
+	time_t start;
+	FILE *fp;
+	int role, got;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		printf("Error: could not open %s\n", path);
+		return 1;
+	}
+	if (fread(&h, sizeof(h), 1, fp) != 1 ||
+	    memcmp(h.magic, CAPTURE_MAGIC, sizeof(h.magic))) {
+		printf("Error: %s is not a capture of the proxy\n", path);
+		fclose(fp);
+		return 1;
+	}
+	start = h.realtime / 1000000000ULL;
+	printf("capture started %s", ctime(&start));
+	memset(streams, 0, sizeof(streams));
+
+	for (;;) {
+		got = fread(&rec, 1, sizeof(rec), fp);
+		if (got != sizeof(rec))
+			break;
+		if (rec.size > size) {
+			size = rec.size;
+			buf = realloc(buf, size);
+		}
+		got = fread(buf, 1, rec.size, fp);
+		if (got != (int)rec.size) {
+			got = -1;
+			break;
+		}
+		records++;
+		printf("%11.6f ", (double)(int64_t)(rec.ns - h.monotonic) / 1e9);
+
+		if (rec.dir == CAPTURE_LOST) {
+			printf("%u records lost, the ring was full\n",
+			       *(uint32_t *)buf);
+			continue;
+		}
+		role = rec.port & ~CAPTURE_USB;
+		if (role >= METRICS_ROLES || rec.dir > METRICS_TX) {
+			printf("bad record\n");
+			got = 0;
+			break;
+		}
+		printf("%-7s %s ", capture_roles[role],
+		       rec.dir == METRICS_RX ? "rx" : "tx");
+		if (rec.port & CAPTURE_USB)
+			printf("usb transfer, %u bytes\n", rec.size);
+		else
+			printf("fd %u, %u bytes\n", rec.sock, rec.size);
+
+		if (role == METRICS_CONSOLE)
+			capture_text(buf, rec.size);
+		else
+			capture_rsp(&streams[role][rec.dir], buf, rec.size);
+	}
+	if (got)
+		printf("capture cut short after %lu records\n", records);
+	fclose(fp);
+	free(buf);
+
+	return 0;
+}
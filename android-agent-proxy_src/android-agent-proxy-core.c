@@ -0,0 +1,353 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-core.c  capture of the target's RAM to an ELF core file
+ *                     that crash and gdb can open with vmlinux
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "android-agent-proxy.h"
+
+/* raw bytes read per call, a multiple of the usb transfer size */
+#define CORE_CHUNK	0x10000
+
+/*
+ * The ARM struct elf_prstatus: pr_reg, r0-r15, cpsr and orig_r0, is at
+ * offset 72.  In kgdb's register block cpsr follows the 8 fpa registers.
+ */
+#define PRSTATUS_SIZE	148
+#define PRSTATUS_REG	72
+#define GDB_CPSR	164
+
+static char reply[2 * IO_BUFSIZE];
+static char chunk[CORE_CHUNK];
+static struct timeval progress_start;
+static unsigned int crc_table[256];
+
+static void core_note(FILE *fp, const char *regs, int regsize)
+{
+	unsigned char prstatus[PRSTATUS_SIZE];
+	Elf32_Nhdr nhdr;
+
+	memset(prstatus, 0, sizeof(prstatus));
+	memcpy(prstatus + PRSTATUS_REG, regs, regsize < 64 ? regsize : 64);
+	if (regsize >= GDB_CPSR + 4)
+		memcpy(prstatus + PRSTATUS_REG + 64, regs + GDB_CPSR, 4);
+
+	nhdr.n_namesz = sizeof("CORE");
+	nhdr.n_descsz = sizeof(prstatus);
+	nhdr.n_type = NT_PRSTATUS;
+	fwrite(&nhdr, sizeof(nhdr), 1, fp);
+	fwrite("CORE\0\0\0", 8, 1, fp);
+	fwrite(prstatus, sizeof(prstatus), 1, fp);
+}
+
+/*
+ * Write the ELF header, the program headers and the register note of a
+ * core with one PT_LOAD per range.  The range contents have to follow,
+ * in order, right after.  regs is the binary 'g' register block.
+ */
+int core_write_header(FILE *fp, const char *regs, int regsize,
+		      unsigned long page_offset, unsigned long phys_offset,
+		      const struct core_range *r, int nr)
+{
+	unsigned int notesz = sizeof(Elf32_Nhdr) + 8 + PRSTATUS_SIZE;
+	unsigned long long lowmem = 0x100000000ULL - page_offset;
+	Elf32_Ehdr ehdr;
+	Elf32_Phdr phdr;
+	Elf32_Off off;
+	int i;
+
+	memset(&ehdr, 0, sizeof(ehdr));
+	memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+	ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+	ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+	ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr.e_type = ET_CORE;
+	ehdr.e_machine = EM_ARM;
+	ehdr.e_version = EV_CURRENT;
+	ehdr.e_phoff = sizeof(ehdr);
+	ehdr.e_ehsize = sizeof(ehdr);
+	ehdr.e_phentsize = sizeof(phdr);
+	ehdr.e_phnum = nr + 1;
+	if (fwrite(&ehdr, sizeof(ehdr), 1, fp) != 1)
+		return -1;
+
+	off = sizeof(ehdr) + (nr + 1) * sizeof(phdr);
+	memset(&phdr, 0, sizeof(phdr));
+	phdr.p_type = PT_NOTE;
+	phdr.p_offset = off;
+	phdr.p_filesz = notesz;
+	fwrite(&phdr, sizeof(phdr), 1, fp);
+	off += notesz;
+
+	for (i = 0; i < nr; i++) {
+		phdr.p_type = PT_LOAD;
+		phdr.p_flags = PF_R | PF_W | PF_X;
+		phdr.p_offset = off;
+		phdr.p_paddr = r[i].start;
+		/* only lowmem has a fixed kernel mapping */
+		if (r[i].start >= phys_offset &&
+		    r[i].start - phys_offset < lowmem)
+			phdr.p_vaddr = r[i].start - phys_offset + page_offset;
+		else
+			phdr.p_vaddr = 0;
+		phdr.p_filesz = r[i].size;
+		phdr.p_memsz = r[i].size;
+		phdr.p_align = 0;
+		fwrite(&phdr, sizeof(phdr), 1, fp);
+		off += r[i].size;
+	}
+
+	core_note(fp, regs, regsize);
+
+	return ferror(fp) ? -1 : 0;
+}
+
+/* "start+size[,start+size...]", returns the number of ranges or -1 */
+int core_parse_ranges(const char *s, struct core_range *r, int max)
+{
+	char *end;
+	int n = 0;
+
+	while (*s) {
+		if (n == max)
+			return -1;
+		r[n].start = strtoull(s, &end, 0);
+		if (*end != '+')
+			return -1;
+		r[n].size = strtoull(end + 1, &end, 0);
+		if (!r[n].size || (*end && *end != ','))
+			return -1;
+		n++;
+		s = *end ? end + 1 : end;
+	}
+
+	return n;
+}
+
+void core_progress_start(void)
+{
+	gettimeofday(&progress_start, NULL);
+}
+
+static double core_elapsed(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - progress_start.tv_sec) +
+	    (now.tv_usec - progress_start.tv_usec) / 1000000.0;
+}
+
+void core_progress(unsigned long long done, unsigned long long total)
+{
+	double secs = core_elapsed();
+
+	printf("\r%llu/%llu MB (%.1f MB/s)", done >> 20, total >> 20,
+	       secs > 0 ? done / 1048576.0 / secs : 0.0);
+	fflush(stdout);
+}
+
+void core_progress_end(unsigned long long done, const char *path)
+{
+	double secs = core_elapsed();
+
+	printf("\r%llu bytes in %.2fs (%.2f MB/s) written to %s\n", done,
+	       secs, secs > 0 ? done / 1048576.0 / secs : 0.0, path);
+}
+
+/* the CRC32 the kernel's crc32_le() computes when started from ~0 */
+static unsigned int core_crc32(unsigned int crc, const unsigned char *p,
+			       int len)
+{
+	unsigned int c;
+	int i, k;
+
+	if (!crc_table[1]) {
+		for (i = 0; i < 256; i++) {
+			c = i;
+			for (k = 0; k < 8; k++)
+				c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+			crc_table[i] = c;
+		}
+	}
+
+	while (len--)
+		crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+/* "<PAGE_OFFSET>,<its physical address>;<start>,<size>;..." */
+static int core_target_ram(struct port_st *port, unsigned long *page_offset,
+			   unsigned long *phys_offset, struct core_range *r,
+			   int max)
+{
+	char *s;
+	int len, n = 0;
+
+	len = gdb_command(port, "qkgdb.ram", reply, sizeof(reply));
+	if (len <= 0 || reply[0] == 'E') {
+		fprintf(stderr, "The target has no qkgdb.ram query, is it "
+			"built with CONFIG_KGDB_USB_DUMP?\n");
+		return -1;
+	}
+
+	if (sscanf(reply, "%lx,%lx", page_offset, phys_offset) != 2)
+		return -1;
+	for (s = strchr(reply, ';'); s && n < max; s = strchr(s + 1, ';')) {
+		if (sscanf(s + 1, "%llx,%llx", &r[n].start, &r[n].size) != 2)
+			return -1;
+		n++;
+	}
+
+	return n;
+}
+
+static int core_dump_range(struct port_st *port, FILE *fp,
+			   const struct core_range *r,
+			   unsigned long long *done, unsigned long long total,
+			   unsigned long *holes)
+{
+	unsigned long long left = r->size, got;
+	unsigned int crc = ~0, tcrc;
+	unsigned long thole;
+	char cmd[64];
+	int len, n;
+
+	sprintf(cmd, "qkgdb.dump:%llx,%llx,p", r->start, r->size);
+	len = gdb_command(port, cmd, reply, sizeof(reply));
+	if (len <= 0 || reply[0] != 'D' ||
+	    sscanf(reply + 1, "%llx", &got) != 1 || got != r->size) {
+		fprintf(stderr, "\nThe target refused to dump %llx+%llx: %s\n",
+			r->start, r->size, len > 0 ? reply : "no reply");
+		return -1;
+	}
+
+	while (left) {
+		n = left < CORE_CHUNK ? left : CORE_CHUNK;
+		if (gdb_read_raw(port, chunk, n) != n) {
+			fprintf(stderr, "\nThe dump stopped at %llx\n",
+				r->start + r->size - left);
+			return -1;
+		}
+		crc = core_crc32(crc, (unsigned char *)chunk, n);
+		if (fwrite(chunk, 1, n, fp) != n) {
+			fprintf(stderr, "\nERROR: write of the core failed\n");
+			return -1;
+		}
+		left -= n;
+		*done += n;
+		if (!(*done & 0xfffff) || !left)
+			core_progress(*done, total);
+	}
+
+	len = gdb_recv(port, reply, sizeof(reply));
+	if (len <= 0 || sscanf(reply, "C%x,%lx", &tcrc, &thole) != 2) {
+		fprintf(stderr, "\nNo checksum after %llx+%llx\n", r->start,
+			r->size);
+		return -1;
+	}
+	if (tcrc != ~crc) {
+		fprintf(stderr, "\nChecksum mismatch in %llx+%llx\n",
+			r->start, r->size);
+		return -1;
+	}
+	*holes += thole;
+
+	return 0;
+}
+
+/*
+ * Capture memory of a target stopped in kgdb with the binary
+ * qkgdb.dump stream.  ranges are physical "start+size" pairs, or NULL
+ * for all the System RAM the target reports.
+ */
+int core_dump(struct port_st *port, const char *path, const char *ranges)
+{
+	struct core_range ram[CORE_MAX_RANGES], r[CORE_MAX_RANGES];
+	unsigned long page_offset, phys_offset;
+	unsigned long long done = 0, total = 0;
+	unsigned long holes = 0;
+	int i, nr, regsize;
+	FILE *fp;
+	int len;
+
+	if (gdb_port_open(port))
+		return 1;
+
+	nr = core_target_ram(port, &page_offset, &phys_offset, ram,
+			     CORE_MAX_RANGES);
+	if (nr < 0)
+		return 1;
+	if (ranges) {
+		nr = core_parse_ranges(ranges, r, CORE_MAX_RANGES);
+		if (nr <= 0) {
+			fprintf(stderr, "Bad range list %s\n", ranges);
+			return 1;
+		}
+	} else {
+		memcpy(r, ram, sizeof(r));
+	}
+
+	len = gdb_command(port, "g", reply, sizeof(reply));
+	if (len <= 0 || reply[0] == 'E') {
+		fprintf(stderr, "Could not read the registers\n");
+		return 1;
+	}
+	regsize = gdb_hex2bin(reply, len);
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		fprintf(stderr, "ERROR: Could not open %s\n", path);
+		return 1;
+	}
+	if (core_write_header(fp, reply, regsize, page_offset, phys_offset,
+			      r, nr)) {
+		fprintf(stderr, "ERROR: write to %s failed\n", path);
+		fclose(fp);
+		return 1;
+	}
+
+	for (i = 0; i < nr; i++)
+		total += r[i].size;
+
+	core_progress_start();
+	for (i = 0; i < nr; i++) {
+		if (core_dump_range(port, fp, &r[i], &done, total, &holes)) {
+			fclose(fp);
+			return 1;
+		}
+	}
+	fclose(fp);
+
+	core_progress_end(done, path);
+	if (holes)
+		printf("%lu bytes could not be read and are zero\n", holes);
+
+	return 0;
+}
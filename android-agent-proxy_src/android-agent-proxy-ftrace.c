@@ -0,0 +1,444 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-ftrace.c  the target's ftrace buffer to a trace.dat file,
+ *                       streamed while it runs or read when it is stopped
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * The target sends ring buffer pages as they are, each after an 8 byte
+ * header, see f_kgdb.c.  They are kept in a temporary file per cpu and
+ * written out as a version 6 trace.dat, the format of trace-cmd, when
+ * the recording ends.
+ *
+ * trace.dat also has the event formats, kallsyms, the printk formats
+ * and the command lines, which only the target knows.  They are read
+ * from a copy of its tracing directory if one is given: events/,
+ * kallsyms, printk_formats and saved_cmdlines.  Without them trace-cmd
+ * can still read the file but not name the events.
+ */
+#define FTRACE_CPUS	32
+#define FTRACE_HDR	8
+#define FTRACE_FLUSH_MS	500	/* for the last pages after the stop */
+
+static FILE *ftrace_tmp[FTRACE_CPUS];
+static unsigned long ftrace_pages[FTRACE_CPUS];
+static unsigned long ftrace_page_size;
+static int ftrace_cpus;
+
+static struct port_st *ftrace_target;
+static const char *ftrace_path;
+static const char *ftrace_dir;
+static int ftrace_on;
+static pthread_mutex_t ftrace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t ftrace_thread;
+static volatile sig_atomic_t ftrace_stop;
+
+static char reply[IO_BUFSIZE];
+
+static unsigned long ftrace_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static void put32(FILE *fp, unsigned long v)
+{
+	unsigned char b[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+	fwrite(b, 1, 4, fp);
+}
+
+static void put64(FILE *fp, unsigned long long v)
+{
+	put32(fp, v);
+	put32(fp, v >> 32);
+}
+
+/* a page, header included, from the target */
+static int ftrace_add(const unsigned char *buf, int len)
+{
+	unsigned int cpu = buf[2] | buf[3] << 8;
+	unsigned long size = ftrace_le32(buf + 4);
+
+	if (len < FTRACE_HDR + size || cpu >= FTRACE_CPUS)
+		return -1;
+	if (!size)
+		return 0;
+
+	if (!ftrace_page_size)
+		ftrace_page_size = size;
+	if (size != ftrace_page_size)
+		return -1;
+	if (!ftrace_tmp[cpu]) {
+		ftrace_tmp[cpu] = tmpfile();
+		if (!ftrace_tmp[cpu])
+			return -1;
+	}
+	if (cpu >= ftrace_cpus)
+		ftrace_cpus = cpu + 1;
+
+	fwrite(buf + FTRACE_HDR, 1, size, ftrace_tmp[cpu]);
+	ftrace_pages[cpu]++;
+
+	return 0;
+}
+
+/* a file of the tracing directory copy, NULL if there is none */
+static char *ftrace_slurp(const char *dir, const char *name, long *len)
+{
+	char path[NAMESIZE * 2];
+	char *buf;
+	FILE *fp;
+
+	*len = 0;
+	if (!dir)
+		return NULL;
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+
+	/* the files of debugfs do not know their size, read until EOF */
+	buf = NULL;
+	for (;;) {
+		char *p = realloc(buf, *len + 4096);
+
+		if (!p)
+			break;
+		buf = p;
+		*len += fread(buf + *len, 1, 4096, fp);
+		if (feof(fp) || ferror(fp))
+			break;
+	}
+	fclose(fp);
+
+	return buf;
+}
+
+/* size, in size_bytes, and contents of a file of the directory copy */
+static void ftrace_put_file(FILE *fp, const char *name, int size_bytes)
+{
+	char *buf;
+	long len;
+
+	buf = ftrace_slurp(ftrace_dir, name, &len);
+	if (size_bytes == 8)
+		put64(fp, len);
+	else
+		put32(fp, len);
+	fwrite(buf, 1, len, fp);
+	free(buf);
+}
+
+static int ftrace_has_format(const char *system, const char *event)
+{
+	char path[NAMESIZE * 2];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/events/%s/%s/format", ftrace_dir,
+		 system, event);
+	return !stat(path, &st) && S_ISREG(st.st_mode);
+}
+
+/* the count and the formats of the events of one system */
+static void ftrace_put_system(FILE *fp, const char *system)
+{
+	char path[NAMESIZE * 2];
+	struct dirent *d;
+	DIR *dir;
+	int n = 0;
+
+	snprintf(path, sizeof(path), "%s/events/%s", ftrace_dir, system);
+	dir = ftrace_dir ? opendir(path) : NULL;
+	while (dir && (d = readdir(dir)))
+		n += d->d_name[0] != '.' && ftrace_has_format(system, d->d_name);
+	put32(fp, n);
+	if (!dir)
+		return;
+
+	rewinddir(dir);
+	while ((d = readdir(dir))) {
+		if (d->d_name[0] == '.' || !ftrace_has_format(system, d->d_name))
+			continue;
+		snprintf(path, sizeof(path), "events/%s/%s/format", system,
+			 d->d_name);
+		ftrace_put_file(fp, path, 8);
+	}
+	closedir(dir);
+}
+
+/* an event system other than ftrace, which has a section of its own */
+static int ftrace_is_system(const char *name)
+{
+	char path[NAMESIZE * 2];
+	struct stat st;
+
+	if (name[0] == '.' || !strcmp(name, "ftrace"))
+		return 0;
+	snprintf(path, sizeof(path), "%s/events/%s", ftrace_dir, name);
+	return !stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+static void ftrace_put_systems(FILE *fp)
+{
+	char path[NAMESIZE * 2];
+	struct dirent *d;
+	DIR *dir = NULL;
+	int n = 0;
+
+	if (ftrace_dir) {
+		snprintf(path, sizeof(path), "%s/events", ftrace_dir);
+		dir = opendir(path);
+	}
+	while (dir && (d = readdir(dir)))
+		n += ftrace_is_system(d->d_name);
+	put32(fp, n);
+	if (!dir)
+		return;
+
+	rewinddir(dir);
+	while ((d = readdir(dir))) {
+		if (!ftrace_is_system(d->d_name))
+			continue;
+		fwrite(d->d_name, 1, strlen(d->d_name) + 1, fp);
+		ftrace_put_system(fp, d->d_name);
+	}
+	closedir(dir);
+}
+
+static void ftrace_put_section(FILE *fp, const char *name, const char *text)
+{
+	fwrite(name, 1, strlen(name) + 1, fp);
+	put64(fp, strlen(text));
+	fwrite(text, 1, strlen(text), fp);
+}
+
+/*
+ * The headers the kernel prints in events/header_page and
+ * events/header_event, for a 32-bit target.
+ */
+static void ftrace_put_headers(FILE *fp)
+{
+	char page[512];
+
+	snprintf(page, sizeof(page),
+		 "\tfield: u64 timestamp;\toffset:0;\tsize:8;\tsigned:0;\n"
+		 "\tfield: local_t commit;\toffset:8;\tsize:4;\tsigned:1;\n"
+		 "\tfield: int overwrite;\toffset:8;\tsize:1;\tsigned:1;\n"
+		 "\tfield: char data;\toffset:12;\tsize:%lu;\tsigned:1;\n",
+		 ftrace_page_size - 12);
+	ftrace_put_section(fp, "header_page", page);
+	ftrace_put_section(fp, "header_event",
+			   "# compressed entry header\n"
+			   "\ttype_len    :    5 bits\n"
+			   "\ttime_delta  :   27 bits\n"
+			   "\tarray       :   32 bits\n"
+			   "\n"
+			   "\tpadding     : type == 29\n"
+			   "\ttime_extend : type == 30\n"
+			   "\tdata max type_len  == 28\n");
+}
+
+static int ftrace_write(const char *path)
+{
+	static const char magic[] = { 0x17, 0x08, 0x44, 't', 'r', 'a', 'c',
+				      'i', 'n', 'g', '6', 0, 0, 4 };
+	char *buf;
+	unsigned long long off;
+	unsigned long total = 0;
+	FILE *fp;
+	int cpu, n;
+
+	if (!ftrace_page_size) {
+		printf("ftrace: the target sent no pages\n");
+		return 1;
+	}
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "ERROR: Could not open %s\n", path);
+		return 1;
+	}
+
+	/* magic, version 6, little endian, 4 byte longs */
+	fwrite(magic, 1, sizeof(magic), fp);
+	put32(fp, ftrace_page_size);
+	ftrace_put_headers(fp);
+
+	/* the events of the ftrace system, then those of the others */
+	ftrace_put_system(fp, "ftrace");
+	ftrace_put_systems(fp);
+	ftrace_put_file(fp, "kallsyms", 4);
+	ftrace_put_file(fp, "printk_formats", 4);
+	ftrace_put_file(fp, "saved_cmdlines", 8);
+
+	put32(fp, ftrace_cpus);
+	fwrite("flyrecord", 1, 10, fp);
+
+	/* the pages of each cpu start on a page boundary */
+	off = ftell(fp) + ftrace_cpus * 16;
+	off = (off + ftrace_page_size - 1) & ~(ftrace_page_size - 1ULL);
+	for (cpu = 0; cpu < ftrace_cpus; cpu++) {
+		put64(fp, off);
+		put64(fp, ftrace_pages[cpu] * ftrace_page_size);
+		off += ftrace_pages[cpu] * ftrace_page_size;
+	}
+
+	buf = malloc(ftrace_page_size);
+	if (!buf) {
+		fclose(fp);
+		return 1;
+	}
+	for (cpu = 0; cpu < ftrace_cpus; cpu++) {
+		if (!ftrace_tmp[cpu])
+			continue;
+		fseek(fp, (ftell(fp) + ftrace_page_size - 1) &
+		      ~(ftrace_page_size - 1), SEEK_SET);
+		rewind(ftrace_tmp[cpu]);
+		while ((n = fread(buf, 1, ftrace_page_size,
+				  ftrace_tmp[cpu])) > 0)
+			fwrite(buf, 1, n, fp);
+		total += ftrace_pages[cpu];
+	}
+	free(buf);
+	fclose(fp);
+
+	printf("ftrace: %lu pages of %d cpus written to %s\n", total,
+	       ftrace_cpus, path);
+	return 0;
+}
+
+/*
+ * Called by the usb thread for everything the target sends.  Returns
+ * how much of buf was an ftrace page.
+ */
+int ftrace_target_data(char *buf, int len)
+{
+	if (!ftrace_on || len < FTRACE_HDR || buf[0] != '&')
+		return 0;
+
+	pthread_mutex_lock(&ftrace_lock);
+	if (ftrace_add((unsigned char *)buf, len))
+		printf("ftrace: bad page from the target\n");
+	pthread_mutex_unlock(&ftrace_lock);
+
+	return len;
+}
+
+static void ftrace_sigint(int sig)
+{
+	ftrace_stop = 1;
+}
+
+/* wait for ^C, then stop the stream and write the file */
+static void *ftrace_thread_main(void *arg)
+{
+	while (!ftrace_stop)
+		usleep(100000);
+
+	usb_set_trace(ftrace_target, 0);
+	usleep(FTRACE_FLUSH_MS * 1000);
+
+	pthread_mutex_lock(&ftrace_lock);
+	ftrace_on = 0;
+	exit(ftrace_write(ftrace_path));
+}
+
+/*
+ * Record the ftrace stream of the usb target to path until the proxy
+ * is interrupted.  dir is the copy of the target's tracing directory.
+ */
+int ftrace_start(struct port_st *target, const char *path, const char *dir)
+{
+	ftrace_target = target;
+	ftrace_path = path;
+	ftrace_dir = dir;
+	ftrace_on = 1;
+
+	if (usb_set_trace(target, 1)) {
+		printf("Error: the target has no ftrace stream\n");
+		ftrace_on = 0;
+		return 1;
+	}
+
+	signal(SIGINT, ftrace_sigint);
+	signal(SIGTERM, ftrace_sigint);
+	printf("Recording the target's ftrace buffer to %s, ^C to stop\n",
+	       path);
+
+	return pthread_create(&ftrace_thread, NULL, ftrace_thread_main,
+			      NULL);
+}
+
+/* the ftrace buffer of a target stopped in kgdb, with qkgdb.ftrace */
+int ftrace_dump(struct port_st *port, const char *path, const char *dir)
+{
+	unsigned char *buf;
+	unsigned long size;
+	int ret = 1;
+
+	ftrace_dir = dir;
+	if (gdb_port_open(port))
+		return 1;
+
+	if (gdb_command(port, "qkgdb.ftrace", reply, sizeof(reply)) <= 0 ||
+	    reply[0] != 'F') {
+		fprintf(stderr, "The target has no qkgdb.ftrace query, is it "
+			"stopped in kgdb?\n");
+		return 1;
+	}
+	size = strtoul(reply + 1, NULL, 16);
+	if (!size || size > 0x10000)
+		return 1;
+
+	buf = malloc(FTRACE_HDR + size);
+	if (!buf)
+		return 1;
+
+	/* every transfer has the full size, the last one no page */
+	for (;;) {
+		if (gdb_read_raw(port, (char *)buf, FTRACE_HDR + size) < 0) {
+			fprintf(stderr, "The target stopped sending\n");
+			goto out;
+		}
+		if (buf[0] != '&' || ftrace_add(buf, FTRACE_HDR + size)) {
+			fprintf(stderr, "Bad page from the target\n");
+			goto out;
+		}
+		if (!ftrace_le32(buf + 4))
+			break;
+	}
+	ret = ftrace_write(path);
+out:
+	free(buf);
+	return ret;
+}
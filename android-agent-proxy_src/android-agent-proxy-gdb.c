@@ -0,0 +1,399 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-gdb.c  gdb remote protocol client for the proxy's own
+ *                    commands, which talk to the target directly
+ *                    instead of relaying a debugger
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "android-agent-proxy.h"
+
+#define GDB_TIMEOUT	5	/* seconds of silence before giving up */
+#define GDB_RETRIES	3
+
+static char gdb_ack[] = "+";
+static char gdb_nak[] = "-";
+
+/* bytes read from the target and not consumed yet */
+static char gdb_rx[IO_BUFSIZE];
+static int gdb_rx_len;
+static int gdb_rx_pos;
+
+int gdb_port_open(struct port_st *port)
+{
+#ifdef FEATURE_PORT_USB
+	if (port->type == PORT_USB)
+		return usb_portopen(port) ? -1 : 0;
+#endif
+	if (port->type == PORT_RS232)
+		return 0;
+
+	fprintf(stderr, "Only usb and serial targets can be used here\n");
+	return -1;
+}
+
+static int gdb_hex(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* wait up to 100ms for bytes to read into buf */
+static int gdb_read(struct port_st *port, char *buf, int size)
+{
+	struct timeval tv;
+	fd_set rds;
+	int got;
+
+#ifdef FEATURE_PORT_USB
+	if (port->type != PORT_USB)
+#endif
+	{
+		FD_ZERO(&rds);
+		FD_SET(port->sock, &rds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 100000;
+		if (select(port->sock + 1, &rds, NULL, NULL, &tv) <= 0)
+			return 0;
+	}
+
+	/* the usb read times out by itself */
+	got = port->portread(port, buf, size, 0);
+
+	return got > 0 ? got : 0;
+}
+
+static int gdb_fill(struct port_st *port)
+{
+	int got;
+
+	got = gdb_read(port, gdb_rx, sizeof(gdb_rx));
+	if (got) {
+		gdb_rx_len = got;
+		gdb_rx_pos = 0;
+	}
+	return got;
+}
+
+static int gdb_getc(struct port_st *port)
+{
+	time_t start = time(NULL);
+
+	while (gdb_rx_pos == gdb_rx_len) {
+		if (gdb_fill(port) > 0)
+			break;
+		if (time(NULL) - start >= GDB_TIMEOUT)
+			return -1;
+	}
+
+	return (unsigned char)gdb_rx[gdb_rx_pos++];
+}
+
+/* frame cmd as a packet in buf, returns its length */
+int gdb_frame(char *buf, const char *cmd)
+{
+	unsigned char csum = 0;
+	int len = strlen(cmd);
+	int i;
+
+	buf[0] = '$';
+	for (i = 0; i < len; i++) {
+		buf[i + 1] = cmd[i];
+		csum += (unsigned char)cmd[i];
+	}
+	sprintf(buf + len + 1, "#%02x", csum);
+
+	return len + 4;
+}
+
+static int gdb_putpkt(struct port_st *port, const char *cmd)
+{
+	char buf[IO_BUFSIZE];
+	int len;
+
+	if (strlen(cmd) + 5 > sizeof(buf))
+		return -1;
+
+	len = gdb_frame(buf, cmd);
+	if (port->portwrite(port, buf, len, 0) != len)
+		return -1;
+	return 0;
+}
+
+/*
+ * Send n commands in one write without waiting for their replies.  The
+ * stub's put_packet() waits for an ack after each reply and takes a
+ * '$' there as a reconnect, dropping that packet, so every command is
+ * followed by the ack of its reply.  The replies have to be read with
+ * gdb_recv(), which does not ack them again.
+ */
+int gdb_send_pipelined(struct port_st *port, char **cmd, int n)
+{
+	char buf[IO_BUFSIZE];
+	int i, len = 0;
+
+	for (i = 0; i < n; i++) {
+		if (len + strlen(cmd[i]) + 6 > sizeof(buf))
+			return -1;
+		len += gdb_frame(buf + len, cmd[i]);
+		buf[len++] = '+';
+	}
+
+	if (port->portwrite(port, buf, len, 0) != len)
+		return -1;
+	return 0;
+}
+
+/*
+ * Read and, if ack is set, acknowledge the next packet.  The payload is
+ * copied to buf as is, binary replies have to be passed to
+ * gdb_unescape().  Returns its length, -1 on a timeout and -2 when the
+ * packet has to be sent again.
+ */
+static int gdb_getpkt(struct port_st *port, char *buf, int size, int ack)
+{
+	unsigned char csum = 0;
+	int len = 0;
+	int c, hi, lo;
+
+	do {
+		c = gdb_getc(port);
+		if (c < 0)
+			return -1;
+		if (c == '-')
+			return -2;
+	} while (c != '$');
+
+	while ((c = gdb_getc(port)) != '#') {
+		if (c < 0)
+			return -1;
+		csum += c;
+		if (len < size - 1)
+			buf[len++] = c;
+	}
+	buf[len] = '\0';
+
+	hi = gdb_hex(gdb_getc(port));
+	lo = gdb_hex(gdb_getc(port));
+	if (hi < 0 || lo < 0 || ((hi << 4) | lo) != csum) {
+		if (ack)
+			port->portwrite(port, gdb_nak, 1, 0);
+		return -2;
+	}
+	if (ack)
+		port->portwrite(port, gdb_ack, 1, 0);
+
+	return len;
+}
+
+/*
+ * Send cmd and wait for the reply.  Returns the reply length, 0 for the
+ * empty reply of an unsupported packet, or -1 if the target does not
+ * answer.
+ */
+int gdb_command(struct port_st *port, const char *cmd, char *reply, int size)
+{
+	int i, len = -1;
+
+	for (i = 0; i < GDB_RETRIES; i++) {
+		if (gdb_putpkt(port, cmd))
+			return -1;
+		len = gdb_getpkt(port, reply, size, 1);
+		if (len != -2)
+			break;
+	}
+	if (len < 0 && debug)
+		printf("No reply from the target to %s\n", cmd);
+
+	return len < 0 ? -1 : len;
+}
+
+/*
+ * Stop a running target as gdb's ^C does.  Once it is in kgdb it
+ * answers the ? packet; a target already stopped does so right away.
+ * If gdb went away without detaching, kgdb sends its stop reply first
+ * and drops the ?, which then is the reply read.
+ */
+int gdb_stop_target(struct port_st *port)
+{
+	char reply[IO_BUFSIZE];
+	int len;
+
+	if (sendSpecialBreak(port, defaultBrkStr, defaultBrkStrLen)) {
+		fprintf(stderr, "Could not send the break to the target\n");
+		return -1;
+	}
+
+	len = gdb_command(port, "?", reply, sizeof(reply));
+	if (len <= 0 || (reply[0] != 'S' && reply[0] != 'T')) {
+		fprintf(stderr, "The target did not stop in kgdb\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read a packet that needs no ack: one the target sends unasked or the
+ * reply to a pipelined command.  Returns as gdb_command() does, or -2
+ * if the packet was damaged.
+ */
+int gdb_recv(struct port_st *port, char *reply, int size)
+{
+	return gdb_getpkt(port, reply, size, 0);
+}
+
+/*
+ * Read len bytes of raw data that the target streams after a reply.
+ * Over usb, len must not end inside one of the target's transfers
+ * unless the stream ends there.  Returns len, or -1 on a timeout.
+ */
+int gdb_read_raw(struct port_st *port, char *buf, int len)
+{
+	time_t start = time(NULL);
+	int n, done;
+
+	done = gdb_rx_len - gdb_rx_pos;
+	if (done > len)
+		done = len;
+	memcpy(buf, gdb_rx + gdb_rx_pos, done);
+	gdb_rx_pos += done;
+
+	while (done < len) {
+		n = gdb_read(port, buf + done, len - done);
+		if (n > 0) {
+			done += n;
+			start = time(NULL);
+		} else if (time(NULL) - start >= GDB_TIMEOUT) {
+			return -1;
+		}
+	}
+
+	return done;
+}
+
+/* undo the '}' escapes of a binary reply in place, returns the new length */
+int gdb_unescape(char *buf, int len)
+{
+	int i, n = 0;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] == '}' && i + 1 < len)
+			buf[n++] = buf[++i] ^ 0x20;
+		else
+			buf[n++] = buf[i];
+	}
+
+	return n;
+}
+
+#ifdef __SSE2__
+/* 0xffff if the 16 bytes in c are all hex digits */
+static inline int gdb_hex_mask(__m128i c)
+{
+	__m128i dig, alpha;
+
+	dig = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+			    _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+	c = _mm_or_si128(c, _mm_set1_epi8(0x20));
+	alpha = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)),
+			      _mm_cmplt_epi8(c, _mm_set1_epi8('f' + 1)));
+
+	return _mm_movemask_epi8(_mm_or_si128(dig, alpha));
+}
+
+/* the values of 16 hex digits, one per byte */
+static inline __m128i gdb_hex_nibbles(__m128i c)
+{
+	__m128i nine;
+
+	/* letters have bit 6 set and their low nibble is 1-6 */
+	nine = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('9')),
+			     _mm_set1_epi8(9));
+	return _mm_add_epi8(_mm_and_si128(c, _mm_set1_epi8(0x0f)), nine);
+}
+
+/* pairs of nibbles, high one first, to bytes in the low half of each word */
+static inline __m128i gdb_hex_pack(__m128i v)
+{
+	v = _mm_or_si128(_mm_slli_epi16(v, 4), _mm_srli_epi16(v, 8));
+	return _mm_and_si128(v, _mm_set1_epi16(0xff));
+}
+
+/* decode 32 hex digits at a time, returns how many were done */
+static int gdb_hex2bin_sse2(char *buf, int len)
+{
+	__m128i a, b;
+	int i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		a = _mm_loadu_si128((__m128i *)(buf + i));
+		b = _mm_loadu_si128((__m128i *)(buf + i + 16));
+		if ((gdb_hex_mask(a) & gdb_hex_mask(b)) != 0xffff)
+			break;
+		a = gdb_hex_pack(gdb_hex_nibbles(a));
+		b = gdb_hex_pack(gdb_hex_nibbles(b));
+		_mm_storeu_si128((__m128i *)(buf + i / 2),
+				 _mm_packus_epi16(a, b));
+	}
+
+	return i;
+}
+#endif
+
+/*
+ * Decode a hex reply in place, returns the number of bytes.  Memory
+ * snapshots go through here by the megabyte, so the bulk is done with
+ * SSE2 where the host has it.
+ */
+int gdb_hex2bin(char *buf, int len)
+{
+	int i = 0, hi, lo;
+
+#ifdef __SSE2__
+	i = gdb_hex2bin_sse2(buf, len);
+#endif
+	for (; i + 1 < len; i += 2) {
+		hi = gdb_hex(buf[i]);
+		lo = gdb_hex(buf[i + 1]);
+		if (hi < 0 || lo < 0)
+			break;
+		buf[i / 2] = (hi << 4) | lo;
+	}
+
+	return i / 2;
+}
@@ -0,0 +1,546 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-mcache.c  cache of target memory that answers gdb's 'm'
+ *                       packets and is revalidated with qCRC after the
+ *                       target ran
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * The cache holds aligned lines that the proxy reads itself, so that a
+ * run of lines can be checked with one qCRC.  A line fits in the reply
+ * buffer of the stub on ARM.
+ */
+#define MCACHE_LINE	256
+#define MCACHE_LINES	4096
+#define MCACHE_HASH	1024
+#define MCACHE_REGION	0x10000		/* checked with one qCRC at most */
+#define MCACHE_MAXREAD	4096		/* larger reads go to the target */
+#define MCACHE_TIMEOUT	5
+
+enum {
+	MCACHE_FREE,
+	MCACHE_VALID,
+	MCACHE_STALE,		/* the target ran since it was read */
+};
+
+struct mcache_line {
+	unsigned long addr;
+	int state;
+	struct mcache_line *hnext;
+	unsigned char data[MCACHE_LINE];
+};
+
+struct mcache_stats {
+	unsigned long gdb_bytes;	/* read by gdb */
+	unsigned long hit_bytes;	/* of those, answered from the cache */
+	unsigned long crc_bytes;	/* revalidated instead of read */
+	unsigned long read_bytes;	/* read from the target */
+	int crcs;
+};
+
+int mcache_enabled;
+
+static struct mcache_line mcache_lines[MCACHE_LINES];
+static struct mcache_line *mcache_hash[MCACHE_HASH];
+static int mcache_next;
+static int mcache_no_crc;
+static int mcache_stop;
+static struct mcache_stats stats;
+static struct mcache_stats totals;	/* since the start, not reset */
+static unsigned int crc_table[256];
+
+/* gdb's packet being assembled */
+static char gdb_pkt[IO_BUFSIZE];
+static int gdb_pkt_len;
+
+/* the target's reply to the cache's own request, filled by the usb thread */
+static pthread_mutex_t reply_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reply_cond = PTHREAD_COND_INITIALIZER;
+static int reply_wait;
+static char reply[2 * IO_BUFSIZE];
+static int reply_len;
+static int reply_state;		/* 0 before '$', 1 in it, 2-3 checksum */
+
+static int mcache_hex(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* gdb's crc32: msb first, started from ~0 and not inverted at the end */
+static unsigned int mcache_crc32(unsigned int crc, const unsigned char *p,
+				 int len)
+{
+	unsigned int c;
+	int i, k;
+
+	if (!crc_table[1]) {
+		for (i = 0; i < 256; i++) {
+			c = i << 24;
+			for (k = 0; k < 8; k++)
+				c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 :
+				    c << 1;
+			crc_table[i] = c;
+		}
+	}
+
+	while (len--)
+		crc = (crc << 8) ^ crc_table[((crc >> 24) ^ *p++) & 0xff];
+
+	return crc;
+}
+
+static int mcache_frame(char *buf, const char *payload, int len)
+{
+	unsigned char csum = 0;
+	int i;
+
+	buf[0] = '$';
+	for (i = 0; i < len; i++) {
+		buf[i + 1] = payload[i];
+		csum += (unsigned char)payload[i];
+	}
+	sprintf(buf + len + 1, "#%02x", csum);
+
+	return len + 4;
+}
+
+/*
+ * Called by the usb thread with what the target sent.  While the cache
+ * waits for a reply, the bytes up to its end are taken; returns how
+ * many, the rest goes on to gdb.
+ */
+int mcache_target_data(char *buf, int len)
+{
+	static unsigned char csum;
+	static int sum;
+	int i, c;
+
+	pthread_mutex_lock(&reply_lock);
+	if (!reply_wait) {
+		pthread_mutex_unlock(&reply_lock);
+		return 0;
+	}
+
+	for (i = 0; i < len && reply_wait; i++) {
+		c = (unsigned char)buf[i];
+		switch (reply_state) {
+		case 0:
+			if (c == '$') {
+				reply_state = 1;
+				reply_len = 0;
+				csum = 0;
+			}
+			break;
+		case 1:
+			if (c == '#') {
+				reply_state = 2;
+				break;
+			}
+			csum += c;
+			if (reply_len < sizeof(reply) - 1)
+				reply[reply_len++] = c;
+			break;
+		case 2:
+			sum = mcache_hex(c) << 4;
+			reply_state = 3;
+			break;
+		case 3:
+			sum |= mcache_hex(c);
+			reply[reply_len] = '\0';
+			if (sum != csum)
+				reply_len = -1;
+			reply_state = 0;
+			reply_wait = 0;
+			pthread_cond_signal(&reply_cond);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&reply_lock);
+
+	return i;
+}
+
+/*
+ * Send a request of the cache's own and wait for the reply, which the
+ * usb thread hands over.  The ack of the reply goes with the request,
+ * as in gdb_send_pipelined(), since nobody is there to send it.
+ */
+static int mcache_command(struct port_st *target, const char *cmd)
+{
+	char buf[128];
+	struct timespec ts;
+	int len, ret = 0;
+
+	len = mcache_frame(buf, cmd, strlen(cmd));
+	buf[len++] = '+';
+
+	pthread_mutex_lock(&reply_lock);
+	reply_wait = 1;
+	reply_state = 0;
+	reply_len = -1;
+	if (target->portwrite(target, buf, len, 0) != len) {
+		reply_wait = 0;
+		pthread_mutex_unlock(&reply_lock);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += MCACHE_TIMEOUT;
+	while (reply_wait && ret != ETIMEDOUT)
+		ret = pthread_cond_timedwait(&reply_cond, &reply_lock, &ts);
+	if (reply_wait) {
+		reply_wait = 0;
+		reply_len = -1;
+		printf("mcache: no reply to %s, cache disabled\n", cmd);
+		mcache_enabled = 0;
+	}
+	len = reply_len;
+	pthread_mutex_unlock(&reply_lock);
+
+	return len;
+}
+
+static struct mcache_line **mcache_slot(unsigned long addr)
+{
+	return &mcache_hash[(addr / MCACHE_LINE) % MCACHE_HASH];
+}
+
+static struct mcache_line *mcache_find(unsigned long addr)
+{
+	struct mcache_line *l;
+
+	for (l = *mcache_slot(addr); l; l = l->hnext)
+		if (l->addr == addr)
+			return l;
+	return NULL;
+}
+
+static void mcache_drop(struct mcache_line *l)
+{
+	struct mcache_line **p;
+
+	for (p = mcache_slot(l->addr); *p; p = &(*p)->hnext) {
+		if (*p == l) {
+			*p = l->hnext;
+			break;
+		}
+	}
+	l->state = MCACHE_FREE;
+}
+
+/* read the line at addr from the target, replacing the oldest one */
+static struct mcache_line *mcache_fill(struct port_st *target,
+				       unsigned long addr)
+{
+	struct mcache_line *l;
+	char cmd[32];
+
+	sprintf(cmd, "m%lx,%x", addr, MCACHE_LINE);
+	if (mcache_command(target, cmd) != 2 * MCACHE_LINE ||
+	    gdb_hex2bin(reply, 2 * MCACHE_LINE) != MCACHE_LINE)
+		return NULL;
+
+	l = &mcache_lines[mcache_next];
+	mcache_next = (mcache_next + 1) % MCACHE_LINES;
+	if (l->state != MCACHE_FREE)
+		mcache_drop(l);
+
+	memcpy(l->data, reply, MCACHE_LINE);
+	l->addr = addr;
+	l->state = MCACHE_VALID;
+	l->hnext = *mcache_slot(addr);
+	*mcache_slot(addr) = l;
+	stats.read_bytes += MCACHE_LINE;
+	totals.read_bytes += MCACHE_LINE;
+
+	return l;
+}
+
+/*
+ * Check n stale lines from addr with one qCRC.  Halves that differ are
+ * checked again until single lines are left, which are dropped to be
+ * read again when gdb asks for them.
+ */
+static void mcache_verify(struct port_st *target, unsigned long addr, int n)
+{
+	unsigned int crc = 0xffffffff, tcrc;
+	char cmd[48];
+	int i, len;
+
+	for (i = 0; i < n; i++)
+		crc = mcache_crc32(crc, mcache_find(addr + i * MCACHE_LINE)->data,
+				   MCACHE_LINE);
+
+	tcrc = ~crc;
+	if (!mcache_no_crc) {
+		sprintf(cmd, "qCRC:%lx,%x", addr, n * MCACHE_LINE);
+		len = mcache_command(target, cmd);
+		if (len > 0 && reply[0] == 'C')
+			tcrc = strtoul(reply + 1, NULL, 16);
+		else if (!len)
+			mcache_no_crc = 1;
+		stats.crcs++;
+	}
+
+	if (tcrc == crc) {
+		for (i = 0; i < n; i++)
+			mcache_find(addr + i * MCACHE_LINE)->state =
+			    MCACHE_VALID;
+		stats.crc_bytes += n * MCACHE_LINE;
+		totals.crc_bytes += n * MCACHE_LINE;
+	} else if (n > 1 && !mcache_no_crc) {
+		mcache_verify(target, addr, n / 2);
+		mcache_verify(target, addr + n / 2 * MCACHE_LINE, n - n / 2);
+	} else {
+		for (i = 0; i < n; i++)
+			mcache_drop(mcache_find(addr + i * MCACHE_LINE));
+	}
+}
+
+static int mcache_is_stale(unsigned long addr)
+{
+	struct mcache_line *l = mcache_find(addr);
+
+	return l && l->state == MCACHE_STALE;
+}
+
+/* revalidate the run of stale lines around l in MCACHE_REGION */
+static void mcache_revalidate(struct port_st *target, struct mcache_line *l)
+{
+	unsigned long region = l->addr & ~(MCACHE_REGION - 1UL);
+	unsigned long start = l->addr, end = l->addr + MCACHE_LINE;
+
+	while (start > region && mcache_is_stale(start - MCACHE_LINE))
+		start -= MCACHE_LINE;
+	while (end < region + MCACHE_REGION && mcache_is_stale(end))
+		end += MCACHE_LINE;
+
+	mcache_verify(target, start, (end - start) / MCACHE_LINE);
+}
+
+static struct mcache_line *mcache_get(struct port_st *target,
+				      unsigned long addr, int *hit)
+{
+	struct mcache_line *l = mcache_find(addr);
+
+	if (l && l->state == MCACHE_STALE) {
+		mcache_revalidate(target, l);
+		l = mcache_find(addr);
+	}
+	*hit = l != NULL;
+
+	return l ? l : mcache_fill(target, addr);
+}
+
+/* answer m<addr>,<len> from the cache, 0 if gdb has to ask the target */
+static int mcache_read(struct port_st *gdb, struct port_st *target,
+		       const char *args)
+{
+	static char hex[2 * MCACHE_MAXREAD + 8];
+	unsigned long addr, a, count;
+	struct mcache_line *l = NULL;
+	char *end;
+	int i, n = 0, hits = 0, hit = 0;
+
+	addr = strtoul(args, &end, 16);
+	if (*end != ',')
+		return 0;
+	count = strtoul(end + 1, &end, 16);
+	if (*end || !count || count > MCACHE_MAXREAD)
+		return 0;
+
+	hex[0] = '+';
+	for (a = addr; a < addr + count; a++) {
+		if (a == addr || !(a % MCACHE_LINE)) {
+			l = mcache_get(target, a - a % MCACHE_LINE, &hit);
+			if (!l)
+				return 0;
+		}
+		hits += hit;
+		i = l->data[a % MCACHE_LINE];
+		hex[2 + n++] = "0123456789abcdef"[i >> 4];
+		hex[2 + n++] = "0123456789abcdef"[i & 0xf];
+	}
+	n = mcache_frame(hex + 1, hex + 2, n) + 1;
+
+	stats.gdb_bytes += count;
+	stats.hit_bytes += hits;
+	totals.gdb_bytes += count;
+	totals.hit_bytes += hits;
+	return gdb->portwrite(gdb, hex, n, 0) == n;
+}
+
+static void mcache_invalidate(const char *args)
+{
+	unsigned long addr, count, a;
+	struct mcache_line *l;
+	char *end;
+
+	addr = strtoul(args, &end, 16);
+	if (*end != ',')
+		return;
+	count = strtoul(end + 1, NULL, 16);
+
+	for (a = addr - addr % MCACHE_LINE; a < addr + count; a += MCACHE_LINE) {
+		l = mcache_find(a);
+		if (l)
+			mcache_drop(l);
+	}
+}
+
+/* the target is resumed: report on the stop and mark everything stale */
+static void mcache_resume(void)
+{
+	int i;
+
+	if (stats.gdb_bytes)
+		printf("mcache: stop %d: gdb read %lu bytes, %lu from the "
+		       "cache, %lu revalidated with %d qCRC instead of read, "
+		       "%lu read from the target\n", mcache_stop,
+		       stats.gdb_bytes, stats.hit_bytes, stats.crc_bytes,
+		       stats.crcs, stats.read_bytes);
+	memset(&stats, 0, sizeof(stats));
+	mcache_stop++;
+
+	for (i = 0; i < MCACHE_LINES; i++)
+		if (mcache_lines[i].state == MCACHE_VALID)
+			mcache_lines[i].state = MCACHE_STALE;
+}
+
+/* the byte counts since the start, for the metrics port */
+void mcache_totals(unsigned long *gdb_bytes, unsigned long *hit_bytes,
+		   unsigned long *crc_bytes, unsigned long *read_bytes)
+{
+	*gdb_bytes = totals.gdb_bytes;
+	*hit_bytes = totals.hit_bytes;
+	*crc_bytes = totals.crc_bytes;
+	*read_bytes = totals.read_bytes;
+}
+
+/* returns 1 if the packet was answered here */
+static int mcache_packet(struct port_st *gdb, struct port_st *target,
+			 char *pkt, int len)
+{
+	unsigned char csum = 0;
+	int i;
+
+	for (i = 1; i < len - 3; i++)
+		csum += (unsigned char)pkt[i];
+	if (mcache_hex(pkt[len - 2]) != csum >> 4 ||
+	    mcache_hex(pkt[len - 1]) != (csum & 0xf))
+		return 0;
+
+	pkt[len - 3] = '\0';
+	switch (pkt[1]) {
+	case 'm':
+		i = mcache_read(gdb, target, pkt + 2);
+		break;
+	case 'M':
+	case 'X':
+		mcache_invalidate(pkt + 2);
+		i = 0;
+		break;
+	case 'c':
+	case 'C':
+	case 's':
+	case 'S':
+	case 'k':
+	case 'D':
+		mcache_resume();
+		i = 0;
+		break;
+	default:
+		if (!strncmp(pkt + 1, "vCont;", 6))
+			mcache_resume();
+		i = 0;
+	}
+	pkt[len - 3] = '#';
+
+	return i;
+}
+
+/*
+ * Filter what gdb sent to target.  Packets the cache answers are
+ * removed, the rest, with the acks, is left in buf in order; returns
+ * its length.  A packet split across reads is held back until its end
+ * arrives.
+ */
+int mcache_gdb_data(struct port_st *gdb, struct port_st *target, char *buf,
+		    int len)
+{
+	static int tail;	/* checksum chars still to come */
+	char out[IO_BUFSIZE];
+	int i, n = 0;
+
+	for (i = 0; i < len; i++) {
+		if (!gdb_pkt_len && buf[i] != '$') {
+			out[n++] = buf[i];
+			continue;
+		}
+		if (gdb_pkt_len == sizeof(gdb_pkt)) {
+			/* too long to be a read, pass it through */
+			target->portwrite(target, gdb_pkt, gdb_pkt_len, 0);
+			gdb_pkt_len = 0;
+		}
+		gdb_pkt[gdb_pkt_len++] = buf[i];
+		if (buf[i] == '#' && !tail)
+			tail = 3;
+		if (!tail || --tail)
+			continue;
+
+		if (mcache_enabled) {
+			/* keep the order of what goes to the target */
+			if (n)
+				target->portwrite(target, out, n, 0);
+			n = 0;
+			if (mcache_packet(gdb, target, gdb_pkt, gdb_pkt_len)) {
+				gdb_pkt_len = 0;
+				continue;
+			}
+		}
+		memcpy(out + n, gdb_pkt, gdb_pkt_len);
+		n += gdb_pkt_len;
+		gdb_pkt_len = 0;
+		if (n > sizeof(out) - sizeof(gdb_pkt)) {
+			target->portwrite(target, out, n, 0);
+			n = 0;
+		}
+	}
+
+	memcpy(buf, out, n);
+	return n;
+}
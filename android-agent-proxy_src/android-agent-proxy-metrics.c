@@ -0,0 +1,252 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-metrics.c  counters of the proxy for Prometheus
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libusb-1.0/libusb.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * The forwarding paths only add to struct metrics, with atomic adds
+ * and no lock, and the listener thread reads the words as they are.  A
+ * scrape can see one counter of a pair updated and not the other yet,
+ * never a torn value.  Any request on the port, an HTTP GET of any
+ * path or just a connection, gets the counters in the text format of
+ * Prometheus.  The port is on the loopback address unless another one
+ * is given, as the counters are no one else's business.
+ */
+#define METRICS_GAUGES	8
+#define METRICS_TEXT	16384
+
+struct metrics metrics;
+int metrics_port;
+char *metrics_addr;
+
+static const char *metrics_roles[METRICS_ROLES] = {
+	"gdb", "console", "target"
+};
+static const char *metrics_dirs[2] = { "rx", "tx" };
+static const char *metrics_ops[METRICS_USB_OPS] = {
+	"read", "write", "control"
+};
+static const char *metrics_errors[METRICS_USB_ERRORS] = {
+	"timeout", "pipe", "overflow", "no_device", "other"
+};
+
+/* queue depths, read through the pointers of their owners */
+static struct {
+	const char *name;
+	const int *val;
+} metrics_gauges[METRICS_GAUGES];
+static int metrics_ngauges;
+
+static int metrics_sock = -1;
+static pthread_t metrics_thread;
+static char metrics_text[METRICS_TEXT];
+static int metrics_len;
+
+/* Count a libusb error of a transfer, printed or not */
+void metrics_usb_error(int op, int r)
+{
+	int type;
+
+	switch (r) {
+	case LIBUSB_ERROR_TIMEOUT:
+		type = 0;
+		break;
+	case LIBUSB_ERROR_PIPE:
+		type = 1;
+		break;
+	case LIBUSB_ERROR_OVERFLOW:
+		type = 2;
+		break;
+	case LIBUSB_ERROR_NO_DEVICE:
+		type = 3;
+		if (op == METRICS_USB_READ)
+			METRIC_ADD(metrics.usb_detached, 1);
+		break;
+	default:
+		type = 4;
+		break;
+	}
+	METRIC_ADD(metrics.usb_errors[op][type], 1);
+}
+
+/* Export the int at val as the depth of the queue name; set up only */
+void metrics_gauge(const char *name, const int *val)
+{
+	if (metrics_ngauges < METRICS_GAUGES) {
+		metrics_gauges[metrics_ngauges].name = name;
+		metrics_gauges[metrics_ngauges].val = val;
+		metrics_ngauges++;
+	}
+}
+
+static void metrics_printf(const char *fmt, ...)
+	__attribute__ ((format(printf, 1, 2)));
+
+static void metrics_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int n, room = sizeof(metrics_text) - metrics_len;
+
+	va_start(ap, fmt);
+	n = vsnprintf(metrics_text + metrics_len, room, fmt, ap);
+	va_end(ap);
+	metrics_len += n < room ? n : room - 1;
+}
+
+static void metrics_head(const char *name, const char *type,
+			 const char *help)
+{
+	metrics_printf("# HELP agent_proxy_%s %s\n", name, help);
+	metrics_printf("# TYPE agent_proxy_%s %s\n", name, type);
+}
+
+static void metrics_format(void)
+{
+	unsigned long gdb, hit, crc, rd;
+	int i, j;
+
+	metrics_len = 0;
+	metrics_head("bytes_total", "counter",
+		     "Bytes read (rx) and written (tx) per port.");
+	for (i = 0; i < METRICS_ROLES; i++)
+		for (j = 0; j < 2; j++)
+			metrics_printf("agent_proxy_bytes_total{port=\"%s\","
+				       "dir=\"%s\"} %lu\n", metrics_roles[i],
+				       metrics_dirs[j], metrics.bytes[i][j]);
+	metrics_head("transfers_total", "counter",
+		     "Reads and writes with data per port.");
+	for (i = 0; i < METRICS_ROLES; i++)
+		for (j = 0; j < 2; j++)
+			metrics_printf("agent_proxy_transfers_total{port=\"%s\","
+				       "dir=\"%s\"} %lu\n", metrics_roles[i],
+				       metrics_dirs[j], metrics.transfers[i][j]);
+	metrics_head("clients", "gauge", "Clients connected per port.");
+	for (i = 0; i < METRICS_TARGET; i++)
+		metrics_printf("agent_proxy_clients{port=\"%s\"} %ld\n",
+			       metrics_roles[i], metrics.clients[i]);
+
+	metrics_head("usb_errors_total", "counter",
+		     "libusb errors per transfer and type; read timeouts "
+		     "are the idle polls.");
+	for (i = 0; i < METRICS_USB_OPS; i++)
+		for (j = 0; j < METRICS_USB_ERRORS; j++)
+			metrics_printf("agent_proxy_usb_errors_total{op=\"%s\","
+				       "type=\"%s\"} %lu\n", metrics_ops[i],
+				       metrics_errors[j],
+				       metrics.usb_errors[i][j]);
+	metrics_head("usb_reconnects_total", "counter",
+		     "Times the usb target was opened again after an error.");
+	metrics_printf("agent_proxy_usb_reconnects_total %lu\n",
+		       metrics.usb_reconnects);
+	metrics_head("usb_device_events_total", "counter",
+		     "The kgdb gadget found on the bus, or gone from it.");
+	metrics_printf("agent_proxy_usb_device_events_total{event=\"attached\"}"
+		       " %lu\n", metrics.usb_attached);
+	metrics_printf("agent_proxy_usb_device_events_total{event=\"detached\"}"
+		       " %lu\n", metrics.usb_detached);
+
+	metrics_head("queue_depth", "gauge", "Bytes held in the proxy.");
+	for (i = 0; i < metrics_ngauges; i++)
+		metrics_printf("agent_proxy_queue_depth{queue=\"%s\"} %d\n",
+			       metrics_gauges[i].name,
+			       *(const volatile int *)metrics_gauges[i].val);
+
+	if (mcache_enabled) {
+		mcache_totals(&gdb, &hit, &crc, &rd);
+		metrics_head("mcache_bytes_total", "counter",
+			     "Memory read by gdb, answered from the cache, "
+			     "revalidated with qCRC and read from the target.");
+		metrics_printf("agent_proxy_mcache_bytes_total{kind=\"gdb\"} "
+			       "%lu\n", gdb);
+		metrics_printf("agent_proxy_mcache_bytes_total{kind=\"hit\"} "
+			       "%lu\n", hit);
+		metrics_printf("agent_proxy_mcache_bytes_total{kind=\"crc\"} "
+			       "%lu\n", crc);
+		metrics_printf("agent_proxy_mcache_bytes_total{kind=\"read\"} "
+			       "%lu\n", rd);
+		metrics_head("mcache_hit_ratio", "gauge",
+			     "Of the bytes read by gdb, those from the cache.");
+		metrics_printf("agent_proxy_mcache_hit_ratio %g\n",
+			       gdb ? (double)hit / gdb : 0.0);
+	}
+}
+
+static void metrics_serve(int fd)
+{
+	static const char hdr[] = "HTTP/1.0 200 OK\r\n"
+	    "Content-Type: text/plain; version=0.0.4\r\n\r\n";
+	struct timeval tv = { 0, 200000 };
+	char req[1024];
+
+	/* the request itself does not matter, nc sends none */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv));
+	if (recv(fd, req, sizeof(req), 0) > 0 && strncmp(req, "GET ", 4) &&
+	    strncmp(req, "HEAD ", 5)) {
+		close(fd);
+		return;
+	}
+	metrics_format();
+	if (send(fd, hdr, sizeof(hdr) - 1, MSG_NOSIGNAL) > 0)
+		send(fd, metrics_text, metrics_len, MSG_NOSIGNAL);
+	close(fd);
+}
+
+static void *metrics_thread_main(void *arg)
+{
+	int fd;
+
+	for (;;) {
+		fd = accept(metrics_sock, NULL, NULL);
+		if (fd < 0)
+			continue;
+		metrics_serve(fd);
+	}
+
+	return NULL;
+}
+
+/* Serve the counters on metrics_addr:metrics_port */
+int metrics_start(void)
+{
+	metrics_sock = listen_socket("metrics", metrics_addr, metrics_port, 4);
+	if (metrics_sock < 0) {
+		metrics_port = 0;
+		return 1;
+	}
+
+	return pthread_create(&metrics_thread, NULL, metrics_thread_main,
+			      NULL);
+}
@@ -0,0 +1,230 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-oops.c  decode oops, BUG and WARN blocks of the console
+ *                     with the symbols and lines of vmlinux
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * The console text goes to the clients as it comes.  A copy of it is
+ * split into lines here, and the lines of a block starting with one of
+ * oops_begin are kept, each followed by the symbol and line of every
+ * [<address>] in it.  When the block ends the decoded copy is handed
+ * back to be sent after the console text, so lines outside a block only
+ * cost the check of their start.
+ *
+ * A block ends with one of oops_end, or for a BUG or dump_stack() that
+ * has none, with the first line after its backtrace that is not part of
+ * it.  That line is then looked at as the start of a new block.
+ */
+#define OOPS_LINE	512
+#define OOPS_BLOCK	65536
+#define OOPS_MAX_LINES	256
+
+int oops_decode;
+
+static const char *oops_begin[] = {
+	"Unable to handle kernel",
+	"Internal error:",
+	"Oops",
+	"kernel BUG at",
+	"BUG: ",
+	"WARNING: at",
+	"------------[ cut here ]------------",
+	NULL
+};
+
+static const char *oops_end[] = {
+	"---[ end trace",
+	"Kernel panic - not syncing",
+	NULL
+};
+
+static char oops_line[OOPS_LINE];
+static int oops_len;
+static int oops_lines;		/* of the block, 0 outside one */
+static int oops_frames;		/* the block's backtrace has started */
+static char oops_block[OOPS_BLOCK];
+static int oops_block_len;
+static char oops_out[OOPS_BLOCK];
+static int oops_out_len;
+static unsigned long oops_blocks;
+
+static void oops_emit(const char *fmt, ...)
+{
+	va_list ap;
+	int n, room = sizeof(oops_block) - oops_block_len;
+
+	va_start(ap, fmt);
+	n = vsnprintf(oops_block + oops_block_len, room, fmt, ap);
+	va_end(ap);
+	oops_block_len += n < room ? n : room - 1;
+}
+
+/* the text after the "<4>" level and "[   12.345678] " time */
+static const char *oops_text(const char *s)
+{
+	if (s[0] == '<' && s[1] && s[2] == '>')
+		s += 3;
+	if (*s == '[') {
+		const char *e = strchr(s, ']');
+
+		if (e && e - s < 20 && strspn(s + 1, " .0123456789") == e - s - 1)
+			s = e + 1 + (e[1] == ' ');
+	}
+	return s;
+}
+
+static int oops_match(const char *s, const char **marks)
+{
+	for (; *marks; marks++)
+		if (!strncmp(s, *marks, strlen(*marks)))
+			return 1;
+	return 0;
+}
+
+/* "[<c0123456>] (func+0x..." or " [<c0123456>] func+0x..." */
+static int oops_frame(const char *t)
+{
+	t += strspn(t, " \t");
+	return !strncmp(t, "[<", 2) || !strncmp(t, "Function entered at", 19);
+}
+
+/* the lines that can follow the frames of a backtrace */
+static int oops_trailer(const char *t)
+{
+	int n;
+
+	if (*t == ' ' || *t == '\t' || strstr(t, "[<") ||
+	    !strncmp(t, "Code:", 5) || !strncmp(t, "Exception stack", 15) ||
+	    !strncmp(t, "---[", 4))
+		return 1;
+	/* the stack dump of an exception, "1f80: 00000000 ..." */
+	n = strspn(t, "0123456789abcdef");
+	return n && t[n] == ':';
+}
+
+/*
+ * The line, then every [<address>] in it with its symbol and line.  An
+ * address after "from " is a return address, its line is looked up one
+ * byte back to get the call rather than the next statement.
+ */
+static void oops_annotate(const char *line)
+{
+	const char *p, *name, *file;
+	unsigned long addr, off;
+	char *end;
+	int ln;
+
+	oops_emit("%s\n", line);
+	for (p = line; (p = strstr(p, "[<")) != NULL; p = end) {
+		addr = strtoul(p + 2, &end, 16);
+		if (end == p + 2 || strncmp(end, ">]", 2))
+			continue;
+		name = sym_lookup(addr, &off);
+		if (!name)
+			continue;
+		oops_emit("    %08lx %s+0x%lx", addr, name, off);
+		if (p - line >= 5 && !strncmp(p - 5, "from ", 5))
+			file = sym_line(addr - 1, &ln);
+		else
+			file = sym_line(addr, &ln);
+		if (file)
+			oops_emit(" %s:%d", file, ln);
+		oops_emit("\n");
+	}
+}
+
+static void oops_block_done(void)
+{
+	int n;
+
+	oops_emit("[agent-proxy] end of decoded block %lu\n", oops_blocks);
+	n = oops_block_len;
+	if (n > sizeof(oops_out) - oops_out_len)
+		n = sizeof(oops_out) - oops_out_len;
+	memcpy(oops_out + oops_out_len, oops_block, n);
+	oops_out_len += n;
+	oops_block_len = 0;
+	oops_lines = 0;
+	oops_frames = 0;
+}
+
+static void oops_line_done(void)
+{
+	const char *t = oops_text(oops_line);
+
+	if (oops_frames && !oops_trailer(t))
+		oops_block_done();
+	if (!oops_lines) {
+		if (!oops_match(t, oops_begin))
+			return;
+		oops_blocks++;
+		oops_emit("[agent-proxy] decoded block %lu\n", oops_blocks);
+	}
+	oops_annotate(oops_line);
+	if (oops_frame(t))
+		oops_frames = 1;
+	if (oops_match(t, oops_end) || ++oops_lines >= OOPS_MAX_LINES)
+		oops_block_done();
+}
+
+/*
+ * Feed the console text sent to the clients.  Returns the length of the
+ * decoded blocks completed by it, in *out, 0 if none.  They go after the
+ * first *at bytes of buf, the end of a line.
+ */
+int oops_feed(const char *buf, int len, const char **out, int *at)
+{
+	int i;
+
+	oops_out_len = 0;
+	*at = len;
+	for (i = 0; i < len; i++) {
+		if (buf[i] == '\n') {
+			oops_line[oops_len] = '\0';
+			oops_line_done();
+			oops_len = 0;
+			if (oops_out_len)
+				*at = i + 1;
+		} else if (buf[i] != '\r' && buf[i] != '\0' &&
+			   oops_len < sizeof(oops_line) - 1) {
+			oops_line[oops_len++] = buf[i];
+		}
+	}
+	*out = oops_out;
+	return oops_out_len;
+}
+
+int oops_start(const char *vmlinux)
+{
+	if (!vmlinux) {
+		fprintf(stderr, "Decoding oopses needs -V vmlinux\n");
+		return -1;
+	}
+	metrics_gauge("oops_block", &oops_block_len);
+	return sym_load(vmlinux);
+}
@@ -0,0 +1,228 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-peek.c  port for the target's live peek channel, memory
+ *                     reads and symbol lookups while the kernel runs
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * Clients send gdb packets, "$m<addr>,<len>#cs", "$qkgdb.sym:<name>#cs"
+ * or "$qkgdb.addr:<addr>#cs", and get gdb packets back.  To the target
+ * they go framed with '%', which the stub ignores, see f_kgdb.c.  A
+ * target stopped in kgdb does not answer and the client gets E01.
+ */
+#define PEEK_TIMEOUT_MS	500
+
+struct peek_stats {
+	int requests;
+	int timeouts;
+	long rtt_min;		/* usec */
+	long rtt_max;
+	long long rtt_total;
+};
+
+int peek_port;
+char *peek_addr;
+
+static struct port_st *peek_target;
+static int peek_sock = -1;
+static pthread_t peek_thread;
+
+/* the reply the usb thread hands over */
+static pthread_mutex_t reply_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reply_cond = PTHREAD_COND_INITIALIZER;
+static char reply[IO_BUFSIZE];
+static int reply_wait;
+static int reply_len;
+
+static struct peek_stats stats;
+
+/*
+ * Called by the usb thread for everything the target sends.  Returns
+ * how much of buf was a peek reply, a transfer of its own.
+ */
+int peek_target_data(char *buf, int len)
+{
+	if (!peek_port || len < 1 || buf[0] != '%')
+		return 0;
+
+	pthread_mutex_lock(&reply_lock);
+	if (reply_wait && len <= sizeof(reply)) {
+		memcpy(reply, buf, len);
+		reply_len = len;
+		reply_wait = 0;
+		pthread_cond_signal(&reply_cond);
+	}
+	pthread_mutex_unlock(&reply_lock);
+
+	return len;
+}
+
+static long peek_usec(struct timeval *a, struct timeval *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000000L + b->tv_usec - a->tv_usec;
+}
+
+/* forward cmd[0 .. len), '%' framed, and put the gdb packet to send in out */
+static int peek_request(char *cmd, int len, char *out)
+{
+	struct timeval start, end;
+	struct timespec ts;
+	unsigned char csum = 0;
+	int i, n, ret = 0;
+
+	out[0] = '%';
+	for (i = 0; i < len; i++) {
+		out[i + 1] = cmd[i];
+		csum += cmd[i];
+	}
+	n = len + 1 + sprintf(out + len + 1, "#%02x", csum);
+
+	gettimeofday(&start, NULL);
+	pthread_mutex_lock(&reply_lock);
+	reply_wait = 1;
+	reply_len = -1;
+	if (peek_target->portwrite(peek_target, out, n, 0) == n) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += PEEK_TIMEOUT_MS * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+		while (reply_wait && ret != ETIMEDOUT)
+			ret = pthread_cond_timedwait(&reply_cond, &reply_lock,
+						     &ts);
+	}
+	reply_wait = 0;
+	n = reply_len;
+	if (n > 0)
+		memcpy(out, reply, n);
+	pthread_mutex_unlock(&reply_lock);
+	gettimeofday(&end, NULL);
+
+	if (n <= 0) {
+		stats.timeouts++;
+		return sprintf(out, "$E01#a6");
+	}
+
+	/* the checksum covers the same data */
+	out[0] = '$';
+
+	stats.requests++;
+	i = peek_usec(&start, &end);
+	stats.rtt_total += i;
+	if (!stats.rtt_min || i < stats.rtt_min)
+		stats.rtt_min = i;
+	if (i > stats.rtt_max)
+		stats.rtt_max = i;
+
+	return n;
+}
+
+static void peek_print_stats(void)
+{
+	if (!stats.requests && !stats.timeouts)
+		return;
+
+	printf("peek: %d requests, rtt min/avg/max %.2f/%.2f/%.2f ms, "
+	       "%d timed out\n", stats.requests, stats.rtt_min / 1000.0,
+	       stats.requests ? stats.rtt_total / 1000.0 / stats.requests : 0,
+	       stats.rtt_max / 1000.0, stats.timeouts);
+}
+
+static void peek_serve(int fd)
+{
+	char buf[IO_BUFSIZE];
+	char out[IO_BUFSIZE + 8];
+	unsigned char csum;
+	char *start, *end, *p;
+	char cs[3] = "";
+	int have = 0, n;
+
+	memset(&stats, 0, sizeof(stats));
+
+	while ((n = recv(fd, buf + have, sizeof(buf) - have, 0)) > 0) {
+		have += n;
+		while ((start = memchr(buf, '$', have)) &&
+		       (end = memchr(start, '#', have - (start - buf))) &&
+		       end + 3 <= buf + have) {
+			for (csum = 0, p = start + 1; p < end; p++)
+				csum += *p;
+			cs[0] = end[1];
+			cs[1] = end[2];
+			if (strtoul(cs, NULL, 16) != csum) {
+				send(fd, "-", 1, 0);
+			} else {
+				out[0] = '+';
+				n = peek_request(start + 1, end - start - 1,
+						 out + 1);
+				send(fd, out, n + 1, 0);
+			}
+			have -= end + 3 - buf;
+			memmove(buf, end + 3, have);
+		}
+		/* acks, or a packet too long to ever be complete */
+		if (!memchr(buf, '$', have) || have == sizeof(buf))
+			have = 0;
+	}
+
+	peek_print_stats();
+}
+
+static void *peek_thread_main(void *arg)
+{
+	int fd;
+
+	for (;;) {
+		fd = accept(peek_sock, NULL, NULL);
+		if (fd < 0)
+			continue;
+		if (debug)
+			printf("peek: client connected\n");
+		peek_serve(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* serve the live peek channel of the usb target on peek_addr:peek_port */
+int peek_start(struct port_st *target)
+{
+	peek_target = target;
+	peek_sock = listen_socket("peek channel", peek_addr, peek_port, 1);
+	if (peek_sock < 0) {
+		peek_port = 0;
+		return 1;
+	}
+
+	return pthread_create(&peek_thread, NULL, peek_thread_main, NULL);
+}
@@ -0,0 +1,340 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-prof.c  statistical profiler that samples the target
+ *                     through the kgdb break path
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * Each sample is one stop of the target:
+ *
+ *   sampling break on ep0 -> stop reply
+ *   "+$qkgdb.sample#.."  -> the pc, lr and task of every cpu
+ *   "+$c#63"             -> running again
+ *
+ * The samples are taken by the break request's interrupt and its IPIs,
+ * asked for with KGDB_BREAK_SAMPLE, see kgdb_function_setup(), so they
+ * show where the kernel was and not the debugger.  The acks ride in front of the next packet.
+ */
+#define PROF_HASH	4096
+#define PROF_TOP	20
+
+struct prof_stack {
+	char *name;		/* the folded stack */
+	char *pc;		/* the function the pc was in */
+	unsigned long count;
+	struct prof_stack *next;
+};
+
+struct prof_cost {
+	unsigned long n;
+	double total;		/* ms */
+	double max;
+};
+
+/* -r, shared with the sampler; 0 gives each its default */
+int prof_hz;
+
+static struct prof_stack *prof_hash[PROF_HASH];
+static unsigned long prof_stacks;
+static unsigned long prof_samples;
+static struct prof_cost prof_break;	/* break request to stop reply */
+static struct prof_cost prof_stop;	/* break request to resume */
+static volatile sig_atomic_t prof_done;
+
+static char reply[IO_BUFSIZE];
+
+static double prof_ms(struct timeval *a, struct timeval *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000.0 +
+	    (b->tv_usec - a->tv_usec) / 1000.0;
+}
+
+static void prof_cost_add(struct prof_cost *c, double ms)
+{
+	c->n++;
+	c->total += ms;
+	if (ms > c->max)
+		c->max = ms;
+}
+
+static unsigned int prof_hash_str(const char *s)
+{
+	unsigned int h = 5381;
+
+	while (*s)
+		h = h * 33 + (unsigned char)*s++;
+	return h % PROF_HASH;
+}
+
+static void prof_add(const char *stack, const char *pc)
+{
+	struct prof_stack **slot = &prof_hash[prof_hash_str(stack)];
+	struct prof_stack *p;
+
+	for (p = *slot; p; p = p->next) {
+		if (!strcmp(p->name, stack)) {
+			p->count++;
+			return;
+		}
+	}
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		return;
+	p->name = strdup(stack);
+	p->pc = strdup(pc);
+	p->count = 1;
+	p->next = *slot;
+	*slot = p;
+	prof_stacks++;
+}
+
+/* "name" or "name+0xoff" without the offset, or the address */
+static void prof_symbol(unsigned long addr, char *buf, int len)
+{
+	unsigned long off;
+	const char *name = sym_lookup(addr, &off);
+
+	if (name)
+		snprintf(buf, len, "%s", name);
+	else
+		snprintf(buf, len, "0x%08lx", addr);
+}
+
+/* "<cpu>:<pc>,<lr>,<pid>,<user>,<hex comm>;..." */
+static void prof_parse(char *s)
+{
+	char comm[17], stack[256], pc_sym[96], lr_sym[96];
+	unsigned long pc, lr;
+	unsigned int cpu, pid;
+	int user, i, n;
+	char *hex;
+
+	for (; s && *s; s = strchr(s, ';') ? strchr(s, ';') + 1 : NULL) {
+		if (sscanf(s, "%x:%lx,%lx,%x,%d,%n", &cpu, &pc, &lr, &pid,
+			   &user, &n) != 5)
+			continue;
+		hex = s + n;
+		for (i = 0; i < 16 && sscanf(hex + 2 * i, "%2hhx",
+					     (unsigned char *)&comm[i]) == 1;
+		     i++)
+			;
+		comm[i] = '\0';
+		if (!pid)
+			strcpy(comm, "swapper");
+
+		prof_samples++;
+		if (user) {
+			snprintf(stack, sizeof(stack), "%s;[user]", comm);
+			prof_add(stack, "[user]");
+			continue;
+		}
+
+		/* lr is a caller only when it is outside the pc's function */
+		prof_symbol(pc, pc_sym, sizeof(pc_sym));
+		prof_symbol(lr, lr_sym, sizeof(lr_sym));
+		if (strcmp(pc_sym, lr_sym) && strncmp(lr_sym, "0x", 2))
+			snprintf(stack, sizeof(stack), "%s;%s;%s", comm,
+				 lr_sym, pc_sym);
+		else
+			snprintf(stack, sizeof(stack), "%s;%s", comm, pc_sym);
+		prof_add(stack, pc_sym);
+	}
+}
+
+/* interrupt the target and wait for it to stop */
+static int prof_interrupt(struct port_st *port)
+{
+	char query[] = "$?#3f";
+
+	if (usb_send_sample_break(port))
+		return -1;
+	if (gdb_recv(port, reply, sizeof(reply)) > 0)
+		return 0;
+
+	/* a stub that gdb never talked to stops without a word */
+	if (port->portwrite(port, query, strlen(query), 0) != strlen(query))
+		return -1;
+	return gdb_recv(port, reply, sizeof(reply)) > 0 ? 0 : -1;
+}
+
+static int prof_sample(struct port_st *port)
+{
+	struct timeval start, stopped, resumed;
+	char sample[32], cont[] = "+$c#63";
+	int len;
+
+	gettimeofday(&start, NULL);
+	if (prof_interrupt(port)) {
+		fprintf(stderr, "The target did not stop\n");
+		return -1;
+	}
+	gettimeofday(&stopped, NULL);
+
+	sample[0] = '+';
+	len = 1 + gdb_frame(sample + 1, "qkgdb.sample");
+	if (port->portwrite(port, sample, len, 0) != len)
+		return -1;
+	len = gdb_recv(port, reply, sizeof(reply));
+	if (port->portwrite(port, cont, strlen(cont), 0) != strlen(cont))
+		return -1;
+	gettimeofday(&resumed, NULL);
+
+	prof_cost_add(&prof_break, prof_ms(&start, &stopped));
+	prof_cost_add(&prof_stop, prof_ms(&start, &resumed));
+
+	if (len <= 0 || reply[0] == 'E') {
+		fprintf(stderr, "The target has no qkgdb.sample query\n");
+		return -1;
+	}
+	prof_parse(reply);
+
+	return 0;
+}
+
+static int prof_cmp(const void *a, const void *b)
+{
+	const struct prof_stack *x = *(struct prof_stack **)a;
+	const struct prof_stack *y = *(struct prof_stack **)b;
+
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+/* the folded stacks, most frequent first, and the flat profile */
+static int prof_report(const char *path, double secs)
+{
+	struct prof_stack **all, *p;
+	unsigned long i, j, n = 0, nflat = 0;
+	FILE *fp;
+
+	all = malloc((prof_stacks + 1) * sizeof(*all));
+	if (!all)
+		return 1;
+	for (i = 0; i < PROF_HASH; i++)
+		for (p = prof_hash[i]; p; p = p->next)
+			all[n++] = p;
+	qsort(all, n, sizeof(*all), prof_cmp);
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "ERROR: Could not open %s\n", path);
+		free(all);
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s %lu\n", all[i]->name, all[i]->count);
+	fclose(fp);
+
+	/* merge the stacks by the function of the pc, in place */
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < nflat; j++) {
+			if (!strcmp(all[j]->pc, all[i]->pc)) {
+				all[j]->count += all[i]->count;
+				break;
+			}
+		}
+		if (j == nflat)
+			all[nflat++] = all[i];
+	}
+	qsort(all, nflat, sizeof(*all), prof_cmp);
+
+	printf("%lu samples in %.1fs (%.1f/s), %lu stacks written to %s\n",
+	       prof_samples, secs, secs > 0 ? prof_stop.n / secs : 0.0,
+	       n, path);
+	for (i = 0; i < nflat && i < PROF_TOP; i++)
+		printf("%6.2f%%  %s\n", 100.0 * all[i]->count / prof_samples,
+		       all[i]->pc);
+
+	if (prof_stop.n) {
+		printf("stop cost per sample: %.3f ms avg, %.3f ms max "
+		       "(break latency %.3f ms avg, %.3f ms max)\n",
+		       prof_stop.total / prof_stop.n, prof_stop.max,
+		       prof_break.total / prof_break.n, prof_break.max);
+		printf("the target was stopped for about %.2f%% of the run\n",
+		       secs > 0 ? prof_stop.total / 10.0 / secs : 0.0);
+	}
+
+	free(all);
+	return 0;
+}
+
+static void prof_sigint(int sig)
+{
+	prof_done = 1;
+}
+
+/*
+ * Sample the target prof_hz times a second until interrupted and write
+ * the folded stacks, the input of flamegraph.pl, to path.
+ */
+int prof_run(struct port_st *port, const char *vmlinux, const char *path)
+{
+	struct timeval start, end;
+	struct timespec next;
+	long period;
+
+#ifdef FEATURE_PORT_USB
+	if (port->type != PORT_USB)
+#endif
+	{
+		fprintf(stderr, "The profiler needs a usb target\n");
+		return 1;
+	}
+	if (!prof_hz)
+		prof_hz = 100;
+	if (prof_hz < 0 || prof_hz > 10000) {
+		fprintf(stderr, "Bad sample rate %d\n", prof_hz);
+		return 1;
+	}
+	if (vmlinux && sym_load(vmlinux))
+		return 1;
+	if (gdb_port_open(port))
+		return 1;
+
+	signal(SIGINT, prof_sigint);
+	printf("Sampling at %d Hz, ^C to stop\n", prof_hz);
+
+	period = 1000000000L / prof_hz;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	gettimeofday(&start, NULL);
+	while (!prof_done) {
+		if (prof_sample(port))
+			break;
+
+		next.tv_nsec += period;
+		next.tv_sec += next.tv_nsec / 1000000000L;
+		next.tv_nsec %= 1000000000L;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	gettimeofday(&end, NULL);
+
+	return prof_report(path, prof_ms(&start, &end) / 1000.0);
+}
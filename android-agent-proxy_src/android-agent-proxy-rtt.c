@@ -0,0 +1,395 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-rtt.c  round trip times of gdb packets per packet type
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * A request is timed from the write of its '#' to the target to the
+ * '#' of the reply, gdb having one packet outstanding at a time.  The
+ * times go to a histogram per target and first letter of the request,
+ * with 32 buckets per power of two, from 1 us up to 2^32 us.  That is
+ * within about 3% of the actual value, HDR histogram style, at a fixed
+ * 3.5 KB a histogram.
+ *
+ * The replies of a usb target come from the poll thread.  Targets are
+ * only added by the main thread, and a request's time is set before
+ * its letter, which the reply side clears.  A histogram is published
+ * with its first time counted, and the dump skips empty ones anyway.
+ */
+#define RTT_SUB_BITS	5
+#define RTT_SUB		(1 << RTT_SUB_BITS)
+#define RTT_BUCKETS	(RTT_SUB + (32 - RTT_SUB_BITS) * RTT_SUB)
+#define RTT_TARGETS	8
+#define RTT_COST_EVERY	256	/* 1 of these calls times itself */
+
+struct rtt_hist {
+	unsigned int bucket[RTT_BUCKETS];
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long min, max;
+};
+
+/* the packet framing of one direction */
+struct rtt_parse {
+	int state;		/* 0 out of a packet, 1 in, 2 and 3 checksum */
+	int first;		/* the first characters of the packet */
+	int second;
+	int len;
+};
+
+struct rtt_target {
+	struct port_st *port;
+	char name[NAMESIZE];
+	struct rtt_parse req, reply;
+	volatile int pending;	/* letter of the outstanding request, or 0 */
+	struct timespec sent;
+	struct rtt_hist *hist[128];
+};
+
+int rtt_enabled;
+
+static volatile sig_atomic_t rtt_dump_pending;
+
+static struct rtt_target rtt_targets[RTT_TARGETS];
+static int rtt_ntargets;
+/* each side is timed by its own thread */
+static unsigned long rtt_req_calls, rtt_reply_calls;
+static unsigned long rtt_req_ns, rtt_req_timed;
+static unsigned long rtt_reply_ns, rtt_reply_timed;
+
+static int rtt_bucket(unsigned long us)
+{
+	int m;
+
+	if (us < RTT_SUB)
+		return us;
+	m = 31 - __builtin_clz(us);
+	return RTT_SUB + (m - RTT_SUB_BITS) * RTT_SUB +
+	    (us >> (m - RTT_SUB_BITS)) - RTT_SUB;
+}
+
+/* the highest value counted in bucket b */
+static unsigned long rtt_bucket_max(int b)
+{
+	int m, sub;
+
+	if (b < RTT_SUB)
+		return b;
+	m = (b - RTT_SUB) / RTT_SUB + RTT_SUB_BITS;
+	sub = (b - RTT_SUB) % RTT_SUB;
+	return ((unsigned long)(RTT_SUB + sub) << (m - RTT_SUB_BITS)) +
+	    (1UL << (m - RTT_SUB_BITS)) - 1;
+}
+
+static void rtt_add(struct rtt_hist *h, unsigned long us)
+{
+	if (us > 0xffffffffUL)
+		us = 0xffffffffUL;
+	h->bucket[rtt_bucket(us)]++;
+	if (!h->count || us < h->min)
+		h->min = us;
+	if (us > h->max)
+		h->max = us;
+	h->count++;
+	h->sum += us;
+}
+
+/* the value at or below which pct percent of the counts are */
+static unsigned long rtt_percentile(const struct rtt_hist *h, double pct)
+{
+	unsigned long long want = (unsigned long long)(h->count * pct / 100.0);
+	unsigned long long seen = 0;
+	int b;
+
+	if (want < 1)
+		want = 1;
+	for (b = 0; b < RTT_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen >= want)
+			return rtt_bucket_max(b) < h->max ?
+			    rtt_bucket_max(b) : h->max;
+	}
+	return h->max;
+}
+
+static struct rtt_target *rtt_target(struct port_st *port, int add)
+{
+	struct rtt_target *t;
+	int i, n = rtt_ntargets;
+
+	for (i = 0; i < n; i++)
+		if (rtt_targets[i].port == port)
+			return &rtt_targets[i];
+	if (!add || n == RTT_TARGETS)
+		return NULL;
+	t = &rtt_targets[n];
+	t->port = port;
+	snprintf(t->name, sizeof(t->name), "%s",
+		 port->name[0] ? port->name : "target");
+	__sync_synchronize();
+	rtt_ntargets = n + 1;
+	return t;
+}
+
+/*
+ * Feed one direction.  Returns the first character of the last packet
+ * completed in buf, 0 if none; for a reply "$O<hex>" of the console it
+ * is 0 as well.
+ */
+static int rtt_parse(struct rtt_parse *p, const char *buf, int len)
+{
+	int i, done = 0;
+
+	for (i = 0; i < len; i++) {
+		switch (p->state) {
+		case 0:
+			if (buf[i] == '$') {
+				p->state = 1;
+				p->len = 0;
+			}
+			break;
+		case 1:
+			if (buf[i] == '#') {
+				p->state = 2;
+				break;
+			}
+			if (p->len == 0)
+				p->first = (unsigned char)buf[i];
+			else if (p->len == 1)
+				p->second = (unsigned char)buf[i];
+			p->len++;
+			break;
+		case 2:
+			p->state = 3;
+			break;
+		case 3:
+			p->state = 0;
+			if (!p->len)
+				done = '$';	/* an empty reply */
+			else if (p->first == 'O' && p->len > 1 &&
+				 p->second != 'K')
+				done = 0;
+			else
+				done = p->first & 0x7f;
+			break;
+		}
+	}
+	return done;
+}
+
+static void rtt_cost(const struct timespec *start, unsigned long *ns,
+		     unsigned long *timed)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*ns += (end.tv_sec - start->tv_sec) * 1000000000L +
+	    end.tv_nsec - start->tv_nsec;
+	(*timed)++;
+}
+
+/* gdb's data, about to be written to the target */
+void rtt_request(struct port_st *target, const char *buf, int len)
+{
+	struct timespec start;
+	struct rtt_target *t;
+	int letter, timed;
+
+	timed = !(++rtt_req_calls % RTT_COST_EVERY);
+	if (timed)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	t = rtt_target(target, 1);
+	if (!t)
+		return;
+	letter = rtt_parse(&t->req, buf, len);
+	if (letter) {
+		clock_gettime(CLOCK_MONOTONIC, &t->sent);
+		__sync_synchronize();
+		t->pending = letter;
+	}
+	if (timed)
+		rtt_cost(&start, &rtt_req_ns, &rtt_req_timed);
+}
+
+/* the target's data, before it goes to gdb */
+void rtt_reply(struct port_st *target, const char *buf, int len)
+{
+	struct timespec start, now;
+	struct rtt_target *t;
+	struct rtt_hist *h;
+	unsigned long us;
+	int timed, letter;
+
+	timed = !(++rtt_reply_calls % RTT_COST_EVERY);
+	if (timed)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	t = rtt_target(target, 0);
+	if (!t)
+		return;
+	if (!rtt_parse(&t->reply, buf, len))
+		goto out;
+	letter = t->pending;
+	if (!letter)
+		goto out;
+	__sync_synchronize();
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - t->sent.tv_sec) * 1000000L +
+	    (now.tv_nsec - t->sent.tv_nsec) / 1000;
+	h = t->hist[letter];
+	if (h) {
+		rtt_add(h, us);
+	} else {
+		h = calloc(1, sizeof(*h));
+		if (h) {
+			rtt_add(h, us);
+			__sync_synchronize();
+			t->hist[letter] = h;
+		}
+	}
+	t->pending = 0;
+out:
+	if (timed)
+		rtt_cost(&start, &rtt_reply_ns, &rtt_reply_timed);
+}
+
+static void rtt_sigusr1(int sig)
+{
+	rtt_dump_pending = 1;
+}
+
+/* Print the percentiles of every histogram, if SIGUSR1 came */
+void rtt_poll(void)
+{
+	const struct rtt_hist *h;
+	struct rtt_target *t;
+	unsigned long count;
+	int i, c;
+
+	if (!rtt_dump_pending)
+		return;
+	rtt_dump_pending = 0;
+	for (i = 0; i < rtt_ntargets; i++) {
+		t = &rtt_targets[i];
+		printf("round trip of gdb packets to %s, usecs\n", t->name);
+		printf("pkt     count      min      p50      p90      p99"
+		       "    p99.9      max     mean\n");
+		for (c = 0; c < 128; c++) {
+			h = t->hist[c];
+			if (!h)
+				continue;
+			count = h->count;
+			if (!count)
+				continue;
+			printf("%c  %10lu %8lu %8lu %8lu %8lu %8lu %8lu %8llu\n",
+			       c, count, h->min, rtt_percentile(h, 50),
+			       rtt_percentile(h, 90), rtt_percentile(h, 99),
+			       rtt_percentile(h, 99.9), h->max,
+			       h->sum / count);
+		}
+	}
+	if (rtt_req_timed && rtt_reply_timed)
+		printf("bookkeeping: %lu ns a request, %lu ns a reply, "
+		       "timed on 1 in %d\n", rtt_req_ns / rtt_req_timed,
+		       rtt_reply_ns / rtt_reply_timed, RTT_COST_EVERY);
+	fflush(stdout);
+}
+
+void rtt_start(void)
+{
+	signal(SIGUSR1, rtt_sigusr1);
+}
+
+/* the upper bound, in usecs, of the bucket holding pct percent */
+static unsigned long rtt_kgdb_bound(const unsigned long *hist, int n,
+				    unsigned long count, double pct)
+{
+	unsigned long long want = (unsigned long long)(count * pct / 100.0);
+	unsigned long long seen = 0;
+	int b;
+
+	if (want < 1)
+		want = 1;
+	for (b = 0; b < n; b++) {
+		seen += hist[b];
+		if (seen >= want)
+			break;
+	}
+	return 1UL << (b < n ? b : n - 1);
+}
+
+/*
+ * Print the histograms a target stopped in kgdb keeps of its own
+ * stops, from the qkgdb.latency query: "name:b0,b1,...;name:..." in
+ * hex, bucket n counting the stops below 2^n usecs.
+ */
+int rtt_kgdb_latency(struct port_st *port)
+{
+	static char reply[IO_BUFSIZE];
+	unsigned long hist[32], count;
+	char *p, *name, *end;
+	int n;
+
+	if (gdb_port_open(port))
+		return 1;
+	if (gdb_command(port, "qkgdb.latency", reply, sizeof(reply)) <= 0 ||
+	    !strchr(reply, ':')) {
+		fprintf(stderr, "The target has no qkgdb.latency query, is it "
+			"built with CONFIG_KGDB_LATENCY?\n");
+		return 1;
+	}
+
+	printf("time the target spent stopped, usecs rounded up to a "
+	       "power of two\n");
+	printf("phase           count      p50      p90      p99      max\n");
+	for (p = reply; *p; ) {
+		name = p;
+		p = strchr(p, ':');
+		if (!p)
+			break;
+		*p++ = 0;
+		for (n = 0, count = 0; n < 32 && *p && *p != ';'; n++) {
+			hist[n] = strtoul(p, &end, 16);
+			count += hist[n];
+			p = *end == ',' ? end + 1 : end;
+		}
+		if (*p == ';')
+			p++;
+		if (!count) {
+			printf("%-10s %10d\n", name, 0);
+			continue;
+		}
+		printf("%-10s %10lu %8lu %8lu %8lu %8lu\n", name, count,
+		       rtt_kgdb_bound(hist, n, count, 50),
+		       rtt_kgdb_bound(hist, n, count, 90),
+		       rtt_kgdb_bound(hist, n, count, 99),
+		       rtt_kgdb_bound(hist, n, count, 100));
+	}
+
+	return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-sampler.c  port for the target's pc sampler stream, with
+ *                        the top functions reported every second
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * The target streams "!" transfers while a client is connected, see
+ * kgdb_sampler_fill() in f_kgdb.c.  The client gets a text report of the
+ * top functions every second.  The sampler runs only while a client is
+ * connected.
+ */
+#define SAMPLER_HZ	1000	/* without -r */
+#define SAMPLER_HASH	16384	/* distinct pcs per second */
+#define SAMPLER_TOP	20
+#define SAMPLER_USER	(1 << 23)
+
+struct sampler_pc {
+	unsigned long pc;
+	unsigned long count;
+};
+
+/* what arrived in the current second */
+struct sampler_interval {
+	struct sampler_pc pcs[SAMPLER_HASH];
+	unsigned long samples;
+	unsigned long user;
+	unsigned long other;	/* pcs that did not fit in the table */
+	unsigned long dropped;
+	unsigned long bytes;
+	unsigned int cpus;
+};
+
+/* a line of the report, the pcs of one function merged */
+struct sampler_line {
+	unsigned long key;
+	unsigned long count;
+	const char *name;
+	unsigned long pc;
+};
+
+int sampler_port;
+char *sampler_addr;
+
+static struct port_st *sampler_target;
+static int sampler_sock = -1;
+static pthread_t sampler_thread;
+static int sampler_on;
+
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sampler_interval cur, rep;
+static struct sampler_line lines[SAMPLER_HASH + 2];
+
+static unsigned long get_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static void sampler_add(unsigned long pc)
+{
+	unsigned int h = (pc >> 2) * 2654435761u % SAMPLER_HASH;
+	int i;
+
+	for (i = 0; i < SAMPLER_HASH; i++) {
+		struct sampler_pc *e = &cur.pcs[(h + i) % SAMPLER_HASH];
+
+		if (e->count && e->pc != pc)
+			continue;
+		e->pc = pc;
+		e->count++;
+		return;
+	}
+	cur.other++;
+}
+
+/*
+ * Called by the usb thread for everything the target sends.  Returns
+ * how much of buf was a sampler transfer.
+ */
+int sampler_target_data(char *buf, int len)
+{
+	unsigned char *p = (unsigned char *)buf;
+	unsigned long cpu_pid;
+	int n, i;
+
+	if (!sampler_port || len < 8 || buf[0] != '!')
+		return 0;
+
+	n = p[2] | p[3] << 8;
+	if (n > (len - 8) / 8)
+		n = (len - 8) / 8;
+
+	pthread_mutex_lock(&sampler_lock);
+	if (sampler_on) {
+		cur.dropped += get_le32(p + 4);
+		cur.bytes += len;
+		for (i = 0, p += 8; i < n; i++, p += 8) {
+			cpu_pid = get_le32(p + 4);
+			cur.cpus |= 1 << (cpu_pid >> 24);
+			cur.samples++;
+			if (cpu_pid & SAMPLER_USER)
+				cur.user++;
+			else
+				sampler_add(get_le32(p));
+		}
+	}
+	pthread_mutex_unlock(&sampler_lock);
+
+	return len;
+}
+
+static int sampler_by_key(const void *a, const void *b)
+{
+	const struct sampler_line *x = a, *y = b;
+
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static int sampler_by_count(const void *a, const void *b)
+{
+	const struct sampler_line *x = a, *y = b;
+
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+static int bits(unsigned int v)
+{
+	int n = 0;
+
+	for (; v; v &= v - 1)
+		n++;
+	return n;
+}
+
+/* the report of rep, secs long, in out */
+static int sampler_report(char *out, int size, double secs)
+{
+	unsigned long off;
+	int i, n = 0, len;
+
+	/* merge the pcs by function, or keep them as they are */
+	for (i = 0; i < SAMPLER_HASH; i++) {
+		if (!rep.pcs[i].count)
+			continue;
+		lines[n].pc = rep.pcs[i].pc;
+		lines[n].count = rep.pcs[i].count;
+		lines[n].name = sym_lookup(lines[n].pc, &off);
+		lines[n].key = lines[n].name ? (unsigned long)lines[n].name :
+			lines[n].pc;
+		n++;
+	}
+	qsort(lines, n, sizeof(lines[0]), sampler_by_key);
+	for (i = 1, len = n ? 1 : 0; i < n; i++) {
+		if (lines[i].key == lines[len - 1].key)
+			lines[len - 1].count += lines[i].count;
+		else
+			lines[len++] = lines[i];
+	}
+	if (rep.user) {
+		lines[len].name = "[user]";
+		lines[len++].count = rep.user;
+	}
+	if (rep.other) {
+		lines[len].name = "[other]";
+		lines[len++].count = rep.other;
+	}
+	qsort(lines, len, sizeof(lines[0]), sampler_by_count);
+
+	n = snprintf(out, size, "\n%.0f samples/s on %d cpus, %lu dropped, "
+		     "%.1f KB/s\n", rep.samples / secs, bits(rep.cpus),
+		     rep.dropped, rep.bytes / 1024.0 / secs);
+	for (i = 0; i < len && i < SAMPLER_TOP && n < size; i++) {
+		if (lines[i].name)
+			n += snprintf(out + n, size - n, "%6.2f%% %8lu  %s\n",
+				      100.0 * lines[i].count / rep.samples,
+				      lines[i].count, lines[i].name);
+		else
+			n += snprintf(out + n, size - n,
+				      "%6.2f%% %8lu  0x%08lx\n",
+				      100.0 * lines[i].count / rep.samples,
+				      lines[i].count, lines[i].pc);
+	}
+
+	return n < size ? n : size;
+}
+
+static double sampler_secs(struct timeval *a, struct timeval *b)
+{
+	return b->tv_sec - a->tv_sec + (b->tv_usec - a->tv_usec) / 1e6;
+}
+
+/* a report every second until the client goes away */
+static void sampler_serve(int fd, int hz)
+{
+	unsigned long samples = 0, dropped = 0;
+	struct timeval last, now, start, tv;
+	char out[4096];
+	fd_set rds;
+	int n;
+
+	pthread_mutex_lock(&sampler_lock);
+	memset(&cur, 0, sizeof(cur));
+	sampler_on = 1;
+	pthread_mutex_unlock(&sampler_lock);
+
+	if (usb_set_sampler(sampler_target, hz)) {
+		n = sprintf(out, "the target has no pc sampler\n");
+		send(fd, out, n, 0);
+		goto out;
+	}
+	n = sprintf(out, "sampling at %d Hz\n", hz);
+	send(fd, out, n, 0);
+
+	gettimeofday(&start, NULL);
+	last = start;
+	for (;;) {
+		FD_ZERO(&rds);
+		FD_SET(fd, &rds);
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		/* anything the client sends is ignored, but not the close */
+		if (select(fd + 1, &rds, NULL, NULL, &tv) > 0 &&
+		    recv(fd, out, sizeof(out), 0) <= 0)
+			break;
+
+		gettimeofday(&now, NULL);
+		if (sampler_secs(&last, &now) < 1.0)
+			continue;
+
+		pthread_mutex_lock(&sampler_lock);
+		memcpy(&rep, &cur, sizeof(rep));
+		memset(&cur, 0, sizeof(cur));
+		pthread_mutex_unlock(&sampler_lock);
+
+		samples += rep.samples;
+		dropped += rep.dropped;
+		n = sampler_report(out, sizeof(out), sampler_secs(&last, &now));
+		last = now;
+		if (send(fd, out, n, 0) != n)
+			break;
+	}
+
+	usb_set_sampler(sampler_target, 0);
+	gettimeofday(&now, NULL);
+	printf("sampler: %lu samples in %.1fs at %d Hz, %lu dropped\n",
+	       samples, sampler_secs(&start, &now), hz, dropped);
+out:
+	pthread_mutex_lock(&sampler_lock);
+	sampler_on = 0;
+	pthread_mutex_unlock(&sampler_lock);
+}
+
+static void *sampler_thread_main(void *arg)
+{
+	int hz = prof_hz ? prof_hz : SAMPLER_HZ;
+	int fd;
+
+	for (;;) {
+		fd = accept(sampler_sock, NULL, NULL);
+		if (fd < 0)
+			continue;
+		if (debug)
+			printf("sampler: client connected\n");
+		sampler_serve(fd, hz);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* serve the pc sampler of the usb target on sampler_addr:sampler_port */
+int sampler_start(struct port_st *target, const char *vmlinux)
+{
+	if (prof_hz < 0 || prof_hz > 20000) {
+		printf("Error: bad sample rate %d\n", prof_hz);
+		sampler_port = 0;
+		return 1;
+	}
+	if (vmlinux && sym_load(vmlinux))
+		return 1;
+
+	sampler_target = target;
+	sampler_sock = listen_socket("sampler", sampler_addr, sampler_port, 1);
+	if (sampler_sock < 0) {
+		sampler_port = 0;
+		return 1;
+	}
+
+	return pthread_create(&sampler_thread, NULL, sampler_thread_main,
+			      NULL);
+}
@@ -0,0 +1,400 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-snap.c  RAM snapshot to an ELF core through the standard
+ *                     'm' packet, for targets without qkgdb.dump
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include <sys/types.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * The stub formats replies in a buffer of BUFMAX bytes, 848 on ARM, and
+ * does not bound 'm' by it, so ask for less unless it reports its
+ * PacketSize.
+ */
+#define SNAP_BLOCK	400
+#define SNAP_WINDOW	16	/* requests in flight */
+#define SNAP_RETRIES	64
+
+/* ARM struct meminfo: nr_banks, then 8 banks of start, size and a flag */
+#define MEMINFO_BANKS	8
+#define MEMINFO_SIZE	(4 + MEMINFO_BANKS * 12)
+
+struct snap_req {
+	unsigned long addr;
+	int len;
+	long long off;		/* in the core file */
+};
+
+/* where the next block comes from */
+struct snap_state {
+	const struct core_range *r;
+	int nr;
+	int i;			/* current range */
+	unsigned long long pos;	/* physical address in it */
+	long long off;
+	unsigned long page_offset, phys_offset;
+	int block;
+	struct snap_req retry[SNAP_WINDOW];
+	int nretry;
+};
+
+static char reply[2 * IO_BUFSIZE];
+
+/* look name up in the symbol table of vmlinux */
+static int snap_symbol(const char *vmlinux, const char *name,
+		       unsigned long *value)
+{
+	Elf32_Ehdr ehdr;
+	Elf32_Shdr *shdr = NULL;
+	Elf32_Sym sym;
+	char *strtab = NULL;
+	FILE *fp;
+	int i, j, n, found = 0;
+
+	fp = fopen(vmlinux, "rb");
+	if (!fp) {
+		fprintf(stderr, "ERROR: Could not open %s\n", vmlinux);
+		return -1;
+	}
+	if (fread(&ehdr, sizeof(ehdr), 1, fp) != 1 ||
+	    memcmp(ehdr.e_ident, ELFMAG, SELFMAG) ||
+	    ehdr.e_ident[EI_CLASS] != ELFCLASS32)
+		goto out;
+
+	shdr = calloc(ehdr.e_shnum, sizeof(*shdr));
+	if (!shdr || fseek(fp, ehdr.e_shoff, SEEK_SET) ||
+	    fread(shdr, sizeof(*shdr), ehdr.e_shnum, fp) != ehdr.e_shnum)
+		goto out;
+
+	for (i = 0; i < ehdr.e_shnum && !found; i++) {
+		if (shdr[i].sh_type != SHT_SYMTAB ||
+		    shdr[i].sh_link >= ehdr.e_shnum)
+			continue;
+		strtab = malloc(shdr[shdr[i].sh_link].sh_size + 1);
+		if (!strtab ||
+		    fseek(fp, shdr[shdr[i].sh_link].sh_offset, SEEK_SET) ||
+		    fread(strtab, shdr[shdr[i].sh_link].sh_size, 1, fp) != 1)
+			goto out;
+		strtab[shdr[shdr[i].sh_link].sh_size] = '\0';
+
+		n = shdr[i].sh_size / sizeof(sym);
+		fseek(fp, shdr[i].sh_offset, SEEK_SET);
+		for (j = 0; j < n; j++) {
+			if (fread(&sym, sizeof(sym), 1, fp) != 1)
+				break;
+			if (sym.st_name < shdr[shdr[i].sh_link].sh_size &&
+			    !strcmp(strtab + sym.st_name, name)) {
+				*value = sym.st_value;
+				found = 1;
+				break;
+			}
+		}
+		free(strtab);
+		strtab = NULL;
+	}
+
+out:
+	free(strtab);
+	free(shdr);
+	fclose(fp);
+	if (!found)
+		fprintf(stderr, "No symbol %s in %s\n", name, vmlinux);
+	return found ? 0 : -1;
+}
+
+static int snap_read(struct port_st *port, unsigned long addr, char *buf,
+		     int len)
+{
+	char cmd[32];
+	int n;
+
+	sprintf(cmd, "m%lx,%x", addr, len);
+	n = gdb_command(port, cmd, reply, sizeof(reply));
+	if (n != 2 * len || gdb_hex2bin(reply, n) != len)
+		return -1;
+	memcpy(buf, reply, len);
+	return 0;
+}
+
+static unsigned long snap_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+/*
+ * The lowmem mapping and the memory banks, read through vmlinux's
+ * meminfo and high_memory since a stock stub cannot report them.  The
+ * first bank starts at PHYS_OFFSET and PAGE_OFFSET is _text rounded
+ * down to 16MB on ARM.
+ */
+static int snap_target_ram(struct port_st *port, const char *vmlinux,
+			   unsigned long *page_offset,
+			   unsigned long *phys_offset,
+			   unsigned long *lowmem_size,
+			   struct core_range *r, int max)
+{
+	unsigned char meminfo[MEMINFO_SIZE], high[4];
+	unsigned long text, mi, hm;
+	int i, n;
+
+	if (snap_symbol(vmlinux, "_text", &text) ||
+	    snap_symbol(vmlinux, "meminfo", &mi) ||
+	    snap_symbol(vmlinux, "high_memory", &hm))
+		return -1;
+
+	if (snap_read(port, mi, (char *)meminfo, sizeof(meminfo)) ||
+	    snap_read(port, hm, (char *)high, sizeof(high))) {
+		fprintf(stderr, "Could not read meminfo from the target\n");
+		return -1;
+	}
+
+	n = snap_le32(meminfo);
+	if (n <= 0 || n > MEMINFO_BANKS || n > max) {
+		fprintf(stderr, "meminfo has %d banks, wrong vmlinux?\n", n);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		r[i].start = snap_le32(meminfo + 4 + i * 12);
+		r[i].size = snap_le32(meminfo + 8 + i * 12);
+	}
+
+	*page_offset = text & 0xff000000;
+	*phys_offset = r[0].start;
+	*lowmem_size = snap_le32(high) - *page_offset;
+
+	return n;
+}
+
+/* the packet size the stub reports, or SNAP_BLOCK */
+static int snap_block(struct port_st *port)
+{
+	char *p;
+	int len, size;
+
+	len = gdb_command(port, "qSupported", reply, sizeof(reply));
+	if (len <= 0)
+		return SNAP_BLOCK;
+	p = strstr(reply, "PacketSize=");
+	if (!p)
+		return SNAP_BLOCK;
+
+	/* the reply is "m" and two hex digits per byte, within #cs */
+	size = (strtol(p + 11, NULL, 16) - 8) / 2;
+	if (size > (sizeof(reply) - 8) / 2)
+		size = (sizeof(reply) - 8) / 2;
+	return size > 0 ? size : SNAP_BLOCK;
+}
+
+static int snap_next(struct snap_state *st, struct snap_req *q)
+{
+	const struct core_range *r;
+
+	if (st->nretry) {
+		*q = st->retry[--st->nretry];
+		return 1;
+	}
+
+	while (st->i < st->nr &&
+	       st->pos == st->r[st->i].start + st->r[st->i].size) {
+		if (++st->i < st->nr)
+			st->pos = st->r[st->i].start;
+	}
+	if (st->i == st->nr)
+		return 0;
+
+	r = &st->r[st->i];
+	q->addr = st->pos - st->phys_offset + st->page_offset;
+	q->len = r->start + r->size - st->pos < st->block ?
+	    r->start + r->size - st->pos : st->block;
+	q->off = st->off;
+	st->pos += q->len;
+	st->off += q->len;
+	return 1;
+}
+
+static int snap_send(struct port_st *port, struct snap_req *q, int n)
+{
+	char cmds[SNAP_WINDOW][32];
+	char *cmd[SNAP_WINDOW];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		sprintf(cmds[i], "m%lx,%x", q[i].addr, q[i].len);
+		cmd[i] = cmds[i];
+	}
+	return gdb_send_pipelined(port, cmd, n);
+}
+
+/*
+ * Read all the blocks with up to SNAP_WINDOW 'm' requests in flight.
+ * The stub answers in order; a reply that arrives damaged, or the '-'
+ * the stub sends for a request that did, stands for the oldest
+ * request, which is asked for again later.
+ */
+static int snap_blocks(struct port_st *port, FILE *fp,
+		       struct snap_state *st, unsigned long long total)
+{
+	struct snap_req fifo[SNAP_WINDOW], batch[SNAP_WINDOW], *q;
+	unsigned long long done = 0;
+	long long pos = ftello(fp);
+	int head = 0, inflight = 0, retries = 0, i, n, len;
+
+	for (;;) {
+		if (inflight <= SNAP_WINDOW / 2) {
+			for (n = 0; inflight + n < SNAP_WINDOW; n++)
+				if (!snap_next(st, &batch[n]))
+					break;
+			if (n && snap_send(port, batch, n))
+				return -1;
+			for (i = 0; i < n; i++)
+				fifo[(head + inflight++) % SNAP_WINDOW] =
+				    batch[i];
+		}
+		if (!inflight)
+			break;
+
+		q = &fifo[head];
+		head = (head + 1) % SNAP_WINDOW;
+		inflight--;
+
+		len = gdb_recv(port, reply, sizeof(reply));
+		if (len == -1) {
+			fprintf(stderr, "\nNo reply for %lx\n", q->addr);
+			return -1;
+		}
+		if (len > 0 && reply[0] == 'E') {
+			fprintf(stderr, "\nThe target cannot read %lx: %s\n",
+				q->addr, reply);
+			return -1;
+		}
+		if (len != 2 * q->len || gdb_hex2bin(reply, len) != q->len) {
+			if (++retries > SNAP_RETRIES) {
+				fprintf(stderr, "\nToo many bad replies\n");
+				return -1;
+			}
+			st->retry[st->nretry++] = *q;
+			continue;
+		}
+
+		/* only retried blocks are out of order */
+		if ((q->off != pos && fseeko(fp, q->off, SEEK_SET)) ||
+		    fwrite(reply, 1, q->len, fp) != q->len) {
+			fprintf(stderr, "\nERROR: write of the core failed\n");
+			return -1;
+		}
+		pos = q->off + q->len;
+		done += q->len;
+		if (!(done & 0xfffff) || done == total)
+			core_progress(done, total);
+	}
+
+	return 0;
+}
+
+/*
+ * Snapshot physical RAM of a target stopped in a stock kgdb stub.  The
+ * memory map comes from vmlinux, or ranges gives "start+size" pairs.
+ * 'm' only reads mapped memory, so ranges are clipped to lowmem.
+ */
+int snap_dump(struct port_st *port, const char *path, const char *vmlinux,
+	      const char *ranges)
+{
+	struct core_range r[CORE_MAX_RANGES];
+	unsigned long page_offset, phys_offset, lowmem_size;
+	unsigned long long total = 0, end;
+	struct snap_state st;
+	int i, nr, regsize;
+	FILE *fp;
+	int len, ret;
+
+	if (gdb_port_open(port))
+		return 1;
+
+	nr = snap_target_ram(port, vmlinux, &page_offset, &phys_offset,
+			     &lowmem_size, r, CORE_MAX_RANGES);
+	if (nr < 0)
+		return 1;
+	if (ranges) {
+		nr = core_parse_ranges(ranges, r, CORE_MAX_RANGES);
+		if (nr <= 0) {
+			fprintf(stderr, "Bad range list %s\n", ranges);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < nr; i++) {
+		end = r[i].start + r[i].size;
+		if (r[i].start < phys_offset ||
+		    end > phys_offset + lowmem_size) {
+			fprintf(stderr, "%llx+%llx is outside lowmem, "
+				"skipped\n", r[i].start, r[i].size);
+			memmove(r + i, r + i + 1, (--nr - i) * sizeof(*r));
+			i--;
+			continue;
+		}
+		total += r[i].size;
+	}
+	if (!nr)
+		return 1;
+
+	len = gdb_command(port, "g", reply, sizeof(reply));
+	if (len <= 0 || reply[0] == 'E') {
+		fprintf(stderr, "Could not read the registers\n");
+		return 1;
+	}
+	regsize = gdb_hex2bin(reply, len);
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		fprintf(stderr, "ERROR: Could not open %s\n", path);
+		return 1;
+	}
+	if (core_write_header(fp, reply, regsize, page_offset, phys_offset,
+			      r, nr)) {
+		fprintf(stderr, "ERROR: write to %s failed\n", path);
+		fclose(fp);
+		return 1;
+	}
+
+	memset(&st, 0, sizeof(st));
+	st.r = r;
+	st.nr = nr;
+	st.pos = r[0].start;
+	st.off = ftello(fp);
+	st.page_offset = page_offset;
+	st.phys_offset = phys_offset;
+	st.block = snap_block(port);
+
+	core_progress_start();
+	ret = snap_blocks(port, fp, &st, total);
+	fclose(fp);
+	if (ret)
+		return 1;
+
+	core_progress_end(total, path);
+	return 0;
+}
@@ -0,0 +1,996 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-sym.c  address to symbol and line lookup in vmlinux
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <elf.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * A sorted address table and its Eytzinger (breadth first) copy: eyt[1]
+ * is the root, eyt[2k] and eyt[2k+1] the children of eyt[k], and pos[k]
+ * the index of eyt[k] in addr.  The first levels of the tree share a few
+ * cache lines, so a lookup in a table of 30k kernel symbols touches
+ * about half the lines the plain binary search does, with no branch on
+ * the comparison.
+ */
+struct sym_index {
+	unsigned int n;
+	unsigned int *addr;
+	unsigned int *eyt;
+	unsigned int *pos;
+};
+
+/* code symbols, with the names packed in sym_names */
+static struct sym_index sym_idx;
+static unsigned int *sym_name;
+static char *sym_names;
+static unsigned int sym_names_len;
+
+/* line table rows, the file names packed in line_files, line 0 ends */
+static struct sym_index line_idx;
+static unsigned int *line_file;
+static unsigned int *line_no;
+static char *line_files;
+static unsigned int line_files_len;
+
+/* cached indexes are one allocation */
+static void *sym_cache;
+
+int sym_lines;
+
+static void sym_index_fill(struct sym_index *x, unsigned int *i,
+			   unsigned int k)
+{
+	if (k > x->n)
+		return;
+	sym_index_fill(x, i, 2 * k);
+	x->eyt[k] = x->addr[*i];
+	x->pos[k] = (*i)++;
+	sym_index_fill(x, i, 2 * k + 1);
+}
+
+static int sym_index_build(struct sym_index *x)
+{
+	unsigned int i = 0;
+
+	x->eyt = malloc((x->n + 1) * sizeof(*x->eyt));
+	x->pos = malloc((x->n + 1) * sizeof(*x->pos));
+	if (!x->eyt || !x->pos)
+		return -1;
+	x->eyt[0] = x->pos[0] = 0;
+	sym_index_fill(x, &i, 1);
+	return 0;
+}
+
+/* index of the last entry at or below addr, -1 if none */
+static int sym_index_find(const struct sym_index *x, unsigned int addr)
+{
+	unsigned int k = 1;
+
+	while (k <= x->n) {
+		/* the 16 nodes four levels down share one cache line */
+		__builtin_prefetch(x->eyt + 16 * k);
+		k = 2 * k + (x->eyt[k] <= addr);
+	}
+	/* drop the trailing right turns and the left one before them */
+	k >>= __builtin_ffs(~k);
+	return (int)(k ? x->pos[k] : x->n) - 1;
+}
+
+/* the same answer by a plain binary search, for sym_bench */
+static int sym_index_bsearch(const struct sym_index *x, unsigned int addr)
+{
+	unsigned int lo = 0, hi = x->n;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (x->addr[mid] <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (int)lo - 1;
+}
+
+/*
+ * Strings packed one after the other.  File names are stored once, as
+ * every unit of the line table lists the same headers again.
+ */
+struct strpack {
+	char *buf;
+	unsigned int len, size;
+	unsigned int *hash;	/* offset + 1, 0 is free */
+	unsigned int hsize, count;
+};
+
+static unsigned int strpack_hash(const char *s)
+{
+	unsigned int h = 5381;
+
+	while (*s)
+		h = h * 33 + (unsigned char)*s++;
+	return h;
+}
+
+static int strpack_grow(struct strpack *p)
+{
+	unsigned int *hash, i, j, size = p->hsize ? p->hsize * 2 : 4096;
+
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -1;
+	for (i = 0; i < p->hsize; i++) {
+		if (!p->hash[i])
+			continue;
+		j = strpack_hash(p->buf + p->hash[i] - 1) & (size - 1);
+		while (hash[j])
+			j = (j + 1) & (size - 1);
+		hash[j] = p->hash[i];
+	}
+	free(p->hash);
+	p->hash = hash;
+	p->hsize = size;
+	return 0;
+}
+
+/* offset of s appended to p, -1 if out of memory */
+static long strpack_append(struct strpack *p, const char *s)
+{
+	unsigned int len = strlen(s) + 1;
+	char *buf;
+
+	if (p->len + len > p->size) {
+		p->size = (p->len + len) * 2;
+		buf = realloc(p->buf, p->size);
+		if (!buf)
+			return -1;
+		p->buf = buf;
+	}
+	memcpy(p->buf + p->len, s, len);
+	p->len += len;
+	return p->len - len;
+}
+
+/* offset of s in p, added if it is not there yet */
+static long strpack_add(struct strpack *p, const char *s)
+{
+	unsigned int j;
+	long off;
+
+	if (p->count * 2 >= p->hsize && strpack_grow(p))
+		return -1;
+	j = strpack_hash(s) & (p->hsize - 1);
+	while (p->hash[j]) {
+		if (!strcmp(p->buf + p->hash[j] - 1, s))
+			return p->hash[j] - 1;
+		j = (j + 1) & (p->hsize - 1);
+	}
+	off = strpack_append(p, s);
+	if (off < 0)
+		return -1;
+	p->hash[j] = off + 1;
+	p->count++;
+	return off;
+}
+
+struct sym_ent {
+	unsigned int addr;
+	unsigned int name;	/* or file */
+	unsigned int line;
+	unsigned int seq;	/* keeps rows of one address in order */
+};
+
+static int sym_ent_cmp(const void *a, const void *b)
+{
+	const struct sym_ent *x = a, *y = b;
+
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+struct sym_ents {
+	struct sym_ent *e;
+	unsigned int n, size;
+};
+
+static int sym_ents_add(struct sym_ents *t, unsigned int addr,
+			unsigned int name, unsigned int line)
+{
+	struct sym_ent *e;
+
+	if (t->n == t->size) {
+		t->size = t->size ? t->size * 2 : 4096;
+		e = realloc(t->e, t->size * sizeof(*e));
+		if (!e)
+			return -1;
+		t->e = e;
+	}
+	t->e[t->n].addr = addr;
+	t->e[t->n].name = name;
+	t->e[t->n].line = line;
+	t->e[t->n].seq = t->n;
+	t->n++;
+	return 0;
+}
+
+/* sort and split into addr[] and name[] (and line[]), dropping e */
+static int sym_ents_index(struct sym_ents *t, struct sym_index *x,
+			  unsigned int **name, unsigned int **line)
+{
+	unsigned int i;
+
+	qsort(t->e, t->n, sizeof(*t->e), sym_ent_cmp);
+	x->n = t->n;
+	x->addr = malloc((t->n + 1) * sizeof(*x->addr));
+	*name = malloc((t->n + 1) * sizeof(**name));
+	if (line)
+		*line = malloc((t->n + 1) * sizeof(**line));
+	if (!x->addr || !*name || (line && !*line))
+		return -1;
+	for (i = 0; i < t->n; i++) {
+		x->addr[i] = t->e[i].addr;
+		(*name)[i] = t->e[i].name;
+		if (line)
+			(*line)[i] = t->e[i].line;
+	}
+	free(t->e);
+	t->e = NULL;
+	return sym_index_build(x);
+}
+
+static int sym_read(FILE *fp, unsigned long off, void *buf, size_t len)
+{
+	return fseek(fp, off, SEEK_SET) || fread(buf, 1, len, fp) != len;
+}
+
+static void *sym_read_section(FILE *fp, const Elf32_Shdr *sh)
+{
+	char *buf = malloc(sh->sh_size + 1);
+
+	if (buf && sym_read(fp, sh->sh_offset, buf, sh->sh_size)) {
+		free(buf);
+		return NULL;
+	}
+	if (buf)
+		buf[sh->sh_size] = '\0';
+	return buf;
+}
+
+/*
+ * Load the code symbols of vmlinux.  Data objects and ARM's $a, $d and
+ * $t mapping symbols are left out.
+ */
+static int sym_load_syms(FILE *fp, const Elf32_Ehdr *ehdr,
+			 const Elf32_Shdr *shdr)
+{
+	struct sym_ents t = { NULL, 0, 0 };
+	struct strpack names;
+	Elf32_Sym *st = NULL;
+	char *strtab = NULL;
+	unsigned int i, j, n, strsize;
+	long name;
+	int type, ret = -1;
+
+	memset(&names, 0, sizeof(names));
+	for (i = 0; i < ehdr->e_shnum; i++)
+		if (shdr[i].sh_type == SHT_SYMTAB &&
+		    shdr[i].sh_link < ehdr->e_shnum)
+			break;
+	if (i == ehdr->e_shnum)
+		return -1;
+
+	n = shdr[i].sh_size / sizeof(*st);
+	strsize = shdr[shdr[i].sh_link].sh_size;
+	st = sym_read_section(fp, &shdr[i]);
+	strtab = sym_read_section(fp, &shdr[shdr[i].sh_link]);
+	if (!st || !strtab)
+		goto out;
+
+	for (j = 0; j < n; j++) {
+		type = ELF32_ST_TYPE(st[j].st_info);
+		if ((type != STT_FUNC && type != STT_NOTYPE) ||
+		    st[j].st_shndx == SHN_UNDEF ||
+		    st[j].st_shndx >= SHN_LORESERVE ||
+		    st[j].st_shndx >= ehdr->e_shnum ||
+		    st[j].st_name >= strsize ||
+		    !strtab[st[j].st_name] ||
+		    strtab[st[j].st_name] == '$' ||
+		    !(shdr[st[j].st_shndx].sh_flags & SHF_EXECINSTR))
+			continue;
+		/* a name per symbol, sampler.c tells functions apart by it */
+		name = strpack_append(&names, strtab + st[j].st_name);
+		if (name < 0 || sym_ents_add(&t, st[j].st_value, name, 0))
+			goto out;
+	}
+	if (sym_ents_index(&t, &sym_idx, &sym_name, NULL))
+		goto out;
+	sym_names = names.buf;
+	sym_names_len = names.len;
+	names.buf = NULL;
+	ret = 0;
+
+out:
+	free(t.e);
+	free(names.buf);
+	free(names.hash);
+	free(strtab);
+	free(st);
+	return ret;
+}
+
+static unsigned long uleb(const unsigned char **p, const unsigned char *end)
+{
+	unsigned long v = 0;
+	int shift = 0;
+
+	while (*p < end) {
+		unsigned char c = *(*p)++;
+
+		if (shift < 32)
+			v |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+		if (!(c & 0x80))
+			break;
+	}
+	return v;
+}
+
+static long sleb(const unsigned char **p, const unsigned char *end)
+{
+	unsigned long v = 0;
+	int shift = 0;
+	unsigned char c = 0;
+
+	while (*p < end) {
+		c = *(*p)++;
+		if (shift < 32)
+			v |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+		if (!(c & 0x80))
+			break;
+	}
+	if (shift < 32 && (c & 0x40))
+		v |= -1UL << shift;
+	return (long)(int)v;
+}
+
+static unsigned int get16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static unsigned int get32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+static const char *cstr(const unsigned char **p, const unsigned char *end)
+{
+	const char *s = (const char *)*p;
+
+	while (*p < end && **p)
+		(*p)++;
+	if (*p >= end)
+		return NULL;
+	(*p)++;
+	return s;
+}
+
+#define LINE_MAX_FILES	4096
+#define LINE_MAX_DIRS	1024
+
+/*
+ * Run the line number program of one unit of .debug_line (DWARF 2 to 4,
+ * 32-bit format, little endian) and add its rows.  Returns the start of
+ * the next unit, NULL on a malformed one.
+ */
+static const unsigned char *sym_line_unit(const unsigned char *p,
+					  const unsigned char *end,
+					  struct sym_ents *t,
+					  struct strpack *files)
+{
+	static const char *dirs[LINE_MAX_DIRS];
+	static unsigned int file[LINE_MAX_FILES];
+	const unsigned char *unit_end, *op, *std;
+	unsigned int version, min_inst, range, opbase, ndirs = 1, nfiles = 1;
+	unsigned int addr = 0, fileno = 1, len;
+	int line_base, line = 1;
+	char path[1024];
+	const char *name;
+	long off;
+
+	if (end - p < 4)
+		return NULL;
+	len = get32(p);
+	/* 64-bit DWARF never describes a 32-bit kernel */
+	if (len >= 0xfffffff0 || len > end - p - 4)
+		return NULL;
+	unit_end = p + 4 + len;
+	if (len < 10)
+		return unit_end;
+	version = get16(p + 4);
+	if (version < 2 || version > 4)
+		return unit_end;
+	op = p + 10 + get32(p + 6);
+	p += 10;
+	min_inst = *p++;
+	if (version >= 4)
+		p++;		/* maximum_operations_per_instruction */
+	p++;			/* default_is_stmt */
+	line_base = (signed char)*p++;
+	range = *p++;
+	opbase = *p++;
+	std = p - 1;		/* std[i] is the length of opcode i */
+	p += opbase - 1;
+	if (!range || !opbase || op > unit_end || p > op)
+		return unit_end;
+
+	dirs[0] = NULL;
+	while (p < op && *p) {
+		name = cstr(&p, op);
+		if (!name)
+			return unit_end;
+		if (ndirs < LINE_MAX_DIRS)
+			dirs[ndirs++] = name;
+	}
+	p++;
+	while (p < op && *p) {
+		unsigned long dir;
+
+		name = cstr(&p, op);
+		if (!name)
+			return unit_end;
+		dir = uleb(&p, op);
+		uleb(&p, op);	/* mtime */
+		uleb(&p, op);	/* length */
+		if (name[0] != '/' && dir && dir < ndirs)
+			snprintf(path, sizeof(path), "%s/%s", dirs[dir], name);
+		else
+			snprintf(path, sizeof(path), "%s", name);
+		off = strpack_add(files, path);
+		if (off < 0)
+			return NULL;
+		if (nfiles < LINE_MAX_FILES)
+			file[nfiles++] = off;
+	}
+	/* file 0 is not valid before DWARF 5, rows naming it get file 1 */
+	if (nfiles > 1)
+		file[0] = file[1];
+	else if ((off = strpack_add(files, "??")) >= 0)
+		file[0] = off;
+	else
+		return NULL;
+
+#define ROW(l)	(sym_ents_add(t, addr, file[fileno < nfiles ? fileno : 0], (l)))
+	p = op;
+	while (p < unit_end) {
+		unsigned int c = *p++;
+
+		if (c >= opbase) {
+			c -= opbase;
+			addr += c / range * min_inst;
+			line += line_base + (int)(c % range);
+			if (ROW(line))
+				return NULL;
+			continue;
+		}
+		switch (c) {
+		case 0:	/* extended */
+			len = uleb(&p, unit_end);
+			if (!len || len > unit_end - p)
+				return unit_end;
+			op = p + len;
+			switch (*p) {
+			case 1:	/* DW_LNE_end_sequence */
+				if (ROW(0))
+					return NULL;
+				addr = 0;
+				fileno = 1;
+				line = 1;
+				break;
+			case 2:	/* DW_LNE_set_address */
+				if (len >= 5)
+					addr = get32(p + 1);
+				break;
+			}
+			p = op;
+			break;
+		case 1:	/* DW_LNS_copy */
+			if (ROW(line))
+				return NULL;
+			break;
+		case 2:	/* DW_LNS_advance_pc */
+			addr += uleb(&p, unit_end) * min_inst;
+			break;
+		case 3:	/* DW_LNS_advance_line */
+			line += sleb(&p, unit_end);
+			break;
+		case 4:	/* DW_LNS_set_file */
+			fileno = uleb(&p, unit_end);
+			break;
+		case 8:	/* DW_LNS_const_add_pc */
+			addr += (255 - opbase) / range * min_inst;
+			break;
+		case 9:	/* DW_LNS_fixed_advance_pc */
+			if (unit_end - p < 2)
+				return unit_end;
+			addr += get16(p);
+			p += 2;
+			break;
+		default:
+			for (len = std[c]; len; len--)
+				uleb(&p, unit_end);
+			break;
+		}
+	}
+#undef ROW
+	return unit_end;
+}
+
+/* Load the .debug_line rows of vmlinux, if it has them */
+static int sym_load_lines(FILE *fp, const Elf32_Ehdr *ehdr,
+			  const Elf32_Shdr *shdr)
+{
+	struct sym_ents t = { NULL, 0, 0 };
+	struct strpack files;
+	const unsigned char *p, *end;
+	unsigned char *buf = NULL;
+	char *shstr;
+	unsigned int i;
+	int ret = -1;
+
+	memset(&files, 0, sizeof(files));
+	if (ehdr->e_shstrndx >= ehdr->e_shnum)
+		return -1;
+	shstr = sym_read_section(fp, &shdr[ehdr->e_shstrndx]);
+	if (!shstr)
+		return -1;
+	for (i = 0; i < ehdr->e_shnum; i++)
+		if (shdr[i].sh_name < shdr[ehdr->e_shstrndx].sh_size &&
+		    !strcmp(shstr + shdr[i].sh_name, ".debug_line"))
+			break;
+	free(shstr);
+	if (i == ehdr->e_shnum)
+		return -1;
+
+	buf = sym_read_section(fp, &shdr[i]);
+	if (!buf)
+		goto out;
+	p = buf;
+	end = buf + shdr[i].sh_size;
+	while (p && p < end)
+		p = sym_line_unit(p, end, &t, &files);
+	if (!p && !t.n)
+		goto out;
+	if (sym_ents_index(&t, &line_idx, &line_file, &line_no))
+		goto out;
+	line_files = files.buf;
+	line_files_len = files.len;
+	files.buf = NULL;
+	ret = 0;
+
+out:
+	free(t.e);
+	free(files.buf);
+	free(files.hash);
+	free(buf);
+	return ret;
+}
+
+/*
+ * The key of the cached index: the GNU build-id of vmlinux, or its size
+ * and time for a kernel built without one.
+ */
+static void sym_build_id(FILE *fp, const Elf32_Ehdr *ehdr,
+			 const Elf32_Shdr *shdr, char *key, int size)
+{
+	unsigned char *note, *p, *end;
+	unsigned int i, namesz, descsz, type;
+	struct stat st;
+	int n;
+
+	for (i = 0; i < ehdr->e_shnum; i++) {
+		if (shdr[i].sh_type != SHT_NOTE)
+			continue;
+		note = sym_read_section(fp, &shdr[i]);
+		if (!note)
+			continue;
+		p = note;
+		end = note + shdr[i].sh_size;
+		while (end - p >= 12) {
+			namesz = get32(p);
+			descsz = get32(p + 4);
+			type = get32(p + 8);
+			p += 12;
+			if (namesz > end - p ||
+			    ((descsz + 3) & ~3) > end - p - ((namesz + 3) & ~3))
+				break;
+			if (type == NT_GNU_BUILD_ID && namesz == 4 &&
+			    !memcmp(p, "GNU", 4) && descsz &&
+			    descsz * 2 < size) {
+				p += 4;
+				for (n = 0; n < descsz; n++)
+					sprintf(key + 2 * n, "%02x", p[n]);
+				free(note);
+				return;
+			}
+			p += ((namesz + 3) & ~3) + ((descsz + 3) & ~3);
+		}
+		free(note);
+	}
+	if (fstat(fileno(fp), &st))
+		memset(&st, 0, sizeof(st));
+	snprintf(key, size, "%lx-%lx", (unsigned long)st.st_size,
+		 (unsigned long)st.st_mtime);
+}
+
+/*
+ * The index is cached in $AGENT_PROXY_CACHE, or ~/.cache/agent-proxy,
+ * as <key>.sym, or <key>-lines.sym with the line table.
+ */
+static int sym_cache_path(const char *key, char *path, int size, int mk)
+{
+	const char *dir = getenv("AGENT_PROXY_CACHE"), *home;
+
+	if (dir) {
+		snprintf(path, size, "%s", dir);
+	} else {
+		home = getenv("HOME");
+		if (!home)
+			return -1;
+		snprintf(path, size, "%s/.cache", home);
+		if (mk)
+			mkdir(path, 0755);
+		snprintf(path, size, "%s/.cache/agent-proxy", home);
+	}
+	if (mk && mkdir(path, 0755) && errno != EEXIST)
+		return -1;
+	snprintf(path + strlen(path), size - strlen(path), "/%s%s.sym", key,
+		 sym_lines ? "-lines" : "");
+	return 0;
+}
+
+#define SYM_CACHE_MAGIC	"AGSYMIX1"
+
+struct sym_cache_hdr {
+	char magic[8];
+	unsigned int nsyms, names_len;
+	unsigned int nlines, files_len;
+};
+
+/* the arrays of an index in the order they are cached */
+static int sym_cache_arrays(unsigned int **a[], unsigned int len[])
+{
+	int n = 0;
+
+	a[n] = &sym_idx.addr, len[n++] = sym_idx.n;
+	a[n] = &sym_idx.eyt, len[n++] = sym_idx.n + 1;
+	a[n] = &sym_idx.pos, len[n++] = sym_idx.n + 1;
+	a[n] = &sym_name, len[n++] = sym_idx.n;
+	if (!sym_lines)
+		return n;
+	a[n] = &line_idx.addr, len[n++] = line_idx.n;
+	a[n] = &line_idx.eyt, len[n++] = line_idx.n + 1;
+	a[n] = &line_idx.pos, len[n++] = line_idx.n + 1;
+	a[n] = &line_file, len[n++] = line_idx.n;
+	a[n] = &line_no, len[n++] = line_idx.n;
+	return n;
+}
+
+static int sym_cache_load(const char *path)
+{
+	struct sym_cache_hdr hdr;
+	unsigned int **a[9], len[9];
+	unsigned long size;
+	struct stat st;
+	char *p;
+	FILE *fp;
+	int i, n;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return -1;
+	if (fstat(fileno(fp), &st) ||
+	    fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, SYM_CACHE_MAGIC, 8) ||
+	    (sym_lines && !hdr.nlines)) {
+		fclose(fp);
+		return -1;
+	}
+	sym_idx.n = hdr.nsyms;
+	line_idx.n = hdr.nlines;
+	n = sym_cache_arrays(a, len);
+	size = hdr.names_len + hdr.files_len;
+	for (i = 0; i < n; i++)
+		size += len[i] * sizeof(unsigned int);
+	if (size != st.st_size - sizeof(hdr) ||
+	    !(sym_cache = malloc(size)) ||
+	    fread(sym_cache, 1, size, fp) != size) {
+		free(sym_cache);
+		sym_cache = NULL;
+		sym_idx.n = line_idx.n = 0;
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	p = sym_cache;
+	for (i = 0; i < n; i++) {
+		*a[i] = (unsigned int *)p;
+		p += len[i] * sizeof(unsigned int);
+	}
+	sym_names = p;
+	sym_names_len = hdr.names_len;
+	p += hdr.names_len;
+	line_files = p;
+	line_files_len = hdr.files_len;
+	return 0;
+}
+
+static void sym_cache_save(const char *key)
+{
+	struct sym_cache_hdr hdr;
+	unsigned int **a[9], len[9];
+	char path[1024], tmp[1040];
+	FILE *fp;
+	int i, n, err = 0;
+
+	if (sym_cache_path(key, path, sizeof(path), 1))
+		return;
+	/* written aside and renamed, for a proxy started at the same time */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	fp = fopen(tmp, "wb");
+	if (!fp)
+		return;
+	memcpy(hdr.magic, SYM_CACHE_MAGIC, 8);
+	hdr.nsyms = sym_idx.n;
+	hdr.names_len = sym_names_len;
+	hdr.nlines = sym_lines ? line_idx.n : 0;
+	hdr.files_len = sym_lines ? line_files_len : 0;
+	err |= fwrite(&hdr, sizeof(hdr), 1, fp) != 1;
+	n = sym_cache_arrays(a, len);
+	for (i = 0; i < n; i++)
+		err |= fwrite(*a[i], sizeof(unsigned int), len[i], fp) != len[i];
+	err |= fwrite(sym_names, 1, hdr.names_len, fp) != hdr.names_len;
+	err |= fwrite(line_files, 1, hdr.files_len, fp) != hdr.files_len;
+	err |= fclose(fp) != 0;
+	if (err || rename(tmp, path))
+		unlink(tmp);
+}
+
+static void sym_free(void)
+{
+	if (sym_cache) {
+		free(sym_cache);
+		sym_cache = NULL;
+	} else {
+		free(sym_idx.addr);
+		free(sym_idx.eyt);
+		free(sym_idx.pos);
+		free(sym_name);
+		free(sym_names);
+		free(line_idx.addr);
+		free(line_idx.eyt);
+		free(line_idx.pos);
+		free(line_file);
+		free(line_no);
+		free(line_files);
+	}
+	memset(&sym_idx, 0, sizeof(sym_idx));
+	memset(&line_idx, 0, sizeof(line_idx));
+	sym_name = line_file = line_no = NULL;
+	sym_names = line_files = NULL;
+	sym_names_len = line_files_len = 0;
+}
+
+static int sym_load_elf(const char *vmlinux, int cached)
+{
+	Elf32_Ehdr ehdr;
+	Elf32_Shdr *shdr = NULL;
+	char key[80], path[1024];
+	FILE *fp;
+	int ret = -1;
+
+	sym_free();
+	fp = fopen(vmlinux, "rb");
+	if (!fp) {
+		fprintf(stderr, "ERROR: Could not open %s\n", vmlinux);
+		return -1;
+	}
+	if (fread(&ehdr, sizeof(ehdr), 1, fp) != 1 ||
+	    memcmp(ehdr.e_ident, ELFMAG, SELFMAG) ||
+	    ehdr.e_ident[EI_CLASS] != ELFCLASS32)
+		goto out;
+
+	shdr = calloc(ehdr.e_shnum, sizeof(*shdr));
+	if (!shdr ||
+	    sym_read(fp, ehdr.e_shoff, shdr, ehdr.e_shnum * sizeof(*shdr)))
+		goto out;
+
+	sym_build_id(fp, &ehdr, shdr, key, sizeof(key));
+	if (cached && !sym_cache_path(key, path, sizeof(path), 0) &&
+	    !sym_cache_load(path)) {
+		ret = 0;
+		goto out;
+	}
+
+	if (sym_load_syms(fp, &ehdr, shdr))
+		goto out;
+	if (sym_lines && sym_load_lines(fp, &ehdr, shdr))
+		fprintf(stderr, "No line table in %s\n", vmlinux);
+	if (cached)
+		sym_cache_save(key);
+	ret = 0;
+
+out:
+	if (ret) {
+		fprintf(stderr, "No symbol table in %s\n", vmlinux);
+		sym_free();
+	}
+	free(shdr);
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * Load the code symbols of vmlinux and with -L its line table, from the
+ * cached index when there is one for this build.
+ */
+int sym_load(const char *vmlinux)
+{
+	return sym_load_elf(vmlinux, 1);
+}
+
+/* the symbol addr is in and the offset into it, NULL if none */
+const char *sym_lookup(unsigned long addr, unsigned long *off)
+{
+	int i;
+
+	if (addr > 0xffffffffUL)
+		return NULL;
+	i = sym_index_find(&sym_idx, addr);
+	if (i < 0)
+		return NULL;
+
+	*off = addr - sym_idx.addr[i];
+	return sym_names + sym_name[i];
+}
+
+/* the source file and line of addr, NULL if the line table has none */
+const char *sym_line(unsigned long addr, int *line)
+{
+	int i;
+
+	if (addr > 0xffffffffUL)
+		return NULL;
+	i = sym_index_find(&line_idx, addr);
+	if (i < 0 || !line_no[i])
+		return NULL;
+
+	*line = line_no[i];
+	return line_files + line_file[i];
+}
+
+static double sym_elapsed(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+	    (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+#define SYM_BENCH_LOOKUPS	(4 << 20)
+
+/* keeps the timed loops from being optimized away */
+volatile unsigned long sym_bench_sink;
+
+/*
+ * Time loading vmlinux from the ELF and from the cached index, and the
+ * lookups per second of the index against a plain binary search, for
+ * random addresses in the kernel text.
+ */
+int sym_bench(const char *vmlinux)
+{
+	struct timeval start;
+	unsigned int *addr, lo, span, i;
+	double elf, cache, t_eyt, t_bin;
+	unsigned long sum = 0;
+
+	gettimeofday(&start, NULL);
+	if (sym_load_elf(vmlinux, 0))
+		return 1;
+	elf = sym_elapsed(&start);
+	if (!sym_idx.n) {
+		fprintf(stderr, "No code symbols in %s\n", vmlinux);
+		return 1;
+	}
+	lo = sym_idx.addr[0];
+	span = sym_idx.addr[sym_idx.n - 1] - lo + 1;
+	printf("%u symbols, %u bytes of names", sym_idx.n, sym_names_len);
+	if (sym_lines)
+		printf(", %u line rows, %u bytes of file names", line_idx.n,
+		       line_files_len);
+	printf("\nload from ELF       %8.1f ms\n", elf * 1e3);
+
+	/* write the cache now, then time reading it back */
+	sym_load_elf(vmlinux, 1);
+	gettimeofday(&start, NULL);
+	if (sym_load(vmlinux) || !sym_cache) {
+		fprintf(stderr, "Could not cache the index of %s\n", vmlinux);
+		return 1;
+	}
+	cache = sym_elapsed(&start);
+	printf("load from cache     %8.1f ms\n", cache * 1e3);
+
+	addr = malloc(SYM_BENCH_LOOKUPS * sizeof(*addr));
+	if (!addr)
+		return 1;
+	srand(1);
+	for (i = 0; i < SYM_BENCH_LOOKUPS; i++)
+		addr[i] = lo + (unsigned int)(((unsigned long long)rand() *
+					       RAND_MAX + rand()) % span);
+
+	for (i = 0; i < SYM_BENCH_LOOKUPS; i++)
+		if (sym_index_find(&sym_idx, addr[i]) !=
+		    sym_index_bsearch(&sym_idx, addr[i])) {
+			fprintf(stderr, "Index mismatch at %08x\n", addr[i]);
+			free(addr);
+			return 1;
+		}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < SYM_BENCH_LOOKUPS; i++)
+		sum += sym_index_find(&sym_idx, addr[i]);
+	t_eyt = sym_elapsed(&start);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < SYM_BENCH_LOOKUPS; i++)
+		sum -= sym_index_bsearch(&sym_idx, addr[i]);
+	t_bin = sym_elapsed(&start);
+	printf("eytzinger lookups   %8.2f M/s\n",
+	       SYM_BENCH_LOOKUPS / t_eyt / 1e6);
+	printf("binary search       %8.2f M/s\n",
+	       SYM_BENCH_LOOKUPS / t_bin / 1e6);
+
+	if (sym_lines && line_idx.n) {
+		gettimeofday(&start, NULL);
+		for (i = 0; i < SYM_BENCH_LOOKUPS; i++)
+			sum += sym_index_find(&line_idx, addr[i]);
+		t_eyt = sym_elapsed(&start);
+		printf("line lookups        %8.2f M/s\n",
+		       SYM_BENCH_LOOKUPS / t_eyt / 1e6);
+	}
+	sym_bench_sink = sum;
+	free(addr);
+	return 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-telemetry.c  the target's telemetry records as a time
+ *                          series on a port or in a columnar file
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "android-agent-proxy.h"
+
+/*
+ * The target sends a record of struct kgdb_telemetry, see f_kgdb.c,
+ * every period.  Each record after the first becomes a row of rates and
+ * percentages over the time since the one before.  The columns are
+ * fixed by the first record.
+ *
+ * Clients of the port get a line with the column names, then a line
+ * per row.  The columnar file is
+ *
+ *	"KGTELEM1", u32 columns, the column names each ending with a NUL
+ *
+ * then blocks of u32 rows followed by the rows of each column in turn,
+ * as doubles, all in the host's byte order.  A block is written every
+ * TELEMETRY_BLOCK rows or every second.
+ */
+#define TELEMETRY_HZ	10	/* without -r */
+#define TELEMETRY_CPUS	4
+#define TELEMETRY_IRQS	64
+#define TELEMETRY_SIZE	696
+#define TELEMETRY_COLS	(8 + TELEMETRY_CPUS * 5 + TELEMETRY_IRQS)
+#define TELEMETRY_BLOCK	64
+#define COL_NAME	16
+
+/* the fields of a record, see struct kgdb_telemetry */
+struct telemetry {
+	unsigned long seq;
+	double secs;
+	unsigned long cost_ns;
+	int cpus;
+	int irqs;
+	int hz;
+	unsigned long long context_switches;
+	unsigned long forks;
+	unsigned long running;
+	unsigned long mem_kb[4];	/* total, free, buffers, cached */
+	unsigned long cpu[TELEMETRY_CPUS][8];
+	unsigned long irq[TELEMETRY_IRQS][2];
+};
+
+int telemetry_port;
+char *telemetry_addr;
+
+static struct port_st *telemetry_target;
+static int telemetry_sock = -1;
+static int telemetry_client = -1;
+static pthread_t telemetry_thread;
+
+static FILE *telemetry_fp;
+static struct telemetry first, prev;
+static int have_prev;
+static double start_secs;
+
+static char col_names[TELEMETRY_COLS][COL_NAME];
+static int ncols;
+static double block[TELEMETRY_BLOCK][TELEMETRY_COLS];
+static int block_rows;
+static time_t block_time;
+
+static unsigned long tm_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static unsigned long long tm_le64(const unsigned char *p)
+{
+	return tm_le32(p) | (unsigned long long)tm_le32(p + 4) << 32;
+}
+
+static void telemetry_parse(const unsigned char *p, struct telemetry *t)
+{
+	int i, j;
+
+	t->seq = tm_le32(p + 4);
+	t->secs = tm_le64(p + 8) / 1e9;
+	t->cost_ns = tm_le32(p + 16);
+	t->cpus = p[20] > TELEMETRY_CPUS ? TELEMETRY_CPUS : p[20];
+	t->irqs = p[21] > TELEMETRY_IRQS ? TELEMETRY_IRQS : p[21];
+	t->hz = p[22] | p[23] << 8;
+	t->context_switches = tm_le64(p + 24);
+	t->forks = tm_le32(p + 32);
+	t->running = tm_le32(p + 36);
+	for (i = 0; i < 4; i++)
+		t->mem_kb[i] = tm_le32(p + 40 + 4 * i);
+	for (i = 0; i < TELEMETRY_CPUS; i++)
+		for (j = 0; j < 8; j++)
+			t->cpu[i][j] = tm_le32(p + 56 + 32 * i + 4 * j);
+	for (i = 0; i < TELEMETRY_IRQS; i++) {
+		t->irq[i][0] = tm_le32(p + 184 + 8 * i);
+		t->irq[i][1] = tm_le32(p + 188 + 8 * i);
+	}
+}
+
+static void telemetry_columns(const struct telemetry *t)
+{
+	static const char *cpu_cols[] = { "user", "system", "irq", "iowait",
+					  "idle" };
+	static const char *cols[] = { "t", "ctxsw", "forks", "running",
+				      "mem_free_kb", "mem_buffers_kb",
+				      "mem_cached_kb", "cost_us" };
+	int i, j;
+
+	for (i = 0; i < 8; i++)
+		strcpy(col_names[ncols++], cols[i]);
+	for (i = 0; i < t->cpus; i++)
+		for (j = 0; j < 5; j++)
+			snprintf(col_names[ncols++], COL_NAME, "cpu%d_%s", i,
+				 cpu_cols[j]);
+	for (i = 0; i < t->irqs; i++)
+		snprintf(col_names[ncols++], COL_NAME, "irq%lu",
+			 t->irq[i][0]);
+}
+
+/* the count of irq in t, 0 if it is not there */
+static unsigned long telemetry_irq(const struct telemetry *t,
+				   unsigned long irq)
+{
+	int i;
+
+	for (i = 0; i < t->irqs; i++)
+		if (t->irq[i][0] == irq)
+			return t->irq[i][1];
+	return 0;
+}
+
+/* the row of t after prev, in the columns of the first record */
+static void telemetry_row(const struct telemetry *t, double *row)
+{
+	double dt = t->secs - prev.secs;
+	unsigned long d[8], total;
+	int n = 0, i, j;
+
+	row[n++] = t->secs - start_secs;
+	row[n++] = (t->context_switches - prev.context_switches) / dt;
+	row[n++] = (t->forks - prev.forks) / dt;
+	row[n++] = t->running;
+	row[n++] = t->mem_kb[1];
+	row[n++] = t->mem_kb[2];
+	row[n++] = t->mem_kb[3];
+	row[n++] = t->cost_ns / 1000.0;
+
+	for (i = 0; i < first.cpus; i++) {
+		for (j = total = 0; j < 7; j++) {
+			d[j] = t->cpu[i][j] - prev.cpu[i][j];
+			total += d[j];
+		}
+		if (!total)
+			total = 1;
+		/* user and nice, system, irq and softirq, iowait, idle */
+		row[n++] = 100.0 * (d[0] + d[1]) / total;
+		row[n++] = 100.0 * d[2] / total;
+		row[n++] = 100.0 * (d[5] + d[6]) / total;
+		row[n++] = 100.0 * d[4] / total;
+		row[n++] = 100.0 * d[3] / total;
+	}
+
+	for (i = 0; i < first.irqs; i++)
+		row[n++] = (telemetry_irq(t, first.irq[i][0]) -
+			    telemetry_irq(&prev, first.irq[i][0])) / dt;
+}
+
+static void telemetry_flush(void)
+{
+	int c, r;
+
+	if (!telemetry_fp || !block_rows)
+		return;
+
+	fwrite(&block_rows, 4, 1, telemetry_fp);
+	for (c = 0; c < ncols; c++)
+		for (r = 0; r < block_rows; r++)
+			fwrite(&block[r][c], sizeof(double), 1, telemetry_fp);
+	fflush(telemetry_fp);
+	block_rows = 0;
+	block_time = time(NULL);
+}
+
+static void telemetry_header(void)
+{
+	char line[TELEMETRY_COLS * (COL_NAME + 1) + 2];
+	int c, n = 0;
+
+	if (telemetry_fp) {
+		unsigned int cols = ncols;
+
+		fwrite("KGTELEM1", 1, 8, telemetry_fp);
+		fwrite(&cols, 4, 1, telemetry_fp);
+		for (c = 0; c < ncols; c++)
+			fwrite(col_names[c], 1, strlen(col_names[c]) + 1,
+			       telemetry_fp);
+	}
+
+	if (telemetry_client >= 0) {
+		for (c = 0; c < ncols; c++)
+			n += sprintf(line + n, "%s%s", c ? " " : "# ",
+				     col_names[c]);
+		line[n++] = '\n';
+		send(telemetry_client, line, n, MSG_DONTWAIT);
+	}
+}
+
+/* a row to the client, dropped rather than waited for */
+static void telemetry_send(const double *row)
+{
+	char line[TELEMETRY_COLS * 16 + 2];
+	int c, n = 0;
+
+	for (c = 0; c < ncols; c++)
+		n += sprintf(line + n, c ? " %.6g" : "%.3f", row[c]);
+	line[n++] = '\n';
+	if (send(telemetry_client, line, n, MSG_DONTWAIT) < 0 &&
+	    errno != EAGAIN) {
+		close(telemetry_client);
+		telemetry_client = -1;
+	}
+}
+
+/*
+ * Called by the usb thread for everything the target sends.  Returns
+ * how much of buf was a telemetry record.
+ */
+int telemetry_target_data(char *buf, int len)
+{
+	struct telemetry t;
+	double *row;
+
+	if ((!telemetry_port && !telemetry_fp) || len < TELEMETRY_SIZE ||
+	    buf[0] != '@')
+		return 0;
+
+	telemetry_parse((unsigned char *)buf, &t);
+	if (!have_prev) {
+		first = t;
+		start_secs = t.secs;
+		telemetry_columns(&t);
+		telemetry_header();
+	} else if (t.secs > prev.secs) {
+		row = block[block_rows];
+		telemetry_row(&t, row);
+		if (telemetry_client >= 0)
+			telemetry_send(row);
+		if (telemetry_fp && (++block_rows == TELEMETRY_BLOCK ||
+				     time(NULL) != block_time))
+			telemetry_flush();
+	}
+	prev = t;
+	have_prev = 1;
+
+	return len;
+}
+
+static void *telemetry_thread_main(void *arg)
+{
+	int fd;
+
+	for (;;) {
+		fd = accept(telemetry_sock, NULL, NULL);
+		if (fd < 0)
+			continue;
+		if (debug)
+			printf("telemetry: client connected\n");
+		/* the newest client wins */
+		if (telemetry_client >= 0)
+			close(telemetry_client);
+		telemetry_client = fd;
+		if (have_prev)
+			telemetry_header();
+	}
+
+	return NULL;
+}
+
+static int telemetry_listen(void)
+{
+	telemetry_sock = listen_socket("telemetry", telemetry_addr,
+				       telemetry_port, 1);
+	if (telemetry_sock < 0) {
+		telemetry_port = 0;
+		return 1;
+	}
+
+	return pthread_create(&telemetry_thread, NULL, telemetry_thread_main,
+			      NULL);
+}
+
+/*
+ * Have the usb target send telemetry prof_hz times a second, for the
+ * clients of telemetry_port and, if path is set, to a columnar file.
+ */
+int telemetry_start(struct port_st *target, const char *path)
+{
+	int hz = prof_hz ? prof_hz : TELEMETRY_HZ;
+
+	if (hz <= 0 || hz > 100) {
+		printf("Error: bad telemetry rate %d\n", hz);
+		telemetry_port = 0;
+		return 1;
+	}
+
+	telemetry_target = target;
+	if (path) {
+		telemetry_fp = fopen(path, "w");
+		if (!telemetry_fp) {
+			printf("Error: Could not open %s\n", path);
+			return 1;
+		}
+		block_time = time(NULL);
+	}
+	if (telemetry_port && telemetry_listen())
+		return 1;
+
+	if (usb_set_telemetry(target, 1000 / hz)) {
+		printf("Error: the target has no telemetry\n");
+		return 1;
+	}
+
+	return 0;
+}
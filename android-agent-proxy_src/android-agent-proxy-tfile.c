@@ -0,0 +1,165 @@
+/*
+ * Agent proxy for android
+ *
+ * agent-proxy-tfile.c  upload of the kgdb trace buffer to a trace file
+ *                      that gdb opens with "target tfile"
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "android-agent-proxy.h"
+
+/* bytes asked for per read, the target sends what fits in a packet */
+#define TFILE_CHUNK	0x10000
+
+static char reply[2 * IO_BUFSIZE];
+
+/*
+ * The target is stopped with a break for the upload and detached from
+ * afterwards, which resumes it.  Tracing goes on across that if gdb
+ * set disconnected-tracing before it detached; "tstop" first for a
+ * complete buffer.  The file has the layout gdb's
+ * "tsave" writes: a text header with the register block size, the
+ * trace status and the tracepoint definitions, then the raw trace
+ * frames and an empty frame number.  The frames are read with the
+ * binary qkgdb.tbuf query, or with the standard hex qTBuffer packet
+ * when the target does not have it.
+ */
+static int tfile_write(struct port_st *port, const char *path)
+{
+	char status[IO_BUFSIZE];
+	char cmd[64];
+	struct timeval start, end;
+	unsigned long off = 0;
+	double secs;
+	int binary = 1;
+	int done = 0;
+	int regsize;
+	char *data;
+	FILE *fp;
+	int len;
+
+	len = gdb_command(port, "qTStatus", status, sizeof(status));
+	if (len <= 0 || status[0] != 'T') {
+		fprintf(stderr, "No trace status, does the kernel have "
+			"tracepoint support?\n");
+		return 1;
+	}
+
+	len = gdb_command(port, "g", reply, sizeof(reply));
+	if (len <= 0 || reply[0] == 'E') {
+		fprintf(stderr, "Could not read the registers\n");
+		return 1;
+	}
+	regsize = len / 2;
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		fprintf(stderr, "ERROR: Could not open %s\n", path);
+		return 1;
+	}
+
+	fprintf(fp, "\x7fTRACE0\n");
+	fprintf(fp, "R %x\n", regsize);
+	fprintf(fp, "status %s\n", status + 1);
+	for (strcpy(cmd, "qTfP");; strcpy(cmd, "qTsP")) {
+		len = gdb_command(port, cmd, reply, sizeof(reply));
+		if (len <= 0 || reply[0] == 'l' || reply[0] == 'E')
+			break;
+		fprintf(fp, "tp %s\n", reply);
+	}
+	fprintf(fp, "\n");
+
+	gettimeofday(&start, NULL);
+	while (!done) {
+		if (binary)
+			sprintf(cmd, "qkgdb.tbuf:%lx,%x", off, TFILE_CHUNK);
+		else
+			sprintf(cmd, "qTBuffer:%lx,%x", off, TFILE_CHUNK);
+		len = gdb_command(port, cmd, reply, sizeof(reply));
+		if (len == 0 && binary) {
+			binary = 0;
+			continue;
+		}
+		if (len <= 0 || reply[0] == 'E') {
+			fprintf(stderr, "\nTrace buffer read failed at %lx\n",
+				off);
+			fclose(fp);
+			return 1;
+		}
+
+		if (binary) {
+			done = reply[0] == 'l';
+			data = reply + 1;
+			len = gdb_unescape(data, len - 1);
+		} else if (reply[0] == 'l') {
+			break;
+		} else {
+			data = reply;
+			len = gdb_hex2bin(data, len);
+		}
+
+		if (fwrite(data, 1, len, fp) != len) {
+			fprintf(stderr, "\nERROR: write to %s failed\n", path);
+			fclose(fp);
+			return 1;
+		}
+		off += len;
+		printf("\r%lu bytes", off);
+		fflush(stdout);
+	}
+
+	/* the end of the frames */
+	memset(reply, 0, 2);
+	fwrite(reply, 1, 2, fp);
+	fclose(fp);
+
+	gettimeofday(&end, NULL);
+	secs = (end.tv_sec - start.tv_sec) +
+	    (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("\r%lu bytes of trace frames in %.2fs (%.1f KB/s) written "
+	       "to %s\n", off, secs, secs > 0 ? off / 1024.0 / secs : 0.0,
+	       path);
+
+	return 0;
+}
+
+int tfile_upload(struct port_st *port, const char *path)
+{
+	int ret;
+
+	if (gdb_port_open(port) || gdb_stop_target(port))
+		return 1;
+
+	ret = tfile_write(port, path);
+
+	/* resume the kernel */
+	if (gdb_command(port, "D", reply, sizeof(reply)) < 0) {
+		fprintf(stderr, "The target did not answer the detach, it "
+			"may still be stopped in kgdb\n");
+		ret = 1;
+	}
+
+	return ret;
+}
@@ -73,6 +73,15 @@ static struct usb_handle handle_list = {
 #define KGDB_SUBCLASS           0x50
 #define KGDB_PROTOCOL           0x1
 
+/* vendor requests to the kgdb interface, see f_kgdb.c */
+#define KGDB_REQ_BREAK          0x01
+#define KGDB_REQ_SAMPLER        0x02
+#define KGDB_REQ_TRACE          0x03
+#define KGDB_REQ_TELEMETRY      0x04
+
+/* wValue of KGDB_REQ_BREAK, have the target sample every cpu */
+#define KGDB_BREAK_SAMPLE       0x0001
+
 void usb_cleanup()
 {
 	libusb_exit(ctx);
@@ -112,6 +121,7 @@ static int usb_bulk_write(struct usb_handle *uh, const void *data, int len)
 			&transferred, 0);
 
 	if (r != 0) {
+		metrics_usb_error(METRICS_USB_WRITE, r);
 		if (usb_debug) {
 			printf("usb_bulk_write(): ");
 			report_bulk_libusb_error(r);
@@ -130,7 +140,12 @@ static int usb_bulk_read(struct usb_handle *uh, void *data, int len)
 	r = libusb_bulk_transfer(uh->devh, uh->end_point_address[0], data, len,
 			&transferred, 100);
 
+	/* a long read can time out part way, keep what did arrive */
+	if (r == LIBUSB_ERROR_TIMEOUT && transferred > 0)
+		return transferred;
+
 	if (r != 0) {
+		metrics_usb_error(METRICS_USB_READ, r);
 		if (usb_debug) {
 			printf("usb_bulk_read(): ");
 			report_bulk_libusb_error(r);
@@ -500,7 +515,11 @@ int  usb_portopen(struct port_st *port)
 	}
 
 	/* initial device scan */
-	return scan_usb_devices();
+	r = scan_usb_devices();
+	if (!r)
+		METRIC_ADD(metrics.usb_attached, 1);
+
+	return r;
 }
 
 
@@ -529,6 +548,59 @@ int usb_portread(struct port_st *port, char *buf, int size, int opts)
  * TCP specific routine for reading
  */
 
+static int usb_vendor_request(const char *who, int request, int value)
+{
+	int r;
+
+	r = libusb_control_transfer(android_uh.devh,
+			LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR |
+			LIBUSB_RECIPIENT_INTERFACE, request, value,
+			android_uh.interface, NULL, 0, 1000);
+	if (r < 0) {
+		metrics_usb_error(METRICS_USB_CONTROL, r);
+		printf("%s(): ", who);
+		report_bulk_libusb_error(r);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * gdb's interrupt.  The target only reads the bulk endpoint when it is
+ * stopped in kgdb, so the break goes out as a control request.
+ */
+int usb_send_break(struct port_st *port)
+{
+	return usb_vendor_request("usb_send_break", KGDB_REQ_BREAK, 0);
+}
+
+/* the same for the profiler, sampling the cpus for qkgdb.sample */
+int usb_send_sample_break(struct port_st *port)
+{
+	return usb_vendor_request("usb_send_sample_break", KGDB_REQ_BREAK,
+				  KGDB_BREAK_SAMPLE);
+}
+
+/* start the target's pc sampler at hz, or stop it with 0 */
+int usb_set_sampler(struct port_st *port, int hz)
+{
+	return usb_vendor_request("usb_set_sampler", KGDB_REQ_SAMPLER, hz);
+}
+
+/* turn the target's ftrace stream on or off */
+int usb_set_trace(struct port_st *port, int on)
+{
+	return usb_vendor_request("usb_set_trace", KGDB_REQ_TRACE, on);
+}
+
+/* have the target send telemetry every ms, or stop it with 0 */
+int usb_set_telemetry(struct port_st *port, int ms)
+{
+	return usb_vendor_request("usb_set_telemetry", KGDB_REQ_TELEMETRY,
+				  ms);
+}
+
 int usb_portwrite(struct port_st *port, char *buf, int size, int opts)
 {
 	opts = 0;
@@ -132,6 +132,65 @@ void usage()
 	printf("   Debug spliter to serial port at 115200 baud\n");
 	printf("      agent-proxy 4440^4441 0 /dev/ttyS0,115200\n");
 	printf("\n");
+	printf("   Upload the kgdb trace buffer to a file for gdb's target tfile,\n");
+	printf("   stopping the kernel for it\n");
+	printf("      agent-proxy -T trace.tf 0 v\n");
+	printf("   Write the RAM of a target stopped in kgdb to an ELF core,\n");
+	printf("   optionally only the physical ranges given with -R\n");
+	printf("      agent-proxy -M vmcore 0 v\n");
+	printf("      agent-proxy -M vmcore -R 0x20000000+0x100000 0 v\n");
+	printf("   The same through 'm' packets, for a kgdb without qkgdb.dump,\n");
+	printf("   with the memory map read through vmlinux\n");
+	printf("      agent-proxy -S vmcore -V vmlinux 0 v\n");
+	printf("   Print the backtraces of all tasks, symbolized with vmlinux\n");
+	printf("      agent-proxy -A -V vmlinux 0 v\n");
+	printf("   -L adds the file and line from the DWARF line table of vmlinux.\n");
+	printf("   Symbols are cached by build-id in ~/.cache/agent-proxy; time\n");
+	printf("   loading them and the lookups with\n");
+	printf("      agent-proxy -X -L -V vmlinux\n");
+	printf("   Cache target memory for gdb on a usb target, checked with\n");
+	printf("   qCRC when the target stops again\n");
+	printf("      agent-proxy -C 4440 0 v\n");
+	printf("   Read memory and look up symbols of the running kernel on\n");
+	printf("   port 4442, with 'm', qkgdb.sym: and qkgdb.addr: packets.\n");
+	printf("   This and -H, -K and -N listen on 127.0.0.1 unless given\n");
+	printf("   <addr>:<port>, as in -P 0.0.0.0:4442\n");
+	printf("      agent-proxy -P 4442 4440 0 v\n");
+	printf("   Profile the kernel at 200 Hz until ^C, writing folded stacks\n");
+	printf("   for flamegraph.pl\n");
+	printf("      agent-proxy -F kernel.folded -r 200 -V vmlinux 0 v\n");
+	printf("   Report the top functions of the running kernel every second\n");
+	printf("   on port 4443, sampled by the target at 1 kHz (-r to change)\n");
+	printf("      agent-proxy -H 4443 -V vmlinux 4440 0 v\n");
+	printf("   Record the ftrace buffer to trace.dat while proxying, until ^C,\n");
+	printf("   with the event formats from a copy of the tracing directory\n");
+	printf("      agent-proxy -Q trace.dat -E tracing 4440 0 v\n");
+	printf("   The same from a target stopped in kgdb\n");
+	printf("      agent-proxy -W trace.dat -E tracing 0 v\n");
+	printf("   Cpu load, interrupts, context switches and memory 10 times\n");
+	printf("   a second (-r to change) on port 4444 and in a columnar file\n");
+	printf("      agent-proxy -K 4444 -O telemetry.col 4440 0 v\n");
+	printf("   Follow oops, BUG and WARN blocks on the console with a copy\n");
+	printf("   giving the symbol and line of each address\n");
+	printf("      agent-proxy -U -L -V vmlinux 4440^4441 0 v\n");
+	printf("   Time the initcalls of a boot with initcall_debug into a\n");
+	printf("   timeline, compared to an earlier one, and the same offline\n");
+	printf("      agent-proxy -Y boot.json -Z old.json 4440^4441 0 v\n");
+	printf("      agent-proxy -Y boot.json -Z old.json\n");
+	printf("   Time the round trip of gdb's packets, printed by packet type\n");
+	printf("   on kill -USR1 <pid>\n");
+	printf("      agent-proxy -I 4440^4441 0 v\n");
+	printf("   Print how long a target stopped in kgdb took to enter, wait\n");
+	printf("   for the other cpus, hear from the host and resume\n");
+	printf("      agent-proxy -k 0 v\n");
+	printf("   Serve the proxy's counters on port 9100 for Prometheus\n");
+	printf("      agent-proxy -N 9100 4440^4441 0 v\n");
+	printf("      agent-proxy -N 0.0.0.0:9100 4440^4441 0 v\n");
+	printf("   Capture every read and write to a binary file, cheaper than\n");
+	printf("   -d, and print it with the packets and console text\n");
+	printf("      agent-proxy -J capture.bin 4440^4441 0 v\n");
+	printf("      agent-proxy -J capture.bin\n");
+	printf("\n");
 	exit(1);
 }
 
@@ -215,6 +274,59 @@ static void setRemoteSockOpts(int nsock)
 	setsockopt(nsock, IPPROTO_TCP, TCP_NODELAY, (void *)&on, sizeof on);
 }
 
+/*
+ * Split the <port> or <addr>:<port> of the -P, -H, -K and -N services,
+ * leaving *addr NULL when there is no address.  Returns the port.
+ */
+int listen_spec(char *spec, char **addr)
+{
+	char *endstr;
+
+	*addr = NULL;
+	if ((endstr = strchr(spec, ':'))) {
+		*endstr = '\0';
+		*addr = spec;
+		spec = endstr + 1;
+	}
+
+	return atoi(spec);
+}
+
+/*
+ * The listening socket of a service, on addr or 127.0.0.1 when that is
+ * NULL, so that nothing is reachable from another machine unless asked
+ * for.  Returns -1 after printing the error.
+ */
+int listen_socket(const char *what, const char *addr, int port, int backlog)
+{
+	struct sockaddr_in serv_addr;
+	int sock, tmp = 1;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		printf("Error opening socket");
+		return -1;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&tmp, sizeof(tmp));
+
+	memset(&serv_addr, 0, sizeof(serv_addr));
+	serv_addr.sin_family = AF_INET;
+	if (addr)
+		serv_addr.sin_addr.s_addr = inet_addr(addr);
+	else
+		serv_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	serv_addr.sin_port = htons((short)port);
+	if (bind(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0 ||
+	    listen(sock, backlog) < 0) {
+		printf("Error: cannot serve the %s on %s:%d\n", what,
+		       addr ? addr : "127.0.0.1", port);
+		CLOSESOCKET(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
 /*
  * Compute the value that should be used for the first parameter to
  * select from the global set of file handles that are in use by the
@@ -361,6 +473,10 @@ static void killport(struct port_st *port)
 		return;
 	}
 
+	/* a gdb client accepted by localPortReadMessage() */
+	if (port->isLocal && !port->cls)
+		METRIC_ADD(metrics.clients[METRICS_GDB], -1);
+
 	if (port->scriptRef && port == port->scriptRef->lscript) {
 		if (!(port->scriptRef->rscript->type == PORT_UDP ||
 		      port->scriptRef->rscript->type == PORT_LISTEN ||
@@ -820,6 +936,7 @@ static void killScriptClient(struct port_st *s_port, struct port_st **iport,
 	} else {
 		prev->clientNext = find->clientNext;
 	}
+	METRIC_ADD(metrics.clients[METRICS_CONSOLE], -1);
 	killport(find);
 }
 #ifdef FEATURE_PORT_USB
@@ -845,6 +962,9 @@ static int writeUSBScriptClients(struct port_st *s_port, char *buf, int bytes,
 	char new_buf[IO_BUFSIZE];
 	int count = 0;
 	int found = 0;
+	const char *decoded;
+	int ndecoded = 0;
+	int at = bytes;
 
 
 	for (i = 0; i < bytes; i++) {
@@ -864,10 +984,31 @@ static int writeUSBScriptClients(struct port_st *s_port, char *buf, int bytes,
 		count++;
 	}
 	
+	if (boot_file)
+		boot_feed(new_buf, count);
+	if (oops_decode)
+		ndecoded = oops_feed(new_buf, count, &decoded, &at);
 
 	while (iport != NULL) {
 
-		got = iport->portwrite(iport, new_buf, count , opts);
+		if (!ndecoded) {
+			got = iport->portwrite(iport, new_buf, count , opts);
+		} else {
+			/* the decoded blocks go in after the line ending them */
+			got = at ? iport->portwrite(iport, new_buf, at, opts) : 1;
+			if (got > 0)
+				got = iport->portwrite(iport, (char *)decoded,
+						       ndecoded, opts);
+			if (got > 0 && at < count)
+				got = iport->portwrite(iport, new_buf + at,
+						       count - at, opts);
+		}
+		if (got > 0) {
+			METRICS_IO(METRICS_CONSOLE, METRICS_TX,
+				   count + ndecoded);
+			CAPTURE_IO(METRICS_CONSOLE, METRICS_TX, iport, new_buf,
+				   count);
+		}
 		if (logchar)
 			printf(">=%i#%i= ", iport->sock, got);
 		if (got <= 0) {
@@ -931,6 +1072,8 @@ static int writeScriptClients(struct port_st *s_port, char *buf, int bytes,
 
 	while (iport != NULL) {
 		got = iport->portwrite(iport, buf, bytes, opts);
+		METRICS_IO(METRICS_CONSOLE, METRICS_TX, got);
+		CAPTURE_IO(METRICS_CONSOLE, METRICS_TX, iport, buf, got);
 		if (logchar)
 			printf(">=%i#%i= ", iport->sock, got);
 		if (got <= 0) {
@@ -973,12 +1116,17 @@ char staticBrkStrLen = 3;
 char *breakStr;
 char breakStrLen = 0;
 
-static int sendSpecialBreak(struct port_st *port, char *breakString, int len)
+int sendSpecialBreak(struct port_st *port, char *breakString, int len)
 {
 	char *ptr = breakString;
 	int i;
 	int rec;
 
+#ifdef FEATURE_PORT_USB
+	if (port->type == PORT_USB)
+		return usb_send_break(port);
+#endif
+
 	for (i = 0; i < len; i++) {
 		if ((unsigned char)ptr[i] == 0xff &&
 		    (i + 1 < len) &&
@@ -1071,14 +1219,14 @@ static int scriptClientPortReadMessage(struct port_st *iport)
 		/* No further processing */
 		goto bad_status;
 	}
+	METRICS_IO(METRICS_CONSOLE, METRICS_RX, got);
+	CAPTURE_IO(METRICS_CONSOLE, METRICS_RX, iport, iport->buf, got);
 	if (debug) {
 		printf("Read from script: %i got: %i\n", iport->sock, got);
 	}
 	if (logchar) {
-		int j;
 		printf("<%i=", iport->sock);
-		for (j = 0; j < got; j++)
-			printf("%c", iport->buf[j]);
+		fwrite(iport->buf, 1, got, stdout);
 		printf("= ");
 	}
 
@@ -1190,6 +1338,7 @@ static int scriptPortReadMessage(struct port_st *s_port)
 	iport->scriptRef = s_port;
 	iport->clientNext = s_port->clients;
 	s_port->clients = iport;
+	METRIC_ADD(metrics.clients[METRICS_CONSOLE], 1);
 
 	if (debug)
 		printf("Added script client: %i\n", iport->sock);
@@ -1262,6 +1411,7 @@ static int localPortReadMessage(struct port_st *l_port)
 			return 0;
 		} else {
 			iport->peer = peer;
+			METRIC_ADD(metrics.clients[METRICS_GDB], 1);
 			/* Connect up to the external port and put that on
 			 * the queue as well as setting up the peer.
 			 */
@@ -1314,16 +1464,19 @@ static int localPortReadMessage(struct port_st *l_port)
 				    ("Terminating because STDIN read return <= 0\n");
 				exit(0);
 			}
+			CAPTURE_IO(METRICS_GDB, METRICS_RX, l_port, l_port->buf,
+				   got);
 			if (logchar) {
-				int j;
 				printf("<%i=", l_port->sock);
-				for (j = 0; j < got; j++)
-					printf("%c", l_port->buf[j]);
+				if (got > 0)
+					fwrite(l_port->buf, 1, got, stdout);
 				printf("=\n");
 			}
 			got =
 			    l_port->peer->portwrite(l_port->peer, l_port->buf,
 						    got, 0);
+			CAPTURE_IO(METRICS_TARGET, METRICS_TX, l_port->peer,
+				   l_port->buf, got);
 			if (got <= 0) {
 				printf("Error writing to remote: %s on %i\n",
 				       l_port->peer->name, l_port->peer->sock);
@@ -1434,10 +1587,9 @@ static int remotePortReadMessage(struct port_st *iport)
 
 	rgot = iport->portread(iport, iport->buf, sizeof(iport->buf), 0);
 	if (logchar) {
-		int j;
 		printf("<%i=", iport->sock);
-		for (j = 0; j < rgot; j++)
-			printf("%c", iport->buf[j]);
+		if (rgot > 0)
+			fwrite(iport->buf, 1, rgot, stdout);
 		printf("= ");
 	}
 	if (rgot <= 0) {
@@ -1445,16 +1597,45 @@ static int remotePortReadMessage(struct port_st *iport)
 		/* No further processing */
 		goto bad_status;
 	} else {
+		METRICS_IO(iport->isLocal ? METRICS_GDB : METRICS_TARGET,
+			   METRICS_RX, rgot);
+		CAPTURE_IO(iport->isLocal ? METRICS_GDB : METRICS_TARGET,
+			   METRICS_RX, iport, iport->buf, rgot);
 		if (telnetNegotiation) {
 			rgot = processIACoptions(iport, rgot);
 			if (rgot <= 0)
 				goto good_status;
 		}
 
+#ifdef FEATURE_PORT_USB
+		/* gdb's ^C, a running target would never read it */
+		if (rgot == 1 && iport->buf[0] == 0x03 && iport->isLocal &&
+		    iport->peer && iport->peer->type == PORT_USB) {
+			sendSpecialBreak(iport->peer, defaultBrkStr,
+					 defaultBrkStrLen);
+			goto good_status;
+		}
+
+		if (mcache_enabled && iport->isLocal && iport->peer &&
+		    iport->peer->type == PORT_USB) {
+			rgot = mcache_gdb_data(iport, iport->peer, iport->buf,
+					       rgot);
+			if (rgot <= 0)
+				goto good_status;
+		}
+#endif
+
 		if (iport->peer && iport->peer->sock >= 0) {
+			/* timed before the write, the reply can beat its return */
+			if (rtt_enabled && iport->isLocal)
+				rtt_request(iport->peer, iport->buf, rgot);
 			wgot =
 			    iport->peer->portwrite(iport->peer, iport->buf,
 						   rgot, 0);
+			METRICS_IO(iport->isLocal ? METRICS_TARGET : METRICS_GDB,
+				   METRICS_TX, wgot);
+			CAPTURE_IO(iport->isLocal ? METRICS_TARGET : METRICS_GDB,
+				   METRICS_TX, iport->peer, iport->buf, wgot);
 			if (logchar)
 				printf(">=%i#%i= ", iport->sock, wgot);
 
@@ -1467,6 +1648,8 @@ static int remotePortReadMessage(struct port_st *iport)
 				/* No further processing */
 				goto bad_status;
 			}
+			if (rtt_enabled && !iport->isLocal)
+				rtt_reply(iport, iport->buf, rgot);
 		} else {
 			if (debug)
 				printf
@@ -1543,22 +1726,48 @@ static int remoteUSBPortReadMessage(struct port_st *iport)
 
 	rgot = iport->portread(iport, iport->buf, sizeof(iport->buf), 0);
 	if (logchar) {
-		int j;
 		printf("<%i=", iport->sock);
-		for (j = 0; j < rgot; j++)
-			printf("%c", iport->buf[j]);
+		if (rgot > 0)
+			fwrite(iport->buf, 1, rgot, stdout);
 		printf("= ");
 	}
 	if (rgot > 0) {
+		METRICS_IO(METRICS_TARGET, METRICS_RX, rgot);
+		CAPTURE_IO(METRICS_TARGET, METRICS_RX, iport, iport->buf, rgot);
 		if (telnetNegotiation) {
 			rgot = processIACoptions(iport, rgot);
 			if (rgot <= 0)
 				goto good_status;
 		}
+
+		/* replies of the live peek channel go to its own port */
+		if (peek_target_data(iport->buf, rgot))
+			goto good_status;
+
+		/* and so do the sampler, ftrace and telemetry streams */
+		if (sampler_target_data(iport->buf, rgot) ||
+		    ftrace_target_data(iport->buf, rgot) ||
+		    telemetry_target_data(iport->buf, rgot))
+			goto good_status;
+
+		/* replies to the memory cache's own requests stop here */
+		if (mcache_enabled) {
+			wgot = mcache_target_data(iport->buf, rgot);
+			rgot -= wgot;
+			memmove(iport->buf, iport->buf + wgot, rgot);
+			if (rgot <= 0)
+				goto good_status;
+		}
 		
+		if (rtt_enabled)
+			rtt_reply(iport, iport->buf, rgot);
+
 		if (iport->peer && iport->peer->sock >= 0) {
 			wgot = iport->peer->portwrite(iport->peer, iport->buf,
 						   rgot, 0);
+			METRICS_IO(METRICS_GDB, METRICS_TX, wgot);
+			CAPTURE_IO(METRICS_GDB, METRICS_TX, iport->peer,
+				   iport->buf, wgot);
 			if (logchar)
 				printf(">=%i#%i= ", iport->sock, wgot);
                         
@@ -1613,6 +1822,7 @@ retry:
 		if (ret)
 			break;
 	}
+	METRIC_ADD(metrics.usb_reconnects, 1);
 	
 	sleep(1);
 	goto retry;
@@ -1640,6 +1850,19 @@ int main(int argc, char *argv[])
 	int select_ret;
 	char *s;
 	char *pidfile = 0;
+	char *tfile = NULL;
+	char *corefile = NULL;
+	char *coreranges = NULL;
+	char *vmlinux = NULL;
+	char *proffile = NULL;
+	char *tracefile = NULL;
+	char *tracedump = NULL;
+	char *tracedir = NULL;
+	char *telemetryfile = NULL;
+	int snapshot = 0;
+	int backtraces = 0;
+	int kgdblat = 0;
+	int symbench = 0;
 	int c;
 	int do_fork = 0;
 	int pargs = 0;
@@ -1702,6 +1925,9 @@ int main(int argc, char *argv[])
 			case 'd':
 				logchar = 1;
 				break;
+			case 'k':
+				kgdblat = 1;
+				break;
 			case 'v':
 				debug = 1;
 				break;
@@ -1718,6 +1944,122 @@ int main(int argc, char *argv[])
 				pidfile = argv[ind + 1];
 				ind++;
 				break;
+			case 'P':
+				if (ind + 1 >= argc) {
+					fprintf(stderr,
+						"%s: no argument specified for option -%c\n",
+						progname, c);
+					usage();
+				}
+				peek_port = listen_spec(argv[ind + 1],
+							&peek_addr);
+				ind++;
+				break;
+			case 'H':
+				if (ind + 1 >= argc) {
+					fprintf(stderr,
+						"%s: no argument specified for option -%c\n",
+						progname, c);
+					usage();
+				}
+				sampler_port = listen_spec(argv[ind + 1],
+							&sampler_addr);
+				ind++;
+				break;
+			case 'K':
+				if (ind + 1 >= argc) {
+					fprintf(stderr,
+						"%s: no argument specified for option -%c\n",
+						progname, c);
+					usage();
+				}
+				telemetry_port = listen_spec(argv[ind + 1],
+							     &telemetry_addr);
+				ind++;
+				break;
+			case 'T':
+				if (ind + 1 >= argc) {
+					fprintf(stderr,
+						"%s: no argument specified for option -%c\n",
+						progname, c);
+					usage();
+				}
+				tfile = argv[ind + 1];
+				ind++;
+				break;
+			case 'E':
+			case 'F':
+			case 'M':
+			case 'O':
+			case 'Q':
+			case 'R':
+			case 'S':
+			case 'V':
+			case 'W':
+			case 'Y':
+			case 'Z':
+			case 'J':
+				if (ind + 1 >= argc) {
+					fprintf(stderr,
+						"%s: no argument specified for option -%c\n",
+						progname, c);
+					usage();
+				}
+				if (c == 'E')
+					tracedir = argv[ind + 1];
+				else if (c == 'F')
+					proffile = argv[ind + 1];
+				else if (c == 'O')
+					telemetryfile = argv[ind + 1];
+				else if (c == 'Q')
+					tracefile = argv[ind + 1];
+				else if (c == 'W')
+					tracedump = argv[ind + 1];
+				else if (c == 'Y')
+					boot_file = argv[ind + 1];
+				else if (c == 'Z')
+					boot_baseline = argv[ind + 1];
+				else if (c == 'J')
+					capture_file = argv[ind + 1];
+				else if (c == 'M' || c == 'S')
+					corefile = argv[ind + 1];
+				else if (c == 'V')
+					vmlinux = argv[ind + 1];
+				else
+					coreranges = argv[ind + 1];
+				if (c == 'S')
+					snapshot = 1;
+				ind++;
+				break;
+			case 'A':
+				backtraces = 1;
+				break;
+			case 'L':
+				sym_lines = 1;
+				break;
+			case 'U':
+				oops_decode = 1;
+				break;
+			case 'I':
+				rtt_enabled = 1;
+				break;
+			case 'N':
+				if (ind + 1 >= argc) {
+					fprintf(stderr,
+						"%s: no argument specified for option -%c\n",
+						progname, c);
+					usage();
+				}
+				metrics_port = listen_spec(argv[ind + 1],
+							   &metrics_addr);
+				ind++;
+				break;
+			case 'X':
+				symbench = 1;
+				break;
+			case 'C':
+				mcache_enabled = 1;
+				break;
 			case 'G':
 				gdbSplit = 0;
 				break;
@@ -1727,6 +2069,7 @@ int main(int argc, char *argv[])
 			case 'b':
 			case 'l':
 			case 'p':
+			case 'r':
 			case 's':
 				if (*s == '\0') {
 					if (ind + 1 >= argc) {
@@ -1751,6 +2094,10 @@ int main(int argc, char *argv[])
 					latency = atoi(s);
 					break;
 
+				case 'r':
+					prof_hz = atoi(s);
+					break;
+
 				default:
 					fprintf(stderr,
 						"%s: option -%c not recognized\n",
@@ -1772,6 +2119,54 @@ int main(int argc, char *argv[])
 	FD_ZERO(&master_rds);
 	FD_ZERO(&master_wds);
 
+	if (symbench) {
+		if (!vmlinux) {
+			fprintf(stderr, "%s: -X needs -V vmlinux\n", progname);
+			usage();
+		}
+		exit(sym_bench(vmlinux));
+	}
+
+	if (boot_baseline && !boot_file) {
+		fprintf(stderr, "%s: -Z needs -Y\n", progname);
+		usage();
+	}
+	if (boot_baseline && !pargs)
+		exit(boot_compare(boot_file, boot_baseline));
+	if (capture_file && !pargs)
+		exit(capture_decode(capture_file));
+
+	/* Commands that talk to the target themselves take only the remote */
+	if (tfile || corefile || backtraces || proffile || tracedump ||
+	    kgdblat) {
+		if (pargs != 2)
+			usage();
+		r_ports = (struct port_st *)malloc(sizeof(struct port_st));
+		memset(r_ports, 0, sizeof(struct port_st));
+		if (setup_remote_port(r_ports, proxy_args[0], proxy_args[1])) {
+			printf("Open of remote port failed\n");
+			exit(1);
+		}
+		if (backtraces)
+			exit(bt_all(r_ports, vmlinux));
+		if (kgdblat)
+			exit(rtt_kgdb_latency(r_ports));
+		if (proffile)
+			exit(prof_run(r_ports, vmlinux, proffile));
+		if (tracedump)
+			exit(ftrace_dump(r_ports, tracedump, tracedir));
+		if (snapshot && !vmlinux) {
+			fprintf(stderr, "%s: -S needs -V vmlinux\n", progname);
+			usage();
+		}
+		if (snapshot)
+			exit(snap_dump(r_ports, corefile, vmlinux,
+				       coreranges));
+		if (corefile)
+			exit(core_dump(r_ports, corefile, coreranges));
+		exit(tfile_upload(r_ports, tfile));
+	}
+
 	l_ports = (struct port_st *)malloc(sizeof(struct port_st));
 	memset(l_ports, 0, sizeof(struct port_st));
 
@@ -1830,6 +2225,14 @@ int main(int argc, char *argv[])
 	}
 
 	printf("Agent Proxy running. pid: %i\n", getpid());
+	if (rtt_enabled)
+		rtt_start();
+	if (capture_file && capture_start())
+		exit(1);
+	if (metrics_port) {
+		metrics_gauge("gdb_split", &gdbPtr);
+		metrics_start();
+	}
 	refresh_nsockhandle();
 	
 #ifdef FEATURE_PORT_USB
@@ -1837,6 +2240,16 @@ int main(int argc, char *argv[])
 	while (iport != NULL) {
 		if (iport->type == PORT_USB) {
 			ret = pthread_create(&poll_thread, NULL, poll_thread_main, iport);
+			if (oops_decode && oops_start(vmlinux))
+				oops_decode = 0;
+			if (peek_port)
+				peek_start(iport);
+			if (sampler_port)
+				sampler_start(iport, vmlinux);
+			if (tracefile)
+				ftrace_start(iport, tracefile, tracedir);
+			if (telemetry_port || telemetryfile)
+				telemetry_start(iport, telemetryfile);
 			break;
 		}
 		iport = iport->next;
@@ -1853,6 +2266,10 @@ int main(int argc, char *argv[])
 			if (debug)
 				printf("Select return: %i\n", select_ret);
 		}
+		if (rtt_enabled)
+			rtt_poll();
+		if (capture_on)
+			capture_poll();
 
 		/* Iterate over all the listening ports to see if any have
 		 * data that should be transmitted. 
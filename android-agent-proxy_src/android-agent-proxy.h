@@ -97,8 +97,176 @@ int usb_portopen(struct port_st *port);
 void usb_portclose(struct port_st *port);
 int usb_portread(struct port_st *port, char *buf, int size, int opts);
 int usb_portwrite(struct port_st *port, char *buf, int size, int opts);
+int usb_send_break(struct port_st *port);
+int usb_send_sample_break(struct port_st *port);
+int usb_set_sampler(struct port_st *port, int hz);
+int usb_set_trace(struct port_st *port, int on);
+int usb_set_telemetry(struct port_st *port, int ms);
 #endif
 
+extern int debug;
+extern char defaultBrkStr[];
+extern char defaultBrkStrLen;
+int sendSpecialBreak(struct port_st *port, char *breakString, int len);
+int listen_spec(char *spec, char **addr);
+int listen_socket(const char *what, const char *addr, int port, int backlog);
+
+/* android-agent-proxy-gdb.c */
+int gdb_port_open(struct port_st *port);
+int gdb_stop_target(struct port_st *port);
+int gdb_frame(char *buf, const char *cmd);
+int gdb_command(struct port_st *port, const char *cmd, char *reply, int size);
+int gdb_send_pipelined(struct port_st *port, char **cmd, int n);
+int gdb_recv(struct port_st *port, char *reply, int size);
+int gdb_read_raw(struct port_st *port, char *buf, int len);
+int gdb_unescape(char *buf, int len);
+int gdb_hex2bin(char *buf, int len);
+
+/* android-agent-proxy-tfile.c */
+int tfile_upload(struct port_st *port, const char *path);
+
+/* android-agent-proxy-core.c */
+#define CORE_MAX_RANGES	32
+
+struct core_range {
+	unsigned long long start;	/* physical address */
+	unsigned long long size;
+};
+
+int core_write_header(FILE *fp, const char *regs, int regsize,
+		      unsigned long page_offset, unsigned long phys_offset,
+		      const struct core_range *r, int nr);
+int core_parse_ranges(const char *s, struct core_range *r, int max);
+void core_progress_start(void);
+void core_progress(unsigned long long done, unsigned long long total);
+void core_progress_end(unsigned long long done, const char *path);
+int core_dump(struct port_st *port, const char *path, const char *ranges);
+
+/* android-agent-proxy-sym.c */
+extern int sym_lines;
+int sym_load(const char *vmlinux);
+const char *sym_lookup(unsigned long addr, unsigned long *off);
+const char *sym_line(unsigned long addr, int *line);
+int sym_bench(const char *vmlinux);
+
+/* android-agent-proxy-bt.c */
+int bt_all(struct port_st *port, const char *vmlinux);
+
+/* android-agent-proxy-mcache.c */
+extern int mcache_enabled;
+int mcache_gdb_data(struct port_st *gdb, struct port_st *target, char *buf,
+		    int len);
+int mcache_target_data(char *buf, int len);
+void mcache_totals(unsigned long *gdb_bytes, unsigned long *hit_bytes,
+		   unsigned long *crc_bytes, unsigned long *read_bytes);
+
+/* android-agent-proxy-peek.c */
+extern int peek_port;
+extern char *peek_addr;
+int peek_start(struct port_st *target);
+int peek_target_data(char *buf, int len);
+
+/* android-agent-proxy-prof.c */
+extern int prof_hz;
+int prof_run(struct port_st *port, const char *vmlinux, const char *path);
+
+/* android-agent-proxy-sampler.c */
+extern int sampler_port;
+extern char *sampler_addr;
+int sampler_start(struct port_st *target, const char *vmlinux);
+int sampler_target_data(char *buf, int len);
+
+/* android-agent-proxy-ftrace.c */
+int ftrace_start(struct port_st *target, const char *path, const char *dir);
+int ftrace_target_data(char *buf, int len);
+int ftrace_dump(struct port_st *port, const char *path, const char *dir);
+
+/* android-agent-proxy-telemetry.c */
+extern int telemetry_port;
+extern char *telemetry_addr;
+int telemetry_start(struct port_st *target, const char *path);
+int telemetry_target_data(char *buf, int len);
+
+/* android-agent-proxy-oops.c */
+extern int oops_decode;
+int oops_start(const char *vmlinux);
+int oops_feed(const char *buf, int len, const char **out, int *at);
+
+/* android-agent-proxy-boot.c */
+extern char *boot_file;
+extern char *boot_baseline;
+void boot_feed(const char *buf, int len);
+int boot_compare(const char *path, const char *baseline);
+
+/* android-agent-proxy-rtt.c */
+extern int rtt_enabled;
+void rtt_start(void);
+void rtt_request(struct port_st *target, const char *buf, int len);
+void rtt_reply(struct port_st *target, const char *buf, int len);
+void rtt_poll(void);
+int rtt_kgdb_latency(struct port_st *port);
+
+/* android-agent-proxy-metrics.c */
+#define METRICS_GDB		0
+#define METRICS_CONSOLE		1
+#define METRICS_TARGET		2
+#define METRICS_ROLES		3
+#define METRICS_RX		0
+#define METRICS_TX		1
+#define METRICS_USB_READ	0
+#define METRICS_USB_WRITE	1
+#define METRICS_USB_CONTROL	2
+#define METRICS_USB_OPS		3
+#define METRICS_USB_ERRORS	5
+
+struct metrics {
+	unsigned long bytes[METRICS_ROLES][2];
+	unsigned long transfers[METRICS_ROLES][2];
+	long clients[METRICS_ROLES];
+	unsigned long usb_errors[METRICS_USB_OPS][METRICS_USB_ERRORS];
+	unsigned long usb_reconnects;
+	unsigned long usb_attached;
+	unsigned long usb_detached;
+};
+
+extern struct metrics metrics;
+extern int metrics_port;
+extern char *metrics_addr;
+
+/* the forwarding threads add without a lock */
+#define METRIC_ADD(x, n)	__sync_fetch_and_add(&(x), (n))
+#define METRICS_IO(role, dir, n)					\
+	do {								\
+		if ((n) > 0) {						\
+			METRIC_ADD(metrics.bytes[role][dir], (n));	\
+			METRIC_ADD(metrics.transfers[role][dir], 1);	\
+		}							\
+	} while (0)
+
+void metrics_usb_error(int op, int r);
+void metrics_gauge(const char *name, const int *val);
+int metrics_start(void);
+
+/* android-agent-proxy-capture.c */
+extern char *capture_file;
+extern int capture_on;
+
+#define CAPTURE_IO(role, dir, port, buf, n)				\
+	do {								\
+		if (capture_on && (n) > 0)				\
+			capture_io(role, dir, port, buf, n);		\
+	} while (0)
+
+void capture_io(int role, int dir, struct port_st *port, const char *buf,
+		int n);
+int capture_start(void);
+void capture_poll(void);
+int capture_decode(const char *path);
+
+/* android-agent-proxy-snap.c */
+int snap_dump(struct port_st *port, const char *path, const char *vmlinux,
+	      const char *ranges);
+
 #ifdef linux
 #define HAVE_TERMIOS
 #endif /* linux */
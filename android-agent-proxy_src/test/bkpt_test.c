@@ -0,0 +1,271 @@
+/*
+ * Agent proxy for android
+ *
+ * test/bkpt_test.c  the software breakpoint table of debug_core with 10k breakpoints
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <time.h>
+
+#include "kshim.h"
+
+/*
+ * The breakpoint table code is taken as is from debug_core.c, built
+ * without CONFIG_KGDB_COND_BREAK.  Breakpoints are planted in a buffer
+ * standing for the kernel text: the check is that every address holds
+ * the break instruction when armed and its own bytes when not, through
+ * set, activate, deactivate, remove, lookup and remove all.  The static
+ * table is filled first, then moved to one for NR_BREAKS as by
+ * dbg_late_init().
+ */
+#define NR_BREAKS	10000
+#define BREAK_INSTR_SIZE	4
+#define L1_CACHE_BYTES		32
+#define CACHE_FLUSH_IS_SAFE	1
+
+enum kgdb_bptype {
+	BP_BREAKPOINT = 0,
+};
+
+enum kgdb_bpstate {
+	BP_UNDEFINED = 0,
+	BP_REMOVED,
+	BP_SET,
+	BP_ACTIVE
+};
+
+struct kgdb_bkpt {
+	unsigned long		bpt_addr;
+	char			saved_instr[BREAK_INSTR_SIZE];
+	enum kgdb_bptype	type;
+	enum kgdb_bpstate	state;
+};
+
+static struct {
+	void (*remove_all_hw_break)(void);
+} arch_kgdb_ops;
+
+static struct {
+	struct {
+		void *mmap_cache;
+	} *mm;
+} *current, task;
+
+static const char break_instr[BREAK_INSTR_SIZE] = { 0xfe, 0xde, 0xff, 0xe7 };
+static unsigned long flushes, flush_alls;
+
+#define sort(base, num, size, cmp, swap)	qsort(base, num, size, cmp)
+#define flush_cache_range(vma, start, end)
+#define flush_icache_range(start, end)		(flushes++)
+#define flush_cache_all()			(flush_alls++)
+
+static int kgdb_arch_set_breakpoint(unsigned long addr, char *saved_instr)
+{
+	memcpy(saved_instr, (char *)addr, BREAK_INSTR_SIZE);
+	memcpy((char *)addr, break_instr, BREAK_INSTR_SIZE);
+	return 0;
+}
+
+static int kgdb_arch_remove_breakpoint(unsigned long addr, char *bundle)
+{
+	memcpy((char *)addr, bundle, BREAK_INSTR_SIZE);
+	return 0;
+}
+
+static int kgdb_validate_break_address(unsigned long addr)
+{
+	return 0;
+}
+
+static inline void kgdb_step_cancel(void) { }
+static inline int kgdb_trace_remove_all(void) { return 0; }
+static inline void kgdb_trace_rearm(void) { }
+
+#include "bkpt.inc"
+
+static char *text, *copy;
+static unsigned long addrs[NR_BREAKS];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, double start, int n)
+{
+	printf("bkpt: %-28s %8.1f ns each\n", what, (now() - start) * 1e9 / n);
+}
+
+/* breakpoints armed every step from the first, the rest of text intact */
+static int check_text(int armed, int step)
+{
+	char *p;
+	int i;
+
+	for (i = 0; i < NR_BREAKS; i++) {
+		p = (char *)addrs[i];
+		if (armed && i % step == armed % step) {
+			if (memcmp(p, break_instr, BREAK_INSTR_SIZE))
+				goto bad;
+		} else if (memcmp(p, copy + (p - text), BREAK_INSTR_SIZE)) {
+			goto bad;
+		}
+	}
+	return 0;
+bad:
+	printf("bkpt: breakpoint %d at %p is not %s\n", i, p,
+	       armed && i % step == armed % step ? "armed" : "restored");
+	return 1;
+}
+
+int main(void)
+{
+	size_t size = NR_BREAKS * 64;
+	double start;
+	int i, err, early;
+
+	current = &task;
+	text = malloc(size);
+	copy = malloc(size);
+	srand(1);
+	for (i = 0; i < (int)size; i++)
+		text[i] = rand();
+	memcpy(copy, text, size);
+
+	/* spread over the buffer, 4 byte aligned, in no order */
+	for (i = 0; i < NR_BREAKS; i++)
+		addrs[i] = (unsigned long)text + (i * 64 + (rand() % 15) * 4);
+	for (i = NR_BREAKS - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		unsigned long t = addrs[i];
+
+		addrs[i] = addrs[j];
+		addrs[j] = t;
+	}
+
+	/* the static table, until it is full */
+	for (i = 0; !(err = dbg_set_sw_break(addrs[i])); i++)
+		;
+	early = i;
+	if (err != -E2BIG || early != (3 << KGDB_BREAK_INIT_BITS) / 4) {
+		printf("bkpt: static table full after %d with %d\n", i, err);
+		return 1;
+	}
+	kgdb_break_max = NR_BREAKS;
+	if (kgdb_break_alloc() || kgdb_break_count != early ||
+	    !kgdb_break_lookup(addrs[early - 1])) {
+		printf("bkpt: the static table was not moved\n");
+		return 1;
+	}
+
+	start = now();
+	for (i = early; i < NR_BREAKS; i++) {
+		err = dbg_set_sw_break(addrs[i]);
+		if (err) {
+			printf("bkpt: set of %d failed with %d\n", i, err);
+			return 1;
+		}
+	}
+	report("dbg_set_sw_break", start, NR_BREAKS - early);
+	if (kgdb_break_count != NR_BREAKS ||
+	    dbg_set_sw_break(addrs[17]) != -EEXIST) {
+		printf("bkpt: %u in the table, or a double set allowed\n",
+		       kgdb_break_count);
+		return 1;
+	}
+
+	start = now();
+	dbg_activate_sw_breakpoints();
+	report("activate, per breakpoint", start, NR_BREAKS);
+	if (check_text(1, 1))
+		return 1;
+
+	start = now();
+	dbg_deactivate_sw_breakpoints();
+	report("deactivate, per breakpoint", start, NR_BREAKS);
+	if (check_text(0, 1))
+		return 1;
+
+	start = now();
+	for (i = 0; i < NR_BREAKS; i += 2)
+		if (dbg_remove_sw_break(addrs[i])) {
+			printf("bkpt: remove of %d failed\n", i);
+			return 1;
+		}
+	report("dbg_remove_sw_break", start, NR_BREAKS / 2);
+
+	start = now();
+	for (i = 0; i < NR_BREAKS; i++)
+		if (kgdb_isremovedbreak(addrs[i]) != !(i % 2)) {
+			printf("bkpt: kgdb_isremovedbreak wrong for %d\n", i);
+			return 1;
+		}
+	report("kgdb_isremovedbreak", start, NR_BREAKS);
+	if (kgdb_isremovedbreak((unsigned long)text + 2) ||
+	    dbg_remove_sw_break(addrs[0]) != -ENOENT) {
+		printf("bkpt: unknown or removed address found\n");
+		return 1;
+	}
+
+	/* the odd ones still set; setting a removed one takes its slot back */
+	dbg_activate_sw_breakpoints();
+	if (check_text(1, 2))
+		return 1;
+	dbg_deactivate_sw_breakpoints();
+	for (i = 0; i < NR_BREAKS; i += 2)
+		dbg_set_sw_break(addrs[i]);
+	if (kgdb_break_count != NR_BREAKS) {
+		printf("bkpt: set again took new slots\n");
+		return 1;
+	}
+
+	dbg_activate_sw_breakpoints();
+	if (check_text(1, 1))
+		return 1;
+	start = now();
+	dbg_remove_all_break();
+	report("remove all, per breakpoint", start, NR_BREAKS);
+	if (check_text(0, 1) || kgdb_break_count ||
+	    kgdb_isremovedbreak(addrs[1])) {
+		printf("bkpt: remove all left something\n");
+		return 1;
+	}
+
+	/* nothing is allocated from the debugger: full is full */
+	for (i = 0; i < NR_BREAKS; i++)
+		dbg_set_sw_break(addrs[i]);
+	for (i = 0; !(err = dbg_set_sw_break((unsigned long)text + i * 64 +
+						 2)); i++)
+		;
+	if (err != -E2BIG ||
+	    kgdb_break_count != (3U << kgdb_break_bits) / 4) {
+		printf("bkpt: full table at %u breakpoints with %d\n",
+		       kgdb_break_count, err);
+		return 1;
+	}
+	dbg_remove_all_break();
+
+	printf("bkpt: %d breakpoints, table of %u slots, %lu range and %lu "
+	       "full cache flushes: ok\n", NR_BREAKS, 1U << kgdb_break_bits,
+	       flushes, flush_alls);
+
+	return 0;
+}
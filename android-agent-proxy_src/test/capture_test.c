@@ -0,0 +1,386 @@
+/*
+ * Agent proxy for android
+ *
+ * test/capture_test.c  the capture ring and decoder of the proxy
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <fcntl.h>
+#include <sched.h>
+
+/*
+ * The ring and the decoder are the proxy's own code, included whole,
+ * driven without the writer thread: capture_drain() is called by the
+ * test.  The checks are records across the end of the ring, the ring
+ * all zero once drained, a record not drained before its commit word
+ * nor the ones after it, a full ring dropping and counting records,
+ * and WRITERS threads against a drain thread, every record of each
+ * found once and in order or counted as lost.  capture_decode() then
+ * prints a capture of split packets, acks, ^C, a bad checksum, console
+ * text, the $O packets of a usb target and lost records.
+ */
+#include "../android-agent-proxy-capture.c"
+
+#define WRITERS		4
+#define PER_WRITER	200000
+
+struct seq {
+	uint32_t writer;
+	uint32_t n;
+};
+
+static char *zero;
+static volatile int writers_done;
+
+/* drain to a new capture_fp, then read the records back from it */
+static FILE *drain_all(int *count)
+{
+	int n;
+
+	*count = 0;
+	while ((n = capture_drain()))
+		*count += n;
+	fflush(capture_fp);
+	rewind(capture_fp);
+	return capture_fp;
+}
+
+static int next_rec(FILE *fp, struct capture_rec *rec, char *buf, int size)
+{
+	if (fread(rec, sizeof(*rec), 1, fp) != 1 || rec->size > size)
+		return 0;
+	return fread(buf, 1, rec->size, fp) == rec->size;
+}
+
+static int check_empty(const char *what)
+{
+	if (capture_head == capture_tail &&
+	    !memcmp(capture_ring, zero, CAPTURE_RING))
+		return 0;
+	printf("capture: %s: ring not empty and zeroed, head %lu tail %lu\n",
+	       what, capture_head, capture_tail);
+	return 1;
+}
+
+/* records of 1 to 200 bytes starting at every 8 bytes before the end */
+static int check_wrap(void)
+{
+	struct capture_rec rec;
+	char buf[256], want[256];
+	int start, i, j, count;
+	FILE *fp;
+
+	for (start = 0; start <= 256; start += 8) {
+		capture_fp = tmpfile();
+		capture_head = capture_tail = 5UL * CAPTURE_RING - start;
+		for (i = 1; i <= 200; i += 37) {
+			for (j = 0; j < i; j++)
+				want[j] = i + j;
+			capture_io(i % METRICS_ROLES, i % 2, NULL, want, i);
+		}
+		fp = drain_all(&count);
+		for (i = 1; i <= 200; i += 37) {
+			for (j = 0; j < i; j++)
+				want[j] = i + j;
+			if (!next_rec(fp, &rec, buf, sizeof(buf)) ||
+			    rec.size != i || rec.port != i % METRICS_ROLES ||
+			    rec.dir != i % 2 || memcmp(buf, want, i)) {
+				printf("capture: record of %d bytes wrong, "
+				       "%d before the end\n", i, start);
+				return 1;
+			}
+		}
+		fclose(fp);
+		if (check_empty("across the end"))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int check_commit(void)
+{
+	struct capture_rec rec;
+	unsigned long at;
+	uint32_t *commit, len;
+	char buf[16];
+	int count;
+	FILE *fp;
+
+	capture_fp = tmpfile();
+	at = capture_head;
+	capture_io(METRICS_GDB, METRICS_TX, NULL, "first", 5);
+	capture_io(METRICS_GDB, METRICS_TX, NULL, "second", 6);
+
+	/* the first still being written */
+	commit = (uint32_t *)(capture_ring + (at & CAPTURE_MASK));
+	len = *commit;
+	*commit = 0;
+	if (capture_drain() || capture_tail != at) {
+		printf("capture: drained past an uncommitted record\n");
+		return 1;
+	}
+	*commit = len;
+
+	fp = drain_all(&count);
+	if (count != 2 || !next_rec(fp, &rec, buf, sizeof(buf)) ||
+	    memcmp(buf, "first", 5) || !next_rec(fp, &rec, buf, sizeof(buf)) ||
+	    memcmp(buf, "second", 6)) {
+		printf("capture: committed records drained wrong\n");
+		return 1;
+	}
+	fclose(fp);
+
+	return check_empty("after the commit");
+}
+
+static int check_full(void)
+{
+	static char big[64 << 10];
+	struct capture_rec rec;
+	unsigned long lost = 0, kept = 0;
+	uint32_t n;
+	int i, count;
+	FILE *fp;
+
+	capture_fp = tmpfile();
+	capture_io(METRICS_TARGET, METRICS_RX, NULL, big, CAPTURE_RING);
+	for (i = 0; i < 2 * CAPTURE_RING / (int)sizeof(big); i++)
+		capture_io(METRICS_TARGET, METRICS_RX, NULL, big, sizeof(big));
+
+	fp = drain_all(&count);
+	while (next_rec(fp, &rec, big, sizeof(big))) {
+		if (rec.dir != CAPTURE_LOST) {
+			kept++;
+			continue;
+		}
+		memcpy(&n, big, sizeof(n));
+		lost += n;
+	}
+	fclose(fp);
+	if (lost + kept != (unsigned long)i + 1 || kept < i / 2 - 1 ||
+	    capture_lost) {
+		printf("capture: full ring kept %lu and lost %lu of %d\n",
+		       kept, lost, i + 1);
+		return 1;
+	}
+
+	return check_empty("after a full ring");
+}
+
+static void *writer(void *arg)
+{
+	char buf[sizeof(struct seq) + 64];
+	struct seq *s = (struct seq *)buf;
+
+	memset(buf, 0, sizeof(buf));
+	s->writer = (unsigned long)arg;
+	for (s->n = 0; s->n < PER_WRITER; s->n++)
+		capture_io(METRICS_GDB, METRICS_RX, NULL, buf,
+			   sizeof(*s) + s->n % 64);
+	return NULL;
+}
+
+static void *drainer(void *arg)
+{
+	while (!writers_done)
+		if (!capture_drain())
+			sched_yield();
+	capture_drain();
+	return NULL;
+}
+
+static int check_threads(void)
+{
+	pthread_t w[WRITERS], d;
+	struct capture_rec rec;
+	struct seq *s;
+	uint32_t next[WRITERS] = { 0 }, n;
+	unsigned long lost = 0, kept = 0;
+	char buf[128];
+	int i, count;
+	FILE *fp;
+
+	capture_fp = tmpfile();
+	pthread_create(&d, NULL, drainer, NULL);
+	for (i = 0; i < WRITERS; i++)
+		pthread_create(&w[i], NULL, writer, (void *)(unsigned long)i);
+	for (i = 0; i < WRITERS; i++)
+		pthread_join(w[i], NULL);
+	writers_done = 1;
+	pthread_join(d, NULL);
+
+	fp = drain_all(&count);
+	while (next_rec(fp, &rec, buf, sizeof(buf))) {
+		if (rec.dir == CAPTURE_LOST) {
+			memcpy(&n, buf, sizeof(n));
+			lost += n;
+			continue;
+		}
+		s = (struct seq *)buf;
+		if (s->writer >= WRITERS || s->n < next[s->writer] ||
+		    rec.size != sizeof(*s) + s->n % 64) {
+			printf("capture: writer %u record %u out of order\n",
+			       s->writer, s->n);
+			return 1;
+		}
+		next[s->writer] = s->n + 1;
+		kept++;
+	}
+	fclose(fp);
+	if (kept + lost != WRITERS * PER_WRITER) {
+		printf("capture: %lu records kept and %lu lost of %d\n", kept,
+		       lost, WRITERS * PER_WRITER);
+		return 1;
+	}
+	printf("capture: %d writers, %d records, %lu dropped by a full "
+	       "ring\n", WRITERS, WRITERS * PER_WRITER, lost);
+
+	return check_empty("after the threads");
+}
+
+/* a gdb packet with its checksum */
+static int packet(char *buf, const char *body)
+{
+	unsigned char sum = 0;
+	int i;
+
+	for (i = 0; body[i]; i++)
+		sum += body[i];
+	return sprintf(buf, "$%s#%02x", body, sum);
+}
+
+static int check_decode(void)
+{
+	static const char *want[] = {
+		"gdb     tx fd 7, 4 bytes",
+		"$m0,4#fd",
+		"target  rx usb transfer",
+		"            +",
+		"$OK#9a",
+		"            ^C",
+		"$01#00  bad checksum, 61",
+		"            | hello",
+		"            | world",
+		"            | Hi",
+		"3 records lost",
+	};
+	char path[] = "/tmp/capture_testXXXXXX";
+	char out[] = "/tmp/capture_outXXXXXX";
+	struct port_st gdb, usb;
+	struct capture_head h;
+	char buf[64], *text;
+	int fd, saved, len, i, count;
+	FILE *fp;
+
+	memset(&gdb, 0, sizeof(gdb));
+	memset(&usb, 0, sizeof(usb));
+	gdb.type = PORT_TCP;
+	gdb.sock = 7;
+	usb.type = PORT_USB;
+
+	fd = mkstemp(path);
+	capture_fp = fdopen(fd, "w+b");
+	memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+	h.realtime = capture_now(CLOCK_REALTIME);
+	h.monotonic = capture_now(CLOCK_MONOTONIC);
+	fwrite(&h, sizeof(h), 1, capture_fp);
+
+	/* a packet split across two records */
+	len = packet(buf, "m0,4");
+	capture_io(METRICS_GDB, METRICS_TX, &gdb, buf, 4);
+	capture_io(METRICS_GDB, METRICS_TX, &gdb, buf + 4, len - 4);
+	len = packet(buf + 1, "OK") + 1;
+	buf[0] = '+';
+	capture_io(METRICS_TARGET, METRICS_RX, &usb, buf, len);
+	capture_io(METRICS_GDB, METRICS_TX, &gdb, "\003", 1);
+	capture_io(METRICS_TARGET, METRICS_RX, &usb, "$01#00", 6);
+	capture_io(METRICS_CONSOLE, METRICS_RX, &gdb, "hello\nworld", 11);
+	len = packet(buf, "O48690a");
+	capture_io(METRICS_TARGET, METRICS_RX, &usb, buf, len);
+	capture_lost = 3;
+	drain_all(&count);
+	fclose(capture_fp);
+
+	/* the decoder prints to stdout */
+	fflush(stdout);
+	saved = dup(1);
+	fd = mkstemp(out);
+	dup2(fd, 1);
+	i = capture_decode(path);
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+
+	text = calloc(1, 1 << 16);
+	lseek(fd, 0, SEEK_SET);
+	len = read(fd, text, (1 << 16) - 1);
+	close(fd);
+	unlink(out);
+	if (i || len <= 0) {
+		printf("capture: decode of %s failed\n", path);
+		return 1;
+	}
+	for (i = 0; i < (int)(sizeof(want) / sizeof(want[0])); i++)
+		if (!strstr(text, want[i])) {
+			printf("capture: \"%s\" missing from the decode:\n%s",
+			       want[i], text);
+			return 1;
+		}
+
+	/* cut short, and not a capture */
+	fflush(stdout);
+	saved = dup(1);
+	fd = open("/dev/null", O_WRONLY);
+	dup2(fd, 1);
+	i = truncate(path, sizeof(h) + sizeof(struct capture_rec) + 2) ||
+	    capture_decode(path) != 0;
+	fp = fopen(path, "r+b");
+	fwrite("AGCAPT00", 8, 1, fp);
+	fclose(fp);
+	i |= (capture_decode(path) != 1) << 1;
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+	close(fd);
+	unlink(path);
+	free(text);
+	if (i) {
+		printf("capture: a short or foreign file decoded wrong, %d\n",
+		       i);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	capture_ring = calloc(1, CAPTURE_RING);
+	zero = calloc(1, CAPTURE_RING);
+	if (!capture_ring || !zero)
+		return 1;
+
+	if (check_wrap() || check_commit() || check_full() ||
+	    check_threads() || check_decode())
+		return 1;
+	printf("capture: records across the ring's end, the commit word, a "
+	       "full ring and the decoder: ok\n");
+
+	return 0;
+}
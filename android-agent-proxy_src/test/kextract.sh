@@ -0,0 +1,109 @@
+#!/bin/sh
+#
+# kextract.sh <file> <name>...
+#
+# Print the top level definitions of the names in a kernel source file,
+# in the order of the file: #defines, struct types, variables and
+# functions.  A name defined twice, as in an #ifdef and its #else, is
+# taken the first time.  The tests build what it prints with kshim.h.
+# Some of the board trees have DOS line ends; they are dropped.
+#
+file=$1
+shift
+
+awk -v names="$*" '
+BEGIN {
+	n = split(names, list, " ")
+	for (i = 1; i <= n; i++)
+		want[list[i]] = 1
+}
+
+# the name a line at column 0 defines, or ""
+function defname(line,   s) {
+	if (line ~ /^#define[ \t]/) {
+		s = line
+		sub(/^#define[ \t]+/, "", s)
+		sub(/[^A-Za-z0-9_].*$/, "", s)
+		return s
+	}
+	if (line ~ /^struct [A-Za-z0-9_]+[ \t]*\{/) {
+		s = line
+		sub(/^struct /, "", s)
+		sub(/[^A-Za-z0-9_].*$/, "", s)
+		return s
+	}
+	if (line !~ /^[A-Za-z_]/ || line ~ /^(return|else|if|for|while)[^A-Za-z0-9_]/)
+		return ""
+	s = line
+	sub(/[([=;].*$/, "", s)
+	sub(/[ \t*]+$/, "", s)
+	sub(/^.*[^A-Za-z0-9_]/, "", s)
+	return s
+}
+
+{
+	sub(/\r$/, "")
+}
+
+mode == "define" {
+	print
+	if ($0 !~ /\\$/)
+		mode = ""
+	next
+}
+mode == "block" {
+	print
+	if ($0 ~ /^};?[ \t]*$/)
+		mode = ""
+	next
+}
+mode == "head" {
+	# the rest of a function head, up to its body or a ;
+	head = head "\n" $0
+	if ($0 ~ /;[ \t]*$/) {
+		mode = ""
+	} else if ($0 ~ /\{[ \t]*$/ || $0 ~ /^\{/) {
+		print head
+		mode = "block"
+		done[name] = 1
+	}
+	next
+}
+
+{
+	name = defname($0)
+	if (name == "" || !(name in want) || (name in done))
+		next
+	if ($0 ~ /^#define/) {
+		print
+		done[name] = 1
+		if ($0 ~ /\\$/)
+			mode = "define"
+		next
+	}
+	if ($0 ~ /^[^=[]*\(/) {
+		if ($0 ~ /\}[ \t]*$/) {
+			print
+			done[name] = 1
+		} else if ($0 ~ /\{[ \t]*$/) {
+			print
+			mode = "block"
+			done[name] = 1
+		} else if ($0 !~ /;[ \t]*$/) {
+			head = $0
+			mode = "head"
+		}
+		next
+	}
+	print
+	done[name] = 1
+	if ($0 !~ /;[ \t]*$/)
+		mode = "block"
+}
+
+END {
+	for (i = 1; i <= n; i++)
+		if (!(list[i] in done))
+			printf("kextract.sh: %s not found\n", list[i]) > "/dev/stderr"
+}
+' "$file"
@@ -0,0 +1,91 @@
+/*
+ * Agent proxy for android
+ *
+ * test/kshim.h  what the kernel code under test needs in userspace
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define ACCESS_ONCE(x)		(*(volatile typeof(x) *)&(x))
+#define smp_mb()		__sync_synchronize()
+#define smp_rmb()		__sync_synchronize()
+#define smp_wmb()		__sync_synchronize()
+
+#define min(x, y) ({			\
+	typeof(x) _x = (x);		\
+	typeof(y) _y = (y);		\
+	_x < _y ? _x : _y; })
+#define max(x, y) ({			\
+	typeof(x) _x = (x);		\
+	typeof(y) _y = (y);		\
+	_x > _y ? _x : _y; })
+#define min_t(type, x, y)	min((type)(x), (type)(y))
+
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+
+#define KERN_ERR		""
+#define KERN_INFO		""
+#define printk			printf
+
+#define GFP_ATOMIC		0
+#define GFP_KERNEL		0
+#define __GFP_NOWARN		0
+#define kmalloc(size, gfp)	malloc(size)
+#define kzalloc(size, gfp)	calloc(1, size)
+#define kfree(p)		free(p)
+#define vmalloc(size)		malloc(size)
+#define vfree(p)		free(p)
+
+#define module_param(name, type, perm)
+#define __init
+#define __weak			__attribute__((weak))
+
+/* linux/hash.h, for a 64 bit host */
+#define GOLDEN_RATIO_PRIME_64	0x9e37fffffffc0001UL
+
+static inline unsigned long hash_long(unsigned long val, unsigned int bits)
+{
+	return (val * GOLDEN_RATIO_PRIME_64) >> (64 - bits);
+}
+
+static inline int scnprintf_shim(char *buf, size_t size, int n)
+{
+	return n < (int)size ? n : (size ? (int)size - 1 : 0);
+}
+#define scnprintf(buf, size, ...)					\
+	scnprintf_shim(buf, size, snprintf(buf, size, __VA_ARGS__))
+
+#define simple_strtoul		strtoul
+
+#endif
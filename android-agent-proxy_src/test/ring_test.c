@@ -0,0 +1,181 @@
+/*
+ * Agent proxy for android
+ *
+ * test/ring_test.c  the rx/tx ring of kgdb_io_usb, checked and timed
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+
+#include "kshim.h"
+#include "ring.inc"
+
+/*
+ * The ring code is taken as is from kgdb_io_usb.c.  The check pushes
+ * and pops spans of random sizes, the indices starting just below
+ * UINT_MAX so that they wrap, and compares the bytes that come out
+ * with a running sequence.  The timing runs a producer and a consumer
+ * thread on one ring, as the usb read and the gdbstub do, yielding
+ * when the ring is full or empty.
+ */
+#define CHECK_ROUNDS	2000000
+#define BENCH_BYTES	(64UL << 20)
+
+static struct kgdb_ring ring;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check(void)
+{
+	static char in[BUFFER_SIZE * 2], out[BUFFER_SIZE * 2];
+	unsigned char wseq = 0, rseq = 0;
+	unsigned int n, got, room, i, r;
+	unsigned long dropped = 0;
+
+	ring.head = ring.tail = UINT_MAX - BUFFER_SIZE / 2;
+	ring.overflow = 0;
+	srand(1);
+
+	for (r = 0; r < CHECK_ROUNDS; r++) {
+		/* mostly small spans, now and then more than fits */
+		n = rand() % (rand() % 8 ? 600 : 2 * BUFFER_SIZE);
+		room = ring_free(&ring);
+		for (i = 0; i < n; i++)
+			in[i] = wseq + i;
+		got = ring_push_n(&ring, in, n);
+		if (got != min(n, room)) {
+			printf("push of %u with %u free gave %u\n", n, room,
+			       got);
+			return 1;
+		}
+		wseq += got;
+		dropped += n - got;
+		if (ring_len(&ring) > BUFFER_SIZE) {
+			printf("ring holds %u\n", ring_len(&ring));
+			return 1;
+		}
+
+		n = rand() % 700;
+		got = ring_pop_n(&ring, out, n);
+		for (i = 0; i < got; i++, rseq++) {
+			if ((unsigned char)out[i] != rseq) {
+				printf("byte %u of a pop is %02x, not %02x\n",
+				       i, (unsigned char)out[i], rseq);
+				return 1;
+			}
+		}
+	}
+	if (ring.overflow != dropped) {
+		printf("overflow %u, %lu bytes were dropped\n", ring.overflow,
+		       dropped);
+		return 1;
+	}
+	printf("ring: %d random spans across the index wrap, %lu bytes "
+	       "refused and counted: ok\n", CHECK_ROUNDS, dropped);
+
+	return 0;
+}
+
+static unsigned int span;
+static volatile int failed;
+
+static void *producer(void *arg)
+{
+	static char buf[BUFFER_SIZE];
+	unsigned long sent = 0;
+	unsigned char seq = 0;
+	unsigned int i, n;
+
+	while (sent < BENCH_BYTES) {
+		n = min((unsigned long)span, BENCH_BYTES - sent);
+		n = min(n, ring_free(&ring));
+		if (!n) {
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			buf[i] = seq++;
+		ring_push_n(&ring, buf, n);
+		sent += n;
+	}
+
+	return NULL;
+}
+
+/* pop a span at a time, or a byte at a time as get_char() does */
+static double bench(unsigned int push, unsigned int pop)
+{
+	static char buf[BUFFER_SIZE];
+	unsigned long recv = 0;
+	unsigned char seq = 0;
+	unsigned int i, n;
+	pthread_t thread;
+	double start;
+
+	ring.head = ring.tail = 0;
+	ring.overflow = 0;
+	span = push;
+	start = now();
+	pthread_create(&thread, NULL, producer, NULL);
+	while (recv < BENCH_BYTES) {
+		n = ring_pop_n(&ring, buf, pop);
+		if (!n)
+			sched_yield();
+		for (i = 0; i < n; i++)
+			if ((unsigned char)buf[i] != seq++)
+				failed = 1;
+		recv += n;
+	}
+	pthread_join(thread, NULL);
+
+	return BENCH_BYTES / (now() - start) / (1 << 20);
+}
+
+int main(void)
+{
+	static const unsigned int spans[][2] = {
+		{ 64, 1 }, { 512, 1 }, { 512, 512 }, { 4096, 4096 },
+	};
+	unsigned int i;
+
+	if (check())
+		return 1;
+
+	for (i = 0; i < sizeof(spans) / sizeof(spans[0]); i++) {
+		double mbs = bench(spans[i][0], spans[i][1]);
+
+		if (failed || ring.overflow) {
+			printf("ring: bytes lost or out of order between "
+			       "threads\n");
+			return 1;
+		}
+		printf("ring: push %4u, pop %4u: %8.1f MB/s\n", spans[i][0],
+		       spans[i][1], mbs);
+	}
+
+	return 0;
+}
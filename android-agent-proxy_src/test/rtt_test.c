@@ -0,0 +1,149 @@
+/*
+ * Agent proxy for android
+ *
+ * test/rtt_test.c  the round trip histogram of the proxy
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/*
+ * The histogram is the proxy's own code, included whole.  Every bucket
+ * must give back its own highest value, the value after it must land
+ * in the next one, and a time must land in the one bucket whose range
+ * holds it, within 1/RTT_SUB of its top, for every time up to 2^22 us
+ * and random ones up to 2^32.  The percentiles of random times are
+ * checked against the sorted times.
+ */
+#include "../android-agent-proxy-rtt.c"
+
+#define ALL_UP_TO	(1UL << 22)
+#define RANDOM		(1 << 20)
+#define SAMPLES		100000
+
+/* rtt.c only asks the target for its kgdb timing */
+int gdb_port_open(struct port_st *port)
+{
+	return -1;
+}
+
+int gdb_command(struct port_st *port, const char *cmd, char *reply,
+		int size)
+{
+	return -1;
+}
+
+static int check(unsigned long us)
+{
+	int b = rtt_bucket(us);
+
+	if (b >= 0 && b < RTT_BUCKETS && us <= rtt_bucket_max(b) &&
+	    (!b || us > rtt_bucket_max(b - 1)) &&
+	    rtt_bucket_max(b) - us <= us / RTT_SUB)
+		return 0;
+	printf("rtt: %lu us in bucket %d, up to %lu\n", us, b,
+	       b >= 0 && b < RTT_BUCKETS ? rtt_bucket_max(b) : 0);
+	return 1;
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int check_percentiles(void)
+{
+	static const double pct[] = { 1, 50, 90, 99, 99.9, 100 };
+	static unsigned long t[SAMPLES];
+	struct rtt_hist *h = calloc(1, sizeof(*h));
+	unsigned long want, got;
+	unsigned int i;
+
+	for (i = 0; i < SAMPLES; i++) {
+		/* mostly fast, a long tail */
+		t[i] = 50 + rand() % 200;
+		if (i % 10 == 0)
+			t[i] = rand() % 1000000;
+		rtt_add(h, t[i]);
+	}
+	qsort(t, SAMPLES, sizeof(*t), cmp_ulong);
+	if (h->count != SAMPLES || h->min != t[0] ||
+	    h->max != t[SAMPLES - 1]) {
+		printf("rtt: %lu times from %lu to %lu, want %d from %lu to "
+		       "%lu\n", h->count, h->min, h->max, SAMPLES, t[0],
+		       t[SAMPLES - 1]);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++) {
+		unsigned long long at = (unsigned long long)(SAMPLES *
+							     pct[i] / 100.0);
+
+		want = t[at ? at - 1 : 0];
+		got = rtt_percentile(h, pct[i]);
+		if (got < want || got - want > want / RTT_SUB) {
+			printf("rtt: p%g is %lu us, the times give %lu\n",
+			       pct[i], got, want);
+			return 1;
+		}
+	}
+	free(h);
+
+	return 0;
+}
+
+int main(void)
+{
+	unsigned long us;
+	int b, i;
+
+	for (b = 0; b < RTT_BUCKETS; b++)
+		if (rtt_bucket(rtt_bucket_max(b)) != b ||
+		    (b + 1 < RTT_BUCKETS &&
+		     rtt_bucket(rtt_bucket_max(b) + 1) != b + 1)) {
+			printf("rtt: bucket %d up to %lu does not round trip\n",
+			       b, rtt_bucket_max(b));
+			return 1;
+		}
+	if (rtt_bucket_max(RTT_BUCKETS - 1) != 0xffffffffUL) {
+		printf("rtt: the last bucket ends at %lu\n",
+		       rtt_bucket_max(RTT_BUCKETS - 1));
+		return 1;
+	}
+
+	for (us = 0; us < ALL_UP_TO; us++)
+		if (check(us))
+			return 1;
+	srand(7);
+	for (i = 0; i < RANDOM; i++) {
+		us = ((unsigned long)rand() << 16 ^ rand()) & 0xffffffffUL;
+		if (check(us) || check(us >> (i % 32)))
+			return 1;
+	}
+
+	if (check_percentiles())
+		return 1;
+
+	printf("rtt: %d buckets, every time up to %lu us and %d random ones, "
+	       "percentiles of %d times: ok\n", RTT_BUCKETS, ALL_UP_TO,
+	       RANDOM, SAMPLES);
+
+	return 0;
+}
@@ -0,0 +1,354 @@
+/*
+ * Agent proxy for android
+ *
+ * test/search_test.c  qSearch:memory of kgdb_io_usb against host side search
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#define _GNU_SOURCE		/* memmem */
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "kshim.h"
+#include "../android-agent-proxy.h"
+
+/*
+ * The search is taken as is from kgdb_io_usb.c.  The check compares it
+ * with memmem() for random patterns over a buffer of few distinct
+ * bytes, so that memchr() finds many false candidates, with the range
+ * and the pattern placed across its chunk boundaries, escaped pattern
+ * bytes and an unreadable page.  The timing serves a buffer from a
+ * fake stub over a socketpair and finds a pattern at its end once with
+ * qSearch:memory and once the way gdb's find does without it: 'm'
+ * reads through the proxy's gdb helpers and a search on the host.
+ */
+#define CHECK_SIZE	(256 << 10)
+#define CHECK_ROUNDS	20000
+#define BENCH_SIZE	(8 << 20)
+#define BENCH_BLOCK	400	/* per 'm', as snap.c reads */
+
+static char *fault_lo, *fault_hi;
+
+static int probe_kernel_read(void *dst, const void *src, size_t size)
+{
+	if ((char *)src < fault_hi && (char *)src + size > fault_lo)
+		return -EFAULT;
+	memcpy(dst, src, size);
+	return 0;
+}
+
+#include "search.inc"
+
+/* the proxy's gdb helpers want these from the proxy's main file */
+int debug;
+char defaultBrkStr[2] = { 0xff, 0xf3 };
+char defaultBrkStrLen = 2;
+
+int sendSpecialBreak(struct port_st *port, char *breakString, int len)
+{
+	return 0;
+}
+
+int usb_portopen(struct port_st *port)
+{
+	return -1;
+}
+
+static int sock_read(struct port_st *port, char *buf, int size, int opts)
+{
+	return read(port->sock, buf, size);
+}
+
+static int sock_write(struct port_st *port, char *buf, int size, int opts)
+{
+	return write(port->sock, buf, size);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run the search on args as kgdb_io_usb_query() would, the reply in buf */
+static int search(const char *args, int len, char *buf, int size)
+{
+	kgdb_usb_args_end = args + len;
+	return kgdb_usb_packet_search(args, buf, size);
+}
+
+/* "addr;count;" and the pattern escaped as gdb sends it */
+static int search_args(char *args, char *addr, unsigned long count,
+		       const char *pat, int plen)
+{
+	int i, n;
+
+	n = sprintf(args, "%lx;%lx;", (unsigned long)addr, count);
+	for (i = 0; i < plen; i++) {
+		if (pat[i] == '$' || pat[i] == '#' || pat[i] == '}' ||
+		    pat[i] == '*') {
+			args[n++] = '}';
+			args[n++] = pat[i] ^ 0x20;
+		} else {
+			args[n++] = pat[i];
+		}
+	}
+	args[n] = '\0';
+
+	return n;
+}
+
+static int check(void)
+{
+	static const char alphabet[] = "ab}$#*";
+	char *mem = malloc(CHECK_SIZE), *addr, *want;
+	char pat[SEARCH_PATTERN_MAX + 1], args[512], reply[64], expect[64];
+	unsigned long count;
+	int i, round, plen, n;
+
+	srand(3);
+	for (i = 0; i < CHECK_SIZE; i++)
+		mem[i] = alphabet[rand() % 4];
+
+	for (round = 0; round < CHECK_ROUNDS; round++) {
+		plen = 1 + rand() % (round % 8 ? 8 : SEARCH_PATTERN_MAX);
+		for (i = 0; i < plen; i++)
+			pat[i] = alphabet[rand() % 6];
+
+		/* ranges and planted matches around the chunk boundaries */
+		addr = mem + rand() % (CHECK_SIZE / 2);
+		if (round % 3 == 0)
+			addr = mem + (rand() % 64 + 1) * SEARCH_CHUNK -
+			       rand() % 8;
+		count = rand() % (4 * SEARCH_CHUNK);
+		if (round % 2 && count >= plen) {
+			n = round % 4 == 1 ? SEARCH_CHUNK - rand() % plen :
+			    rand() % (count - plen + 1);
+			if (n + plen <= count)
+				memcpy(addr + n, pat, plen);
+		}
+
+		want = count >= plen ? memmem(addr, count, pat, plen) : NULL;
+		if (want)
+			sprintf(expect, "1,%lx", (unsigned long)want);
+		else
+			strcpy(expect, "0");
+
+		n = search_args(args, addr, count, pat, plen);
+		search(args, n, reply, sizeof(reply));
+		if (strcmp(reply, expect)) {
+			printf("search: round %d, %lx bytes at +%lx, pattern "
+			       "of %d: %s, memmem %s\n", round, count,
+			       (unsigned long)(addr - mem), plen, reply,
+			       expect);
+			return 1;
+		}
+	}
+
+	/* a page that cannot be read, before and after a match */
+	fault_lo = mem + 8 * SEARCH_CHUNK;
+	fault_hi = fault_lo + 4096;
+	memcpy(fault_lo - 100, "needle", 6);
+	n = search_args(args, fault_lo - 2 * SEARCH_CHUNK,
+			4 * SEARCH_CHUNK, "needle", 6);
+	search(args, n, reply, sizeof(reply));
+	sprintf(expect, "1,%lx", (unsigned long)(fault_lo - 100));
+	if (strcmp(reply, expect)) {
+		printf("search: match before a hole: %s, want %s\n", reply,
+		       expect);
+		return 1;
+	}
+	n = search_args(args, fault_lo - 50, 4 * SEARCH_CHUNK, "needle", 6);
+	search(args, n, reply, sizeof(reply));
+	if (strcmp(reply, "E14")) {
+		printf("search: read of a hole: %s\n", reply);
+		return 1;
+	}
+	fault_lo = fault_hi = NULL;
+
+	/* no pattern, one too long, a bad range */
+	memset(pat, 'a', sizeof(pat));
+	n = search_args(args, mem, 100, pat, 0);
+	search(args, n, reply, sizeof(reply));
+	if (strcmp(reply, "E22"))
+		goto bad;
+	n = search_args(args, mem, 100, pat, SEARCH_PATTERN_MAX + 1);
+	search(args, n, reply, sizeof(reply));
+	if (strcmp(reply, "E22"))
+		goto bad;
+	search("10,20", 5, reply, sizeof(reply));
+	if (strcmp(reply, "E22"))
+		goto bad;
+
+	printf("search: %d random searches against memmem: ok\n",
+	       CHECK_ROUNDS);
+	free(mem);
+	return 0;
+bad:
+	printf("search: bad request answered %s\n", reply);
+	return 1;
+}
+
+/* the fake stub: qSearch:memory and 'm' on the whole address space */
+static int sv[2];
+static unsigned long stub_rx, stub_tx, stub_packets;
+
+static void stub_put(const char *r, int len)
+{
+	char pkt[2 * BENCH_BLOCK + 8];
+	unsigned char csum = 0;
+	int i, n;
+
+	for (i = 0; i < len; i++)
+		csum += (unsigned char)r[i];
+	pkt[0] = '$';
+	memcpy(pkt + 1, r, len);
+	n = len + 1 + sprintf(pkt + len + 1, "#%02x", csum);
+	stub_tx += n;		/* before the reply can be seen */
+	if (write(sv[1], pkt, n) != n)
+		exit(1);
+}
+
+static void *stub(void *arg)
+{
+	static const char hex[] = "0123456789abcdef";
+	char cmd[512], reply[2 * BENCH_BLOCK + 1], c, *p;
+	unsigned long addr, len, i;
+	int n;
+
+	for (;;) {
+		do {
+			if (read(sv[1], &c, 1) != 1)
+				return NULL;
+			stub_rx++;
+		} while (c != '$');
+		for (n = 0; read(sv[1], &c, 1) == 1 && c != '#'; n++)
+			cmd[n] = c;
+		cmd[n] = '\0';
+		stub_rx += n + 3;
+		stub_tx++;
+		stub_packets++;
+		if (read(sv[1], reply, 2) != 2 || write(sv[1], "+", 1) != 1)
+			return NULL;
+
+		if (!strncmp(cmd, "qSearch:memory:", 15)) {
+			n = search(cmd + 15, n - 15, reply, sizeof(reply));
+		} else if (cmd[0] == 'm') {
+			addr = strtoul(cmd + 1, &p, 16);
+			len = strtoul(p + 1, NULL, 16);
+			for (i = 0; i < len; i++) {
+				c = ((char *)addr)[i];
+				reply[2 * i] = hex[(c >> 4) & 0xf];
+				reply[2 * i + 1] = hex[c & 0xf];
+			}
+			n = 2 * len;
+		} else if (cmd[0] == 'k') {
+			stub_put("", 0);
+			return NULL;
+		} else {
+			n = 0;
+		}
+		stub_put(reply, n);
+	}
+}
+
+static void bench_report(const char *what, double start, int found)
+{
+	printf("search: %-26s %7.3fs %6lu packets %9lu bytes to the "
+	       "target %9lu from it%s\n", what, now() - start, stub_packets,
+	       stub_rx, stub_tx, found ? "" : ", NOT FOUND");
+	stub_rx = stub_tx = stub_packets = 0;
+}
+
+static int bench(void)
+{
+	static const char needle[] = "kgdb search needle";
+	char *mem = malloc(BENCH_SIZE), *at = NULL;
+	char cmd[512], reply[IO_BUFSIZE], *buf, *hit;
+	int plen = sizeof(needle) - 1, keep = 0, len, i;
+	unsigned long off;
+	struct port_st port;
+	pthread_t t;
+	double start;
+
+	for (i = 0; i < BENCH_SIZE; i++)
+		mem[i] = "kgdb search"[i % 11];
+	memcpy(mem + BENCH_SIZE - 100, needle, plen);
+
+	memset(&port, 0, sizeof(port));
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+		return 1;
+	port.type = PORT_RS232;
+	port.sock = sv[0];
+	port.portread = sock_read;
+	port.portwrite = sock_write;
+	pthread_create(&t, NULL, stub, NULL);
+
+	start = now();
+	sprintf(cmd, "qSearch:memory:%lx;%x;%s", (unsigned long)mem,
+		BENCH_SIZE, needle);
+	len = gdb_command(&port, cmd, reply, sizeof(reply));
+	if (len > 2 && !strncmp(reply, "1,", 2))
+		at = (char *)strtoul(reply + 2, NULL, 16);
+	bench_report("qSearch:memory", start, at == mem + BENCH_SIZE - 100);
+
+	/* gdb's find without it: read, keeping plen - 1 bytes, and search */
+	start = now();
+	buf = malloc(BENCH_BLOCK + plen);
+	at = NULL;
+	for (off = 0; off < BENCH_SIZE && !at; off += BENCH_BLOCK) {
+		sprintf(cmd, "m%lx,%x", (unsigned long)mem + off, BENCH_BLOCK);
+		len = gdb_command(&port, cmd, reply, sizeof(reply));
+		if (len != 2 * BENCH_BLOCK ||
+		    gdb_hex2bin(reply, len) != BENCH_BLOCK) {
+			printf("search: 'm' read failed at %lx\n", off);
+			return 1;
+		}
+		memcpy(buf + keep, reply, BENCH_BLOCK);
+		hit = memmem(buf, keep + BENCH_BLOCK, needle, plen);
+		if (hit)
+			at = mem + off - keep + (hit - buf);
+		keep = plen - 1;
+		memmove(buf, buf + BENCH_BLOCK, keep);
+	}
+	bench_report("'m' reads, host search", start,
+		     at == mem + BENCH_SIZE - 100);
+
+	gdb_command(&port, "k", reply, sizeof(reply));
+	pthread_join(t, NULL);
+	close(sv[0]);
+	close(sv[1]);
+	free(buf);
+	free(mem);
+
+	return 0;
+}
+
+int main(void)
+{
+	if (check())
+		return 1;
+
+	printf("search: %d MiB, the pattern at its end, fake stub over a "
+	       "socketpair\n", BENCH_SIZE >> 20);
+	return bench();
+}
@@ -0,0 +1,164 @@
+/*
+ * Agent proxy for android
+ *
+ * test/sym_test.c  the symbol index of the proxy against a binary search
+ *
+ * Copyright (C) 2011 Sevencore, Inc.
+ * 	Author: Joohyun Kyong <joohyun0115@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+#include <time.h>
+
+/*
+ * The index is built with the proxy's own code, included whole: random
+ * addresses with many repeats go through sym_ents_add() and
+ * sym_ents_index() for every table size up to MAX_SMALL and a few
+ * large ones.  sym_index_find() must give what sym_index_bsearch()
+ * does, the last entry at or below the address, for every entry, its
+ * neighbours, both ends of the address space and random addresses.
+ * The timing is that of sym_bench, on a table of a kernel's size.
+ */
+#include "../android-agent-proxy-sym.c"
+
+#define MAX_SMALL	300
+#define BIG		30000
+#define LOOKUPS		(4 << 20)
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int build(struct sym_index *x, unsigned int **name, unsigned int n,
+		 unsigned int span)
+{
+	struct sym_ents t;
+	unsigned int i;
+
+	memset(&t, 0, sizeof(t));
+	memset(x, 0, sizeof(*x));
+	for (i = 0; i < n; i++)
+		if (sym_ents_add(&t, 0xc0008000 + rand() % span, i, 0))
+			return -1;
+	return sym_ents_index(&t, x, name, NULL);
+}
+
+static void drop(struct sym_index *x, unsigned int *name)
+{
+	free(x->addr);
+	free(x->eyt);
+	free(x->pos);
+	free(name);
+}
+
+static int probe(const struct sym_index *x, unsigned int addr)
+{
+	int want = sym_index_bsearch(x, addr);
+	int got = sym_index_find(x, addr);
+
+	if (got == want && (want < 0 || x->addr[want] <= addr) &&
+	    (want + 1 == (int)x->n || x->addr[want + 1] > addr))
+		return 0;
+	printf("sym: %u entries, %08x found at %d, binary search %d\n", x->n,
+	       addr, got, want);
+	return 1;
+}
+
+static int check(unsigned int n, unsigned int span)
+{
+	struct sym_index x;
+	unsigned int *name, i;
+	int err = 0;
+
+	if (build(&x, &name, n, span)) {
+		printf("sym: no memory for %u entries\n", n);
+		return 1;
+	}
+	err |= probe(&x, 0) | probe(&x, 0xffffffff);
+	for (i = 0; i < n && !err; i++) {
+		if (i && x.addr[i - 1] > x.addr[i]) {
+			printf("sym: %u entries not sorted at %u\n", n, i);
+			err = 1;
+		}
+		/* entries of one address stay in the order they came in */
+		if (i && x.addr[i - 1] == x.addr[i] && name[i - 1] > name[i]) {
+			printf("sym: %u entries, repeats reordered at %u\n",
+			       n, i);
+			err = 1;
+		}
+		err |= probe(&x, x.addr[i] - 1) | probe(&x, x.addr[i]) |
+		    probe(&x, x.addr[i] + 1);
+	}
+	for (i = 0; i < 1000 && !err; i++)
+		err |= probe(&x, 0xc0000000 + rand() % (span + 0x10000));
+	drop(&x, name);
+
+	return err;
+}
+
+static int bench(void)
+{
+	struct sym_index x;
+	unsigned int *name, *addr, i;
+	unsigned long sum = 0;
+	double start, t_eyt, t_bin;
+
+	if (build(&x, &name, BIG, 4 << 20))
+		return 1;
+	addr = malloc(LOOKUPS * sizeof(*addr));
+	if (!addr)
+		return 1;
+	for (i = 0; i < LOOKUPS; i++)
+		addr[i] = 0xc0008000 + rand() % (4 << 20);
+
+	start = now();
+	for (i = 0; i < LOOKUPS; i++)
+		sum += sym_index_find(&x, addr[i]);
+	t_eyt = now() - start;
+	start = now();
+	for (i = 0; i < LOOKUPS; i++)
+		sum -= sym_index_bsearch(&x, addr[i]);
+	t_bin = now() - start;
+	sym_bench_sink = sum;
+
+	printf("sym: %u symbols, eytzinger %.2f M/s, binary search "
+	       "%.2f M/s\n", BIG, LOOKUPS / t_eyt / 1e6,
+	       LOOKUPS / t_bin / 1e6);
+	free(addr);
+	drop(&x, name);
+
+	return sum != 0;
+}
+
+int main(void)
+{
+	unsigned int n;
+
+	srand(5);
+	for (n = 0; n <= MAX_SMALL; n++)
+		if (check(n, n % 2 ? 4 * n + 1 : 64 * n + 1))
+			return 1;
+	for (n = BIG - 2; n <= BIG + 2; n++)
+		if (check(n, n % 2 ? 2 * n : 4 << 20))
+			return 1;
+	printf("sym: tables of 0 to %d and about %d entries against a binary "
+	       "search: ok\n", MAX_SMALL, BIG);
+
+	return bench();
+}
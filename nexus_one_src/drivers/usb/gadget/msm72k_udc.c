@@ -41,6 +41,10 @@
 #include <linux/device.h>
 #include <mach/msm_hsusb_hw.h>
 
+#ifdef CONFIG_KGDB_USB_DEVICE
+#include "f_kgdb.h"
+#endif
+
 static const char driver_name[] = "msm72k_udc";
 
 /* #define DEBUG */
@@ -974,6 +978,49 @@ int platform_usb_handler(void)
 {
     return usb_interrupt(0, the_usb_info);
 }
+
+/*
+ * Complete only the kgdb endpoints.  Port changes, resets, suspend,
+ * setup packets and completions on other endpoints are left to
+ * usb_interrupt(), which acknowledges them itself.
+ */
+static int msm72k_kgdb_poll(struct usb_ep *in, struct usb_ep *out)
+{
+	struct usb_info *ui = the_usb_info;
+	unsigned mask, n;
+
+	mask = (1 << to_msm_endpoint(in)->bit) |
+		(1 << to_msm_endpoint(out)->bit);
+
+	n = readl(USB_USBSTS) & readl(USB_USBINTR);
+	if ((n & ~STS_UI) || readl(USB_ENDPTSETUPSTAT))
+		goto full;
+
+	n = readl(USB_ENDPTCOMPLETE);
+	if (n & ~mask)
+		goto full;
+	if (!n)
+		return 0;
+
+	writel(STS_UI, USB_USBSTS);
+	writel(n, USB_ENDPTCOMPLETE);
+	while (n) {
+		unsigned bit = __ffs(n);
+		handle_endpoint(ui, bit);
+		n = n & (~(1 << bit));
+	}
+	return 0;
+
+full:
+	usb_interrupt(0, ui);
+	return 1;
+}
+
+struct kgdb_usb_poll_ops kgdb_usb_poll_ops = {
+	.name	= "msm72k_udc",
+	.poll	= msm72k_kgdb_poll,
+	.irq	= platform_usb_handler,
+};
 #endif
 
 static void usb_prepare(struct usb_info *ui)
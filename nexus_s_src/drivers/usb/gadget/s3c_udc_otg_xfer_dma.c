@@ -28,6 +28,10 @@
 
 #define	DMA_ADDR_INVALID	(~(dma_addr_t)0)
 
+#ifdef CONFIG_KGDB_USB_DEVICE
+#include "f_kgdb.h"
+#endif
+
 static u8 clear_feature_num;
 static int clear_feature_flag;
 static int set_conf_done;
@@ -529,6 +533,54 @@ int platform_usb_handler(void)
 {
 	return s3c_udc_irq(0, the_controller);
 }
+
+/*
+ * Complete only the kgdb endpoints.  Everything else, including setup
+ * packets on ep0 and transfers of other functions, is left pending for
+ * s3c_udc_irq().
+ */
+static int s3c_udc_kgdb_poll(struct usb_ep *in, struct usb_ep *out)
+{
+	struct s3c_udc *dev = the_controller;
+	u32 in_num = ep_index(container_of(in, struct s3c_ep, ep));
+	u32 out_num = ep_index(container_of(out, struct s3c_ep, ep));
+	u32 intr_status, ep_intr, ep_intr_status;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+
+	intr_status = readl(S3C_UDC_OTG_GINTSTS) & readl(S3C_UDC_OTG_GINTMSK);
+	ep_intr = readl(S3C_UDC_OTG_DAINT);
+	if ((intr_status & ~(INT_IN_EP | INT_OUT_EP)) ||
+	    (ep_intr & ~((1 << in_num) | (1 << (out_num + DAINT_OUT_BIT))))) {
+		spin_unlock_irqrestore(&dev->lock, flags);
+		s3c_udc_irq(0, dev);
+		return 1;
+	}
+
+	if (ep_intr & (1 << in_num)) {
+		ep_intr_status = readl(S3C_UDC_OTG_DIEPINT(in_num));
+		writel(ep_intr_status, S3C_UDC_OTG_DIEPINT(in_num));
+		if (ep_intr_status & TRANSFER_DONE)
+			complete_tx(dev, in_num);
+	}
+
+	if (ep_intr & (1 << (out_num + DAINT_OUT_BIT))) {
+		ep_intr_status = readl(S3C_UDC_OTG_DOEPINT(out_num));
+		writel(ep_intr_status, S3C_UDC_OTG_DOEPINT(out_num));
+		if (ep_intr_status & TRANSFER_DONE)
+			complete_rx(dev, out_num);
+	}
+
+	spin_unlock_irqrestore(&dev->lock, flags);
+	return 0;
+}
+
+struct kgdb_usb_poll_ops kgdb_usb_poll_ops = {
+	.name	= "s3c-udc",
+	.poll	= s3c_udc_kgdb_poll,
+	.irq	= platform_usb_handler,
+};
 #endif
 
 /** Queue one request
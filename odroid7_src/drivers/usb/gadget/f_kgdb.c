@@ -35,17 +35,44 @@
 #include <linux/file.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
+#include <linux/debugfs.h>
+#include <linux/kgdb.h>
+#include <linux/kallsyms.h>
+#include <linux/uaccess.h>
+#include <linux/ctype.h>
+#include <linux/sched.h>
+#include <linux/smp.h>
+#include <linux/hrtimer.h>
+#include <linux/ring_buffer.h>
+#include <linux/ftrace_event.h>
+#include <linux/kernel_stat.h>
+#include <linux/irq.h>
+#include <linux/mm.h>
+#include <linux/vmstat.h>
+#include <asm/irq_regs.h>
+#include <asm/unaligned.h>
 
 #include <linux/usb.h>
 #include <linux/usb/ch9.h>
 #include <linux/usb/android_composite.h>
 
+#include "f_kgdb.h"
+
 
 #define BULK_BUFFER_SIZE    16384
 #define KGDB_STRING_SIZE     256
 
 #define PROTOCOL_VERSION    1
 
+/* vendor request to the interface, the host's break-in */
+#define KGDB_REQ_BREAK      0x01
+#define KGDB_REQ_SAMPLER    0x02
+#define KGDB_REQ_TRACE      0x03
+#define KGDB_REQ_TELEMETRY  0x04
+
+/* wValue of KGDB_REQ_BREAK: take a sample for the profiler as well */
+#define KGDB_BREAK_SAMPLE   0x0001
+
 /* String IDs */
 #define INTERFACE_STRING_INDEX	0
 
@@ -73,6 +100,45 @@ struct kgdb_dev {
 	wait_queue_head_t write_wq;
 	struct usb_request *rx_req[RX_REQ_MAX];
 	int rx_done;
+
+	/*
+	 * The threads sending while the kernel runs wait for an IN request,
+	 * and queue it under live_lock, which the pause from the debugger
+	 * takes too.
+	 */
+	wait_queue_head_t live_tx_wq;
+	spinlock_t live_lock;
+
+#ifdef CONFIG_USB_ANDROID_KGDB_PEEK
+	/* the live peek channel, on rx_req[1] */
+	struct task_struct *peek_thread;
+	wait_queue_head_t peek_wq;
+	int peek_queued;
+	int peek_done;
+	int peek_paused;
+#endif
+#ifdef CONFIG_USB_ANDROID_KGDB_SAMPLER
+	/* the pc sampler and its rate, set by the host */
+	struct task_struct *sampler_thread;
+	wait_queue_head_t sampler_wq;
+	unsigned int sampler_hz;
+	int sampler_paused;
+#endif
+#ifdef CONFIG_USB_ANDROID_KGDB_TRACE
+	/* the ftrace stream, turned on by the host */
+	struct task_struct *trace_thread;
+	wait_queue_head_t trace_wq;
+	int trace_on;
+	int trace_paused;
+#endif
+#ifdef CONFIG_USB_ANDROID_KGDB_TELEMETRY
+	/* the telemetry records and their period, set by the host */
+	struct task_struct *telemetry_thread;
+	wait_queue_head_t telemetry_wq;
+	unsigned int telemetry_ms;
+	u32 telemetry_cost_ns;
+	int telemetry_paused;
+#endif
 };
 
 static struct usb_interface_descriptor kgdb_interface_desc = {
@@ -148,6 +214,121 @@ static struct usb_gadget_strings *kgdb_strings[] = {
 /* temporary variable used between kgdb_open() and kgdb_gadget_bind() */
 static struct kgdb_dev *_kgdb_dev;
 
+/* TX statistics, exported through debugfs as f_kgdb/tx_* */
+static u32 kgdb_tx_requests;
+static u32 kgdb_tx_waits;
+
+/* break-in requests from the host, see kgdb_function_setup() */
+static u32 kgdb_breaks;
+
+/* requests served by the live peek thread */
+static u32 kgdb_peeks;
+
+/* pc samples taken and the transfers that carried them to the host */
+static u32 kgdb_sampler_samples;
+static u32 kgdb_sampler_xfers;
+
+/* ftrace pages sent to the host */
+static u32 kgdb_trace_pages;
+
+/* telemetry records sent, and those skipped for want of a request */
+static u32 kgdb_telemetry_records;
+static u32 kgdb_telemetry_skipped;
+
+/* counters for the polled controller access, see kgdb_usb_poll() */
+static u32 kgdb_poll_fast;
+static u32 kgdb_poll_full;
+
+/*
+ * Latency of the bulk transfers and of the polled controller access,
+ * in cycles.  Each stat collects the number of samples, the worst case
+ * and the sum.  They are only filled in with USB_ANDROID_KGDB_CYCLES.
+ */
+struct kgdb_cycle_stat {
+	u32 count;
+	u32 max;
+	u64 total;
+};
+
+static struct kgdb_cycle_stat kgdb_tx_cycles;
+static struct kgdb_cycle_stat kgdb_rx_cycles;
+static struct kgdb_cycle_stat kgdb_poll_fast_cycles;
+static struct kgdb_cycle_stat kgdb_poll_full_cycles;
+static struct kgdb_cycle_stat kgdb_peek_cycles;
+static struct kgdb_cycle_stat kgdb_sampler_cycles;
+static struct kgdb_cycle_stat kgdb_telemetry_cycles;
+
+#ifdef CONFIG_USB_ANDROID_KGDB_CYCLES
+/* ARMv7 PMU cycle counter */
+static inline u32 kgdb_cycles(void)
+{
+	u32 ccnt;
+
+	asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r" (ccnt));
+	return ccnt;
+}
+
+static void kgdb_cycle_stat_add(struct kgdb_cycle_stat *stat, u32 start)
+{
+	u32 delta = kgdb_cycles() - start;
+
+	stat->count++;
+	stat->total += delta;
+	if (delta > stat->max)
+		stat->max = delta;
+}
+
+static void __init kgdb_cycle_stat_debugfs(struct dentry *dir,
+		const char *name, struct kgdb_cycle_stat *stat)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%s_count", name);
+	debugfs_create_u32(buf, 0444, dir, &stat->count);
+	snprintf(buf, sizeof(buf), "%s_max", name);
+	debugfs_create_u32(buf, 0444, dir, &stat->max);
+	snprintf(buf, sizeof(buf), "%s_total", name);
+	debugfs_create_u64(buf, 0444, dir, &stat->total);
+}
+
+static void __init kgdb_cycles_init(struct dentry *root)
+{
+	struct dentry *dir;
+	u32 pmcr;
+
+	/* enable the PMU and the cycle counter */
+	asm volatile("mrc p15, 0, %0, c9, c12, 0" : "=r" (pmcr));
+	asm volatile("mcr p15, 0, %0, c9, c12, 0" : : "r" (pmcr | 1));
+	asm volatile("mcr p15, 0, %0, c9, c12, 1" : : "r" (1 << 31));
+
+	dir = debugfs_create_dir("cycles", root);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	kgdb_cycle_stat_debugfs(dir, "tx", &kgdb_tx_cycles);
+	kgdb_cycle_stat_debugfs(dir, "rx", &kgdb_rx_cycles);
+	kgdb_cycle_stat_debugfs(dir, "poll_fast", &kgdb_poll_fast_cycles);
+	kgdb_cycle_stat_debugfs(dir, "poll_full", &kgdb_poll_full_cycles);
+	kgdb_cycle_stat_debugfs(dir, "peek", &kgdb_peek_cycles);
+	kgdb_cycle_stat_debugfs(dir, "sampler", &kgdb_sampler_cycles);
+	kgdb_cycle_stat_debugfs(dir, "telemetry", &kgdb_telemetry_cycles);
+}
+#else
+static inline u32 kgdb_cycles(void)
+{
+	return 0;
+}
+
+static inline void kgdb_cycle_stat_add(struct kgdb_cycle_stat *stat,
+		u32 start)
+{
+}
+
+static inline void kgdb_cycles_init(struct dentry *root)
+{
+}
+#endif
+
 static inline struct kgdb_dev *func_to_dev(struct usb_function *f)
 {
 	return container_of(f, struct kgdb_dev, function);
@@ -211,18 +392,74 @@ static void kgdb_set_disconnected(struct kgdb_dev *dev)
 	dev->disconnected = 1;
 }
 
+/*
+ * The completions and the vendor requests also run from kgdb_usb_poll()
+ * inside the debugger, where nothing may be woken up: the other CPUs
+ * need not be stopped, and one of them may hold the queue's lock.  The
+ * threads notice on their timeouts instead.
+ */
+static void kgdb_live_wake(wait_queue_head_t *wq)
+{
+	if (atomic_read(&kgdb_active) == -1)
+		wake_up(wq);
+}
+
 static void kgdb_complete_in(struct usb_ep *ep, struct usb_request *req)
 {
 	struct kgdb_dev *dev = _kgdb_dev;
 
+	kgdb_cycle_stat_add(&kgdb_tx_cycles, (u32)(unsigned long)req->context);
 	if (req->status != 0)
 		kgdb_set_disconnected(dev);
 
 	req_put(dev, &dev->tx_idle, req);
 
-	wake_up(&dev->write_wq);
+	kgdb_live_wake(&dev->live_tx_wq);
+}
+
+#if defined(CONFIG_USB_ANDROID_KGDB_PEEK) || \
+    defined(CONFIG_USB_ANDROID_KGDB_SAMPLER) || \
+    defined(CONFIG_USB_ANDROID_KGDB_TRACE) || \
+    defined(CONFIG_USB_ANDROID_KGDB_TELEMETRY)
+/*
+ * Queue an IN transfer of a thread running while the kernel runs,
+ * unless the debugger has paused its channel.  The other CPUs need not
+ * be stopped, so the check and the queue are under live_lock, which
+ * kgdb_live_pause() takes as well: once that returns no transfer of the
+ * channel can land in the stub's stream.  An unqueued request goes back
+ * to tx_idle.  These transfers stand alone, one that fills its last
+ * packet is ended with a zero length packet.
+ */
+static int kgdb_live_queue(struct kgdb_dev *dev, struct usb_request *req,
+			   int length, int *paused)
+{
+	unsigned long flags;
+	int ret = -EBUSY;
+
+	req->length = length;
+	req->zero = 1;
+	req->context = (void *)(unsigned long)kgdb_cycles();
+	spin_lock_irqsave(&dev->live_lock, flags);
+	if (!*paused)
+		ret = usb_ep_queue(dev->ep_in, req, GFP_ATOMIC);
+	spin_unlock_irqrestore(&dev->live_lock, flags);
+	if (ret < 0)
+		req_put(dev, &dev->tx_idle, req);
+
+	return ret;
 }
 
+static inline void kgdb_live_pause(struct kgdb_dev *dev, int *paused)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->live_lock, flags);
+	*paused = 1;
+	spin_unlock_irqrestore(&dev->live_lock, flags);
+}
+#endif
+
+/* rx_req[0] is only queued by kgdb_read(), which polls for it */
 static void kgdb_complete_out(struct usb_ep *ep, struct usb_request *req)
 {
 	struct kgdb_dev *dev = _kgdb_dev;
@@ -230,7 +467,6 @@ static void kgdb_complete_out(struct usb_ep *ep, struct usb_request *req)
 	dev->rx_done = 1;
 	if (req->status != 0)
 		kgdb_set_disconnected(dev);
-	wake_up(&dev->read_wq);
 }
 
 static int __init create_bulk_endpoints(struct kgdb_dev *dev,
@@ -298,7 +534,27 @@ fail:
 	return -1;
 }
 
-int platform_usb_handler(void);
+/*
+ * Let the controller make progress while we spin in the debugger.  Once
+ * the function is online only the kgdb endpoints are serviced; the UDC
+ * falls back to its full interrupt handler on bus events.
+ */
+static void kgdb_usb_poll(struct kgdb_dev *dev)
+{
+	u32 start = kgdb_cycles();
+
+	if (!dev->online || !kgdb_usb_poll_ops.poll) {
+		kgdb_usb_poll_ops.irq();
+		kgdb_poll_full++;
+		kgdb_cycle_stat_add(&kgdb_poll_full_cycles, start);
+	} else if (kgdb_usb_poll_ops.poll(dev->ep_in, dev->ep_out)) {
+		kgdb_poll_full++;
+		kgdb_cycle_stat_add(&kgdb_poll_full_cycles, start);
+	} else {
+		kgdb_poll_fast++;
+		kgdb_cycle_stat_add(&kgdb_poll_fast_cycles, start);
+	}
+}
 
 ssize_t kgdb_read(char  *buf, size_t count)
 {
@@ -307,6 +563,7 @@ ssize_t kgdb_read(char  *buf, size_t count)
 	struct usb_request *req;
 	int r = count, xfer;
 	int ret = 0;
+	u32 rx_start;
 
 	DBG(cdev, "kgdb_read(%d)\n", count);
 
@@ -319,7 +576,7 @@ ssize_t kgdb_read(char  *buf, size_t count)
 	/* we will block until we're online */
 	while (!(dev->online)) {
 		DBG(cdev, "kgdb_read: waiting for online state\n");
-		platform_usb_handler();
+		kgdb_usb_poll(dev);
 	}
 	
 
@@ -328,6 +585,7 @@ requeue_req:
 	req = dev->rx_req[0];
 	req->length = count;
 	dev->rx_done = 0;
+	rx_start = kgdb_cycles();
 	ret = usb_ep_queue(dev->ep_out, req, GFP_KERNEL);
 	
 	if (ret < 0) {
@@ -336,8 +594,9 @@ requeue_req:
 	} 
 	
 	while (!dev->rx_done) {
-		platform_usb_handler();
+		kgdb_usb_poll(dev);
 	}
+	kgdb_cycle_stat_add(&kgdb_rx_cycles, rx_start);
 	
 	if (dev->online) {
 		/* If we got a 0-len packet, throw it back and try again. */
@@ -358,34 +617,76 @@ done:
 }
 
 
+/*
+ * Take an idle IN request.  When all TX_REQ_MAX requests are in flight,
+ * poll the controller until one of them completes and count the stall.
+ */
+static struct usb_request *kgdb_tx_get(struct kgdb_dev *dev)
+{
+	struct usb_request *req;
+
+	req = req_get(dev, &dev->tx_idle);
+	if (req)
+		return req;
+
+	kgdb_tx_waits++;
+	while (!(req = req_get(dev, &dev->tx_idle))) {
+		if (!dev->online)
+			return NULL;
+		kgdb_usb_poll(dev);
+	}
+
+	return req;
+}
+
+static int kgdb_tx_queue(struct kgdb_dev *dev, struct usb_request *req,
+			 int length)
+{
+	int ret;
+
+	req->length = length;
+	req->zero = 0;		/* the request may have carried a live one */
+	req->context = (void *)(unsigned long)kgdb_cycles();
+
+	/* the controller may refuse while its queue drains, retry */
+	while ((ret = usb_ep_queue(dev->ep_in, req, GFP_ATOMIC)) < 0) {
+		kgdb_tx_waits++;
+		if (!dev->online)
+			break;
+		kgdb_usb_poll(dev);
+	}
+	if (ret < 0) {
+		req_put(dev, &dev->tx_idle, req);
+		return -EIO;
+	}
+	kgdb_tx_requests++;
+
+	return 0;
+}
+
+/*
+ * Replies are split into BULK_BUFFER_SIZE chunks and queued back to back,
+ * so a large reply keeps every IN request busy.  We do not wait for the
+ * transfers to finish; the completions are reaped by the next
+ * kgdb_tx_get() or by the polling done in kgdb_read().
+ */
 ssize_t kgdb_write(char  *buf, size_t count)
 {
 	struct kgdb_dev *dev = _kgdb_dev;
 	struct usb_composite_dev *cdev = dev->cdev;
-	struct usb_request *req = 0;
+	struct usb_request *req;
 	int r = count, xfer;
-	int ret;
 
 	if (!dev->online || dev->disconnected)
 		return -ENODEV;
 
 	while (count > 0) {
-		if (!dev->online) {
+		req = kgdb_tx_get(dev);
+		if (!req) {
 			printk("kgdb_write dev->error\n");
 			r = -EIO;
 			break;
 		}
-		
-		/* get an idle tx request to use */
-		req = 0;
-
-		while ( !(req = req_get(dev, &dev->tx_idle))) {
-			platform_usb_handler(); 
-		}		
-		if (!req) {
-			r = ret;
-			break;
-		}
 
 		if (count > BULK_BUFFER_SIZE)
 			xfer = BULK_BUFFER_SIZE;
@@ -393,31 +694,993 @@ ssize_t kgdb_write(char  *buf, size_t count)
 			xfer = count;
 
 		memcpy(req->buf, buf, xfer);
-		
-		req->length = xfer;
-		ret = usb_ep_queue(dev->ep_in, req, GFP_KERNEL);
-		if (ret < 0) {
-			DBG(cdev, "kgdb_write: xfer error %d\n", ret);
+		if (kgdb_tx_queue(dev, req, xfer)) {
 			r = -EIO;
 			break;
 		}
 
-
 		buf += xfer;
 		count -= xfer;
-
-		/* zero this so we don't try to free it on error exit */
-		req = 0;
-		
 	}
-	
-	if (req)
-		req_put(dev, &dev->tx_idle, req);
 
 	DBG(cdev, "kgdb_write returning %d\n", r);
 	return r;
 }
 
+/*
+ * Like kgdb_write(), but fill() produces the data directly in the IN
+ * request buffers, up to len bytes per call, so bulk transfers are not
+ * copied twice.  fill() returns how much it stored.
+ */
+ssize_t kgdb_write_fill(int (*fill)(char *buf, int len, void *data),
+			void *data, size_t count)
+{
+	struct kgdb_dev *dev = _kgdb_dev;
+	struct usb_request *req;
+	size_t done = 0;
+	int xfer;
+
+	if (!dev->online || dev->disconnected)
+		return -ENODEV;
+
+	while (done < count) {
+		req = kgdb_tx_get(dev);
+		if (!req)
+			return -EIO;
+
+		xfer = min_t(size_t, count - done, BULK_BUFFER_SIZE);
+		xfer = fill(req->buf, xfer, data);
+		if (kgdb_tx_queue(dev, req, xfer))
+			return -EIO;
+
+		done += xfer;
+	}
+
+	return done;
+}
+
+#ifdef CONFIG_USB_ANDROID_KGDB_PEEK
+/*
+ * Live peek: read-only requests served while the kernel runs, by a
+ * kthread on the normal interrupt driven endpoints.  Requests and
+ * replies are framed "%<data>#<checksum>" and are not acknowledged.
+ * The stub skips everything up to a '$', so a request that reaches a
+ * stopped kernel is dropped and the host times out.
+ *
+ * The thread keeps rx_req[1] queued on the OUT endpoint.  When the
+ * kernel stops in the debugger, kgdb_peek_pause() takes it back for
+ * kgdb_read().
+ */
+#define KGDB_PEEK_MAX		2048	/* bytes per 'm' request */
+#define KGDB_PEEK_IDLE		msecs_to_jiffies(250)
+
+static void kgdb_complete_peek(struct usb_ep *ep, struct usb_request *req)
+{
+	struct kgdb_dev *dev = _kgdb_dev;
+
+	dev->peek_queued = 0;
+	dev->peek_done = 1;
+	kgdb_live_wake(&dev->peek_wq);
+}
+
+/* the command of a "%<cmd>#<checksum>" request, NULL if it is not one */
+static char *kgdb_peek_command(char *buf, int len)
+{
+	unsigned char csum = 0;
+	char *end, *p;
+
+	if (len < 4 || buf[0] != '%')
+		return NULL;
+	end = memchr(buf, '#', len);
+	if (!end || end + 3 > buf + len)
+		return NULL;
+
+	for (p = buf + 1; p < end; p++)
+		csum += *p;
+	if (tolower(end[1]) != hex_asc_hi(csum) ||
+	    tolower(end[2]) != hex_asc_lo(csum))
+		return NULL;
+
+	*end = '\0';
+	return buf + 1;
+}
+
+/* the reply to cmd in out, returns its length */
+static int kgdb_peek_handle(char *cmd, char *out)
+{
+	unsigned long addr, len, i;
+	unsigned char c;
+	char *p;
+
+	if (cmd[0] == 'm') {
+		addr = simple_strtoul(cmd + 1, &p, 16);
+		if (*p != ',')
+			return sprintf(out, "E%02d", EINVAL);
+		len = simple_strtoul(p + 1, NULL, 16);
+		if (!len || len > KGDB_PEEK_MAX)
+			return sprintf(out, "E%02d", EINVAL);
+
+		/* read into the second half and expand to hex in place */
+		p = out + len;
+		if (probe_kernel_read(p, (void *)addr, len))
+			return sprintf(out, "E%02d", EFAULT);
+		for (i = 0; i < len; i++) {
+			c = p[i];
+			out[2 * i] = hex_asc_hi(c);
+			out[2 * i + 1] = hex_asc_lo(c);
+		}
+		return 2 * len;
+	}
+
+	if (!strncmp(cmd, "qkgdb.sym:", 10)) {
+		addr = kallsyms_lookup_name(cmd + 10);
+		if (!addr)
+			return sprintf(out, "E%02d", ENOENT);
+		return sprintf(out, "%lx", addr);
+	}
+
+	if (!strncmp(cmd, "qkgdb.addr:", 11)) {
+		addr = simple_strtoul(cmd + 11, NULL, 16);
+		return sprint_symbol(out, addr);
+	}
+
+	/* unsupported, like the stub's empty reply */
+	return 0;
+}
+
+static void kgdb_peek_reply(struct kgdb_dev *dev, char *cmd)
+{
+	struct usb_request *req = NULL;
+	unsigned char csum = 0;
+	char *p;
+	int len, i;
+
+	wait_event_interruptible_timeout(dev->live_tx_wq,
+			(req = req_get(dev, &dev->tx_idle)) || !dev->online,
+			HZ);
+	if (!req)
+		return;
+
+	p = req->buf;
+	len = kgdb_peek_handle(cmd, p + 1);
+	for (i = 1; i <= len; i++)
+		csum += p[i];
+	p[0] = '%';
+	p[i++] = '#';
+	p[i++] = hex_asc_hi(csum);
+	p[i++] = hex_asc_lo(csum);
+
+	kgdb_live_queue(dev, req, i, &dev->peek_paused);
+}
+
+static int kgdb_peek_thread(void *data)
+{
+	struct kgdb_dev *dev = data;
+	struct usb_request *req = dev->rx_req[1];
+	unsigned long flags;
+	char *cmd;
+	u32 start;
+
+	req->complete = kgdb_complete_peek;
+
+	while (!kthread_should_stop()) {
+		/* arm the OUT endpoint unless the debugger owns it */
+		spin_lock_irqsave(&dev->live_lock, flags);
+		if (dev->online && !dev->peek_paused && !dev->peek_queued) {
+			req->length = BULK_BUFFER_SIZE;
+			dev->peek_done = 0;
+			if (!usb_ep_queue(dev->ep_out, req, GFP_ATOMIC))
+				dev->peek_queued = 1;
+		}
+		spin_unlock_irqrestore(&dev->live_lock, flags);
+
+		/* the timeout also notices a resume from the debugger */
+		wait_event_interruptible_timeout(dev->peek_wq,
+				dev->peek_done || kthread_should_stop(),
+				KGDB_PEEK_IDLE);
+		if (!dev->peek_done)
+			continue;
+		dev->peek_done = 0;
+		if (req->status || dev->peek_paused)
+			continue;
+
+		start = kgdb_cycles();
+		cmd = kgdb_peek_command(req->buf, req->actual);
+		if (cmd) {
+			kgdb_peek_reply(dev, cmd);
+			kgdb_peeks++;
+		}
+		kgdb_cycle_stat_add(&kgdb_peek_cycles, start);
+	}
+
+	return 0;
+}
+
+/* called by kgdb_io_usb when the kernel stops in the debugger */
+void kgdb_peek_pause(void)
+{
+	struct kgdb_dev *dev = _kgdb_dev;
+	unsigned long flags;
+
+	if (!dev)
+		return;
+
+	spin_lock_irqsave(&dev->live_lock, flags);
+	dev->peek_paused = 1;
+	if (dev->peek_queued)
+		usb_ep_dequeue(dev->ep_out, dev->rx_req[1]);
+	spin_unlock_irqrestore(&dev->live_lock, flags);
+}
+
+/* and when it continues, the thread rearms within KGDB_PEEK_IDLE */
+void kgdb_peek_resume(void)
+{
+	if (_kgdb_dev)
+		_kgdb_dev->peek_paused = 0;
+}
+
+static void kgdb_peek_start(struct kgdb_dev *dev)
+{
+	init_waitqueue_head(&dev->peek_wq);
+	dev->peek_thread = kthread_run(kgdb_peek_thread, dev, "kgdb_peek");
+	if (IS_ERR(dev->peek_thread)) {
+		printk(KERN_ERR "kgdb: could not start the peek thread\n");
+		dev->peek_thread = NULL;
+	}
+}
+
+static void kgdb_peek_stop(struct kgdb_dev *dev)
+{
+	if (!dev->peek_thread)
+		return;
+
+	kthread_stop(dev->peek_thread);
+	if (dev->peek_queued)
+		usb_ep_dequeue(dev->ep_out, dev->rx_req[1]);
+}
+#else
+static inline void kgdb_peek_start(struct kgdb_dev *dev)
+{
+}
+
+static inline void kgdb_peek_stop(struct kgdb_dev *dev)
+{
+}
+#endif
+
+#ifdef CONFIG_USB_ANDROID_KGDB_SAMPLER
+/*
+ * Continuous pc sampling.  A pinned hrtimer on each CPU stores the
+ * interrupted pc and task in a per-CPU ring, and the kgdb_sampler
+ * thread, at the lowest priority, sends the rings to the host on idle
+ * IN requests while the kernel runs.  A transfer is
+ *
+ *	'!', version, u16 samples, u32 samples dropped since the last one,
+ *	then per sample u32 pc and u32 cpu << 24 | user << 23 | pid
+ *
+ * little endian, and nothing after the samples.  The stub never sends a '!', so the host can tell the
+ * transfers apart.  The host starts and stops the sampler with the
+ * KGDB_REQ_SAMPLER vendor request, wValue is the rate in Hz.
+ */
+#define KGDB_SAMPLER_RING	2048	/* samples per CPU, a power of 2 */
+#define KGDB_SAMPLER_XFER	4096	/* bytes per transfer */
+#define KGDB_SAMPLER_MAX_HZ	20000
+#define KGDB_SAMPLER_DRAIN	msecs_to_jiffies(20)
+
+struct kgdb_pc_sample {
+	u32 pc;
+	u32 cpu_pid;
+};
+
+struct kgdb_sampler_ring {
+	struct hrtimer timer;
+	struct kgdb_pc_sample *buf;
+	unsigned int head;		/* written by the timer */
+	unsigned int tail;		/* by the thread */
+	u32 dropped;
+	u32 dropped_sent;
+};
+
+static DEFINE_PER_CPU(struct kgdb_sampler_ring, kgdb_sampler_rings);
+static unsigned long kgdb_sampler_ns;
+
+static enum hrtimer_restart kgdb_sampler_tick(struct hrtimer *timer)
+{
+	struct kgdb_sampler_ring *r =
+		container_of(timer, struct kgdb_sampler_ring, timer);
+	struct pt_regs *regs = get_irq_regs();
+	struct kgdb_pc_sample *s;
+	u32 start = kgdb_cycles();
+
+	if (!kgdb_sampler_ns)
+		return HRTIMER_NORESTART;
+
+	if (!regs) {
+		/* nothing was interrupted */
+	} else if (r->head - r->tail < KGDB_SAMPLER_RING) {
+		s = &r->buf[r->head & (KGDB_SAMPLER_RING - 1)];
+		s->pc = instruction_pointer(regs);
+		s->cpu_pid = smp_processor_id() << 24 |
+			(user_mode(regs) ? 1 << 23 : 0) |
+			(current->pid & 0x7fffff);
+		smp_wmb();
+		r->head++;
+		kgdb_sampler_samples++;
+	} else {
+		r->dropped++;
+	}
+
+	hrtimer_forward_now(timer, ns_to_ktime(kgdb_sampler_ns));
+	/* the stat is not per CPU, only the boot CPU adds to it */
+	if (!smp_processor_id())
+		kgdb_cycle_stat_add(&kgdb_sampler_cycles, start);
+
+	return HRTIMER_RESTART;
+}
+
+static void kgdb_sampler_arm(void *info)
+{
+	struct kgdb_sampler_ring *r = &__get_cpu_var(kgdb_sampler_rings);
+
+	if (r->buf)
+		hrtimer_start(&r->timer, ns_to_ktime(kgdb_sampler_ns),
+			      HRTIMER_MODE_REL_PINNED);
+}
+
+/* the samples of every CPU, as many as fit into len bytes */
+static int kgdb_sampler_fill(char *buf, int len)
+{
+	struct kgdb_sampler_ring *r;
+	struct kgdb_pc_sample *s = (struct kgdb_pc_sample *)(buf + 8);
+	int max = (len - 8) / sizeof(*s);
+	u32 dropped = 0, d;
+	int cpu, n = 0;
+
+	for_each_possible_cpu(cpu) {
+		r = &per_cpu(kgdb_sampler_rings, cpu);
+		if (!r->buf)
+			continue;
+
+		d = r->dropped;
+		dropped += d - r->dropped_sent;
+		r->dropped_sent = d;
+
+		while (r->tail != r->head && n < max) {
+			smp_rmb();
+			s[n++] = r->buf[r->tail & (KGDB_SAMPLER_RING - 1)];
+			smp_mb();
+			r->tail++;
+		}
+	}
+	if (!n && !dropped)
+		return 0;
+
+	buf[0] = '!';
+	buf[1] = 1;
+	put_unaligned_le16(n, buf + 2);
+	put_unaligned_le32(dropped, buf + 4);
+
+	return 8 + n * sizeof(*s);
+}
+
+/* send everything in the rings, or until the debugger takes over */
+static void kgdb_sampler_drain(struct kgdb_dev *dev)
+{
+	struct usb_request *req;
+	int len;
+
+	while (dev->online && !dev->sampler_paused) {
+		req = req_get(dev, &dev->tx_idle);
+		if (!req) {
+			wait_event_interruptible_timeout(dev->live_tx_wq,
+				!list_empty(&dev->tx_idle) || !dev->online,
+				HZ);
+			continue;
+		}
+
+		len = kgdb_sampler_fill(req->buf, KGDB_SAMPLER_XFER);
+		if (!len) {
+			req_put(dev, &dev->tx_idle, req);
+			return;
+		}
+
+		if (kgdb_live_queue(dev, req, len, &dev->sampler_paused))
+			return;
+		kgdb_sampler_xfers++;
+	}
+}
+
+static void kgdb_sampler_set_rate(unsigned int hz)
+{
+	struct kgdb_sampler_ring *r;
+	int cpu;
+
+	kgdb_sampler_ns = hz ? NSEC_PER_SEC / hz : 0;
+	if (!hz)
+		return;
+
+	/* start over with empty rings */
+	for_each_possible_cpu(cpu) {
+		r = &per_cpu(kgdb_sampler_rings, cpu);
+		r->tail = r->head;
+		r->dropped_sent = r->dropped;
+	}
+	on_each_cpu(kgdb_sampler_arm, NULL, 1);
+}
+
+static int kgdb_sampler_thread(void *data)
+{
+	struct kgdb_dev *dev = data;
+	unsigned int hz = 0;
+
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		if (dev->sampler_hz != hz) {
+			hz = dev->sampler_hz;
+			kgdb_sampler_set_rate(hz);
+		}
+
+		if (hz)
+			kgdb_sampler_drain(dev);
+
+		wait_event_interruptible_timeout(dev->sampler_wq,
+				dev->sampler_hz != hz || kthread_should_stop(),
+				hz ? KGDB_SAMPLER_DRAIN : MAX_SCHEDULE_TIMEOUT);
+	}
+	kgdb_sampler_set_rate(0);
+
+	return 0;
+}
+
+/* KGDB_REQ_SAMPLER, in the UDC interrupt */
+static int kgdb_sampler_request(struct kgdb_dev *dev, u16 hz)
+{
+	if (!dev->sampler_thread || hz > KGDB_SAMPLER_MAX_HZ)
+		return -EINVAL;
+
+	dev->sampler_hz = hz;
+	kgdb_live_wake(&dev->sampler_wq);
+
+	return 0;
+}
+
+/* called by kgdb_io_usb when the kernel stops in the debugger */
+void kgdb_sampler_pause(void)
+{
+	if (_kgdb_dev)
+		kgdb_live_pause(_kgdb_dev, &_kgdb_dev->sampler_paused);
+}
+
+/* and when it continues; the thread catches up within a drain period */
+void kgdb_sampler_resume(void)
+{
+	if (_kgdb_dev)
+		_kgdb_dev->sampler_paused = 0;
+}
+
+static void kgdb_sampler_start(struct kgdb_dev *dev)
+{
+	struct kgdb_sampler_ring *r;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		r = &per_cpu(kgdb_sampler_rings, cpu);
+		r->buf = kcalloc(KGDB_SAMPLER_RING, sizeof(*r->buf),
+				 GFP_KERNEL);
+		hrtimer_init(&r->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		r->timer.function = kgdb_sampler_tick;
+	}
+
+	init_waitqueue_head(&dev->sampler_wq);
+	dev->sampler_thread = kthread_run(kgdb_sampler_thread, dev,
+					  "kgdb_sampler");
+	if (IS_ERR(dev->sampler_thread)) {
+		printk(KERN_ERR "kgdb: could not start the sampler thread\n");
+		dev->sampler_thread = NULL;
+	}
+}
+
+static void kgdb_sampler_stop(struct kgdb_dev *dev)
+{
+	struct kgdb_sampler_ring *r;
+	int cpu;
+
+	if (dev->sampler_thread)
+		kthread_stop(dev->sampler_thread);
+
+	for_each_possible_cpu(cpu) {
+		r = &per_cpu(kgdb_sampler_rings, cpu);
+		hrtimer_cancel(&r->timer);
+		kfree(r->buf);
+		r->buf = NULL;
+	}
+}
+#else
+static inline int kgdb_sampler_request(struct kgdb_dev *dev, u16 hz)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void kgdb_sampler_start(struct kgdb_dev *dev)
+{
+}
+
+static inline void kgdb_sampler_stop(struct kgdb_dev *dev)
+{
+}
+#endif
+
+#ifdef CONFIG_USB_ANDROID_KGDB_TRACE
+/*
+ * ftrace over the kgdb interface.  The pages of the ftrace ring buffer
+ * go to the host as they are, the form trace-cmd keeps them in
+ * trace.dat, each in a transfer of its own:
+ *
+ *	'&', version, u16 cpu, u32 length, then the buffer_data_page
+ *
+ * little endian.  While the kernel runs, the kgdb_trace thread sends
+ * the full pages every KGDB_TRACE_DRAIN once the host turns it on with
+ * the KGDB_REQ_TRACE vendor request, and what is left when it turns it
+ * off.  A kernel stopped in kgdb sends everything at once for the
+ * qkgdb.ftrace query, see kgdb_trace_dump().
+ *
+ * The thread reads a page under kgdb_trace_lock, which the debugger
+ * entry takes before the dump, so that the dump never finds the
+ * reader_lock of a CPU buffer held by a stopped CPU.  The entry can
+ * have stopped the thread itself holding it, so it only waits for it
+ * KGDB_TRACE_WAIT microseconds and the dump sends nothing without it.
+ */
+#define KGDB_TRACE_XFER		(8 + PAGE_SIZE)
+#define KGDB_TRACE_DRAIN	msecs_to_jiffies(100)
+#define KGDB_TRACE_WAIT		1000
+
+static struct ring_buffer *kgdb_trace_buffer;
+static void *kgdb_trace_page;		/* for the thread */
+static void *kgdb_trace_dump_page;	/* for the debugger */
+static char kgdb_trace_xfer[KGDB_TRACE_XFER];
+static DEFINE_SPINLOCK(kgdb_trace_lock);
+static int kgdb_trace_locked;		/* by the debugger */
+
+/* the next page of cpu as a transfer in out, 0 when there is none */
+static int kgdb_trace_read(void **page, int cpu, int full, char *out)
+{
+	if (ring_buffer_read_page(kgdb_trace_buffer, page, PAGE_SIZE, cpu,
+				  full) < 0)
+		return 0;
+
+	out[0] = '&';
+	out[1] = 1;
+	put_unaligned_le16(cpu, out + 2);
+	put_unaligned_le32(PAGE_SIZE, out + 4);
+	memcpy(out + 8, *page, PAGE_SIZE);
+
+	return KGDB_TRACE_XFER;
+}
+
+/* send the pages of every CPU, only the full ones unless flushing */
+static void kgdb_trace_drain(struct kgdb_dev *dev, int full)
+{
+	struct usb_request *req;
+	int cpu, len;
+
+	for_each_online_cpu(cpu) {
+		while (dev->online && !dev->trace_paused) {
+			req = req_get(dev, &dev->tx_idle);
+			if (!req) {
+				wait_event_interruptible_timeout(dev->live_tx_wq,
+					!list_empty(&dev->tx_idle) ||
+					!dev->online, HZ);
+				continue;
+			}
+
+			len = 0;
+			if (spin_trylock(&kgdb_trace_lock)) {
+				if (!dev->trace_paused)
+					len = kgdb_trace_read(&kgdb_trace_page,
+							      cpu, full,
+							      req->buf);
+				spin_unlock(&kgdb_trace_lock);
+			}
+			if (!len) {
+				req_put(dev, &dev->tx_idle, req);
+				break;
+			}
+
+			if (kgdb_live_queue(dev, req, len, &dev->trace_paused))
+				return;
+			kgdb_trace_pages++;
+		}
+	}
+}
+
+static int kgdb_trace_thread(void *data)
+{
+	struct kgdb_dev *dev = data;
+	int on = 0;
+
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		if (on || dev->trace_on)
+			kgdb_trace_drain(dev, dev->trace_on);
+		on = dev->trace_on;
+
+		wait_event_interruptible_timeout(dev->trace_wq,
+				dev->trace_on != on || kthread_should_stop(),
+				on ? KGDB_TRACE_DRAIN : MAX_SCHEDULE_TIMEOUT);
+	}
+
+	return 0;
+}
+
+/* KGDB_REQ_TRACE, in the UDC interrupt */
+static int kgdb_trace_request(struct kgdb_dev *dev, u16 on)
+{
+	if (!dev->trace_thread)
+		return -EINVAL;
+
+	dev->trace_on = !!on;
+	kgdb_live_wake(&dev->trace_wq);
+
+	return 0;
+}
+
+/*
+ * For the qkgdb.ftrace query: all the pages of every CPU, then a
+ * transfer of the same size with length 0.  The debugger entry has
+ * turned tracing off.
+ */
+void kgdb_trace_dump(void)
+{
+	int cpu, len;
+
+	if (kgdb_trace_locked && kgdb_trace_dump_page) {
+		for_each_online_cpu(cpu) {
+			while ((len = kgdb_trace_read(&kgdb_trace_dump_page,
+						      cpu, 0,
+						      kgdb_trace_xfer))) {
+				if (kgdb_write(kgdb_trace_xfer, len) < 0)
+					return;
+				kgdb_trace_pages++;
+			}
+		}
+	}
+
+	memset(kgdb_trace_xfer, 0, KGDB_TRACE_XFER);
+	kgdb_trace_xfer[0] = '&';
+	kgdb_trace_xfer[1] = 1;
+	kgdb_write(kgdb_trace_xfer, KGDB_TRACE_XFER);
+}
+
+/* called by kgdb_io_usb when the kernel stops in the debugger */
+void kgdb_trace_pause(void)
+{
+	int i;
+
+	if (!_kgdb_dev)
+		return;
+
+	kgdb_live_pause(_kgdb_dev, &_kgdb_dev->trace_paused);
+	for (i = 0; i < KGDB_TRACE_WAIT; i++) {
+		if (spin_trylock(&kgdb_trace_lock)) {
+			kgdb_trace_locked = 1;
+			break;
+		}
+		udelay(1);
+	}
+}
+
+/* and when it continues */
+void kgdb_trace_resume(void)
+{
+	if (kgdb_trace_locked) {
+		kgdb_trace_locked = 0;
+		spin_unlock(&kgdb_trace_lock);
+	}
+	if (_kgdb_dev)
+		_kgdb_dev->trace_paused = 0;
+}
+
+/*
+ * The ring buffer of the tracer is global_trace's, which tracing keeps
+ * static.  trace_current_buffer_lock_reserve() is the exported call that
+ * hands it out, to the trace events; asked for more than a page it
+ * reserves nothing.
+ */
+static struct ring_buffer *kgdb_trace_get_buffer(void)
+{
+	struct ring_buffer *buffer = NULL;
+	struct ring_buffer_event *event;
+
+	event = trace_current_buffer_lock_reserve(&buffer, 0, 2 * PAGE_SIZE,
+						  0, 0);
+	if (event)
+		ring_buffer_discard_commit(buffer, event);
+
+	return buffer;
+}
+
+static void kgdb_trace_start(struct kgdb_dev *dev)
+{
+	kgdb_trace_buffer = kgdb_trace_get_buffer();
+	if (!kgdb_trace_buffer) {
+		printk(KERN_ERR "kgdb: no ftrace buffer to send\n");
+		return;
+	}
+
+	kgdb_trace_page = ring_buffer_alloc_read_page(kgdb_trace_buffer);
+	kgdb_trace_dump_page = ring_buffer_alloc_read_page(kgdb_trace_buffer);
+	if (!kgdb_trace_page || !kgdb_trace_dump_page)
+		return;
+
+	init_waitqueue_head(&dev->trace_wq);
+	dev->trace_thread = kthread_run(kgdb_trace_thread, dev, "kgdb_trace");
+	if (IS_ERR(dev->trace_thread)) {
+		printk(KERN_ERR "kgdb: could not start the trace thread\n");
+		dev->trace_thread = NULL;
+	}
+}
+
+static void kgdb_trace_stop(struct kgdb_dev *dev)
+{
+	if (dev->trace_thread)
+		kthread_stop(dev->trace_thread);
+	dev->trace_thread = NULL;
+
+	if (kgdb_trace_page)
+		ring_buffer_free_read_page(kgdb_trace_buffer, kgdb_trace_page);
+	if (kgdb_trace_dump_page)
+		ring_buffer_free_read_page(kgdb_trace_buffer,
+					   kgdb_trace_dump_page);
+	kgdb_trace_page = NULL;
+	kgdb_trace_dump_page = NULL;
+}
+#else
+static inline int kgdb_trace_request(struct kgdb_dev *dev, u16 on)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void kgdb_trace_start(struct kgdb_dev *dev)
+{
+}
+
+static inline void kgdb_trace_stop(struct kgdb_dev *dev)
+{
+}
+#endif
+
+#ifdef CONFIG_USB_ANDROID_KGDB_TELEMETRY
+/*
+ * Telemetry: every period the kgdb_telemetry thread sends one record of
+ * struct kgdb_telemetry, in the target's byte order (little endian on
+ * all the boards), in a transfer of its own.  The counters are the
+ * running totals; the host takes the differences.  The host sets the
+ * period in ms with the KGDB_REQ_TELEMETRY vendor request, 0 stops it.
+ *
+ * The cost is bounded: a record has a fixed size, the period is at
+ * least KGDB_TELEMETRY_MIN_MS, and a record that finds no idle IN
+ * request is skipped rather than waited for.  The time it took to
+ * build the previous record is in each record.
+ */
+#define KGDB_TELEMETRY_CPUS	4
+#define KGDB_TELEMETRY_IRQS	64
+#define KGDB_TELEMETRY_MIN_MS	10
+
+struct kgdb_telemetry {
+	u8 magic;			/* '@' */
+	u8 version;
+	u16 size;			/* of the record */
+	u32 seq;
+	u64 ns;				/* ktime_get() */
+	u32 cost_ns;			/* of the previous record */
+	u8 cpus;
+	u8 irqs;
+	u16 hz;				/* of the cpu times */
+	u64 context_switches;
+	u32 forks;
+	u32 running;
+	u32 mem_total_kb;
+	u32 mem_free_kb;
+	u32 mem_buffers_kb;
+	u32 mem_cached_kb;
+	struct {
+		u32 user;
+		u32 nice;
+		u32 system;
+		u32 idle;
+		u32 iowait;
+		u32 irq;
+		u32 softirq;
+		u32 online;
+	} cpu[KGDB_TELEMETRY_CPUS];
+	struct {
+		u32 irq;
+		u32 count;
+	} irq[KGDB_TELEMETRY_IRQS];
+};
+
+/* the interrupts that have a handler when the host starts the stream */
+static unsigned int kgdb_telemetry_irqs[KGDB_TELEMETRY_IRQS];
+static int kgdb_telemetry_nirqs;
+
+static void kgdb_telemetry_pick_irqs(void)
+{
+	struct irq_desc *desc;
+	unsigned int irq;
+
+	kgdb_telemetry_nirqs = 0;
+	for (irq = 0; irq < nr_irqs; irq++) {
+		desc = irq_to_desc(irq);
+		if (!desc || !desc->action)
+			continue;
+		kgdb_telemetry_irqs[kgdb_telemetry_nirqs++] = irq;
+		if (kgdb_telemetry_nirqs == KGDB_TELEMETRY_IRQS)
+			break;
+	}
+}
+
+#define KGDB_CPUTIME(t)	((u32)cputime64_to_jiffies64(t))
+
+static void kgdb_telemetry_fill(struct kgdb_telemetry *t, u32 seq,
+				u32 cost_ns)
+{
+	struct cpu_usage_stat *stat;
+	struct sysinfo si;
+	int cpu, i;
+
+	memset(t, 0, sizeof(*t));
+	t->magic = '@';
+	t->version = 1;
+	t->size = sizeof(*t);
+	t->seq = seq;
+	t->ns = ktime_to_ns(ktime_get());
+	t->cost_ns = cost_ns;
+	t->hz = HZ;
+
+	t->context_switches = nr_context_switches();
+	t->forks = total_forks;
+	t->running = nr_running();
+
+	si_meminfo(&si);
+	t->mem_total_kb = si.totalram << (PAGE_SHIFT - 10);
+	t->mem_free_kb = si.freeram << (PAGE_SHIFT - 10);
+	t->mem_buffers_kb = si.bufferram << (PAGE_SHIFT - 10);
+	t->mem_cached_kb = global_page_state(NR_FILE_PAGES) <<
+		(PAGE_SHIFT - 10);
+
+	for_each_possible_cpu(cpu) {
+		if (cpu >= KGDB_TELEMETRY_CPUS)
+			break;
+		stat = &kstat_cpu(cpu).cpustat;
+		t->cpu[cpu].user = KGDB_CPUTIME(stat->user);
+		t->cpu[cpu].nice = KGDB_CPUTIME(stat->nice);
+		t->cpu[cpu].system = KGDB_CPUTIME(stat->system);
+		t->cpu[cpu].idle = KGDB_CPUTIME(stat->idle);
+		t->cpu[cpu].iowait = KGDB_CPUTIME(stat->iowait);
+		t->cpu[cpu].irq = KGDB_CPUTIME(stat->irq);
+		t->cpu[cpu].softirq = KGDB_CPUTIME(stat->softirq);
+		t->cpu[cpu].online = cpu_online(cpu);
+		t->cpus = cpu + 1;
+	}
+
+	for (i = 0; i < kgdb_telemetry_nirqs; i++) {
+		t->irq[i].irq = kgdb_telemetry_irqs[i];
+		t->irq[i].count = kstat_irqs(kgdb_telemetry_irqs[i]);
+	}
+	t->irqs = kgdb_telemetry_nirqs;
+}
+
+static void kgdb_telemetry_send(struct kgdb_dev *dev, u32 seq)
+{
+	struct usb_request *req;
+	ktime_t start = ktime_get();
+	u32 cycles = kgdb_cycles();
+
+	req = req_get(dev, &dev->tx_idle);
+	if (!req) {
+		kgdb_telemetry_skipped++;
+		return;
+	}
+
+	kgdb_telemetry_fill(req->buf, seq, dev->telemetry_cost_ns);
+	if (kgdb_live_queue(dev, req, sizeof(struct kgdb_telemetry),
+			    &dev->telemetry_paused)) {
+		kgdb_telemetry_skipped++;
+		return;
+	}
+
+	kgdb_telemetry_records++;
+	dev->telemetry_cost_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	kgdb_cycle_stat_add(&kgdb_telemetry_cycles, cycles);
+}
+
+static int kgdb_telemetry_thread(void *data)
+{
+	struct kgdb_dev *dev = data;
+	unsigned int ms = 0;
+	u32 seq = 0;
+
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		if (dev->telemetry_ms != ms) {
+			ms = dev->telemetry_ms;
+			kgdb_telemetry_pick_irqs();
+		}
+
+		if (ms && dev->online && !dev->telemetry_paused)
+			kgdb_telemetry_send(dev, seq++);
+
+		wait_event_interruptible_timeout(dev->telemetry_wq,
+				dev->telemetry_ms != ms ||
+				kthread_should_stop(),
+				ms ? msecs_to_jiffies(ms) :
+				MAX_SCHEDULE_TIMEOUT);
+	}
+
+	return 0;
+}
+
+/* KGDB_REQ_TELEMETRY, in the UDC interrupt */
+static int kgdb_telemetry_request(struct kgdb_dev *dev, u16 ms)
+{
+	if (!dev->telemetry_thread || (ms && ms < KGDB_TELEMETRY_MIN_MS))
+		return -EINVAL;
+
+	dev->telemetry_ms = ms;
+	kgdb_live_wake(&dev->telemetry_wq);
+
+	return 0;
+}
+
+/* called by kgdb_io_usb when the kernel stops in the debugger */
+void kgdb_telemetry_pause(void)
+{
+	if (_kgdb_dev)
+		kgdb_live_pause(_kgdb_dev, &_kgdb_dev->telemetry_paused);
+}
+
+/* and when it continues */
+void kgdb_telemetry_resume(void)
+{
+	if (_kgdb_dev)
+		_kgdb_dev->telemetry_paused = 0;
+}
+
+static void kgdb_telemetry_start(struct kgdb_dev *dev)
+{
+	init_waitqueue_head(&dev->telemetry_wq);
+	dev->telemetry_thread = kthread_run(kgdb_telemetry_thread, dev,
+					    "kgdb_telemetry");
+	if (IS_ERR(dev->telemetry_thread)) {
+		printk(KERN_ERR "kgdb: could not start the telemetry thread\n");
+		dev->telemetry_thread = NULL;
+	}
+}
+
+static void kgdb_telemetry_stop(struct kgdb_dev *dev)
+{
+	if (dev->telemetry_thread)
+		kthread_stop(dev->telemetry_thread);
+	dev->telemetry_thread = NULL;
+}
+#else
+static inline int kgdb_telemetry_request(struct kgdb_dev *dev, u16 ms)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void kgdb_telemetry_start(struct kgdb_dev *dev)
+{
+}
+
+static inline void kgdb_telemetry_stop(struct kgdb_dev *dev)
+{
+}
+#endif
+
 
 static int
 kgdb_function_bind(struct usb_configuration *c, struct usb_function *f)
@@ -463,6 +1726,11 @@ kgdb_function_unbind(struct usb_configuration *c, struct usb_function *f)
 	struct usb_request *req;
 	int i;
 
+	kgdb_peek_stop(dev);
+	kgdb_sampler_stop(dev);
+	kgdb_trace_stop(dev);
+	kgdb_telemetry_stop(dev);
+
 	spin_lock_irq(&dev->lock);
 	while ((req = req_get(dev, &dev->tx_idle)))
 		kgdb_request_free(req, dev->ep_in);
@@ -501,8 +1769,8 @@ static int kgdb_function_set_alt(struct usb_function *f,
 	if (!dev->function.disabled)
 		dev->online = 1;
 
-	/* readers may be blocked waiting for us to go online */
-	wake_up(&dev->read_wq);
+	/* senders may be blocked waiting for us to go online */
+	kgdb_live_wake(&dev->live_tx_wq);
 	return 0;
 }
 
@@ -516,14 +1784,166 @@ static void kgdb_function_disable(struct usb_function *f)
 	usb_ep_disable(dev->ep_in);
 	usb_ep_disable(dev->ep_out);
 
-	/* readers may be blocked waiting for us to go online */
-	wake_up(&dev->read_wq);
+	/* senders may be blocked waiting for an IN request */
+	kgdb_live_wake(&dev->live_tx_wq);
 
 	VDBG(cdev, "%s disabled\n", dev->function.name);
 }
 
+/*
+ * Where every CPU was when the last break request with
+ * KGDB_BREAK_SAMPLE came in, for the proxy's profiler; gdb's own
+ * interrupts send no IPIs.  The USB interrupt samples its own CPU and
+ * sends the others an IPI, without waiting, that samples theirs.  Both
+ * run with the interrupted registers in get_irq_regs().  A CPU whose
+ * IPI from the last request has not run yet, kgdb_sample_busy still
+ * set, is skipped and left out of this sample: queueing its csd again
+ * would spin in csd_lock() in hard interrupt.  The flag is cleared at
+ * the start of the IPI, just before kernel/smp.c unlocks the csd, so
+ * at worst a request spins for the rest of that handler.
+ */
+struct kgdb_sample {
+	unsigned long seq;
+	unsigned long pc;
+	unsigned long lr;
+	pid_t pid;
+	int user;
+	char comm[TASK_COMM_LEN];
+};
+
+static DEFINE_PER_CPU(struct kgdb_sample, kgdb_samples);
+static DEFINE_PER_CPU(atomic_t, kgdb_sample_busy);
+static unsigned long kgdb_sample_seq;
+
+static void kgdb_sample_cpu(void *info)
+{
+	struct kgdb_sample *s = &__get_cpu_var(kgdb_samples);
+	struct pt_regs *regs = get_irq_regs();
+
+	atomic_set(&__get_cpu_var(kgdb_sample_busy), 0);
+	if (!regs)
+		return;
+
+	s->pc = instruction_pointer(regs);
+	s->lr = regs->ARM_lr;
+	s->user = user_mode(regs);
+	s->pid = current->pid;
+	memcpy(s->comm, current->comm, TASK_COMM_LEN);
+	smp_wmb();
+	s->seq = (unsigned long)info;
+}
+
+#ifdef CONFIG_SMP
+static DEFINE_PER_CPU(struct call_single_data, kgdb_sample_csd);
+
+static void kgdb_sample_all(void)
+{
+	struct call_single_data *csd;
+	int cpu, this_cpu = smp_processor_id();
+
+	kgdb_sample_seq++;
+	for_each_online_cpu(cpu) {
+		if (cpu == this_cpu)
+			continue;
+		if (atomic_cmpxchg(&per_cpu(kgdb_sample_busy, cpu), 0, 1))
+			continue;
+		csd = &per_cpu(kgdb_sample_csd, cpu);
+		csd->func = kgdb_sample_cpu;
+		csd->info = (void *)kgdb_sample_seq;
+		__smp_call_function_single(cpu, csd, 0);
+	}
+	kgdb_sample_cpu((void *)kgdb_sample_seq);
+}
+#else
+static void kgdb_sample_all(void)
+{
+	kgdb_sample_seq++;
+	kgdb_sample_cpu((void *)kgdb_sample_seq);
+}
+#endif
+
+/*
+ * "<cpu>:<pc>,<lr>,<pid>,<user>,<hex comm>" for each CPU sampled by the
+ * last sampling break request, separated by ';'.
+ */
+int kgdb_sample_format(char *buf, int len)
+{
+	struct kgdb_sample *s;
+	int cpu, i, n = 0;
+
+	for_each_online_cpu(cpu) {
+		s = &per_cpu(kgdb_samples, cpu);
+		if (s->seq != kgdb_sample_seq || n + 80 > len)
+			continue;
+		smp_rmb();
+		n += sprintf(buf + n, "%s%x:%lx,%lx,%x,%d,", n ? ";" : "",
+			     cpu, s->pc, s->lr, s->pid, s->user);
+		for (i = 0; i < TASK_COMM_LEN && s->comm[i]; i++) {
+			buf[n++] = hex_asc_hi(s->comm[i]);
+			buf[n++] = hex_asc_lo(s->comm[i]);
+		}
+	}
+
+	return n;
+}
+
+/*
+ * gdb's interrupt.  Nobody reads the bulk OUT endpoint while the kernel
+ * runs, so the host sends a vendor request to our interface on ep0
+ * instead.  It arrives in the UDC interrupt, and the tasklet scheduled
+ * by kgdb_schedule_breakpoint() stops the kernel right after it.
+ */
+static int kgdb_function_setup(struct usb_function *f,
+		const struct usb_ctrlrequest *ctrl)
+{
+	struct kgdb_dev	*dev = func_to_dev(f);
+	struct usb_composite_dev *cdev = f->config->cdev;
+	struct usb_request *req = cdev->req;
+	u16 w_index = le16_to_cpu(ctrl->wIndex);
+	u16 w_value = le16_to_cpu(ctrl->wValue);
+	u16 w_length = le16_to_cpu(ctrl->wLength);
+	int value;
+
+	if (ctrl->bRequestType !=
+			(USB_DIR_OUT | USB_TYPE_VENDOR | USB_RECIP_INTERFACE) ||
+	    w_index != kgdb_interface_desc.bInterfaceNumber || w_length)
+		return -EOPNOTSUPP;
+
+	switch (ctrl->bRequest) {
+	case KGDB_REQ_BREAK:
+		VDBG(cdev, "break request\n");
+		kgdb_breaks++;
+		if (w_value & KGDB_BREAK_SAMPLE)
+			kgdb_sample_all();
+		kgdb_schedule_breakpoint();
+		value = 0;
+		break;
+	case KGDB_REQ_SAMPLER:
+		value = kgdb_sampler_request(dev, w_value);
+		break;
+	case KGDB_REQ_TRACE:
+		value = kgdb_trace_request(dev, w_value);
+		break;
+	case KGDB_REQ_TELEMETRY:
+		value = kgdb_telemetry_request(dev, w_value);
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+	if (value < 0)
+		return value;
+
+	/* composite leaves the zero length status stage to the function */
+	req->zero = 0;
+	req->length = 0;
+	value = usb_ep_queue(cdev->gadget->ep0, req, GFP_ATOMIC);
+	if (value < 0)
+		ERROR(cdev, "kgdb request %d status, err %d\n",
+		      ctrl->bRequest, value);
+
+	return value;
+}
 
-#include <linux/kgdb.h>
 
 static void breakpoint_func(struct work_struct *work)
 {
@@ -555,8 +1975,10 @@ static int kgdb_bind_config(struct usb_configuration *c)
 	}
 
 	spin_lock_init(&dev->lock);
+	spin_lock_init(&dev->live_lock);
 	init_waitqueue_head(&dev->read_wq);
 	init_waitqueue_head(&dev->write_wq);
+	init_waitqueue_head(&dev->live_tx_wq);
 	INIT_LIST_HEAD(&dev->tx_idle);
 
 	dev->cdev = c->cdev;
@@ -568,6 +1990,7 @@ static int kgdb_bind_config(struct usb_configuration *c)
 	dev->function.unbind = kgdb_function_unbind;
 	dev->function.set_alt = kgdb_function_set_alt;
 	dev->function.disable = kgdb_function_disable;
+	dev->function.setup = kgdb_function_setup;
 	dev->function.disabled = 1;
 
 	/* _kgdb_dev must be set before calling usb_gadget_register_driver */
@@ -578,6 +2001,10 @@ static int kgdb_bind_config(struct usb_configuration *c)
 		goto err1;
 
 	android_enable_function(&dev->function, 1);
+	kgdb_peek_start(dev);
+	kgdb_sampler_start(dev);
+	kgdb_trace_start(dev);
+	kgdb_telemetry_start(dev);
 	
 	INIT_WORK(&breakpoint_work, breakpoint_func);
 	schedule_work(&breakpoint_work);
@@ -594,10 +2021,37 @@ static struct android_usb_function kgdb_function = {
 	.bind_config = kgdb_bind_config,
 };
 
+static void __init kgdb_debugfs_init(void)
+{
+	struct dentry *root;
+
+	root = debugfs_create_dir("f_kgdb", NULL);
+	if (IS_ERR_OR_NULL(root))
+		return;
+
+	debugfs_create_u32("tx_requests", 0444, root, &kgdb_tx_requests);
+	debugfs_create_u32("tx_waits", 0444, root, &kgdb_tx_waits);
+	debugfs_create_u32("breaks", 0444, root, &kgdb_breaks);
+	debugfs_create_u32("peeks", 0444, root, &kgdb_peeks);
+	debugfs_create_u32("sampler_samples", 0444, root,
+			   &kgdb_sampler_samples);
+	debugfs_create_u32("sampler_xfers", 0444, root, &kgdb_sampler_xfers);
+	debugfs_create_u32("trace_pages", 0444, root, &kgdb_trace_pages);
+	debugfs_create_u32("telemetry_records", 0444, root,
+			   &kgdb_telemetry_records);
+	debugfs_create_u32("telemetry_skipped", 0444, root,
+			   &kgdb_telemetry_skipped);
+	debugfs_create_u32("poll_fast", 0444, root, &kgdb_poll_fast);
+	debugfs_create_u32("poll_full", 0444, root, &kgdb_poll_full);
+
+	kgdb_cycles_init(root);
+}
+
 static int __init init(void)
 {
 	printk(KERN_INFO "f_kgdb init\n");
 	android_register_function(&kgdb_function);
+	kgdb_debugfs_init();
 
 	return 0;
 }
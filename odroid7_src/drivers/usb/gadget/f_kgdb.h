@@ -3,5 +3,88 @@
 
 ssize_t kgdb_write(char  *buf, size_t count);
 ssize_t kgdb_read(char  *buf, size_t count);
+ssize_t kgdb_write_fill(int (*fill)(char *buf, int len, void *data),
+			void *data, size_t count);
+int kgdb_sample_format(char *buf, int len);
+
+/* the live peek channel stands aside while the debugger runs */
+#ifdef CONFIG_USB_ANDROID_KGDB_PEEK
+void kgdb_peek_pause(void);
+void kgdb_peek_resume(void);
+#else
+static inline void kgdb_peek_pause(void)
+{
+}
+
+static inline void kgdb_peek_resume(void)
+{
+}
+#endif
+
+/* so does the pc sampler's stream */
+#ifdef CONFIG_USB_ANDROID_KGDB_SAMPLER
+void kgdb_sampler_pause(void);
+void kgdb_sampler_resume(void);
+#else
+static inline void kgdb_sampler_pause(void)
+{
+}
+
+static inline void kgdb_sampler_resume(void)
+{
+}
+#endif
+
+/* and the ftrace stream, which the debugger sends in one go */
+#ifdef CONFIG_USB_ANDROID_KGDB_TRACE
+void kgdb_trace_pause(void);
+void kgdb_trace_resume(void);
+void kgdb_trace_dump(void);
+#else
+static inline void kgdb_trace_pause(void)
+{
+}
+
+static inline void kgdb_trace_resume(void)
+{
+}
+#endif
+
+/* and the telemetry records */
+#ifdef CONFIG_USB_ANDROID_KGDB_TELEMETRY
+void kgdb_telemetry_pause(void);
+void kgdb_telemetry_resume(void);
+#else
+static inline void kgdb_telemetry_pause(void)
+{
+}
+
+static inline void kgdb_telemetry_resume(void)
+{
+}
+#endif
+
+/*
+ * Polled access to the device controller while the kernel is stopped in
+ * the debugger.  Every UDC driver that supports kgdb over USB provides
+ * one instance named kgdb_usb_poll_ops.
+ *
+ * poll() services only the kgdb bulk endpoints.  When a bus event is
+ * pending (reset, suspend, a setup packet or traffic for another
+ * function) it runs the full interrupt handler instead and returns 1,
+ * otherwise it returns 0.
+ *
+ * irq() is the full interrupt handler.  It is used until the host has
+ * configured the kgdb function.
+ */
+struct usb_ep;
+
+struct kgdb_usb_poll_ops {
+	const char *name;
+	int (*poll)(struct usb_ep *in, struct usb_ep *out);
+	int (*irq)(void);
+};
+
+extern struct kgdb_usb_poll_ops kgdb_usb_poll_ops;
 
 #endif /* __F_KGDB_H */
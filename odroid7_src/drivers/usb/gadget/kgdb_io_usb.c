@@ -22,6 +22,20 @@
 #include <linux/kgdb.h>
 #include <linux/tty.h>
 #include <linux/console.h>
+#if defined(CONFIG_KGDB_USB_DUMP) || defined(CONFIG_KGDB_USB_QCRC)
+#include <linux/crc32.h>
+#endif
+#if defined(CONFIG_KGDB_USB_DUMP) || defined(CONFIG_KGDB_USB_QCRC) || \
+    defined(CONFIG_KGDB_USB_SEARCH)
+#include <linux/uaccess.h>
+#endif
+#ifdef CONFIG_KGDB_USB_DUMP
+#include <linux/ioport.h>
+#include <linux/mm.h>
+#endif
+#ifdef CONFIG_USB_ANDROID_KGDB_TRACE
+#include <asm/page.h>
+#endif
 
 #include "f_kgdb.h"
 
@@ -71,7 +85,8 @@ noconfig:
 }
 
 
-#define BUFFER_SIZE 4096	 
+#define BUFFER_SIZE 4096	/* must be a power of two */
+#define BUFFER_MASK (BUFFER_SIZE - 1)
 #define END_PUT_COUNT 3
 
 static int put_count;
@@ -79,44 +94,592 @@ static int check = 0;
 static char kgdb_read_buf[BUFFER_SIZE];
 static char kgdb_write_buf[BUFFER_SIZE];
 
-enum cqueue_type {
-	RX = 0,
-	TX = 1,
+/*
+ * Single producer, single consumer ring.  head and tail run freely and
+ * are masked on access, so head - tail is the fill level even after
+ * they wrap.  Only the producer moves head and only the consumer moves
+ * tail; the barriers order the data copy against the index update.
+ * A push that does not fit is truncated and counted in overflow.
+ */
+struct kgdb_ring {
+	unsigned char buf[BUFFER_SIZE];
+	unsigned int head;
+	unsigned int tail;
+	unsigned int overflow;
 };
 
-struct cqueue {
-	unsigned char queue[BUFFER_SIZE];
-	int top;
-	int bottom;
-};
+static struct kgdb_ring rx_ring;
+static struct kgdb_ring tx_ring;
 
-struct cqueue cqueue_buffer[2]; 
+static inline unsigned int ring_len(struct kgdb_ring *r)
+{
+	return ACCESS_ONCE(r->head) - ACCESS_ONCE(r->tail);
+}
 
-static int is_empty(int type)
+static inline unsigned int ring_free(struct kgdb_ring *r)
 {
-	return (cqueue_buffer[type].top == cqueue_buffer[type].bottom) ;
+	return BUFFER_SIZE - ring_len(r);
 }
 
-static void add_queue(int type, unsigned char data)
+static unsigned int ring_push_n(struct kgdb_ring *r, const char *src,
+				unsigned int n)
 {
-	cqueue_buffer[type].queue[cqueue_buffer[type].top] = data;
-	cqueue_buffer[type].top = (cqueue_buffer[type].top + 1) % BUFFER_SIZE;
+	unsigned int head = r->head;
+	unsigned int off = head & BUFFER_MASK;
+	unsigned int room = ring_free(r);
+	unsigned int first;
+
+	if (n > room) {
+		r->overflow += n - room;
+		n = room;
+	}
+
+	first = min(n, BUFFER_SIZE - off);
+	memcpy(r->buf + off, src, first);
+	memcpy(r->buf, src + first, n - first);
+
+	smp_wmb();
+	r->head = head + n;
+
+	return n;
 }
 
-static unsigned char delete_queue(int type)
+static unsigned int ring_pop_n(struct kgdb_ring *r, char *dst, unsigned int n)
 {
-	unsigned char data;
+	unsigned int tail = r->tail;
+	unsigned int off = tail & BUFFER_MASK;
+	unsigned int avail = ring_len(r);
+	unsigned int first;
+
+	if (n > avail)
+		n = avail;
+
+	smp_rmb();
+	first = min(n, BUFFER_SIZE - off);
+	memcpy(dst, r->buf + off, first);
+	memcpy(dst + first, r->buf, n - first);
 
-	data = cqueue_buffer[type].queue[cqueue_buffer[type].bottom];
-	cqueue_buffer[type].bottom = (cqueue_buffer[type].bottom + 1) % BUFFER_SIZE;
+	smp_mb();
+	r->tail = tail + n;
 
-	return data;
+	return n;
 }
 
 static void buffer_init(void)
 {
-	cqueue_buffer[RX].top = cqueue_buffer[RX].bottom = 0;
-	cqueue_buffer[TX].top = cqueue_buffer[TX].bottom = 0;
+	rx_ring.head = rx_ring.tail = 0;
+	tx_ring.head = tx_ring.tail = 0;
+}
+
+/*
+ * Vendor query packets, "$qkgdb.<name>[:<args>]#cs", are answered here
+ * rather than by the gdb stub, so the host proxy can read driver and
+ * debug core state while the target is stopped.  A query has to arrive
+ * as a bulk transfer of its own.  Unknown names get the empty reply.
+ *
+ * kgdb_usb_packets lists the standard gdb packets, matched by prefix,
+ * that are answered here as well because the stub does not know them.
+ * Their handlers return a negative length to leave the packet to the
+ * stub after all.
+ *
+ * stream, if set, is called after the reply has been sent, for data
+ * that does not go through a packet.
+ */
+#define QUERY_PREFIX	"$qkgdb."
+
+struct kgdb_usb_query {
+	const char *name;
+	int (*reply)(const char *args, char *buf, int len);
+	void (*stream)(void);
+};
+
+/* where the arguments of the packet being handled end, for binary ones */
+static const char *kgdb_usb_args_end;
+
+static char kgdb_query_buf[BUFFER_SIZE];
+
+/* send kgdb_query_buf[2 .. len + 2) as an acknowledged packet */
+static void kgdb_io_usb_put_packet(int len)
+{
+	char *p = kgdb_query_buf;
+	unsigned char csum = 0;
+	int i;
+
+	for (i = 2; i < len + 2; i++)
+		csum += p[i];
+
+	p[0] = '+';
+	p[1] = '$';
+	p[i++] = '#';
+	p[i++] = hex_asc_hi(csum);
+	p[i++] = hex_asc_lo(csum);
+
+	kgdb_write(p, i);
+}
+
+#ifdef CONFIG_KGDB_LATENCY
+/* kernel/debug/debug_core.c */
+extern int dbg_latency_format(char *buf, int len);
+extern void dbg_latency_first_byte(void);
+
+static int kgdb_usb_query_latency(const char *args, char *buf, int len)
+{
+	return dbg_latency_format(buf, len);
+}
+#endif
+
+#ifdef CONFIG_KGDB_COND_BREAK
+/* kernel/debug/debug_core.c */
+extern int dbg_set_sw_break_cond(unsigned long addr, const char *cond);
+extern int dbg_break_stat_format(char *buf, int len);
+
+static int kgdb_usb_query_breakpoints(const char *args, char *buf, int len)
+{
+	return dbg_break_stat_format(buf, len);
+}
+
+static int kgdb_usb_packet_supported(const char *args, char *buf, int len)
+{
+#ifdef CONFIG_KGDB_TRACEPOINTS
+	return scnprintf(buf, len,
+			 "ConditionalBreakpoints+;ConditionalTracepoints+");
+#else
+	return scnprintf(buf, len, "ConditionalBreakpoints+");
+#endif
+}
+
+/* Z0,<addr>,<kind>[;X<len>,<bytecode>]... */
+static int kgdb_usb_packet_break(const char *args, char *buf, int len)
+{
+	unsigned long addr;
+	char *p;
+	int err;
+
+	addr = simple_strtoul(args, &p, 16);
+	if (*p != ',')
+		return scnprintf(buf, len, "E%02d", EINVAL);
+
+	p = strchr(p, ';');
+	err = dbg_set_sw_break_cond(addr, p ? p + 1 : NULL);
+	if (err)
+		return scnprintf(buf, len, "E%02d", -err);
+
+	return scnprintf(buf, len, "OK");
+}
+#endif
+
+#ifdef CONFIG_KGDB_TRACEPOINTS
+/* kernel/debug/debug_core.c */
+extern int dbg_trace_packet(char type, const char *args, char *buf, int len);
+extern int dbg_trace_frame_regs(char *buf, int len);
+extern int dbg_trace_frame_mem(const char *args, char *buf, int len);
+extern int dbg_trace_read(unsigned long off, char *buf, int len);
+
+static int kgdb_usb_packet_trace_set(const char *args, char *buf, int len)
+{
+	return dbg_trace_packet('Q', args, buf, len);
+}
+
+static int kgdb_usb_packet_trace_get(const char *args, char *buf, int len)
+{
+	return dbg_trace_packet('q', args, buf, len);
+}
+
+/* g and m read the selected trace frame, if there is one */
+static int kgdb_usb_packet_regs(const char *args, char *buf, int len)
+{
+	return dbg_trace_frame_regs(buf, len);
+}
+
+static int kgdb_usb_packet_mem(const char *args, char *buf, int len)
+{
+	return dbg_trace_frame_mem(args, buf, len);
+}
+
+/*
+ * tbuf:<offset>,<length> returns 'm', or 'l' once the end of the trace
+ * buffer is reached, followed by the raw bytes with '#', '$', '}' and
+ * '*' escaped as '}' and the byte xor 0x20.
+ */
+static int kgdb_usb_query_tbuf(const char *args, char *buf, int len)
+{
+	unsigned long off, count;
+	char raw[64], *end;
+	int n = 1, got, want, i;
+
+	off = simple_strtoul(args, &end, 16);
+	if (*end != ',')
+		return scnprintf(buf, len, "E%02d", EINVAL);
+	count = simple_strtoul(end + 1, NULL, 16);
+
+	buf[0] = 'm';
+	while (count && len - n >= 2) {
+		want = min_t(unsigned long, count,
+			     min_t(int, sizeof(raw), (len - n) / 2));
+		got = dbg_trace_read(off, raw, want);
+		for (i = 0; i < got; i++) {
+			if (raw[i] == '#' || raw[i] == '$' ||
+			    raw[i] == '}' || raw[i] == '*') {
+				buf[n++] = '}';
+				buf[n++] = raw[i] ^ 0x20;
+			} else {
+				buf[n++] = raw[i];
+			}
+		}
+		if (got < want) {
+			buf[0] = 'l';
+			break;
+		}
+		off += got;
+		count -= got;
+	}
+
+	return n;
+}
+#endif
+
+#ifdef CONFIG_KGDB_USB_DUMP
+/*
+ * dump:<addr>,<length>[,p] is answered with D<length>, then the range
+ * as raw bytes and a C<crc32>,<unreadable bytes> packet.  With p the
+ * address is physical.  Unreadable bytes are sent as zeros, and so are
+ * highmem pages: mapping them would take a kmap slot that the code the
+ * debugger stopped may be holding.
+ */
+struct kgdb_usb_dump {
+	unsigned long addr;
+	unsigned long left;
+	int phys;
+	u32 crc;
+	unsigned long holes;
+};
+
+static struct kgdb_usb_dump kgdb_usb_dump;
+
+static int kgdb_usb_dump_read(struct kgdb_usb_dump *d, char *buf, int len)
+{
+	unsigned long pfn = d->addr >> PAGE_SHIFT;
+
+	if (!d->phys)
+		return probe_kernel_read(buf, (void *)d->addr, len);
+
+	if (!pfn_valid(pfn) || PageHighMem(pfn_to_page(pfn)))
+		return -EFAULT;
+
+	return probe_kernel_read(buf, __va(d->addr), len);
+}
+
+static int kgdb_usb_dump_fill(char *buf, int len, void *data)
+{
+	struct kgdb_usb_dump *d = data;
+	int done, n;
+
+	/* a page at a time, so a hole costs no more than its page */
+	for (done = 0; done < len; done += n) {
+		n = min_t(unsigned long, len - done,
+			  PAGE_SIZE - (d->addr & ~PAGE_MASK));
+		if (kgdb_usb_dump_read(d, buf + done, n)) {
+			memset(buf + done, 0, n);
+			d->holes += n;
+		}
+		d->addr += n;
+	}
+	d->crc = crc32_le(d->crc, buf, len);
+
+	return len;
+}
+
+static int kgdb_usb_query_dump(const char *args, char *buf, int len)
+{
+	struct kgdb_usb_dump *d = &kgdb_usb_dump;
+	char *end;
+
+	d->left = 0;
+	d->addr = simple_strtoul(args, &end, 16);
+	if (*end != ',')
+		return scnprintf(buf, len, "E%02d", EINVAL);
+	d->left = simple_strtoul(end + 1, &end, 16);
+	d->phys = !strcmp(end, ",p");
+	d->crc = ~0;
+	d->holes = 0;
+
+	return scnprintf(buf, len, "D%lx", d->left);
+}
+
+static void kgdb_usb_dump_stream(void)
+{
+	struct kgdb_usb_dump *d = &kgdb_usb_dump;
+
+	if (!d->left)
+		return;
+	if (kgdb_write_fill(kgdb_usb_dump_fill, d, d->left) < 0)
+		return;
+
+	kgdb_io_usb_put_packet(scnprintf(kgdb_query_buf + 2,
+					 sizeof(kgdb_query_buf) - 5,
+					 "C%08x,%lx", ~d->crc, d->holes));
+}
+
+/* "<PAGE_OFFSET>,<its physical address>;<start>,<size>;..." */
+static int kgdb_usb_query_ram(const char *args, char *buf, int len)
+{
+	struct resource *r;
+	int n;
+
+	n = scnprintf(buf, len, "%lx,%lx", PAGE_OFFSET,
+		      (unsigned long)__pa(PAGE_OFFSET));
+	for (r = iomem_resource.child; r; r = r->sibling)
+		if (r->name && !strcmp(r->name, "System RAM"))
+			n += scnprintf(buf + n, len - n, ";%llx,%llx",
+				       (unsigned long long)r->start,
+				       (unsigned long long)(r->end -
+							    r->start + 1));
+
+	return n;
+}
+#endif
+
+#ifdef CONFIG_KGDB_USB_QCRC
+/*
+ * qCRC:<addr>,<length> is answered with C<crc>, the CRC32 gdb uses: the
+ * big endian polynomial started from ~0 with no final inversion, which
+ * is what the table driven crc32_be() computes.
+ */
+static int kgdb_usb_packet_crc(const char *args, char *buf, int len)
+{
+	unsigned long addr, count;
+	char raw[256], *end;
+	u32 crc = ~0;
+	int n;
+
+	addr = simple_strtoul(args, &end, 16);
+	if (*end != ',')
+		return scnprintf(buf, len, "E%02d", EINVAL);
+	count = simple_strtoul(end + 1, NULL, 16);
+
+	for (; count; count -= n, addr += n) {
+		n = min_t(unsigned long, count, sizeof(raw));
+		if (probe_kernel_read(raw, (void *)addr, n))
+			return scnprintf(buf, len, "E%02d", EFAULT);
+		crc = crc32_be(crc, raw, n);
+	}
+
+	return scnprintf(buf, len, "C%x", crc);
+}
+#endif
+
+#ifdef CONFIG_KGDB_USB_SEARCH
+#define SEARCH_PATTERN_MAX	128
+#define SEARCH_CHUNK		1024
+
+static char kgdb_search_buf[SEARCH_CHUNK + SEARCH_PATTERN_MAX];
+static char kgdb_search_pattern[SEARCH_PATTERN_MAX];
+
+/*
+ * qSearch:memory:<addr>;<length>;<pattern>, the pattern being escaped
+ * binary as gdb sends it.  The range is read a chunk at a time and the
+ * last pattern length - 1 bytes are kept for matches across chunks.
+ * memchr() finds the candidates for the first byte.
+ */
+static int kgdb_usb_packet_search(const char *args, char *buf, int len)
+{
+	char *pat = kgdb_search_pattern, *s, *hit, *limit, *end;
+	unsigned long addr, count;
+	int plen = 0, keep = 0, n;
+	const char *p;
+
+	addr = simple_strtoul(args, &end, 16);
+	if (*end != ';')
+		return scnprintf(buf, len, "E%02d", EINVAL);
+	count = simple_strtoul(end + 1, &end, 16);
+	if (*end != ';')
+		return scnprintf(buf, len, "E%02d", EINVAL);
+
+	for (p = end + 1; p < kgdb_usb_args_end; p++) {
+		if (plen == SEARCH_PATTERN_MAX)
+			return scnprintf(buf, len, "E%02d", EINVAL);
+		if (*p == '}' && p + 1 < kgdb_usb_args_end)
+			pat[plen++] = *++p ^ 0x20;
+		else
+			pat[plen++] = *p;
+	}
+	if (!plen)
+		return scnprintf(buf, len, "E%02d", EINVAL);
+
+	while (count) {
+		n = min_t(unsigned long, count, SEARCH_CHUNK);
+		if (probe_kernel_read(kgdb_search_buf + keep, (void *)addr, n))
+			return scnprintf(buf, len, "E%02d", EFAULT);
+		n += keep;
+
+		limit = kgdb_search_buf + n - plen + 1;
+		for (s = kgdb_search_buf; s < limit; s = hit + 1) {
+			hit = memchr(s, pat[0], limit - s);
+			if (!hit)
+				break;
+			if (!memcmp(hit, pat, plen))
+				return scnprintf(buf, len, "1,%lx", addr - keep +
+						 (hit - kgdb_search_buf));
+		}
+
+		addr += n - keep;
+		count -= n - keep;
+		keep = min(plen - 1, n);
+		memmove(kgdb_search_buf, kgdb_search_buf + n - keep, keep);
+	}
+
+	return scnprintf(buf, len, "0");
+}
+#endif
+
+#ifdef CONFIG_KGDB_BACKTRACE
+/* kernel/debug/debug_core.c */
+extern int dbg_backtrace_start(void);
+extern int dbg_backtrace_fill(char *buf, int len, void *data);
+
+static int kgdb_usb_bt_len;
+
+/* bt is answered with B<length>, then the records of all the tasks */
+static int kgdb_usb_query_bt(const char *args, char *buf, int len)
+{
+	kgdb_usb_bt_len = dbg_backtrace_start();
+
+	return scnprintf(buf, len, "B%x", kgdb_usb_bt_len);
+}
+
+static void kgdb_usb_bt_stream(void)
+{
+	if (kgdb_usb_bt_len)
+		kgdb_write_fill(dbg_backtrace_fill, NULL, kgdb_usb_bt_len);
+}
+#endif
+
+#ifdef CONFIG_USB_ANDROID_KGDB_TRACE
+/*
+ * ftrace is answered with F<page size>, then the ftrace pages in
+ * transfers of 8 bytes more, see f_kgdb.c.
+ */
+static int kgdb_usb_query_ftrace(const char *args, char *buf, int len)
+{
+	return scnprintf(buf, len, "F%lx", PAGE_SIZE);
+}
+#endif
+
+static int kgdb_usb_query_sample(const char *args, char *buf, int len)
+{
+	len = kgdb_sample_format(buf, len);
+
+	return len ? len : sprintf(buf, "E%02d", ENOENT);
+}
+
+static const struct kgdb_usb_query kgdb_usb_queries[] = {
+	{ "sample",	kgdb_usb_query_sample },
+#ifdef CONFIG_KGDB_LATENCY
+	{ "latency",	kgdb_usb_query_latency },
+#endif
+#ifdef CONFIG_KGDB_COND_BREAK
+	{ "breakpoints", kgdb_usb_query_breakpoints },
+#endif
+#ifdef CONFIG_KGDB_TRACEPOINTS
+	{ "tbuf",	kgdb_usb_query_tbuf },
+#endif
+#ifdef CONFIG_KGDB_USB_DUMP
+	{ "dump",	kgdb_usb_query_dump,	kgdb_usb_dump_stream },
+	{ "ram",	kgdb_usb_query_ram },
+#endif
+#ifdef CONFIG_KGDB_BACKTRACE
+	{ "bt",		kgdb_usb_query_bt,	kgdb_usb_bt_stream },
+#endif
+#ifdef CONFIG_USB_ANDROID_KGDB_TRACE
+	{ "ftrace",	kgdb_usb_query_ftrace,	kgdb_trace_dump },
+#endif
+	{ NULL,		NULL },
+};
+
+static const struct kgdb_usb_query kgdb_usb_packets[] = {
+#ifdef CONFIG_KGDB_COND_BREAK
+	{ "qSupported",	kgdb_usb_packet_supported },
+	{ "Z0,",	kgdb_usb_packet_break },
+#endif
+#ifdef CONFIG_KGDB_TRACEPOINTS
+	{ "QT",		kgdb_usb_packet_trace_set },
+	{ "qT",		kgdb_usb_packet_trace_get },
+	{ "g",		kgdb_usb_packet_regs },
+	{ "m",		kgdb_usb_packet_mem },
+#endif
+#ifdef CONFIG_KGDB_USB_QCRC
+	{ "qCRC:",	kgdb_usb_packet_crc },
+#endif
+#ifdef CONFIG_KGDB_USB_SEARCH
+	{ "qSearch:memory:", kgdb_usb_packet_search },
+#endif
+	{ NULL,		NULL },
+};
+
+/* returns the number of bytes consumed from buf */
+static int kgdb_io_usb_query(char *buf, int size)
+{
+	const struct kgdb_usb_query *q = NULL;
+	unsigned char csum = 0;
+	char *end, *name, *args, *p;
+	int len = 0;
+
+	if (size < 4 || buf[0] != '$')
+		return 0;
+
+	end = memchr(buf, '#', size);
+	if (!end || end + 3 > buf + size)
+		return 0;
+
+	if (strncmp(buf, QUERY_PREFIX, sizeof(QUERY_PREFIX) - 1)) {
+		for (q = kgdb_usb_packets; q->name; q++)
+			if (!strncmp(buf + 1, q->name, strlen(q->name)))
+				break;
+		if (!q->name)
+			return 0;
+	}
+
+	for (p = buf + 1; p < end; p++)
+		csum += *p;
+	if (hex_to_bin(end[1]) != (csum >> 4) ||
+	    hex_to_bin(end[2]) != (csum & 0xf)) {
+		kgdb_write("-", 1);
+		return end + 3 - buf;
+	}
+
+	*end = 0;
+	kgdb_usb_args_end = end;
+	if (q) {
+		len = q->reply(buf + 1 + strlen(q->name), kgdb_query_buf + 2,
+			       sizeof(kgdb_query_buf) - 5);
+		if (len < 0) {
+			*end = '#';
+			return 0;
+		}
+		goto reply;
+	}
+
+	name = buf + sizeof(QUERY_PREFIX) - 1;
+	args = strchr(name, ':');
+	if (args)
+		*args++ = 0;
+	else
+		args = "";
+
+	for (q = kgdb_usb_queries; q->name; q++) {
+		if (!strcmp(q->name, name)) {
+			len = q->reply(args, kgdb_query_buf + 2,
+				       sizeof(kgdb_query_buf) - 5);
+			break;
+		}
+	}
+
+reply:
+	kgdb_io_usb_put_packet(len);
+	if (q->stream)
+		q->stream();
+
+	return end + 3 - buf;
 }
 
 static int boot_break;
@@ -147,30 +710,50 @@ static void cleanup_kgdb_io_usb(void)
 
 static int kgdb_io_usb_get_char(void)
 {
-	int i;
-	int size;
+	int size, used, acks;
 	char read_value;
 
-	if (!is_empty(RX)) {
-		read_value = delete_queue(RX);
-		return (int) read_value;
+	while (!ring_len(&rx_ring)) {
+		size = kgdb_read(kgdb_read_buf, ring_free(&rx_ring));
+		if (size <= 0)
+			return NO_POLL_CHAR;
+
+		/* the ack of a stub reply may lead a query */
+		for (acks = 0; acks < size && kgdb_read_buf[acks] == '+'; )
+			acks++;
+		ring_push_n(&rx_ring, kgdb_read_buf, acks);
+
+		used = acks + kgdb_io_usb_query(kgdb_read_buf + acks,
+						size - acks);
+		ring_push_n(&rx_ring, kgdb_read_buf + used, size - used);
 	}
-	
-	size = kgdb_read(kgdb_read_buf, BUFFER_SIZE);
 
-	for (i = 0; i < size; i++) 
-		add_queue(RX, kgdb_read_buf[i]);
- 
-	read_value = delete_queue(RX);	
-	
+	ring_pop_n(&rx_ring, &read_value, 1);
+#ifdef CONFIG_KGDB_LATENCY
+	/* the gdbstub reads through read_char, not dbg_io_get_char() */
+	dbg_latency_first_byte();
+#endif
+
 	return (int)read_value;
 }
 
+static void kgdb_io_usb_flush(void)
+{
+	unsigned int count;
+
+	count = ring_pop_n(&tx_ring, kgdb_write_buf, BUFFER_SIZE);
+	if (count)
+		kgdb_write(kgdb_write_buf, count);
+}
+
 static void kgdb_io_usb_put_char(u8 chr)
 {
+	/* a reply larger than the ring goes out in chunks */
+	if (!ring_free(&tx_ring))
+		kgdb_io_usb_flush();
+
+	ring_push_n(&tx_ring, (char *)&chr, 1);
 
-	add_queue(TX, chr);
-	
 	if (chr == '#') {
 		check = 1;
 	}
@@ -179,11 +762,8 @@ static void kgdb_io_usb_put_char(u8 chr)
 		put_count++;
 
 	if (put_count == END_PUT_COUNT) {
-		while (!is_empty(TX)) 
-			kgdb_write_buf[put_count++] = delete_queue(TX);
-	
-		kgdb_write(kgdb_write_buf, put_count);
-     	
+		kgdb_io_usb_flush();
+
 		check = 0;
 		put_count = 0;
 	}
@@ -228,6 +808,11 @@ static void kgdb_io_usb_pre_exp_handler(void)
 	/* Increment the module count when the debugger is active */
 	if (!kgdb_connected)
 		try_module_get(THIS_MODULE);
+
+	kgdb_peek_pause();
+	kgdb_sampler_pause();
+	kgdb_trace_pause();
+	kgdb_telemetry_pause();
 }
 
 static void kgdb_io_usb_post_exp_handler(void)
@@ -235,6 +820,11 @@ static void kgdb_io_usb_post_exp_handler(void)
 	/* decrement the module count when the debugger detaches */
 	if (!kgdb_connected)
 		module_put(THIS_MODULE);
+
+	kgdb_peek_resume();
+	kgdb_sampler_resume();
+	kgdb_trace_resume();
+	kgdb_telemetry_resume();
 }
 
 static struct kgdb_io kgdb_io_usb_io_ops = {
@@ -249,6 +839,10 @@ module_init(init_kgdb_io_usb);
 module_exit(cleanup_kgdb_io_usb);
 module_param_call(kgdb_io_usb, param_set_kgdb_io_usb_var, param_get_string, &kps, 0644);
 MODULE_PARM_DESC(kgdb_io_usb, "<usb device>");
+module_param_named(rx_overflow, rx_ring.overflow, uint, 0444);
+MODULE_PARM_DESC(rx_overflow, "bytes dropped because the RX ring was full");
+module_param_named(tx_overflow, tx_ring.overflow, uint, 0444);
+MODULE_PARM_DESC(tx_overflow, "bytes dropped because the TX ring was full");
 MODULE_DESCRIPTION("KGDB USB I/O Driver");
 MODULE_LICENSE("GPL");
 
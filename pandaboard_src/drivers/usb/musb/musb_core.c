@@ -110,6 +110,10 @@
 
 #include "musb_core.h"
 
+#ifdef CONFIG_KGDB_USB_DEVICE
+#include "../gadget/f_kgdb.h"
+#endif
+
 
 #ifdef CONFIG_ARCH_DAVINCI
 #include "davinci.h"
@@ -1600,7 +1604,51 @@ int platform_usb_handler(void)
 {
 	generic_interrupt(0, the_musb);
 	platform_dma_controller();
+	return 0;
 }
+
+/*
+ * The interrupt status registers are cleared on read, so whatever is
+ * pending beyond the kgdb endpoints is handed to musb_interrupt() in the
+ * same pass.  DMA completions are always checked; an idle DMA
+ * controller costs a single register read.
+ */
+static int musb_kgdb_poll(struct usb_ep *in, struct usb_ep *out)
+{
+	struct musb *musb = the_musb;
+	u8 in_num = to_musb_ep(in)->current_epnum;
+	u8 out_num = to_musb_ep(out)->current_epnum;
+	unsigned long flags;
+	int full = 0;
+
+	spin_lock_irqsave(&musb->lock, flags);
+
+	musb->int_usb = musb_readb(musb->mregs, MUSB_INTRUSB);
+	musb->int_tx = musb_readw(musb->mregs, MUSB_INTRTX);
+	musb->int_rx = musb_readw(musb->mregs, MUSB_INTRRX);
+
+	if (musb->int_usb || (musb->int_tx & ~(1 << in_num)) ||
+	    (musb->int_rx & ~(1 << out_num))) {
+		musb_interrupt(musb);
+		full = 1;
+	} else {
+		if (musb->int_tx)
+			musb_g_tx(musb, in_num);
+		if (musb->int_rx)
+			musb_g_rx(musb, out_num);
+	}
+
+	spin_unlock_irqrestore(&musb->lock, flags);
+
+	platform_dma_controller();
+	return full;
+}
+
+struct kgdb_usb_poll_ops kgdb_usb_poll_ops = {
+	.name	= "musb_hdrc",
+	.poll	= musb_kgdb_poll,
+	.irq	= platform_usb_handler,
+};
 #endif
 
 #else
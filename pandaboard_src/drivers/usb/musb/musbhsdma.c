@@ -358,7 +358,7 @@ struct musb_dma_controller *the_controller;
 
 int platform_dma_controller(void)
 {
-	dma_controller_irq(0, (void *)the_controller);
+	return dma_controller_irq(0, (void *)the_controller);
 }
 #endif
 
@@ -39,6 +39,11 @@
 #include <linux/ptrace.h>
 #include <linux/string.h>
 #include <linux/delay.h>
+#include <linux/hash.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/math64.h>
+#include <linux/cache.h>
 #include <linux/sched.h>
 #include <linux/sysrq.h>
 #include <linux/init.h>
@@ -47,11 +52,15 @@
 #include <linux/pid.h>
 #include <linux/smp.h>
 #include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/cacheflush.h>
 #include <asm/byteorder.h>
 #include <asm/atomic.h>
 #include <asm/system.h>
+#include <asm/div64.h>
 
 #include "debug_core.h"
 
@@ -99,289 +108,1991 @@ module_param(kgdb_use_con, int, 0644);
 /*
  * Holds information about breakpoints in a kernel. These breakpoints are
  * added and removed by gdb.
+ *
+ * The table is hashed by address with linear probing.  A removed
+ * breakpoint stays in its slot as BP_REMOVED, so kgdb_isremovedbreak()
+ * still finds it, and slots are only emptied all at once by
+ * dbg_remove_all_break(); no tombstones are needed.  kgdb_break_order
+ * lists the used slots so that activate and deactivate only walk the
+ * breakpoints that exist.  A small static table holds the breakpoints
+ * set before dbg_late_init(), which moves them to one vmalloc'ed for
+ * kgdb_break_max breakpoints at three quarters load.  Nothing is
+ * allocated from the debugger, dbg_set_sw_break() fails once the table
+ * is full.  kgdb_break_flush collects the addresses to flush after
+ * arming or disarming, kgdb_break_info holds the conditions and
+ * counters of conditional breakpoints.
+ */
+#define KGDB_BREAK_INIT_BITS	5
+
+static unsigned int kgdb_break_max = 1024;
+module_param(kgdb_break_max, uint, 0444);
+
+static struct kgdb_bkpt		kgdb_break_init[1 << KGDB_BREAK_INIT_BITS] = {
+	[0 ... (1 << KGDB_BREAK_INIT_BITS) - 1] = { .state = BP_UNDEFINED }
+};
+static unsigned int		kgdb_break_order_init[1 << KGDB_BREAK_INIT_BITS];
+static unsigned long		kgdb_break_flush_init[1 << KGDB_BREAK_INIT_BITS];
+
+static struct kgdb_bkpt		*kgdb_break = kgdb_break_init;
+static unsigned int		*kgdb_break_order = kgdb_break_order_init;
+static unsigned long		*kgdb_break_flush = kgdb_break_flush_init;
+static unsigned int		kgdb_break_bits = KGDB_BREAK_INIT_BITS;
+static unsigned int		kgdb_break_count;
+
+#ifdef CONFIG_KGDB_COND_BREAK
+struct kgdb_tp;
+
+struct kgdb_break_info {
+	struct kgdb_break_cond	*cond;
+	unsigned int		hits;
+	unsigned int		filtered;
+#ifdef CONFIG_KGDB_TRACEPOINTS
+	struct kgdb_tp		*tp;		/* tracepoints here */
+#endif
+};
+
+static struct kgdb_break_info	kgdb_break_info_init[1 << KGDB_BREAK_INIT_BITS];
+static struct kgdb_break_info	*kgdb_break_info = kgdb_break_info_init;
+#endif
+
+/*
+ * The CPU# of the active CPU, or -1 if none:
+ */
+atomic_t			kgdb_active = ATOMIC_INIT(-1);
+EXPORT_SYMBOL_GPL(kgdb_active);
+
+/*
+ * We use NR_CPUs not PERCPU, in case kgdb is used to debug early
+ * bootup code (which might not have percpu set up yet):
+ */
+static atomic_t			passive_cpu_wait[NR_CPUS];
+static atomic_t			cpu_in_kgdb[NR_CPUS];
+static atomic_t			kgdb_break_tasklet_var;
+atomic_t			kgdb_setting_breakpoint;
+
+struct task_struct		*kgdb_usethread;
+struct task_struct		*kgdb_contthread;
+
+int				kgdb_single_step;
+static pid_t			kgdb_sstep_pid;
+
+/* to keep track of the CPU which is doing the single stepping*/
+atomic_t			kgdb_cpu_doing_single_step = ATOMIC_INIT(-1);
+
+/*
+ * If you are debugging a problem where roundup (the collection of
+ * all other CPUs) is a problem [this should be extremely rare],
+ * then use the nokgdbroundup option to avoid roundup. In that case
+ * the other CPUs might interfere with your debugging context, so
+ * use this with care:
+ */
+ #ifdef CONFIG_KGDB_USB_DEVICE
+static int kgdb_do_roundup = 0;
+#else
+static int kgdb_do_roundup = 1;
+#endif
+static int __init opt_nokgdbroundup(char *str)
+{
+	kgdb_do_roundup = 0;
+
+	return 0;
+}
+
+early_param("nokgdbroundup", opt_nokgdbroundup);
+
+/*
+ * Finally, some KGDB code :-)
+ */
+
+/*
+ * Weak aliases for breakpoint management,
+ * can be overriden by architectures when needed:
+ */
+int __weak kgdb_arch_set_breakpoint(unsigned long addr, char *saved_instr)
+{
+	int err;
+
+	err = probe_kernel_read(saved_instr, (char *)addr, BREAK_INSTR_SIZE);
+	if (err)
+		return err;
+
+	return probe_kernel_write((char *)addr, arch_kgdb_ops.gdb_bpt_instr,
+				  BREAK_INSTR_SIZE);
+}
+
+int __weak kgdb_arch_remove_breakpoint(unsigned long addr, char *bundle)
+{
+	return probe_kernel_write((char *)addr,
+				  (char *)bundle, BREAK_INSTR_SIZE);
+}
+
+int __weak kgdb_validate_break_address(unsigned long addr)
+{
+	char tmp_variable[BREAK_INSTR_SIZE];
+	int err;
+	/* Validate setting the breakpoint and then removing it.  In the
+	 * remove fails, the kernel needs to emit a bad message because we
+	 * are deep trouble not being able to put things back the way we
+	 * found them.
+	 */
+	err = kgdb_arch_set_breakpoint(addr, tmp_variable);
+	if (err)
+		return err;
+	err = kgdb_arch_remove_breakpoint(addr, tmp_variable);
+	if (err)
+		printk(KERN_ERR "KGDB: Critical breakpoint error, kernel "
+		   "memory destroyed at: %lx", addr);
+	return err;
+}
+
+unsigned long __weak kgdb_arch_pc(int exception, struct pt_regs *regs)
+{
+	return instruction_pointer(regs);
+}
+
+int __weak kgdb_arch_init(void)
+{
+	return 0;
+}
+
+int __weak kgdb_skipexception(int exception, struct pt_regs *regs)
+{
+	return 0;
+}
+
+/**
+ *	kgdb_disable_hw_debug - Disable hardware debugging while we in kgdb.
+ *	@regs: Current &struct pt_regs.
+ *
+ *	This function will be called if the particular architecture must
+ *	disable hardware debugging while it is processing gdb packets or
+ *	handling exception.
+ */
+void __weak kgdb_disable_hw_debug(struct pt_regs *regs)
+{
+}
+
+/*
+ * Some architectures need cache flushes when we set/clear a
+ * breakpoint:
+ */
+static void kgdb_flush_swbreak_range(unsigned long start, unsigned long end)
+{
+	if (current->mm && current->mm->mmap_cache) {
+		flush_cache_range(current->mm->mmap_cache, start, end);
+	}
+	/* Force flush instruction cache if it was outside the mm */
+	flush_icache_range(start, end);
+}
+
+/*
+ * Breakpoints armed or disarmed in one pass are flushed together: the
+ * addresses are sorted, breakpoints within a cache line of each other
+ * are merged into one range and each range is flushed once.  Above
+ * kgdb_flush_all_ranges ranges the whole cache is flushed instead.
+ */
+static unsigned int kgdb_flush_all_ranges = 64;
+module_param(kgdb_flush_all_ranges, uint, 0644);
+
+static unsigned int kgdb_flush_count;
+
+static void kgdb_flush_swbreak_add(unsigned long addr)
+{
+	kgdb_break_flush[kgdb_flush_count++] = addr;
+}
+
+static int kgdb_flush_cmp(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void kgdb_flush_swbreak_batch(void)
+{
+	unsigned long start, end;
+	unsigned int i, ranges;
+
+	if (!CACHE_FLUSH_IS_SAFE || !kgdb_flush_count)
+		goto out;
+
+	sort(kgdb_break_flush, kgdb_flush_count, sizeof(unsigned long),
+	     kgdb_flush_cmp, NULL);
+
+	for (i = 1, ranges = 1; i < kgdb_flush_count; i++)
+		if (kgdb_break_flush[i] >= kgdb_break_flush[i - 1] +
+		    BREAK_INSTR_SIZE + L1_CACHE_BYTES)
+			ranges++;
+
+	if (ranges > kgdb_flush_all_ranges) {
+		flush_cache_all();
+		goto out;
+	}
+
+	start = kgdb_break_flush[0];
+	end = start + BREAK_INSTR_SIZE;
+	for (i = 1; i < kgdb_flush_count; i++) {
+		if (kgdb_break_flush[i] >= end + L1_CACHE_BYTES) {
+			kgdb_flush_swbreak_range(start, end);
+			start = kgdb_break_flush[i];
+		}
+		end = kgdb_break_flush[i] + BREAK_INSTR_SIZE;
+	}
+	kgdb_flush_swbreak_range(start, end);
+
+out:
+	kgdb_flush_count = 0;
+}
+
+/*
+ * SW breakpoint management:
+ */
+
+/* slot holding addr, or the empty slot where it would be inserted */
+static unsigned int kgdb_break_slot(struct kgdb_bkpt *table,
+				    unsigned int bits, unsigned long addr)
+{
+	unsigned int mask = (1U << bits) - 1;
+	unsigned int i = hash_long(addr, bits);
+
+	while (table[i].state != BP_UNDEFINED && table[i].bpt_addr != addr)
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+static struct kgdb_bkpt *kgdb_break_lookup(unsigned long addr)
+{
+	struct kgdb_bkpt *bpt;
+
+	bpt = &kgdb_break[kgdb_break_slot(kgdb_break, kgdb_break_bits, addr)];
+	if (bpt->state == BP_UNDEFINED)
+		return NULL;
+
+	return bpt;
+}
+
+/* the table for kgdb_break_max, with what the static one holds */
+static int __init kgdb_break_alloc(void)
+{
+	unsigned int bits = KGDB_BREAK_INIT_BITS;
+	struct kgdb_bkpt *table;
+	unsigned int *order;
+	unsigned long *flush;
+	unsigned int i, slot;
+#ifdef CONFIG_KGDB_COND_BREAK
+	struct kgdb_break_info *info;
+#endif
+
+	while ((3U << bits) < kgdb_break_max * 4)
+		bits++;
+	if (bits == kgdb_break_bits)
+		return 0;
+
+#ifdef CONFIG_KGDB_COND_BREAK
+	info = vmalloc(sizeof(*info) << bits);
+	if (!info)
+		return -ENOMEM;
+	memset(info, 0, sizeof(*info) << bits);
+#endif
+
+	table = vmalloc(sizeof(*table) << bits);
+	order = vmalloc(sizeof(*order) << bits);
+	flush = vmalloc(sizeof(*flush) << bits);
+	if (!table || !order || !flush) {
+		vfree(table);
+		vfree(order);
+		vfree(flush);
+#ifdef CONFIG_KGDB_COND_BREAK
+		vfree(info);
+#endif
+		return -ENOMEM;
+	}
+	memset(table, 0, sizeof(*table) << bits);
+
+	for (i = 0; i < kgdb_break_count; i++) {
+		struct kgdb_bkpt *bpt = &kgdb_break[kgdb_break_order[i]];
+
+		slot = kgdb_break_slot(table, bits, bpt->bpt_addr);
+		table[slot] = *bpt;
+#ifdef CONFIG_KGDB_COND_BREAK
+		info[slot] = kgdb_break_info[kgdb_break_order[i]];
+#endif
+		order[i] = slot;
+	}
+
+	kgdb_break = table;
+	kgdb_break_order = order;
+	kgdb_break_flush = flush;
+#ifdef CONFIG_KGDB_COND_BREAK
+	kgdb_break_info = info;
+#endif
+	kgdb_break_bits = bits;
+
+	return 0;
+}
+
+#ifdef CONFIG_KGDB_COND_BREAK
+/*
+ * Conditional breakpoints.  gdb sends the conditions as agent expression
+ * bytecode with the Z0 packet; they are evaluated here when the
+ * breakpoint hits, before the host is contacted.  If all of them are
+ * false the breakpoint is stepped over in place: the original
+ * instruction is put back, a temporary breakpoint is planted on the
+ * next one and the cpu resumes.  When that one hits on the same cpu,
+ * the original breakpoint is armed again.  Only one step over can be
+ * pending.  Another cpu that meanwhile hits the temporary breakpoint,
+ * or a conditional one, resumes on it without the host being told and
+ * takes it again once the step over is done; but with the other cpus
+ * not rounded up, one going through the stepped over breakpoint while
+ * it is out is not seen at all.  A conditional breakpoint can only be
+ * set on an instruction that can be stepped over, so a stop is never
+ * reported for a condition that is false.
+ */
+struct kgdb_break_cond {
+	struct kgdb_break_cond	*next;
+	int			len;
+	unsigned char		expr[0];
+};
+
+#define KGDB_AX_STACK		32
+#define KGDB_AX_STEPS		1024
+
+static unsigned long		kgdb_step_addr;	/* temporary breakpoint */
+static unsigned long		kgdb_step_bpt;	/* breakpoint stepped over */
+static int			kgdb_step_cpu;	/* the cpu stepping over */
+/* 0 if kgdb_step_addr is an active breakpoint of the table instead */
+static int			kgdb_step_temp;
+static char			kgdb_step_saved[BREAK_INSTR_SIZE];
+/* breakpoints taken out while the step over was pending */
+static unsigned long		kgdb_step_defer[8];
+static int			kgdb_step_ndefer;
+
+/*
+ * Address of the instruction following the one at addr if executing it
+ * cannot change the pc, 0 if it can or if that is not known.  The
+ * architecture decodes its instructions, without that conditional
+ * breakpoints cannot be set.
+ */
+unsigned long __weak kgdb_arch_step_over_pc(unsigned long addr,
+					    const char *saved_instr)
+{
+	return 0;
+}
+
+/*
+ * Index in the register block of the g packet of gdb register regno,
+ * -1 if it is not there.  The architecture maps its own numbering.
+ */
+int __weak kgdb_arch_gdb_regno(int regno)
+{
+	return regno;
+}
+
+static int kgdb_ax_reg(struct pt_regs *regs, int regno, unsigned long *val)
+{
+	unsigned long gdb_regs[NUMREGBYTES / sizeof(unsigned long)];
+	int n = kgdb_arch_gdb_regno(regno);
+
+	if (n < 0 || n >= ARRAY_SIZE(gdb_regs))
+		return -EINVAL;
+
+	pt_regs_to_gdb_regs(gdb_regs, regs);
+	*val = gdb_regs[n];
+
+	return 0;
+}
+
+static int kgdb_ax_ref(u64 addr, int size, u64 *val)
+{
+	union {
+		u8 b;
+		u16 h;
+		u32 w;
+		u64 d;
+	} v;
+
+	if (probe_kernel_read(&v, (void *)(unsigned long)addr, size))
+		return -EFAULT;
+
+	switch (size) {
+	case 1: *val = v.b; break;
+	case 2: *val = v.h; break;
+	case 4: *val = v.w; break;
+	default: *val = v.d; break;
+	}
+
+	return 0;
+}
+
+static s64 kgdb_ax_sdiv(s64 a, s64 b, int rem)
+{
+	u64 ua = a < 0 ? -a : a;
+	u64 ub = b < 0 ? -b : b;
+	u64 q = div64_u64(ua, ub);
+
+	if (rem)
+		return a < 0 ? -(s64)(ua - q * ub) : (s64)(ua - q * ub);
+
+	return (a < 0) != (b < 0) ? -(s64)q : (s64)q;
+}
+
+/*
+ * Run one agent expression, see "Agent Expressions" in the gdb manual.
+ * Only the operations a breakpoint condition compiles to are supported;
+ * trace, variable and float operations are rejected.
+ */
+static int kgdb_ax_eval(const unsigned char *ax, int len,
+			struct pt_regs *regs, u64 *result)
+{
+	u64 stack[KGDB_AX_STACK];
+	int sp = 0, pc = 0, steps = 0;
+	unsigned long reg;
+	u64 a, b;
+	int n;
+
+#define AX_NEED(in, out)						\
+	do {								\
+		if (sp < (in) || sp - (in) + (out) > KGDB_AX_STACK)	\
+			return -EINVAL;					\
+	} while (0)
+#define AX_IMM(size)							\
+	do {								\
+		if (pc + (size) > len)					\
+			return -EINVAL;					\
+		for (a = 0, n = 0; n < (size); n++)			\
+			a = (a << 8) | ax[pc++];			\
+	} while (0)
+
+	while (pc < len) {
+		if (++steps > KGDB_AX_STEPS)
+			return -E2BIG;
+
+		switch (ax[pc++]) {
+		case 0x02:	/* add */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] += stack[sp];
+			break;
+		case 0x03:	/* sub */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] -= stack[sp];
+			break;
+		case 0x04:	/* mul */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] *= stack[sp];
+			break;
+		case 0x05:	/* div_signed */
+		case 0x07:	/* rem_signed */
+			AX_NEED(2, 1);
+			sp--;
+			if (!stack[sp])
+				return -EINVAL;
+			stack[sp - 1] = kgdb_ax_sdiv(stack[sp - 1], stack[sp],
+						     ax[pc - 1] == 0x07);
+			break;
+		case 0x06:	/* div_unsigned */
+		case 0x08:	/* rem_unsigned */
+			AX_NEED(2, 1);
+			sp--;
+			if (!stack[sp])
+				return -EINVAL;
+			a = div64_u64(stack[sp - 1], stack[sp]);
+			if (ax[pc - 1] == 0x08)
+				a = stack[sp - 1] - a * stack[sp];
+			stack[sp - 1] = a;
+			break;
+		case 0x09:	/* lsh */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] <<= stack[sp] & 63;
+			break;
+		case 0x0a:	/* rsh_signed */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] = (s64)stack[sp - 1] >> (stack[sp] & 63);
+			break;
+		case 0x0b:	/* rsh_unsigned */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] >>= stack[sp] & 63;
+			break;
+		case 0x0e:	/* log_not */
+			AX_NEED(1, 1);
+			stack[sp - 1] = !stack[sp - 1];
+			break;
+		case 0x0f:	/* bit_and */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] &= stack[sp];
+			break;
+		case 0x10:	/* bit_or */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] |= stack[sp];
+			break;
+		case 0x11:	/* bit_xor */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] ^= stack[sp];
+			break;
+		case 0x12:	/* bit_not */
+			AX_NEED(1, 1);
+			stack[sp - 1] = ~stack[sp - 1];
+			break;
+		case 0x13:	/* equal */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] = stack[sp - 1] == stack[sp];
+			break;
+		case 0x14:	/* less_signed */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] = (s64)stack[sp - 1] < (s64)stack[sp];
+			break;
+		case 0x15:	/* less_unsigned */
+			AX_NEED(2, 1);
+			sp--;
+			stack[sp - 1] = stack[sp - 1] < stack[sp];
+			break;
+		case 0x16:	/* ext */
+			AX_NEED(1, 1);
+			AX_IMM(1);
+			if (a && a < 64)
+				stack[sp - 1] = (s64)(stack[sp - 1] << (64 - a))
+						>> (64 - a);
+			break;
+		case 0x2a:	/* zero_ext */
+			AX_NEED(1, 1);
+			AX_IMM(1);
+			if (a && a < 64)
+				stack[sp - 1] &= (1ULL << a) - 1;
+			break;
+		case 0x17:	/* ref8 */
+		case 0x18:	/* ref16 */
+		case 0x19:	/* ref32 */
+		case 0x1a:	/* ref64 */
+			AX_NEED(1, 1);
+			if (kgdb_ax_ref(stack[sp - 1], 1 << (ax[pc - 1] - 0x17),
+					&stack[sp - 1]))
+				return -EFAULT;
+			break;
+		case 0x20:	/* if_goto */
+			AX_NEED(1, 0);
+			AX_IMM(2);
+			if (stack[--sp])
+				pc = a;
+			break;
+		case 0x21:	/* goto */
+			AX_IMM(2);
+			pc = a;
+			break;
+		case 0x22:	/* const8 */
+			AX_NEED(0, 1);
+			AX_IMM(1);
+			stack[sp++] = a;
+			break;
+		case 0x23:	/* const16 */
+			AX_NEED(0, 1);
+			AX_IMM(2);
+			stack[sp++] = a;
+			break;
+		case 0x24:	/* const32 */
+			AX_NEED(0, 1);
+			AX_IMM(4);
+			stack[sp++] = a;
+			break;
+		case 0x25:	/* const64 */
+			AX_NEED(0, 1);
+			AX_IMM(8);
+			stack[sp++] = a;
+			break;
+		case 0x26:	/* reg */
+			AX_NEED(0, 1);
+			AX_IMM(2);
+			if (kgdb_ax_reg(regs, a, &reg))
+				return -EINVAL;
+			stack[sp++] = reg;
+			break;
+		case 0x27:	/* end */
+			AX_NEED(1, 0);
+			*result = stack[sp - 1];
+			return 0;
+		case 0x28:	/* dup */
+			AX_NEED(1, 2);
+			stack[sp] = stack[sp - 1];
+			sp++;
+			break;
+		case 0x29:	/* pop */
+			AX_NEED(1, 0);
+			sp--;
+			break;
+		case 0x2b:	/* swap */
+			AX_NEED(2, 2);
+			b = stack[sp - 1];
+			stack[sp - 1] = stack[sp - 2];
+			stack[sp - 2] = b;
+			break;
+		case 0x32:	/* pick */
+			AX_IMM(1);
+			AX_NEED(a + 1, a + 2);
+			stack[sp] = stack[sp - 1 - a];
+			sp++;
+			break;
+		case 0x33:	/* rot */
+			AX_NEED(3, 3);
+			b = stack[sp - 3];
+			stack[sp - 3] = stack[sp - 2];
+			stack[sp - 2] = stack[sp - 1];
+			stack[sp - 1] = b;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+#undef AX_IMM
+#undef AX_NEED
+	return -EINVAL;
+}
+
+/* gdb stops when any of the conditions is true or cannot be evaluated */
+static int kgdb_break_cond_true(struct kgdb_break_cond *cond,
+				struct pt_regs *regs)
+{
+	u64 val;
+
+	for (; cond; cond = cond->next)
+		if (kgdb_ax_eval(cond->expr, cond->len, regs, &val) || val)
+			return 1;
+
+	return 0;
+}
+
+static void kgdb_break_cond_free(struct kgdb_break_info *info)
+{
+	struct kgdb_break_cond *cond, *next;
+
+	for (cond = info->cond; cond; cond = next) {
+		next = cond->next;
+		kfree(cond);
+	}
+	info->cond = NULL;
+}
+
+/* parse "X<len>,<hex bytecode>[;X...]", anything else ends the list */
+static int kgdb_break_cond_parse(const char *p, struct kgdb_break_cond **list)
+{
+	struct kgdb_break_cond *cond, **tail = list;
+	unsigned long len;
+	char *end;
+	int i, hi, lo;
+
+	*list = NULL;
+	while (p && *p == 'X') {
+		len = simple_strtoul(p + 1, &end, 16);
+		if (*end != ',' || !len || len > BUFMAX)
+			return -EINVAL;
+		p = end + 1;
+
+		cond = kmalloc(sizeof(*cond) + len, GFP_ATOMIC | __GFP_NOWARN);
+		if (!cond)
+			return -ENOMEM;
+		cond->next = NULL;
+		cond->len = len;
+		*tail = cond;
+		tail = &cond->next;
+
+		for (i = 0; i < len; i++, p += 2) {
+			hi = hex_to_bin(p[0]);
+			lo = hi < 0 ? -1 : hex_to_bin(p[1]);
+			if (lo < 0)
+				return -EINVAL;
+			cond->expr[i] = (hi << 4) | lo;
+		}
+
+		if (*p == ';')
+			p++;
+	}
+
+	return 0;
+}
+
+static void kgdb_step_finish(void)
+{
+	struct kgdb_bkpt *bpt = kgdb_break_lookup(kgdb_step_bpt);
+
+	if (kgdb_step_temp) {
+		kgdb_arch_remove_breakpoint(kgdb_step_addr, kgdb_step_saved);
+		kgdb_flush_swbreak_add(kgdb_step_addr);
+	}
+	while (1) {
+		if (bpt && bpt->state == BP_ACTIVE) {
+			kgdb_arch_set_breakpoint(bpt->bpt_addr,
+						 bpt->saved_instr);
+			kgdb_flush_swbreak_add(bpt->bpt_addr);
+		}
+		if (!kgdb_step_ndefer)
+			break;
+		bpt = kgdb_break_lookup(kgdb_step_defer[--kgdb_step_ndefer]);
+	}
+	kgdb_flush_swbreak_batch();
+
+	kgdb_step_addr = 0;
+}
+
+/* put the stepped over breakpoint back before anything else is patched */
+static void kgdb_step_cancel(void)
+{
+	if (kgdb_step_addr)
+		kgdb_step_finish();
+}
+
+/*
+ * Step over the active breakpoint bpt in place on this cpu.  -EBUSY if
+ * another step over is pending, -EINVAL if the instruction cannot be
+ * stepped over.  An active breakpoint on the next instruction is used
+ * as it is instead of a temporary one.
  */
-static struct kgdb_bkpt		kgdb_break[KGDB_MAX_BREAKPOINTS] = {
-	[0 ... KGDB_MAX_BREAKPOINTS-1] = { .state = BP_UNDEFINED }
+static int kgdb_step_over(struct kgdb_bkpt *bpt)
+{
+	unsigned long addr = bpt->bpt_addr;
+	struct kgdb_bkpt *at_next;
+	unsigned long next;
+
+	if (kgdb_step_addr)
+		return -EBUSY;
+	next = kgdb_arch_step_over_pc(addr, bpt->saved_instr);
+	if (!next)
+		return -EINVAL;
+	at_next = kgdb_break_lookup(next);
+	kgdb_step_temp = !at_next || at_next->state != BP_ACTIVE;
+	if (kgdb_step_temp && kgdb_arch_set_breakpoint(next, kgdb_step_saved))
+		return -EFAULT;
+	if (kgdb_arch_remove_breakpoint(addr, bpt->saved_instr)) {
+		if (kgdb_step_temp)
+			kgdb_arch_remove_breakpoint(next, kgdb_step_saved);
+		return -EFAULT;
+	}
+	kgdb_flush_swbreak_add(addr);
+	if (kgdb_step_temp)
+		kgdb_flush_swbreak_add(next);
+	kgdb_flush_swbreak_batch();
+
+	kgdb_step_addr = next;
+	kgdb_step_bpt = addr;
+	kgdb_step_cpu = raw_smp_processor_id();
+
+	return 0;
+}
+
+/* conditions can only be set where the instruction can be stepped over */
+static int kgdb_step_check(unsigned long addr)
+{
+	struct kgdb_bkpt *bpt = kgdb_break_lookup(addr);
+	char insn[BREAK_INSTR_SIZE];
+
+	if (bpt && bpt->state == BP_ACTIVE)
+		memcpy(insn, bpt->saved_instr, BREAK_INSTR_SIZE);
+	else if (probe_kernel_read(insn, (char *)addr, BREAK_INSTR_SIZE))
+		return -EFAULT;
+
+	return kgdb_arch_step_over_pc(addr, insn) ? 0 : -EINVAL;
+}
+
+#ifdef CONFIG_KGDB_TRACEPOINTS
+/*
+ * Tracepoints.  gdb defines them with QTDP packets and QTStart plants a
+ * breakpoint for each.  From then on a hit collects the registers and
+ * memory the tracepoint asks for into the trace buffer and is stepped
+ * over like a breakpoint whose conditions are false, so the host is
+ * not contacted.  Frames have the layout of gdb trace files:
+ *
+ *	u16 tracepoint, u32 size, then blocks of
+ *	'R' <register block as sent by the g packet>
+ *	'M' <u64 address> <u16 length> <bytes>
+ *
+ * in target byte order, so the buffer can be uploaded as it is.  The
+ * buffer is linear and collection stops when it is full.  Agent
+ * expression actions, while-stepping and fast tracepoints are not
+ * supported.  All of this runs on the master cpu, which serializes it.
+ */
+#define KGDB_TP_MEM		32
+#define KGDB_TRACE_HDR		6
+
+enum {
+	KGDB_TRACE_NOTRUN,
+	KGDB_TRACE_STOP,
+	KGDB_TRACE_FULL,
+	KGDB_TRACE_DISCONN,
+	KGDB_TRACE_PASSCOUNT,
+	KGDB_TRACE_ERROR,
 };
 
-/*
- * The CPU# of the active CPU, or -1 if none:
- */
-atomic_t			kgdb_active = ATOMIC_INIT(-1);
-EXPORT_SYMBOL_GPL(kgdb_active);
+/* the definition packets, kept for qTfP/qTsP */
+struct kgdb_tp_src {
+	struct kgdb_tp_src	*next;
+	char			text[0];
+};
+
+struct kgdb_tp_mem {
+	int			basereg;	/* -1: offset is the address */
+	unsigned long		offset;
+	unsigned long		len;
+};
+
+struct kgdb_tp {
+	struct kgdb_tp		*next;
+	struct kgdb_tp		*same;		/* next one at this address */
+	unsigned int		num;
+	unsigned long		addr;
+	int			enabled;
+	unsigned int		pass;
+	unsigned int		hits;
+	unsigned long		bytes;
+	struct kgdb_break_cond	*cond;
+	int			regs;
+	int			nmem;
+	struct kgdb_tp_mem	mem[KGDB_TP_MEM];
+	struct kgdb_tp_src	*src;
+};
+
+static unsigned int kgdb_trace_size = 256 << 10;
+module_param(kgdb_trace_size, uint, 0444);
+
+static char			*kgdb_trace_buf;
+static unsigned long		kgdb_trace_used;
+static unsigned int		kgdb_trace_frames;
+static int			kgdb_trace_running;
+static int			kgdb_trace_reason;
+static unsigned int		kgdb_trace_stop_tp;
+static int			kgdb_trace_disconn;
+static struct kgdb_tp		*kgdb_tp_list;
+
+/* selected frame, -1 for none */
+static int			kgdb_trace_cur = -1;
+static unsigned long		kgdb_trace_cur_off;
+
+static struct kgdb_tp		*kgdb_upload_tp;
+static struct kgdb_tp_src	*kgdb_upload_src;
+
+static struct kgdb_tp *kgdb_trace_find(unsigned int num)
+{
+	struct kgdb_tp *tp;
+
+	for (tp = kgdb_tp_list; tp; tp = tp->next)
+		if (tp->num == num)
+			break;
+
+	return tp;
+}
+
+static void kgdb_trace_stop(int reason, unsigned int num)
+{
+	struct kgdb_break_info *info;
+	struct kgdb_bkpt *bpt;
+	struct kgdb_tp *tp;
+
+	for (tp = kgdb_tp_list; tp; tp = tp->next) {
+		bpt = kgdb_break_lookup(tp->addr);
+		if (!bpt)
+			continue;
+		info = &kgdb_break_info[bpt - kgdb_break];
+		if (!info->tp)
+			continue;
+		if (bpt->state == BP_ACTIVE) {
+			if (kgdb_arch_remove_breakpoint(bpt->bpt_addr,
+							bpt->saved_instr))
+				printk(KERN_ERR "KGDB: tracepoint remove "
+				       "failed: %lx\n", bpt->bpt_addr);
+			kgdb_flush_swbreak_add(bpt->bpt_addr);
+		}
+		bpt->state = BP_REMOVED;
+		info->tp = NULL;
+	}
+	kgdb_flush_swbreak_batch();
+
+	kgdb_trace_running = 0;
+	kgdb_trace_reason = reason;
+	kgdb_trace_stop_tp = num;
+}
+
+/* a breakpoint in the table for each tracepoint */
+static int kgdb_trace_plant(void)
+{
+	struct kgdb_break_info *info;
+	struct kgdb_tp *tp;
+	int err;
+
+	for (tp = kgdb_tp_list; tp; tp = tp->next) {
+		err = dbg_set_sw_break(tp->addr);
+		info = &kgdb_break_info[kgdb_break_slot(kgdb_break,
+							kgdb_break_bits,
+							tp->addr)];
+		/* several tracepoints can share an address, gdb cannot */
+		if (err == -EEXIST)
+			err = info->tp ? 0 : -EBUSY;
+		if (err)
+			return err;
+		tp->same = info->tp;
+		info->tp = tp;
+	}
+
+	return 0;
+}
+
+/*
+ * dbg_remove_all_break() takes the tracepoint breakpoints with it.  On
+ * a detach after QTDisconnected:1 tracing goes on, 1 is returned and
+ * kgdb_trace_rearm() plants them again once the table is empty.  Not
+ * when the debugger was re-entered, a tracepoint may be the cause.
+ */
+static int kgdb_trace_remove_all(void)
+{
+	if (!kgdb_trace_running)
+		return 0;
+	if (kgdb_trace_disconn && !exception_level)
+		return 1;
+
+	kgdb_trace_stop(KGDB_TRACE_DISCONN, 0);
+	return 0;
+}
+
+/* the detach resumes without activating breakpoints, so do it here */
+static void kgdb_trace_rearm(void)
+{
+	if (kgdb_trace_plant()) {
+		kgdb_trace_stop(KGDB_TRACE_ERROR, 0);
+		return;
+	}
+	dbg_activate_sw_breakpoints();
+}
+
+static void kgdb_tp_free(struct kgdb_tp *tp)
+{
+	struct kgdb_break_info tmp = { .cond = tp->cond };
+	struct kgdb_tp_src *src, *next;
+
+	kgdb_break_cond_free(&tmp);
+	for (src = tp->src; src; src = next) {
+		next = src->next;
+		kfree(src);
+	}
+	kfree(tp);
+}
+
+static void kgdb_trace_free(void)
+{
+	struct kgdb_tp *tp, *next;
+
+	for (tp = kgdb_tp_list; tp; tp = next) {
+		next = tp->next;
+		kgdb_tp_free(tp);
+	}
+	kgdb_tp_list = NULL;
+	kgdb_upload_tp = NULL;
+}
+
+static int kgdb_trace_add_src(struct kgdb_tp *tp, const char *text)
+{
+	struct kgdb_tp_src *src, **tail;
+	int len = strlen(text);
+
+	/* a trailing '-' only says that more packets follow */
+	if (len && text[len - 1] == '-')
+		len--;
+
+	src = kmalloc(sizeof(*src) + len + 1, GFP_ATOMIC | __GFP_NOWARN);
+	if (!src)
+		return -ENOMEM;
+	src->next = NULL;
+	memcpy(src->text, text, len);
+	src->text[len] = 0;
+
+	for (tail = &tp->src; *tail; tail = &(*tail)->next)
+		;
+	*tail = src;
+
+	return 0;
+}
+
+/* R<mask> and M<basereg>,<offset>,<length> */
+static int kgdb_trace_parse_actions(struct kgdb_tp *tp, const char *p)
+{
+	struct kgdb_tp_mem *m;
+	char *end;
+
+	while (*p && *p != '-') {
+		switch (*p) {
+		case 'R':
+			/* the whole register block is collected */
+			simple_strtoul(p + 1, &end, 16);
+			tp->regs = 1;
+			break;
+		case 'M':
+			if (tp->nmem == KGDB_TP_MEM)
+				return -E2BIG;
+			m = &tp->mem[tp->nmem];
+			m->basereg = (int)simple_strtoul(p + 1, &end, 16);
+			if (*end != ',')
+				return -EINVAL;
+			m->offset = simple_strtoul(end + 1, &end, 16);
+			if (*end != ',')
+				return -EINVAL;
+			m->len = simple_strtoul(end + 1, &end, 16);
+			if (!m->len || m->len > 0xffff)
+				return -EINVAL;
+			tp->nmem++;
+			break;
+		default:
+			/* X expressions and while-stepping actions */
+			return -EINVAL;
+		}
+		p = end;
+	}
+
+	return 0;
+}
+
+/*
+ * QTDP:<num>:<addr>:<E|D>:<step>:<pass>[:X<len>,<cond>][-]
+ * QTDP:-<num>:<addr>:<actions>[-]
+ */
+static int kgdb_trace_define(const char *p)
+{
+	struct kgdb_tp *tp, **tail;
+	unsigned long num, addr;
+	int action = *p == '-';
+	char *end;
+	int err;
+
+	num = simple_strtoul(p + action, &end, 16);
+	if (*end != ':')
+		return -EINVAL;
+	addr = simple_strtoul(end + 1, &end, 16);
+	if (*end++ != ':')
+		return -EINVAL;
+
+	if (action) {
+		tp = kgdb_trace_find(num);
+		if (!tp || tp->addr != addr)
+			return -ENOENT;
+		err = kgdb_trace_parse_actions(tp, end);
+		if (!err)
+			err = kgdb_trace_add_src(tp, p + 1);
+		return err;
+	}
+
+	if (kgdb_trace_running)
+		return -EBUSY;
+	if (!num || num > 0xffff || kgdb_trace_find(num))
+		return -EINVAL;
+	if ((*end != 'E' && *end != 'D') || end[1] != ':')
+		return -EINVAL;
+
+	tp = kzalloc(sizeof(*tp), GFP_ATOMIC | __GFP_NOWARN);
+	if (!tp)
+		return -ENOMEM;
+	tp->num = num;
+	tp->addr = addr;
+	tp->enabled = *end == 'E';
+
+	if (simple_strtoul(end + 2, &end, 16) || *end != ':') {
+		err = -EINVAL;		/* while-stepping */
+	} else {
+		tp->pass = simple_strtoul(end + 1, &end, 16);
+		if (*end == ':' && end[1] == 'X')
+			err = kgdb_break_cond_parse(end + 1, &tp->cond);
+		else if (*end && *end != '-')
+			err = -EINVAL;	/* fast and static tracepoints */
+		else
+			err = 0;
+	}
+	if (!err)
+		err = kgdb_trace_add_src(tp, p);
+	if (err) {
+		kgdb_tp_free(tp);
+		return err;
+	}
+
+	for (tail = &kgdb_tp_list; *tail; tail = &(*tail)->next)
+		;
+	*tail = tp;
+
+	return 0;
+}
+
+static int kgdb_trace_start(void)
+{
+	struct kgdb_tp *tp;
+	int err;
+
+	if (!kgdb_trace_buf)
+		return -ENOMEM;
+	if (kgdb_trace_running)
+		kgdb_trace_stop(KGDB_TRACE_STOP, 0);
+
+	kgdb_trace_used = 0;
+	kgdb_trace_frames = 0;
+	kgdb_trace_cur = -1;
+
+	for (tp = kgdb_tp_list; tp; tp = tp->next) {
+		tp->hits = 0;
+		tp->bytes = 0;
+	}
+	err = kgdb_trace_plant();
+	if (err) {
+		kgdb_trace_stop(KGDB_TRACE_NOTRUN, 0);
+		return err;
+	}
+	kgdb_trace_running = 1;
+
+	return 0;
+}
+
+static int kgdb_trace_collect(struct kgdb_tp *tp, struct pt_regs *regs)
+{
+	unsigned long gdb_regs[NUMREGBYTES / sizeof(unsigned long)];
+	char *frame = kgdb_trace_buf + kgdb_trace_used;
+	char *p = frame + KGDB_TRACE_HDR;
+	struct kgdb_tp_mem *m;
+	unsigned long size = KGDB_TRACE_HDR;
+	unsigned long base;
+	u16 num = tp->num;
+	u32 frame_size;
+	u16 len;
+	u64 addr;
+	int i;
+
+	if (tp->regs)
+		size += 1 + NUMREGBYTES;
+	for (i = 0; i < tp->nmem; i++)
+		size += 11 + tp->mem[i].len;
+	if (size > kgdb_trace_size - kgdb_trace_used)
+		return -ENOSPC;
+
+	if (tp->regs) {
+		pt_regs_to_gdb_regs(gdb_regs, regs);
+		*p++ = 'R';
+		memcpy(p, gdb_regs, NUMREGBYTES);
+		p += NUMREGBYTES;
+	}
+
+	/* a block that cannot be read is left out */
+	for (i = 0, m = tp->mem; i < tp->nmem; i++, m++) {
+		base = 0;
+		if (m->basereg >= 0 && kgdb_ax_reg(regs, m->basereg, &base))
+			continue;
+		addr = base + m->offset;
+		len = m->len;
+		if (probe_kernel_read(p + 11, (void *)(unsigned long)addr,
+				      len))
+			continue;
+		p[0] = 'M';
+		memcpy(p + 1, &addr, sizeof(addr));
+		memcpy(p + 9, &len, sizeof(len));
+		p += 11 + len;
+	}
+
+	frame_size = p - frame - KGDB_TRACE_HDR;
+	memcpy(frame, &num, sizeof(num));
+	memcpy(frame + 2, &frame_size, sizeof(frame_size));
+
+	kgdb_trace_used += p - frame;
+	kgdb_trace_frames++;
+	tp->bytes += p - frame;
+
+	return 0;
+}
+
+/*
+ * A tracepoint hit: collect and step over.  When a step over is already
+ * pending the breakpoint is taken out until it completes and the hits
+ * meanwhile are lost.  If the instruction cannot be stepped over in
+ * place, tracing stops with an error.
+ */
+static int kgdb_trace_hit(struct kgdb_break_info *info,
+			  struct kgdb_bkpt *bpt, struct pt_regs *regs)
+{
+	unsigned int num = info->tp->num;
+	struct kgdb_tp *tp;
+	int err;
+
+	for (tp = info->tp; tp && kgdb_trace_running; tp = tp->same) {
+		if (!tp->enabled ||
+		    (tp->cond && !kgdb_break_cond_true(tp->cond, regs)))
+			continue;
+		tp->hits++;
+		if (kgdb_trace_collect(tp, regs))
+			kgdb_trace_stop(KGDB_TRACE_FULL, 0);
+		else if (tp->pass && tp->hits >= tp->pass)
+			kgdb_trace_stop(KGDB_TRACE_PASSCOUNT, tp->num);
+	}
+	if (!kgdb_trace_running)
+		return 1;		/* the breakpoint is gone */
+
+	err = kgdb_step_over(bpt);
+	if (err == -EBUSY &&
+	    kgdb_step_ndefer < ARRAY_SIZE(kgdb_step_defer) &&
+	    !kgdb_arch_remove_breakpoint(bpt->bpt_addr, bpt->saved_instr)) {
+		kgdb_flush_swbreak_add(bpt->bpt_addr);
+		kgdb_flush_swbreak_batch();
+		kgdb_step_defer[kgdb_step_ndefer++] = bpt->bpt_addr;
+		err = 0;
+	}
+	if (err)
+		kgdb_trace_stop(KGDB_TRACE_ERROR, num);
+
+	return 1;
+}
+
+/* offset of frame n, or of the first one from n on that matches pc */
+static long kgdb_trace_seek(int n, int tpnum, unsigned long lo,
+			    unsigned long hi, int outside)
+{
+	struct kgdb_tp *tp;
+	unsigned long off;
+	u32 size;
+	u16 num;
+	int i;
+
+	for (i = 0, off = 0; off < kgdb_trace_used; i++) {
+		memcpy(&num, kgdb_trace_buf + off, sizeof(num));
+		memcpy(&size, kgdb_trace_buf + off + 2, sizeof(size));
+		if (i >= n && (tpnum < 0 || num == tpnum)) {
+			if (hi == 0)
+				break;
+			tp = kgdb_trace_find(num);
+			if (tp && (tp->addr >= lo && tp->addr <= hi) != outside)
+				break;
+		}
+		off += KGDB_TRACE_HDR + size;
+	}
+	if (off >= kgdb_trace_used)
+		return -1;
+
+	kgdb_trace_cur = i;
+	return off;
+}
+
+/* QTFrame:<n>, :pc:<addr>, :tdp:<num>, :range:<lo>:<hi>, :outside:... */
+static int kgdb_trace_frame(const char *p, char *buf, int len)
+{
+	unsigned long lo = 0, hi = 0;
+	int from = kgdb_trace_cur + 1;
+	int tpnum = -1, outside = 0;
+	long off;
+	u16 num;
+	char *end;
+
+	if (!strncmp(p, "pc:", 3)) {
+		lo = hi = simple_strtoul(p + 3, NULL, 16);
+	} else if (!strncmp(p, "tdp:", 4)) {
+		tpnum = simple_strtoul(p + 4, NULL, 16);
+	} else if (!strncmp(p, "range:", 6) || !strncmp(p, "outside:", 8)) {
+		outside = *p == 'o';
+		lo = simple_strtoul(strchr(p, ':') + 1, &end, 16);
+		if (*end != ':')
+			return scnprintf(buf, len, "E%02d", EINVAL);
+		hi = simple_strtoul(end + 1, NULL, 16);
+	} else if (*p == '-') {
+		kgdb_trace_cur = -1;
+		return scnprintf(buf, len, "OK");
+	} else {
+		from = simple_strtoul(p, NULL, 16);
+		off = kgdb_trace_seek(from, -1, 0, 0, 0);
+		if (off < 0 || kgdb_trace_cur != from)
+			goto none;
+		goto found;
+	}
+
+	off = kgdb_trace_seek(from, tpnum, lo, hi, outside);
+	if (off < 0)
+		goto none;
+found:
+	kgdb_trace_cur_off = off;
+	memcpy(&num, kgdb_trace_buf + off, sizeof(num));
+	return scnprintf(buf, len, "F%xT%x", kgdb_trace_cur, num);
+none:
+	kgdb_trace_cur = -1;
+	return scnprintf(buf, len, "F-1");
+}
+
+static int kgdb_trace_status(char *buf, int len)
+{
+	static const char * const reason[] = {
+		[KGDB_TRACE_NOTRUN]	= "tnotrun:0",
+		[KGDB_TRACE_STOP]	= "tstop::0",
+		[KGDB_TRACE_FULL]	= "tfull:0",
+		[KGDB_TRACE_DISCONN]	= "tdisconnected:0",
+		[KGDB_TRACE_PASSCOUNT]	= "tpasscount:",
+		[KGDB_TRACE_ERROR]	= "terror:",
+	};
+	int n;
+
+	n = scnprintf(buf, len, "T%d", kgdb_trace_running);
+	if (!kgdb_trace_running) {
+		n += scnprintf(buf + n, len - n, ";%s",
+			       reason[kgdb_trace_reason]);
+		if (kgdb_trace_reason == KGDB_TRACE_PASSCOUNT)
+			n += scnprintf(buf + n, len - n, "%x",
+				       kgdb_trace_stop_tp);
+		else if (kgdb_trace_reason == KGDB_TRACE_ERROR)
+			/* hex of "step over" */
+			n += scnprintf(buf + n, len - n,
+				       "73746570206f766572:%x",
+				       kgdb_trace_stop_tp);
+	}
+	n += scnprintf(buf + n, len - n,
+		       ";tframes:%x;tcreated:%x;tfree:%lx;tsize:%x"
+		       ";circular:0;disconn:%d",
+		       kgdb_trace_frames, kgdb_trace_frames,
+		       kgdb_trace_size - kgdb_trace_used,
+		       kgdb_trace_buf ? kgdb_trace_size : 0,
+		       kgdb_trace_disconn);
+
+	return n;
+}
+
+/* qTfP/qTsP: T<definition> for a tracepoint, then A<action> lines */
+static int kgdb_trace_upload(int first, char *buf, int len)
+{
+	struct kgdb_tp_src *src;
+
+	if (first) {
+		kgdb_upload_tp = kgdb_tp_list;
+		kgdb_upload_src = kgdb_upload_tp ? kgdb_upload_tp->src : NULL;
+	}
+	while (kgdb_upload_tp && !kgdb_upload_src) {
+		kgdb_upload_tp = kgdb_upload_tp->next;
+		kgdb_upload_src = kgdb_upload_tp ? kgdb_upload_tp->src : NULL;
+	}
+	if (!kgdb_upload_tp)
+		return scnprintf(buf, len, "l");
+
+	src = kgdb_upload_src;
+	kgdb_upload_src = src->next;
+
+	return scnprintf(buf, len, "%c%s",
+			 src == kgdb_upload_tp->src ? 'T' : 'A', src->text);
+}
+
+/*
+ * The QT and qT packets.  type is the first letter, args what follows
+ * it.  Returns the reply length, or -1 for packets the stub should see.
+ */
+int dbg_trace_packet(char type, const char *args, char *buf, int len)
+{
+	unsigned long off, count;
+	struct kgdb_tp *tp;
+	char *end;
+	int err = 0;
+
+	if (type == 'q') {
+		if (!strcmp(args, "Status"))
+			return kgdb_trace_status(buf, len);
+		if (!strcmp(args, "fP") || !strcmp(args, "sP"))
+			return kgdb_trace_upload(args[0] == 'f', buf, len);
+		if (!strcmp(args, "fV") || !strcmp(args, "sV"))
+			return scnprintf(buf, len, "l");
+		if (!strncmp(args, "P:", 2)) {
+			tp = kgdb_trace_find(simple_strtoul(args + 2, NULL,
+							    16));
+			if (!tp)
+				return scnprintf(buf, len, "E%02d", ENOENT);
+			return scnprintf(buf, len, "V%x:%lx",
+					 tp->hits, tp->bytes);
+		}
+		if (!strncmp(args, "Buffer:", 7)) {
+			off = simple_strtoul(args + 7, &end, 16);
+			if (*end != ',')
+				return scnprintf(buf, len, "E%02d", EINVAL);
+			count = simple_strtoul(end + 1, NULL, 16);
+			if (off >= kgdb_trace_used)
+				return scnprintf(buf, len, "l");
+			count = min(count, kgdb_trace_used - off);
+			count = min_t(unsigned long, count, (len - 1) / 2);
+			kgdb_mem2hex(kgdb_trace_buf + off, buf, count);
+			return count * 2;
+		}
+		return -1;
+	}
+
+	if (!strcmp(args, "init")) {
+		kgdb_trace_stop(KGDB_TRACE_NOTRUN, 0);
+		kgdb_trace_free();
+		kgdb_trace_used = 0;
+		kgdb_trace_frames = 0;
+		kgdb_trace_cur = -1;
+	} else if (!strncmp(args, "DP:", 3)) {
+		err = kgdb_trace_define(args + 3);
+	} else if (!strcmp(args, "Start")) {
+		err = kgdb_trace_start();
+	} else if (!strcmp(args, "Stop")) {
+		if (kgdb_trace_running)
+			kgdb_trace_stop(KGDB_TRACE_STOP, 0);
+	} else if (!strncmp(args, "Frame:", 6)) {
+		return kgdb_trace_frame(args + 6, buf, len);
+	} else if (!strncmp(args, "Enable:", 7) ||
+		   !strncmp(args, "Disable:", 8)) {
+		tp = kgdb_trace_find(simple_strtoul(strchr(args, ':') + 1,
+						    NULL, 16));
+		if (!tp)
+			err = -ENOENT;
+		else
+			tp->enabled = args[0] == 'E';
+	} else if (!strncmp(args, "Disconnected:", 13)) {
+		kgdb_trace_disconn = args[13] == '1';
+	} else if (!strcmp(args, "Buffer:circular:1")) {
+		err = -EINVAL;
+	} else if (strcmp(args, "Buffer:circular:0") && strcmp(args, "ro") &&
+		   strncmp(args, "ro:", 3)) {
+		return -1;
+	}
+
+	if (err)
+		return scnprintf(buf, len, "E%02d", -err);
+
+	return scnprintf(buf, len, "OK");
+}
+EXPORT_SYMBOL_GPL(dbg_trace_packet);
+
+/* the g packet while a trace frame is selected */
+int dbg_trace_frame_regs(char *buf, int len)
+{
+	unsigned long gdb_regs[NUMREGBYTES / sizeof(unsigned long)];
+	char *frame = kgdb_trace_buf + kgdb_trace_cur_off;
+	char *p = frame + KGDB_TRACE_HDR;
+	struct pt_regs regs;
+	struct kgdb_tp *tp;
+	u32 size;
+	u16 num;
+
+	if (kgdb_trace_cur < 0)
+		return -1;
+	if (len < NUMREGBYTES * 2 + 1)
+		return scnprintf(buf, len, "E%02d", ENOSPC);
+
+	memcpy(&num, frame, sizeof(num));
+	memcpy(&size, frame + 2, sizeof(size));
+	while (p < frame + KGDB_TRACE_HDR + size && *p == 'M') {
+		u16 mlen;
 
-/*
- * We use NR_CPUs not PERCPU, in case kgdb is used to debug early
- * bootup code (which might not have percpu set up yet):
- */
-static atomic_t			passive_cpu_wait[NR_CPUS];
-static atomic_t			cpu_in_kgdb[NR_CPUS];
-static atomic_t			kgdb_break_tasklet_var;
-atomic_t			kgdb_setting_breakpoint;
+		memcpy(&mlen, p + 9, sizeof(mlen));
+		p += 11 + mlen;
+	}
 
-struct task_struct		*kgdb_usethread;
-struct task_struct		*kgdb_contthread;
+	/* without a register block only the pc is known */
+	if (p < frame + KGDB_TRACE_HDR + size && *p == 'R') {
+		memcpy(gdb_regs, p + 1, NUMREGBYTES);
+	} else {
+		memset(&regs, 0, sizeof(regs));
+		tp = kgdb_trace_find(num);
+		if (tp)
+			kgdb_arch_set_pc(&regs, tp->addr);
+		pt_regs_to_gdb_regs(gdb_regs, &regs);
+	}
+	kgdb_mem2hex((char *)gdb_regs, buf, NUMREGBYTES);
 
-int				kgdb_single_step;
-static pid_t			kgdb_sstep_pid;
+	return NUMREGBYTES * 2;
+}
+EXPORT_SYMBOL_GPL(dbg_trace_frame_regs);
 
-/* to keep track of the CPU which is doing the single stepping*/
-atomic_t			kgdb_cpu_doing_single_step = ATOMIC_INIT(-1);
+/* the m packet while a trace frame is selected: collected memory only */
+int dbg_trace_frame_mem(const char *args, char *buf, int len)
+{
+	char *frame = kgdb_trace_buf + kgdb_trace_cur_off;
+	char *p = frame + KGDB_TRACE_HDR;
+	unsigned long addr, count;
+	char *end;
+	u64 maddr;
+	u32 size;
+	u16 mlen;
+
+	if (kgdb_trace_cur < 0)
+		return -1;
 
-/*
- * If you are debugging a problem where roundup (the collection of
- * all other CPUs) is a problem [this should be extremely rare],
- * then use the nokgdbroundup option to avoid roundup. In that case
- * the other CPUs might interfere with your debugging context, so
- * use this with care:
- */
- #ifdef CONFIG_KGDB_USB_DEVICE
-static int kgdb_do_roundup = 0;
-#else
-static int kgdb_do_roundup = 1;
-#endif
-static int __init opt_nokgdbroundup(char *str)
+	addr = simple_strtoul(args, &end, 16);
+	if (*end != ',')
+		return scnprintf(buf, len, "E%02d", EINVAL);
+	count = simple_strtoul(end + 1, NULL, 16);
+
+	memcpy(&size, frame + 2, sizeof(size));
+	while (p < frame + KGDB_TRACE_HDR + size) {
+		if (*p == 'R') {
+			p += 1 + NUMREGBYTES;
+			continue;
+		}
+		memcpy(&maddr, p + 1, sizeof(maddr));
+		memcpy(&mlen, p + 9, sizeof(mlen));
+		if (addr >= maddr && addr < maddr + mlen) {
+			count = min_t(unsigned long, count,
+				      maddr + mlen - addr);
+			count = min_t(unsigned long, count, (len - 1) / 2);
+			kgdb_mem2hex(p + 11 + (addr - maddr), buf, count);
+			return count * 2;
+		}
+		p += 11 + mlen;
+	}
+
+	return scnprintf(buf, len, "E%02d", EFAULT);
+}
+EXPORT_SYMBOL_GPL(dbg_trace_frame_mem);
+
+/* raw trace buffer bytes for the qkgdb.tbuf query */
+int dbg_trace_read(unsigned long off, char *buf, int len)
 {
-	kgdb_do_roundup = 0;
+	if (off >= kgdb_trace_used)
+		return 0;
 
-	return 0;
+	len = min_t(unsigned long, len, kgdb_trace_used - off);
+	memcpy(buf, kgdb_trace_buf + off, len);
+
+	return len;
 }
+EXPORT_SYMBOL_GPL(dbg_trace_read);
 
-early_param("nokgdbroundup", opt_nokgdbroundup);
+static int __init kgdb_trace_init(void)
+{
+	kgdb_trace_buf = vmalloc(kgdb_trace_size);
+	if (!kgdb_trace_buf)
+		printk(KERN_ERR "KGDB: no memory for the trace buffer\n");
+	return 0;
+}
+late_initcall(kgdb_trace_init);
+#else
+static inline int kgdb_trace_remove_all(void) { return 0; }
+static inline void kgdb_trace_rearm(void) { }
+#endif
 
+#ifdef CONFIG_KGDB_BACKTRACE
 /*
- * Finally, some KGDB code :-)
+ * Backtraces of every task, unwound here and sent to the host in one
+ * stream.  Each task is a record of u32 pid, u32 number of pcs, the
+ * 16 byte comm and the pcs as u32, all in the cpu's byte order.  The
+ * other cpus may not have been rounded up, as with kgdb over usb on
+ * SMP, so tasks come and go while the stream is sent: the task list is
+ * walked once, under RCU, into a buffer allocated at boot and the
+ * stream is sent from there.  Tasks that do not fit are left out.  A
+ * task running on a cpu that is not in the debugger has no saved
+ * context to unwind and is sent without pcs.
  */
+#define KGDB_BT_DEPTH	32
 
-/*
- * Weak aliases for breakpoint management,
- * can be overriden by architectures when needed:
- */
-int __weak kgdb_arch_set_breakpoint(unsigned long addr, char *saved_instr)
-{
-	int err;
+struct kgdb_bt_rec {
+	u32 pid;
+	u32 nr;
+	char comm[TASK_COMM_LEN];
+	u32 pc[KGDB_BT_DEPTH];
+};
 
-	err = probe_kernel_read(saved_instr, (char *)addr, BREAK_INSTR_SIZE);
-	if (err)
-		return err;
+static unsigned int kgdb_bt_size = 64 << 10;
+module_param(kgdb_bt_size, uint, 0444);
 
-	return probe_kernel_write((char *)addr, arch_kgdb_ops.gdb_bpt_instr,
-				  BREAK_INSTR_SIZE);
-}
+static struct kgdb_bt_rec kgdb_bt_rec;
+static char *kgdb_bt_buf;
+static int kgdb_bt_len;		/* of the snapshot */
+static int kgdb_bt_off;		/* of it sent so far */
 
-int __weak kgdb_arch_remove_breakpoint(unsigned long addr, char *bundle)
+/*
+ * Unwind p into at most max pcs, from regs if it is stopped in the
+ * debugger, else from the context it was switched out with.  Returns
+ * the number of pcs.  The architecture knows its frames.
+ */
+int __weak kgdb_arch_unwind(struct task_struct *p, struct pt_regs *regs,
+			    u32 *pc, int max)
 {
-	return probe_kernel_write((char *)addr,
-				  (char *)bundle, BREAK_INSTR_SIZE);
+	return 0;
 }
 
-int __weak kgdb_validate_break_address(unsigned long addr)
+/* unwind p into rec, from the cpu it is stopped on if any */
+static void kgdb_bt_unwind(struct task_struct *p, struct kgdb_bt_rec *rec)
 {
-	char tmp_variable[BREAK_INSTR_SIZE];
-	int err;
-	/* Validate setting the breakpoint and then removing it.  In the
-	 * remove fails, the kernel needs to emit a bad message because we
-	 * are deep trouble not being able to put things back the way we
-	 * found them.
-	 */
-	err = kgdb_arch_set_breakpoint(addr, tmp_variable);
-	if (err)
-		return err;
-	err = kgdb_arch_remove_breakpoint(addr, tmp_variable);
-	if (err)
-		printk(KERN_ERR "KGDB: Critical breakpoint error, kernel "
-		   "memory destroyed at: %lx", addr);
-	return err;
+	struct pt_regs *regs = NULL;
+	int cpu;
+
+	rec->pid = p->pid;
+	rec->nr = 0;
+	memcpy(rec->comm, p->comm, TASK_COMM_LEN);
+
+	for_each_online_cpu(cpu)
+		if (kgdb_info[cpu].task == p)
+			regs = kgdb_info[cpu].debuggerinfo;
+
+	if (!regs && task_curr(p))
+		return;			/* its stack is live */
+
+	rec->nr = kgdb_arch_unwind(p, regs, rec->pc, KGDB_BT_DEPTH);
 }
 
-unsigned long __weak kgdb_arch_pc(int exception, struct pt_regs *regs)
+/* take the snapshot, returns the length of the stream */
+int dbg_backtrace_start(void)
 {
-	return instruction_pointer(regs);
+	struct kgdb_bt_rec *rec = &kgdb_bt_rec;
+	struct task_struct *g, *p;
+	int n;
+
+	kgdb_bt_len = kgdb_bt_off = 0;
+	if (!kgdb_bt_buf)
+		return 0;
+
+	rcu_read_lock();
+	do_each_thread(g, p) {
+		kgdb_bt_unwind(p, rec);
+		n = offsetof(struct kgdb_bt_rec, pc[rec->nr]);
+		if (kgdb_bt_len + n > kgdb_bt_size)
+			goto full;
+		memcpy(kgdb_bt_buf + kgdb_bt_len, rec, n);
+		kgdb_bt_len += n;
+	} while_each_thread(g, p);
+full:
+	rcu_read_unlock();
+
+	return kgdb_bt_len;
 }
+EXPORT_SYMBOL_GPL(dbg_backtrace_start);
 
-int __weak kgdb_arch_init(void)
+/* kgdb_write_fill() callback, returns the bytes stored in buf */
+int dbg_backtrace_fill(char *buf, int len, void *data)
 {
-	return 0;
+	int n = min(len, kgdb_bt_len - kgdb_bt_off);
+
+	memcpy(buf, kgdb_bt_buf + kgdb_bt_off, n);
+	kgdb_bt_off += n;
+
+	return n;
 }
+EXPORT_SYMBOL_GPL(dbg_backtrace_fill);
 
-int __weak kgdb_skipexception(int exception, struct pt_regs *regs)
+static int __init kgdb_bt_init(void)
 {
+	kgdb_bt_buf = vmalloc(kgdb_bt_size);
+	if (!kgdb_bt_buf)
+		printk(KERN_ERR "KGDB: no memory for the backtrace buffer\n");
 	return 0;
 }
+late_initcall(kgdb_bt_init);
+#endif
 
-/**
- *	kgdb_disable_hw_debug - Disable hardware debugging while we in kgdb.
- *	@regs: Current &struct pt_regs.
- *
- *	This function will be called if the particular architecture must
- *	disable hardware debugging while it is processing gdb packets or
- *	handling exception.
+/*
+ * Called by the master cpu before the host is contacted.  Returns 1 if
+ * the exception was a conditional breakpoint whose conditions are all
+ * false, a tracepoint, or the end of a step over, and the cpu can
+ * resume; also, to take the breakpoint again, if it was hit while
+ * another cpu is stepping over.
  */
-void __weak kgdb_disable_hw_debug(struct pt_regs *regs)
+static int kgdb_break_cond_filter(struct kgdb_state *ks)
 {
+	unsigned long addr = kgdb_arch_pc(ks->ex_vector, ks->linux_regs);
+	struct kgdb_break_info *info;
+	struct kgdb_bkpt *bpt;
+	unsigned int slot;
+
+	if (kgdb_step_addr && ks->cpu == kgdb_step_cpu) {
+		/*
+		 * Anywhere else than the next instruction the stepping cpu
+		 * was diverted before it got there, by an interrupt say.
+		 * The stepped over breakpoint is put back either way, if
+		 * it has not been gone through it is taken again.
+		 */
+		if (addr != kgdb_step_addr) {
+			kgdb_step_cancel();
+		} else {
+			kgdb_step_finish();
+			if (kgdb_step_temp)
+				return 1;
+		}
+	} else if (kgdb_step_addr && addr == kgdb_step_addr &&
+		   kgdb_step_temp) {
+		return 1;
+	}
+
+	slot = kgdb_break_slot(kgdb_break, kgdb_break_bits, addr);
+	bpt = &kgdb_break[slot];
+	if (bpt->state != BP_ACTIVE)
+		return 0;
+
+	info = &kgdb_break_info[slot];
+#ifdef CONFIG_KGDB_TRACEPOINTS
+	if (info->tp)
+		return kgdb_trace_hit(info, bpt, ks->linux_regs);
+#endif
+	if (info->cond && kgdb_step_addr)
+		return 1;
+	info->hits++;
+	if (!info->cond || kgdb_break_cond_true(info->cond, ks->linux_regs))
+		return 0;
+
+	/* -EINVAL is ruled out when the condition is set */
+	if (kgdb_step_over(bpt))
+		return 0;
+	info->filtered++;
+
+	return 1;
 }
 
 /*
- * Some architectures need cache flushes when we set/clear a
- * breakpoint:
+ * Set a breakpoint with the conditions of a Z0 packet, cond points
+ * after the kind field.  An existing breakpoint gets its conditions
+ * replaced, that is how gdb updates them.
  */
-static void kgdb_flush_swbreak_addr(unsigned long addr)
+int dbg_set_sw_break_cond(unsigned long addr, const char *cond)
 {
-	if (!CACHE_FLUSH_IS_SAFE)
-		return;
+	struct kgdb_break_cond *list;
+	struct kgdb_break_info *info;
+	int err;
 
-	if (current->mm && current->mm->mmap_cache) {
-		flush_cache_range(current->mm->mmap_cache,
-				  addr, addr + BREAK_INSTR_SIZE);
+#ifdef CONFIG_KGDB_TRACEPOINTS
+	struct kgdb_bkpt *bpt = kgdb_break_lookup(addr);
+
+	if (bpt && kgdb_break_info[bpt - kgdb_break].tp)
+		return -EBUSY;
+#endif
+	err = kgdb_break_cond_parse(cond, &list);
+	if (!err && list)
+		err = kgdb_step_check(addr);
+	if (!err) {
+		err = dbg_set_sw_break(addr);
+		if (err == -EEXIST)
+			err = 0;
 	}
-	/* Force flush instruction cache if it was outside the mm */
-	flush_icache_range(addr, addr + BREAK_INSTR_SIZE);
+	if (err) {
+		struct kgdb_break_info tmp = { .cond = list };
+
+		kgdb_break_cond_free(&tmp);
+		return err;
+	}
+
+	info = &kgdb_break_info[kgdb_break_slot(kgdb_break, kgdb_break_bits,
+						addr)];
+	kgdb_break_cond_free(info);
+	info->cond = list;
+
+	return 0;
 }
+EXPORT_SYMBOL_GPL(dbg_set_sw_break_cond);
+
+/* "addr:hits,filtered;..." for the qkgdb.breakpoints query */
+int dbg_break_stat_format(char *buf, int len)
+{
+	struct kgdb_break_info *info;
+	struct kgdb_bkpt *bpt;
+	int i, n = 0;
+
+	for (i = 0; i < kgdb_break_count && n < len; i++) {
+		bpt = &kgdb_break[kgdb_break_order[i]];
+		info = &kgdb_break_info[kgdb_break_order[i]];
+		if (bpt->state == BP_REMOVED)
+			continue;
+		n += scnprintf(buf + n, len - n, "%s%lx:%x,%x", n ? ";" : "",
+			       bpt->bpt_addr, info->hits, info->filtered);
+	}
+
+	return n;
+}
+EXPORT_SYMBOL_GPL(dbg_break_stat_format);
+
+static int kgdb_break_stat_show(struct seq_file *m, void *v)
+{
+	struct kgdb_break_info *info;
+	struct kgdb_bkpt *bpt;
+	struct kgdb_break_cond *cond;
+	int i, conds;
+
+	seq_printf(m, "%-10s %10s %10s %5s\n",
+		   "address", "hits", "filtered", "conds");
+	for (i = 0; i < kgdb_break_count; i++) {
+		bpt = &kgdb_break[kgdb_break_order[i]];
+		info = &kgdb_break_info[kgdb_break_order[i]];
+		if (bpt->state == BP_REMOVED)
+			continue;
+		for (conds = 0, cond = info->cond; cond; cond = cond->next)
+			conds++;
+		seq_printf(m, "%08lx   %10u %10u %5d\n", bpt->bpt_addr,
+			   info->hits, info->filtered, conds);
+	}
+
+	return 0;
+}
+
+static int kgdb_break_stat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kgdb_break_stat_show, NULL);
+}
+
+static const struct file_operations kgdb_break_stat_fops = {
+	.open		= kgdb_break_stat_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init kgdb_break_stat_init(void)
+{
+	debugfs_create_file("kgdb_breakpoints", 0444, NULL, NULL,
+			    &kgdb_break_stat_fops);
+	return 0;
+}
+late_initcall(kgdb_break_stat_init);
+#else
+static inline void kgdb_step_cancel(void) { }
+static inline int kgdb_break_cond_filter(struct kgdb_state *ks) { return 0; }
+static inline int kgdb_trace_remove_all(void) { return 0; }
+static inline void kgdb_trace_rearm(void) { }
+#endif
 
-/*
- * SW breakpoint management:
- */
 int dbg_activate_sw_breakpoints(void)
 {
+	struct kgdb_bkpt *bpt;
 	unsigned long addr;
 	int error;
 	int ret = 0;
 	int i;
 
-	for (i = 0; i < KGDB_MAX_BREAKPOINTS; i++) {
-		if (kgdb_break[i].state != BP_SET)
+	for (i = 0; i < kgdb_break_count; i++) {
+		bpt = &kgdb_break[kgdb_break_order[i]];
+		if (bpt->state != BP_SET)
 			continue;
 
-		addr = kgdb_break[i].bpt_addr;
-		error = kgdb_arch_set_breakpoint(addr,
-				kgdb_break[i].saved_instr);
+		addr = bpt->bpt_addr;
+		error = kgdb_arch_set_breakpoint(addr, bpt->saved_instr);
 		if (error) {
 			ret = error;
 			printk(KERN_INFO "KGDB: BP install failed: %lx", addr);
 			continue;
 		}
 
-		kgdb_flush_swbreak_addr(addr);
-		kgdb_break[i].state = BP_ACTIVE;
+		kgdb_flush_swbreak_add(addr);
+		bpt->state = BP_ACTIVE;
 	}
+	kgdb_flush_swbreak_batch();
 	return ret;
 }
 
 int dbg_set_sw_break(unsigned long addr)
 {
 	int err = kgdb_validate_break_address(addr);
-	int breakno = -1;
-	int i;
+	unsigned int slot;
 
 	if (err)
 		return err;
 
-	for (i = 0; i < KGDB_MAX_BREAKPOINTS; i++) {
-		if ((kgdb_break[i].state == BP_SET) &&
-					(kgdb_break[i].bpt_addr == addr))
-			return -EEXIST;
-	}
-	for (i = 0; i < KGDB_MAX_BREAKPOINTS; i++) {
-		if (kgdb_break[i].state == BP_REMOVED &&
-					kgdb_break[i].bpt_addr == addr) {
-			breakno = i;
-			break;
-		}
-	}
+	slot = kgdb_break_slot(kgdb_break, kgdb_break_bits, addr);
+	if (kgdb_break[slot].state == BP_SET)
+		return -EEXIST;
 
-	if (breakno == -1) {
-		for (i = 0; i < KGDB_MAX_BREAKPOINTS; i++) {
-			if (kgdb_break[i].state == BP_UNDEFINED) {
-				breakno = i;
-				break;
-			}
-		}
+	if (kgdb_break[slot].state == BP_UNDEFINED) {
+		if ((kgdb_break_count + 1) * 4 > (3U << kgdb_break_bits))
+			return -E2BIG;
+		kgdb_break_order[kgdb_break_count++] = slot;
 	}
 
-	if (breakno == -1)
-		return -E2BIG;
-
-	kgdb_break[breakno].state = BP_SET;
-	kgdb_break[breakno].type = BP_BREAKPOINT;
-	kgdb_break[breakno].bpt_addr = addr;
+	kgdb_break[slot].state = BP_SET;
+	kgdb_break[slot].type = BP_BREAKPOINT;
+	kgdb_break[slot].bpt_addr = addr;
+#ifdef CONFIG_KGDB_COND_BREAK
+	kgdb_break_info[slot].hits = 0;
+	kgdb_break_info[slot].filtered = 0;
+#endif
 
 	return 0;
 }
 
 int dbg_deactivate_sw_breakpoints(void)
 {
+	struct kgdb_bkpt *bpt;
 	unsigned long addr;
 	int error;
 	int ret = 0;
 	int i;
 
-	for (i = 0; i < KGDB_MAX_BREAKPOINTS; i++) {
-		if (kgdb_break[i].state != BP_ACTIVE)
+	kgdb_step_cancel();
+
+	for (i = 0; i < kgdb_break_count; i++) {
+		bpt = &kgdb_break[kgdb_break_order[i]];
+		if (bpt->state != BP_ACTIVE)
 			continue;
-		addr = kgdb_break[i].bpt_addr;
-		error = kgdb_arch_remove_breakpoint(addr,
-					kgdb_break[i].saved_instr);
+		addr = bpt->bpt_addr;
+		error = kgdb_arch_remove_breakpoint(addr, bpt->saved_instr);
 		if (error) {
 			printk(KERN_INFO "KGDB: BP remove failed: %lx\n", addr);
 			ret = error;
 		}
 
-		kgdb_flush_swbreak_addr(addr);
-		kgdb_break[i].state = BP_SET;
+		kgdb_flush_swbreak_add(addr);
+		bpt->state = BP_SET;
 	}
+	kgdb_flush_swbreak_batch();
 	return ret;
 }
 
 int dbg_remove_sw_break(unsigned long addr)
 {
-	int i;
+	struct kgdb_bkpt *bpt = kgdb_break_lookup(addr);
 
-	for (i = 0; i < KGDB_MAX_BREAKPOINTS; i++) {
-		if ((kgdb_break[i].state == BP_SET) &&
-				(kgdb_break[i].bpt_addr == addr)) {
-			kgdb_break[i].state = BP_REMOVED;
-			return 0;
-		}
+	if (bpt && bpt->state == BP_SET) {
+#ifdef CONFIG_KGDB_TRACEPOINTS
+		if (kgdb_break_info[bpt - kgdb_break].tp)
+			return -EBUSY;
+#endif
+		bpt->state = BP_REMOVED;
+#ifdef CONFIG_KGDB_COND_BREAK
+		kgdb_break_cond_free(&kgdb_break_info[bpt - kgdb_break]);
+#endif
+		return 0;
 	}
 	return -ENOENT;
 }
 
 int kgdb_isremovedbreak(unsigned long addr)
 {
-	int i;
+	struct kgdb_bkpt *bpt = kgdb_break_lookup(addr);
 
-	for (i = 0; i < KGDB_MAX_BREAKPOINTS; i++) {
-		if ((kgdb_break[i].state == BP_REMOVED) &&
-					(kgdb_break[i].bpt_addr == addr))
-			return 1;
-	}
-	return 0;
+	return bpt && bpt->state == BP_REMOVED;
 }
 
 int dbg_remove_all_break(void)
 {
+	struct kgdb_bkpt *bpt;
 	unsigned long addr;
+	int tracing;
 	int error;
 	int i;
 
+	kgdb_step_cancel();
+	tracing = kgdb_trace_remove_all();
+
 	/* Clear memory breakpoints. */
-	for (i = 0; i < KGDB_MAX_BREAKPOINTS; i++) {
-		if (kgdb_break[i].state != BP_ACTIVE)
+	for (i = 0; i < kgdb_break_count; i++) {
+		bpt = &kgdb_break[kgdb_break_order[i]];
+		if (bpt->state != BP_ACTIVE)
 			goto setundefined;
-		addr = kgdb_break[i].bpt_addr;
-		error = kgdb_arch_remove_breakpoint(addr,
-				kgdb_break[i].saved_instr);
+		addr = bpt->bpt_addr;
+		error = kgdb_arch_remove_breakpoint(addr, bpt->saved_instr);
 		if (error)
 			printk(KERN_ERR "KGDB: breakpoint remove failed: %lx\n",
 			   addr);
 setundefined:
-		kgdb_break[i].state = BP_UNDEFINED;
+		bpt->state = BP_UNDEFINED;
+#ifdef CONFIG_KGDB_COND_BREAK
+		kgdb_break_cond_free(&kgdb_break_info[kgdb_break_order[i]]);
+#endif
+#ifdef CONFIG_KGDB_TRACEPOINTS
+		kgdb_break_info[kgdb_break_order[i]].tp = NULL;
+#endif
 	}
+	kgdb_break_count = 0;
 
 	/* Clear hardware breakpoints. */
 	if (arch_kgdb_ops.remove_all_hw_break)
 		arch_kgdb_ops.remove_all_hw_break();
 
+	if (tracing)
+		kgdb_trace_rearm();
+
 	return 0;
 }
 
@@ -473,6 +2184,137 @@ static void dbg_cpu_switch(int cpu, int next_cpu)
 	kgdb_info[next_cpu].exception_state |= DCPU_NEXT_MASTER;
 }
 
+#ifdef CONFIG_KGDB_LATENCY
+/*
+ * Time the target spends frozen in the debugger, split by phase and
+ * collected in log2 histograms of microseconds: bucket n counts the
+ * samples below 2^n us, the last bucket everything above.
+ */
+enum dbg_lat_phase {
+	DBG_LAT_ACQUIRE,	/* exception to master cpu */
+	DBG_LAT_ROUNDUP,	/* waiting for the other cpus */
+	DBG_LAT_FIRST_BYTE,	/* stub entry to the first byte from the host */
+	DBG_LAT_SESSION,	/* stub entry to resume */
+	DBG_LAT_EXIT,		/* resume to return from the exception */
+	DBG_LAT_NR,
+};
+
+#define DBG_LAT_BUCKETS		32
+
+static const char *dbg_lat_names[DBG_LAT_NR] = {
+	"acquire", "roundup", "first_byte", "session", "exit",
+};
+
+static u32 dbg_lat_hist[DBG_LAT_NR][DBG_LAT_BUCKETS];
+static unsigned long long dbg_lat_first_byte;
+
+static inline unsigned long long dbg_lat_now(void)
+{
+	return sched_clock();
+}
+
+static void dbg_lat_record(int phase, unsigned long long start)
+{
+	unsigned long long delta = dbg_lat_now() - start;
+	int bucket;
+
+	do_div(delta, NSEC_PER_USEC);
+	bucket = fls64(delta);
+	if (bucket >= DBG_LAT_BUCKETS)
+		bucket = DBG_LAT_BUCKETS - 1;
+	dbg_lat_hist[phase][bucket]++;
+}
+
+/*
+ * Format the histograms as "name:b0,b1,...;name:..." with trailing
+ * empty buckets left out.  Used by the I/O driver to answer a query
+ * packet while the debugger is active.
+ */
+int dbg_latency_format(char *buf, int len)
+{
+	int phase, i, last, n = 0;
+
+	for (phase = 0; phase < DBG_LAT_NR && n < len; phase++) {
+		for (last = DBG_LAT_BUCKETS - 1; last > 0; last--)
+			if (dbg_lat_hist[phase][last])
+				break;
+		n += scnprintf(buf + n, len - n, "%s%s:",
+			       phase ? ";" : "", dbg_lat_names[phase]);
+		for (i = 0; i <= last; i++)
+			n += scnprintf(buf + n, len - n, "%s%x",
+				       i ? "," : "", dbg_lat_hist[phase][i]);
+	}
+
+	return n;
+}
+EXPORT_SYMBOL_GPL(dbg_latency_format);
+
+/*
+ * Called by the I/O driver with each byte it hands to the stub: the
+ * first one since the stub was entered ends the first_byte phase.
+ */
+void dbg_latency_first_byte(void)
+{
+	if (dbg_lat_first_byte) {
+		dbg_lat_record(DBG_LAT_FIRST_BYTE, dbg_lat_first_byte);
+		dbg_lat_first_byte = 0;
+	}
+}
+EXPORT_SYMBOL_GPL(dbg_latency_first_byte);
+
+static int dbg_latency_show(struct seq_file *m, void *v)
+{
+	int phase, i;
+
+	seq_printf(m, "%-10s", "us <");
+	for (i = 0; i < DBG_LAT_BUCKETS; i++)
+		seq_printf(m, " %u", 1U << i);
+	seq_putc(m, '\n');
+
+	for (phase = 0; phase < DBG_LAT_NR; phase++) {
+		seq_printf(m, "%-10s", dbg_lat_names[phase]);
+		for (i = 0; i < DBG_LAT_BUCKETS; i++)
+			seq_printf(m, " %u", dbg_lat_hist[phase][i]);
+		seq_putc(m, '\n');
+	}
+
+	return 0;
+}
+
+static int dbg_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dbg_latency_show, NULL);
+}
+
+static ssize_t dbg_latency_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	/* any write resets the histograms */
+	memset(dbg_lat_hist, 0, sizeof(dbg_lat_hist));
+	return count;
+}
+
+static const struct file_operations dbg_latency_fops = {
+	.open		= dbg_latency_open,
+	.read		= seq_read,
+	.write		= dbg_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init dbg_latency_init(void)
+{
+	debugfs_create_file("kgdb_latency", 0644, NULL, NULL,
+			    &dbg_latency_fops);
+	return 0;
+}
+late_initcall(dbg_latency_init);
+#else
+static inline unsigned long long dbg_lat_now(void) { return 0; }
+static inline void dbg_lat_record(int phase, unsigned long long start) { }
+static inline void dbg_latency_first_byte(void) { }
+#endif
+
 static int kgdb_cpu_enter(struct kgdb_state *ks, struct pt_regs *regs)
 {
 	unsigned long flags;
@@ -480,6 +2322,8 @@ static int kgdb_cpu_enter(struct kgdb_state *ks, struct pt_regs *regs)
 	int error;
 	int i, cpu;
 	int trace_on = 0;
+	unsigned long long t_enter = dbg_lat_now(), t = 0;
+
 acquirelock:
 	/*
 	 * Interrupts will be restored by the 'trap return' code, except when
@@ -551,6 +2395,14 @@ return_normal:
 		goto acquirelock;
 	}
 
+	dbg_lat_record(DBG_LAT_ACQUIRE, t_enter);
+
+	/* A conditional breakpoint that does not apply: resume silently */
+	if (kgdb_break_cond_filter(ks)) {
+		atomic_dec(&cpu_in_kgdb[cpu]);
+		goto kgdb_restore;
+	}
+
 	if (!kgdb_io_ready(1)) {
 		kgdb_info[cpu].ret_state = 1;
 		goto kgdb_restore; /* No I/O connection, resume the system */
@@ -572,6 +2424,7 @@ return_normal:
 	 * Get the passive CPU lock which will hold all the non-primary
 	 * CPU in a spin state while the debugger is active
 	 */
+	t = dbg_lat_now();
 	if (!kgdb_single_step) {
 		for (i = 0; i < NR_CPUS; i++)
 			atomic_inc(&passive_cpu_wait[i]);
@@ -590,6 +2443,7 @@ return_normal:
 		while (kgdb_do_roundup && !atomic_read(&cpu_in_kgdb[i]))
 			cpu_relax();
 	}
+	dbg_lat_record(DBG_LAT_ROUNDUP, t);
 
 	/*
 	 * At this point the primary processor is completely
@@ -603,6 +2457,11 @@ return_normal:
 	if (trace_on)
 		tracing_off();
 
+	t = dbg_lat_now();
+#ifdef CONFIG_KGDB_LATENCY
+	dbg_lat_first_byte = t;
+#endif
+
 	while (1) {
 cpu_master_loop:
 		if (dbg_kdb_mode) {
@@ -623,6 +2482,9 @@ cpu_master_loop:
 			break;
 		}
 	}
+	if (t)
+		dbg_lat_record(DBG_LAT_SESSION, t);
+	t = dbg_lat_now();
 
 	/* Call the I/O driver's post_exception routine */
 	if (dbg_io_ops->post_exception)
@@ -662,6 +2524,8 @@ kgdb_restore:
 	atomic_set(&kgdb_active, -1);
 	touch_softlockup_watchdog_sync();
 	clocksource_touch_watchdog();
+	if (t)
+		dbg_lat_record(DBG_LAT_EXIT, t);
 	local_irq_restore(flags);
 
 	return kgdb_info[cpu].ret_state;
@@ -788,6 +2652,9 @@ void __weak kgdb_arch_late(void)
 
 void __init dbg_late_init(void)
 {
+	if (kgdb_break_alloc())
+		printk(KERN_ERR "KGDB: no memory for %u breakpoints\n",
+		       kgdb_break_max);
 	dbg_is_early = false;
 	if (kgdb_io_module_registered)
 		kgdb_arch_late();
@@ -947,6 +2814,7 @@ int dbg_io_get_char(void)
 	int ret = dbg_io_ops->read_char();
 	if (ret == NO_POLL_CHAR)
 		return -1;
+	dbg_latency_first_byte();
 	if (!dbg_kdb_mode)
 		return ret;
 	if (ret == 127)